@@ -11,9 +11,16 @@
 #if defined(__AVX2__) || (defined(_MSC_VER) && defined(__AVX2__))
 #include <immintrin.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_function_t dispatch_pq_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_hamming_distance;
+extern distance_function_t dispatch_u4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_s4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_weighted_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 extern char *distance_backend_name;
 
 #define _mm256_abs_ps(x) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), (x))
@@ -949,6 +956,413 @@ float int8_distance_cosine_avx2 (const void *a, const void *b, int n) {
     return 1.0f - cosine_similarity;
 }
 
+// MARK: - PQ -
+
+float pq_distance_adc_avx2 (const void *v1, const void *v2, int n) {
+    const float *lut = (const float *)v1;
+    const uint8_t *codes = (const uint8_t *)v2;
+    
+    // offsets of 8 consecutive sub-quantizer tables inside the lookup table
+    const __m256i base = _mm256_setr_epi32(0, PQ_KSUB, 2*PQ_KSUB, 3*PQ_KSUB, 4*PQ_KSUB, 5*PQ_KSUB, 6*PQ_KSUB, 7*PQ_KSUB);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    
+    for (; i <= n - 16; i += 16) {
+        __m256i idx0 = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(codes + i))), base);
+        __m256i idx1 = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(codes + i + 8))), base);
+        acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut + (size_t)i * PQ_KSUB, idx0, 4));
+        acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(lut + (size_t)(i + 8) * PQ_KSUB, idx1, 4));
+    }
+    
+    for (; i <= n - 8; i += 8) {
+        __m256i idx = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(codes + i))), base);
+        acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut + (size_t)i * PQ_KSUB, idx, 4));
+    }
+    
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    float sum = _mm_cvtss_f32(s);
+    
+    // tail loop
+    for (; i < n; ++i) {
+        sum += lut[(size_t)i * PQ_KSUB + codes[i]];
+    }
+    
+    return sum;
+}
+
+float pq_distance_adc_sqrt_avx2 (const void *v1, const void *v2, int n) {
+    float sum = pq_distance_adc_avx2(v1, v2, n);
+    return (sum > 0.0f) ? sqrtf(sum) : 0.0f;
+}
+
+// MARK: - BINARY -
+
+float bit_distance_hamming_avx2 (const void *v1, const void *v2, int n) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    
+    // nibble popcount lookup (pshufb) accumulated with sad_epu8 into 64-bit lanes
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    
+    for (; i <= n - 32; i += 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low_mask));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    
+    uint64_t count = (uint64_t)_mm256_extract_epi64(acc, 0) + (uint64_t)_mm256_extract_epi64(acc, 1) +
+                     (uint64_t)_mm256_extract_epi64(acc, 2) + (uint64_t)_mm256_extract_epi64(acc, 3);
+    
+    // tail loop
+    for (; i < n; ++i) {
+        count += (uint64_t)__builtin_popcount((unsigned int)(a[i] ^ b[i]));
+    }
+    
+    return (float)count;
+}
+
+// MARK: - BATCH -
+
+// Batch kernels score BATCH_ROWS rows per pass: every block of the query is loaded (and widened) once and reused
+// for all the rows, each row has its own accumulators and the horizontal reduction is done once per row.
+// When nrows is not a multiple of BATCH_ROWS the last pass repeats the last row and discards the extra results.
+#define BATCH_ROWS  4
+
+static inline void batch_rows_setup (const uint8_t **b, const void *rows, size_t stride, int r, int nrows) {
+    for (int j = 0; j < BATCH_ROWS; ++j) {
+        int index = (r + j < nrows) ? r + j : nrows - 1;
+        b[j] = (const uint8_t *)rows + (size_t)index * stride;
+    }
+}
+
+static inline int32_t hsum256_epi32 (__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+static inline float float32_batch_finalize_avx2 (float total, float norm_a, float norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf(total);
+        case VECTOR_DISTANCE_DOT: return -total;
+        case VECTOR_DISTANCE_COSINE: {
+            float norm_b = sqrtf(norm_b2);
+            if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+            return 1.0f - (total / (norm_a * norm_b));
+        }
+        default: return total;
+    }
+}
+
+static inline void float32_distance_batch_impl_avx2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric) {
+    const float *a = (const float *)q;
+    float norm_a = (metric == VECTOR_DISTANCE_COSINE) ? sqrtf(-float32_distance_dot_avx2(a, a, n)) : 0.0f;
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *rb[BATCH_ROWS];
+        batch_rows_setup(rb, rows, stride, r, nrows);
+        const float *b[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) b[j] = (const float *)rb[j];
+        
+        __m256 acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = _mm256_setzero_ps(); nrm[j] = _mm256_setzero_ps();}
+        
+        int i = 0;
+        for (; i <= n - 8; i += 8) {
+            __m256 va = _mm256_loadu_ps(a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m256 vb = _mm256_loadu_ps(b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    __m256 diff = _mm256_sub_ps(va, vb);
+                    acc[j] = _mm256_add_ps(acc[j], _mm256_mul_ps(diff, diff));
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    acc[j] = _mm256_add_ps(acc[j], _mm256_abs_ps(_mm256_sub_ps(va, vb)));
+                } else {
+                    acc[j] = _mm256_add_ps(acc[j], _mm256_mul_ps(va, vb));
+                    if (metric == VECTOR_DISTANCE_COSINE) nrm[j] = _mm256_add_ps(nrm[j], _mm256_mul_ps(vb, vb));
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            float temp[8], ntemp[8];
+            _mm256_storeu_ps(temp, acc[j]);
+            _mm256_storeu_ps(ntemp, nrm[j]);
+            float total = temp[0] + temp[1] + temp[2] + temp[3] + temp[4] + temp[5] + temp[6] + temp[7];
+            float norm_b2 = ntemp[0] + ntemp[1] + ntemp[2] + ntemp[3] + ntemp[4] + ntemp[5] + ntemp[6] + ntemp[7];
+            
+            for (int k = i; k < n; ++k) {
+                float d = a[k] - b[j][k];
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += d * d;
+                else if (metric == VECTOR_DISTANCE_L1) total += fabsf(d);
+                else {total += a[k] * b[j][k]; norm_b2 += b[j][k] * b[j][k];}
+            }
+            
+            out[r + j] = float32_batch_finalize_avx2(total, norm_a, norm_b2, metric);
+        }
+    }
+}
+
+static inline int int8_batch_value (const uint8_t *p, int i, bool is_signed) {
+    return (is_signed) ? (int)((const int8_t *)p)[i] : (int)p[i];
+}
+
+static inline __m256i int8_batch_load_avx2 (const uint8_t *p, bool is_signed) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return (is_signed) ? _mm256_cvtepi8_epi16(v) : _mm256_cvtepu8_epi16(v);
+}
+
+static inline float int8_batch_finalize_avx2 (int32_t total, int32_t norm_a2, int32_t norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)total);
+        case VECTOR_DISTANCE_DOT: return -(float)total;
+        case VECTOR_DISTANCE_COSINE: {
+            float norm_a = sqrtf((float)norm_a2);
+            float norm_b = sqrtf((float)norm_b2);
+            if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+            return 1.0f - ((float)total / (norm_a * norm_b));
+        }
+        default: return (float)total;
+    }
+}
+
+// 8bit values are widened to 16bit and multiplied with madd, so products are accumulated in 32bit lanes
+static inline void int8_distance_batch_impl_avx2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)q;
+    const __m256i ones = _mm256_set1_epi16(1);
+    
+    int32_t norm_a2 = 0;
+    if (metric == VECTOR_DISTANCE_COSINE) {
+        for (int i = 0; i < n; ++i) norm_a2 += int8_batch_value(a, i, is_signed) * int8_batch_value(a, i, is_signed);
+    }
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+        
+        __m256i acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = _mm256_setzero_si256(); nrm[j] = _mm256_setzero_si256();}
+        
+        int i = 0;
+        for (; i <= n - 16; i += 16) {
+            __m256i va = int8_batch_load_avx2(a + i, is_signed);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m256i vb = int8_batch_load_avx2(b[j] + i, is_signed);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    __m256i diff = _mm256_sub_epi16(va, vb);
+                    acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(diff, diff));
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    __m256i diff = _mm256_abs_epi16(_mm256_sub_epi16(va, vb));
+                    acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(diff, ones));
+                } else {
+                    acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(va, vb));
+                    if (metric == VECTOR_DISTANCE_COSINE) nrm[j] = _mm256_add_epi32(nrm[j], _mm256_madd_epi16(vb, vb));
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            int32_t total = hsum256_epi32(acc[j]);
+            int32_t norm_b2 = hsum256_epi32(nrm[j]);
+            
+            for (int k = i; k < n; ++k) {
+                int va = int8_batch_value(a, k, is_signed);
+                int vb = int8_batch_value(b[j], k, is_signed);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += (va - vb) * (va - vb);
+                else if (metric == VECTOR_DISTANCE_L1) total += abs(va - vb);
+                else {total += va * vb; norm_b2 += vb * vb;}
+            }
+            
+            out[r + j] = int8_batch_finalize_avx2(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+#define DEFINE_BATCH_KERNELS_AVX2(NAME, METRIC) \
+    void float32_distance_##NAME##_batch_avx2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        float32_distance_batch_impl_avx2(q, rows, stride, nrows, n, out, METRIC); \
+    } \
+    void uint8_distance_##NAME##_batch_avx2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_avx2(q, rows, stride, nrows, n, out, METRIC, false); \
+    } \
+    void int8_distance_##NAME##_batch_avx2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_avx2(q, rows, stride, nrows, n, out, METRIC, true); \
+    }
+
+DEFINE_BATCH_KERNELS_AVX2(l2, VECTOR_DISTANCE_L2)
+DEFINE_BATCH_KERNELS_AVX2(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_BATCH_KERNELS_AVX2(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_BATCH_KERNELS_AVX2(dot, VECTOR_DISTANCE_DOT)
+DEFINE_BATCH_KERNELS_AVX2(l1, VECTOR_DISTANCE_L1)
+
+// MARK: - 4BIT -
+
+// Packed nibbles are split with a mask and a shift and never widened past 8 bits: signed nibbles are sign-extended
+// with a pshufb lookup, squares (at most 15*15) come from a pshufb table and are summed with sad_epu8, products are
+// summed with maddubs_epi16. The last partial block is copied to a zero-filled buffer (zero nibbles add nothing).
+
+static inline void nibble_unpack_avx2 (__m256i x, bool is_signed, __m256i *lo, __m256i *hi) {
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    const __m256i sign_lut = _mm256_setr_epi8(0,1,2,3,4,5,6,7,-8,-7,-6,-5,-4,-3,-2,-1, 0,1,2,3,4,5,6,7,-8,-7,-6,-5,-4,-3,-2,-1);
+    *lo = _mm256_and_si256(x, low_mask);
+    *hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+    if (is_signed) {
+        *lo = _mm256_shuffle_epi8(sign_lut, *lo);
+        *hi = _mm256_shuffle_epi8(sign_lut, *hi);
+    }
+}
+
+// sum of the squares of lo and hi (bytes in -15..15) in 64-bit lanes
+static inline __m256i nibble_sumsq_avx2 (__m256i lo, __m256i hi) {
+    const __m256i squares = _mm256_setr_epi8(0,1,4,9,16,25,36,49,64,81,100,121,(char)144,(char)169,(char)196,(char)225,
+                                             0,1,4,9,16,25,36,49,64,81,100,121,(char)144,(char)169,(char)196,(char)225);
+    __m256i s_lo = _mm256_sad_epu8(_mm256_shuffle_epi8(squares, _mm256_abs_epi8(lo)), _mm256_setzero_si256());
+    __m256i s_hi = _mm256_sad_epu8(_mm256_shuffle_epi8(squares, _mm256_abs_epi8(hi)), _mm256_setzero_si256());
+    return _mm256_add_epi64(s_lo, s_hi);
+}
+
+// products of the bytes in 32-bit lanes (maddubs needs an unsigned operand, signed codes move the sign of a to b)
+static inline __m256i nibble_dot_avx2 (__m256i alo, __m256i ahi, __m256i blo, __m256i bhi, bool is_signed) {
+    __m256i p;
+    if (is_signed) {
+        p = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_abs_epi8(alo), _mm256_sign_epi8(blo, alo)),
+                             _mm256_maddubs_epi16(_mm256_abs_epi8(ahi), _mm256_sign_epi8(bhi, ahi)));
+    } else {
+        p = _mm256_add_epi16(_mm256_maddubs_epi16(alo, blo), _mm256_maddubs_epi16(ahi, bhi));
+    }
+    return _mm256_madd_epi16(p, _mm256_set1_epi16(1));
+}
+
+static inline uint64_t hsum256_epi64 (__m256i v) {
+    return (uint64_t)_mm256_extract_epi64(v, 0) + (uint64_t)_mm256_extract_epi64(v, 1) +
+           (uint64_t)_mm256_extract_epi64(v, 2) + (uint64_t)_mm256_extract_epi64(v, 3);
+}
+
+static inline float nibble_distance_impl_avx2 (const void *v1, const void *v2, int n, bool is_signed, vector_distance metric) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    __m256i acc = _mm256_setzero_si256();       // 64-bit lanes: squares or absolute differences
+    __m256i dot = _mm256_setzero_si256();       // 32-bit lanes
+    __m256i norm_a = _mm256_setzero_si256();    // 64-bit lanes
+    __m256i norm_b = _mm256_setzero_si256();
+
+    for (int i = 0; i < n; i += 32) {
+        __m256i x, y;
+        if (n - i >= 32) {
+            x = _mm256_loadu_si256((const __m256i *)(a + i));
+            y = _mm256_loadu_si256((const __m256i *)(b + i));
+        } else {
+            uint8_t ta[32] = {0}, tb[32] = {0};
+            memcpy(ta, a + i, (size_t)(n - i));
+            memcpy(tb, b + i, (size_t)(n - i));
+            x = _mm256_loadu_si256((const __m256i *)ta);
+            y = _mm256_loadu_si256((const __m256i *)tb);
+        }
+
+        __m256i alo, ahi, blo, bhi;
+        nibble_unpack_avx2(x, is_signed, &alo, &ahi);
+        nibble_unpack_avx2(y, is_signed, &blo, &bhi);
+
+        switch (metric) {
+            case VECTOR_DISTANCE_L1: {
+                __m256i d = _mm256_add_epi8(_mm256_abs_epi8(_mm256_sub_epi8(alo, blo)), _mm256_abs_epi8(_mm256_sub_epi8(ahi, bhi)));
+                acc = _mm256_add_epi64(acc, _mm256_sad_epu8(d, _mm256_setzero_si256()));
+                break;
+            }
+            case VECTOR_DISTANCE_DOT:
+                dot = _mm256_add_epi32(dot, nibble_dot_avx2(alo, ahi, blo, bhi, is_signed));
+                break;
+            case VECTOR_DISTANCE_COSINE:
+                dot = _mm256_add_epi32(dot, nibble_dot_avx2(alo, ahi, blo, bhi, is_signed));
+                norm_a = _mm256_add_epi64(norm_a, nibble_sumsq_avx2(alo, ahi));
+                norm_b = _mm256_add_epi64(norm_b, nibble_sumsq_avx2(blo, bhi));
+                break;
+            default:
+                acc = _mm256_add_epi64(acc, nibble_sumsq_avx2(_mm256_sub_epi8(alo, blo), _mm256_sub_epi8(ahi, bhi)));
+                break;
+        }
+    }
+
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)hsum256_epi64(acc));
+        case VECTOR_DISTANCE_DOT: return -(float)hsum256_epi32(dot);
+        case VECTOR_DISTANCE_COSINE: {
+            uint64_t norm_a2 = hsum256_epi64(norm_a), norm_b2 = hsum256_epi64(norm_b);
+            if (norm_a2 == 0 || norm_b2 == 0) return 1.0f;
+            return 1.0f - (float)hsum256_epi32(dot) / (sqrtf((float)norm_a2) * sqrtf((float)norm_b2));
+        }
+        default: return (float)hsum256_epi64(acc);
+    }
+}
+
+#define DEFINE_NIBBLE_KERNELS_AVX2(NAME, METRIC) \
+    float uint4_distance_##NAME##_avx2 (const void *v1, const void *v2, int n) { \
+        return nibble_distance_impl_avx2(v1, v2, n, false, METRIC); \
+    } \
+    float int4_distance_##NAME##_avx2 (const void *v1, const void *v2, int n) { \
+        return nibble_distance_impl_avx2(v1, v2, n, true, METRIC); \
+    }
+
+DEFINE_NIBBLE_KERNELS_AVX2(l2, VECTOR_DISTANCE_L2)
+DEFINE_NIBBLE_KERNELS_AVX2(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_NIBBLE_KERNELS_AVX2(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_NIBBLE_KERNELS_AVX2(dot, VECTOR_DISTANCE_DOT)
+DEFINE_NIBBLE_KERNELS_AVX2(l1, VECTOR_DISTANCE_L1)
+
+// MARK: - WEIGHTED -
+
+static inline float weighted_dot_avx2 (const float *w, const uint8_t *codes, int n, bool is_signed) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    
+    for (; i <= n - 16; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(codes + i));
+        __m256i lo = (is_signed) ? _mm256_cvtepi8_epi32(c) : _mm256_cvtepu8_epi32(c);
+        __m256i hi = (is_signed) ? _mm256_cvtepi8_epi32(_mm_srli_si128(c, 8)) : _mm256_cvtepu8_epi32(_mm_srli_si128(c, 8));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + i), _mm256_cvtepi32_ps(lo), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + i + 8), _mm256_cvtepi32_ps(hi), acc1);
+    }
+    
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    float sum = _mm_cvtss_f32(s);
+    
+    // tail loop
+    for (; i < n; ++i) {
+        sum += w[i] * ((is_signed) ? (float)(int8_t)codes[i] : (float)codes[i]);
+    }
+    
+    return sum;
+}
+
+#define DEFINE_WEIGHTED_KERNELS_AVX2(NAME, METRIC) \
+    float uint8_distance_##NAME##_weighted_avx2 (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_avx2((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), false), v1, v2, n, METRIC); \
+    } \
+    float int8_distance_##NAME##_weighted_avx2 (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_avx2((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), true), v1, v2, n, METRIC); \
+    }
+
+DEFINE_WEIGHTED_KERNELS_AVX2(l2, VECTOR_DISTANCE_L2)
+DEFINE_WEIGHTED_KERNELS_AVX2(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_WEIGHTED_KERNELS_AVX2(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_WEIGHTED_KERNELS_AVX2(dot, VECTOR_DISTANCE_DOT)
+
 #endif
 
 // MARK: -
@@ -985,6 +1399,55 @@ void init_distance_functions_avx2 (void) {
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_avx2;
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_avx2;
     
+    dispatch_pq_distance_table[VECTOR_DISTANCE_L2] = pq_distance_adc_sqrt_avx2;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_SQUARED_L2] = pq_distance_adc_avx2;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_COSINE] = pq_distance_adc_avx2;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_DOT] = pq_distance_adc_avx2;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_L1] = pq_distance_adc_avx2;
+    
+    dispatch_hamming_distance = bit_distance_hamming_avx2;
+    
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L2] = uint4_distance_l2_avx2;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = uint4_distance_l2_squared_avx2;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_COSINE] = uint4_distance_cosine_avx2;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_DOT] = uint4_distance_dot_avx2;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L1] = uint4_distance_l1_avx2;
+    
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L2] = int4_distance_l2_avx2;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = int4_distance_l2_squared_avx2;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_COSINE] = int4_distance_cosine_avx2;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_DOT] = int4_distance_dot_avx2;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L1] = int4_distance_l1_avx2;
+    
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_weighted_avx2;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_weighted_avx2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F32] = float32_distance_l2_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_batch_avx2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32] = float32_distance_l2_squared_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_batch_avx2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F32] = float32_distance_cosine_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_batch_avx2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F32] = float32_distance_dot_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_batch_avx2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F32] = float32_distance_l1_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_batch_avx2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_batch_avx2;
+    
     distance_backend_name = "AVX2";
 #endif
 }
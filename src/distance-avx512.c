@@ -0,0 +1,755 @@
+//
+//  distance-avx512.c
+//  sqlitevector
+//
+//  Created by Marco Bambini on 20/06/25.
+//
+
+#include "distance-avx512.h"
+#include "distance-cpu.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include <immintrin.h>
+#include <stdint.h>
+#include <math.h>
+
+extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern char *distance_backend_name;
+
+// Tails are handled with masked loads: lanes past n are loaded as zero and contribute nothing to the sums.
+static inline __mmask16 tail_mask16 (int count) {
+    return (count >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << count) - 1);
+}
+
+static inline __mmask64 tail_mask64 (int count) {
+    return (count >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << count) - 1);
+}
+
+// 16 f32 lanes widened to 2 x 8 f64 lanes
+static inline __m512d cvt_lo_pd (__m512 v) {
+    return _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+}
+
+static inline __m512d cvt_hi_pd (__m512 v) {
+    return _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+}
+
+// MARK: - FLOAT32 -
+
+static inline float float32_distance_l2_impl_avx512 (const void *v1, const void *v2, int n, bool use_sqrt) {
+    const float *a = (const float *)v1;
+    const float *b = (const float *)v2;
+
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i <= n - 32; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i < n; i += 16) {
+        __mmask16 m = tail_mask16(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+
+    float total = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    return use_sqrt ? sqrtf(total) : total;
+}
+
+float float32_distance_l2_avx512 (const void *v1, const void *v2, int n) {
+    return float32_distance_l2_impl_avx512(v1, v2, n, true);
+}
+
+float float32_distance_l2_squared_avx512 (const void *v1, const void *v2, int n) {
+    return float32_distance_l2_impl_avx512(v1, v2, n, false);
+}
+
+float float32_distance_l1_avx512 (const void *v1, const void *v2, int n) {
+    const float *a = (const float *)v1;
+    const float *b = (const float *)v2;
+
+    __m512 acc = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = tail_mask16(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc = _mm512_add_ps(acc, _mm512_abs_ps(d));
+    }
+
+    return _mm512_reduce_add_ps(acc);
+}
+
+float float32_distance_dot_avx512 (const void *v1, const void *v2, int n) {
+    const float *a = (const float *)v1;
+    const float *b = (const float *)v2;
+
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i <= n - 32; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i < n; i += 16) {
+        __mmask16 m = tail_mask16(n - i);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+    }
+
+    return -_mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+float float32_distance_cosine_avx512 (const void *v1, const void *v2, int n) {
+    const float *a = (const float *)v1;
+    const float *b = (const float *)v2;
+
+    // dot product and both norms in a single pass
+    __m512 dot = _mm512_setzero_ps();
+    __m512 norm_a2 = _mm512_setzero_ps();
+    __m512 norm_b2 = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = tail_mask16(n - i);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+        __m512 vb = _mm512_maskz_loadu_ps(m, b + i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        norm_a2 = _mm512_fmadd_ps(va, va, norm_a2);
+        norm_b2 = _mm512_fmadd_ps(vb, vb, norm_b2);
+    }
+
+    float norm_a = sqrtf(_mm512_reduce_add_ps(norm_a2));
+    float norm_b = sqrtf(_mm512_reduce_add_ps(norm_b2));
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+
+    float cosine_similarity = _mm512_reduce_add_ps(dot) / (norm_a * norm_b);
+    return 1.0f - cosine_similarity;
+}
+
+// MARK: - FLOAT16/BFLOAT16 -
+
+// Same NaN/Inf policy as the AVX2 kernels: NaN lanes are ignored, an Inf difference (Inf against a finite value or
+// Infs of opposite sign) makes L1/L2 +Inf and an Inf product makes dot ±Inf. Sums are accumulated in f64.
+// Both 16bit formats are handled by the same code, classified with their exponent mask (0x7C00 or 0x7F80).
+
+// 16 x 16bit values (count of them, the rest is zero)
+static inline __m256i half16_loadu (const uint16_t *p, int count) {
+    return _mm512_castsi512_si256(_mm512_maskz_loadu_epi16((__mmask32)tail_mask16(count), p));
+}
+
+static inline __m512 half16_to_f32 (__m256i h, bool is_bf16) {
+    if (is_bf16) return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+    return _mm512_cvtph_ps(h);
+}
+
+static inline __mmask16 half16_inf_mask (__m512i h32, __m512i exp_mask) {
+    return _mm512_cmpeq_epi32_mask(_mm512_and_si512(h32, _mm512_set1_epi32(0x7FFF)), exp_mask);
+}
+
+static inline __mmask16 half16_nan_mask (__m512i h32, __m512i exp_mask) {
+    return _mm512_cmpgt_epi32_mask(_mm512_and_si512(h32, _mm512_set1_epi32(0x7FFF)), exp_mask);
+}
+
+static inline __mmask16 half16_zero_mask (__m512i h32) {
+    return _mm512_testn_epi32_mask(h32, _mm512_set1_epi32(0x7FFF));
+}
+
+// true when a lane has an infinite difference: (a_inf ^ b_inf) || (both inf and signs differ)
+static inline bool half16_inf_mismatch (__m256i ha, __m256i hb, __m512i exp_mask) {
+    __m512i a32 = _mm512_cvtepu16_epi32(ha);
+    __m512i b32 = _mm512_cvtepu16_epi32(hb);
+    __mmask16 ai = half16_inf_mask(a32, exp_mask);
+    __mmask16 bi = half16_inf_mask(b32, exp_mask);
+    __mmask16 sign_diff = _mm512_test_epi32_mask(_mm512_xor_si512(a32, b32), _mm512_set1_epi32(0x8000));
+    return ((ai ^ bi) | (ai & bi & sign_diff)) != 0;
+}
+
+static inline float half16_distance_l2_impl_avx512 (const uint16_t *a, const uint16_t *b, int n, bool use_sqrt, bool is_bf16) {
+    const __m512i exp_mask = _mm512_set1_epi32(is_bf16 ? 0x7F80 : 0x7C00);
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+
+    for (int i = 0; i < n; i += 16) {
+        __m256i ha = half16_loadu(a + i, n - i);
+        __m256i hb = half16_loadu(b + i, n - i);
+        if (half16_inf_mismatch(ha, hb, exp_mask)) return INFINITY;
+
+        __m512 fa = half16_to_f32(ha, is_bf16);
+        __m512 fb = half16_to_f32(hb, is_bf16);
+        __m512d d0, d1;
+        if (is_bf16) {
+            // bfloat16 has the f32 range, so the difference is taken in f64
+            d0 = _mm512_sub_pd(cvt_lo_pd(fa), cvt_lo_pd(fb));
+            d1 = _mm512_sub_pd(cvt_hi_pd(fa), cvt_hi_pd(fb));
+        } else {
+            __m512 d = _mm512_sub_ps(fa, fb);
+            d0 = cvt_lo_pd(d);
+            d1 = cvt_hi_pd(d);
+        }
+
+        // NaN differences (NaN inputs or Inf - Inf) are zeroed
+        d0 = _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(d0, d0, _CMP_ORD_Q), d0);
+        d1 = _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(d1, d1, _CMP_ORD_Q), d1);
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm512_fmadd_pd(d1, d1, acc1);
+    }
+
+    double sum = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    return use_sqrt ? (float)sqrt(sum) : (float)sum;
+}
+
+static inline float half16_distance_l1_impl_avx512 (const uint16_t *a, const uint16_t *b, int n, bool is_bf16) {
+    const __m512i exp_mask = _mm512_set1_epi32(is_bf16 ? 0x7F80 : 0x7C00);
+    __m512d acc = _mm512_setzero_pd();
+
+    for (int i = 0; i < n; i += 16) {
+        __m256i ha = half16_loadu(a + i, n - i);
+        __m256i hb = half16_loadu(b + i, n - i);
+        if (half16_inf_mismatch(ha, hb, exp_mask)) return INFINITY;
+
+        __m512 fa = half16_to_f32(ha, is_bf16);
+        __m512 fb = half16_to_f32(hb, is_bf16);
+        __m512d d0, d1;
+        if (is_bf16) {
+            d0 = _mm512_sub_pd(cvt_lo_pd(fa), cvt_lo_pd(fb));
+            d1 = _mm512_sub_pd(cvt_hi_pd(fa), cvt_hi_pd(fb));
+        } else {
+            __m512 d = _mm512_sub_ps(fa, fb);
+            d0 = cvt_lo_pd(d);
+            d1 = cvt_hi_pd(d);
+        }
+
+        d0 = _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(d0, d0, _CMP_ORD_Q), _mm512_abs_pd(d0));
+        d1 = _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(d1, d1, _CMP_ORD_Q), _mm512_abs_pd(d1));
+        acc = _mm512_add_pd(acc, _mm512_add_pd(d0, d1));
+    }
+
+    return (float)_mm512_reduce_add_pd(acc);
+}
+
+static inline float half16_distance_dot_impl_avx512 (const uint16_t *a, const uint16_t *b, int n, bool is_bf16) {
+    const __m512i exp_mask = _mm512_set1_epi32(is_bf16 ? 0x7F80 : 0x7C00);
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+
+    for (int i = 0; i < n; i += 16) {
+        __m256i ha = half16_loadu(a + i, n - i);
+        __m256i hb = half16_loadu(b + i, n - i);
+        __m512i a32 = _mm512_cvtepu16_epi32(ha);
+        __m512i b32 = _mm512_cvtepu16_epi32(hb);
+        __mmask16 nan = half16_nan_mask(a32, exp_mask) | half16_nan_mask(b32, exp_mask);
+
+        // an Inf input times a non zero value returns ±Inf (function returns -dot), with float16 NaN lanes are
+        // skipped first and a finite product can also overflow, bfloat16 products are accumulated as they are
+        __mmask16 ai = half16_inf_mask(a32, exp_mask), bi = half16_inf_mask(b32, exp_mask);
+        __mmask16 inf = (ai & ~half16_zero_mask(b32)) | (bi & ~half16_zero_mask(a32));
+        if (!is_bf16) inf &= ~nan;
+
+        __m512 p = _mm512_maskz_mul_ps(~nan, half16_to_f32(ha, is_bf16), half16_to_f32(hb, is_bf16));
+        if (!is_bf16) inf |= _mm512_cmp_ps_mask(_mm512_abs_ps(p), _mm512_set1_ps(INFINITY), _CMP_EQ_OQ) & ~nan;
+        if (inf) {
+            int k = __builtin_ctz((unsigned)inf);
+            int sign = ((a[i + k] ^ b[i + k]) >> 15) & 1;
+            return (sign) ? INFINITY : -INFINITY;
+        }
+
+        p = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(p, p, _CMP_ORD_Q), p);
+        acc0 = _mm512_add_pd(acc0, cvt_lo_pd(p));
+        acc1 = _mm512_add_pd(acc1, cvt_hi_pd(p));
+    }
+
+    return (float)(-_mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)));
+}
+
+static inline float half16_distance_cosine_impl_avx512 (const uint16_t *a, const uint16_t *b, int n, bool is_bf16, distance_function_t dot_fn) {
+    if (!is_bf16) {
+        // if either vector contains any ±Inf, return max distance
+        const __m512i exp_mask = _mm512_set1_epi32(0x7C00);
+        for (int i = 0; i < n; i += 16) {
+            __mmask16 inf = half16_inf_mask(_mm512_cvtepu16_epi32(half16_loadu(a + i, n - i)), exp_mask) |
+                            half16_inf_mask(_mm512_cvtepu16_epi32(half16_loadu(b + i, n - i)), exp_mask);
+            if (inf) return 1.0f;
+        }
+    }
+
+    float dot    = -dot_fn(a, b, n);
+    float norm_a =  sqrtf(-dot_fn(a, a, n));
+    float norm_b =  sqrtf(-dot_fn(b, b, n));
+
+    if (!(norm_a > 0.0f) || !(norm_b > 0.0f) || !isfinite(norm_a) || !isfinite(norm_b) || !isfinite(dot))
+        return 1.0f;
+
+    float cosine = dot / (norm_a * norm_b);
+    if (cosine > 1.0f)  cosine = 1.0f;
+    if (cosine < -1.0f) cosine = -1.0f;
+    return 1.0f - cosine;
+}
+
+float float16_distance_l2_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l2_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true, false);
+}
+
+float float16_distance_l2_squared_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l2_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, false, false);
+}
+
+float float16_distance_l1_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l1_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, false);
+}
+
+float float16_distance_dot_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_dot_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, false);
+}
+
+float float16_distance_cosine_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_cosine_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, false, float16_distance_dot_avx512);
+}
+
+float bfloat16_distance_l2_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l2_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true, true);
+}
+
+float bfloat16_distance_l2_squared_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l2_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, false, true);
+}
+
+float bfloat16_distance_l1_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_l1_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true);
+}
+
+float bfloat16_distance_dot_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_dot_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true);
+}
+
+float bfloat16_distance_cosine_avx512 (const void *v1, const void *v2, int n) {
+    return half16_distance_cosine_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true, bfloat16_distance_dot_avx512);
+}
+
+#if defined(__AVX512BF16__)
+// AVX512-BF16: vdpbf16ps multiplies pairs of bfloat16 values and accumulates them in f32 (denormals are flushed),
+// NaN lanes are zeroed before the multiply and Inf products are detected as in bfloat16_distance_dot_avx512
+float bfloat16_distance_dot_avx512bf16 (const void *v1, const void *v2, int n) {
+    const uint16_t *a = (const uint16_t *)v1;
+    const uint16_t *b = (const uint16_t *)v2;
+    const __m512i abs_mask = _mm512_set1_epi16(0x7FFF);
+    const __m512i exp_mask = _mm512_set1_epi16(0x7F80);
+
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 32) {
+        int count = n - i;
+        __mmask32 m = (count >= 32) ? 0xFFFFFFFFu : (__mmask32)((1u << count) - 1);
+        __m512i va = _mm512_maskz_loadu_epi16(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi16(m, b + i);
+        __m512i abs_a = _mm512_and_si512(va, abs_mask);
+        __m512i abs_b = _mm512_and_si512(vb, abs_mask);
+
+        __mmask32 ai = _mm512_cmpeq_epi16_mask(abs_a, exp_mask);
+        __mmask32 bi = _mm512_cmpeq_epi16_mask(abs_b, exp_mask);
+        __mmask32 inf = (ai & _mm512_test_epi16_mask(abs_b, abs_b)) | (bi & _mm512_test_epi16_mask(abs_a, abs_a));
+        if (inf) {
+            int k = __builtin_ctz((unsigned)inf);
+            int sign = ((a[i + k] ^ b[i + k]) >> 15) & 1;
+            return (sign) ? INFINITY : -INFINITY;
+        }
+
+        // NaN lanes and the remaining Inf lanes (Inf * 0) are ignored
+        __mmask32 valid = ~(_mm512_cmpge_epu16_mask(abs_a, exp_mask) | _mm512_cmpge_epu16_mask(abs_b, exp_mask));
+        va = _mm512_maskz_mov_epi16(valid, va);
+        vb = _mm512_maskz_mov_epi16(valid, vb);
+        if (i & 32) acc1 = _mm512_dpbf16_ps(acc1, (__m512bh)va, (__m512bh)vb);
+        else acc0 = _mm512_dpbf16_ps(acc0, (__m512bh)va, (__m512bh)vb);
+    }
+
+    return -_mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+float bfloat16_distance_cosine_avx512bf16 (const void *v1, const void *v2, int n) {
+    return half16_distance_cosine_impl_avx512((const uint16_t *)v1, (const uint16_t *)v2, n, true, bfloat16_distance_dot_avx512bf16);
+}
+#endif
+
+// MARK: - BATCH -
+
+// Batch kernels score BATCH_ROWS rows per pass, see distance-avx2.c
+#define BATCH_ROWS  4
+
+static inline void batch_rows_setup (const uint8_t **b, const void *rows, size_t stride, int r, int nrows) {
+    for (int j = 0; j < BATCH_ROWS; ++j) {
+        int index = (r + j < nrows) ? r + j : nrows - 1;
+        b[j] = (const uint8_t *)rows + (size_t)index * stride;
+    }
+}
+
+static inline float float32_batch_finalize_avx512 (float total, float norm_a, float norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf(total);
+        case VECTOR_DISTANCE_DOT: return -total;
+        case VECTOR_DISTANCE_COSINE: {
+            float norm_b = sqrtf(norm_b2);
+            if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+            return 1.0f - (total / (norm_a * norm_b));
+        }
+        default: return total;
+    }
+}
+
+static inline void float32_distance_batch_impl_avx512 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric) {
+    const float *a = (const float *)q;
+    float norm_a = (metric == VECTOR_DISTANCE_COSINE) ? sqrtf(-float32_distance_dot_avx512(a, a, n)) : 0.0f;
+
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+
+        __m512 acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = _mm512_setzero_ps(); nrm[j] = _mm512_setzero_ps();}
+
+        for (int i = 0; i < n; i += 16) {
+            __mmask16 m = tail_mask16(n - i);
+            __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m512 vb = _mm512_maskz_loadu_ps(m, (const float *)b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    __m512 diff = _mm512_sub_ps(va, vb);
+                    acc[j] = _mm512_fmadd_ps(diff, diff, acc[j]);
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    acc[j] = _mm512_add_ps(acc[j], _mm512_abs_ps(_mm512_sub_ps(va, vb)));
+                } else {
+                    acc[j] = _mm512_fmadd_ps(va, vb, acc[j]);
+                    if (metric == VECTOR_DISTANCE_COSINE) nrm[j] = _mm512_fmadd_ps(vb, vb, nrm[j]);
+                }
+            }
+        }
+
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            out[r + j] = float32_batch_finalize_avx512(_mm512_reduce_add_ps(acc[j]), norm_a, _mm512_reduce_add_ps(nrm[j]), metric);
+        }
+    }
+}
+
+#define DEFINE_FLOAT32_BATCH_KERNEL_AVX512(NAME, METRIC) \
+    void float32_distance_##NAME##_batch_avx512 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        float32_distance_batch_impl_avx512(q, rows, stride, nrows, n, out, METRIC); \
+    }
+
+DEFINE_FLOAT32_BATCH_KERNEL_AVX512(l2, VECTOR_DISTANCE_L2)
+DEFINE_FLOAT32_BATCH_KERNEL_AVX512(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_FLOAT32_BATCH_KERNEL_AVX512(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_FLOAT32_BATCH_KERNEL_AVX512(dot, VECTOR_DISTANCE_DOT)
+DEFINE_FLOAT32_BATCH_KERNEL_AVX512(l1, VECTOR_DISTANCE_L1)
+
+// MARK: - UINT8/INT8 (VNNI) -
+
+#if defined(__AVX512VNNI__)
+// vpdpbusd multiplies unsigned by signed bytes and adds groups of 4 products to 32bit lanes. Operands that do not
+// fit are re-biased by 128 (x ^ 0x80 flips between the unsigned and the signed range) and corrected afterwards:
+//   u8 . u8:  a.b = a.(b-128) + 128*sum(a)
+//   s8 . s8:  a.b = (a+128).b - 128*sum(b)
+//   d.d (d unsigned, e.g. |a-b|):  d.d = d.(d-128) + 128*sum(d)
+// Unsigned sums are computed with sad_epu8 into 64bit lanes, results are exact integers.
+
+typedef struct {
+    __m512i dot;        // 32bit lanes
+    __m512i sum;        // 64bit lanes
+} vnni_acc;
+
+static inline void vnni_acc_init (vnni_acc *acc) {
+    acc->dot = _mm512_setzero_si512();
+    acc->sum = _mm512_setzero_si512();
+}
+
+static inline int64_t vnni_acc_total (const vnni_acc *acc, int64_t sum_scale) {
+    return (int64_t)_mm512_reduce_add_epi32(acc->dot) + sum_scale * (int64_t)_mm512_reduce_add_epi64(acc->sum);
+}
+
+// acc += d.d for unsigned bytes (total with sum_scale 128)
+static inline void vnni_square_u8 (vnni_acc *acc, __m512i d) {
+    acc->dot = _mm512_dpbusd_epi32(acc->dot, d, _mm512_xor_si512(d, _mm512_set1_epi8((char)0x80)));
+    acc->sum = _mm512_add_epi64(acc->sum, _mm512_sad_epu8(d, _mm512_setzero_si512()));
+}
+
+// acc += a.b (total with sum_scale 128 for unsigned, -128 for signed bytes)
+static inline void vnni_dot_8 (vnni_acc *acc, __m512i a, __m512i b, bool is_signed) {
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+    if (is_signed) {
+        acc->dot = _mm512_dpbusd_epi32(acc->dot, _mm512_xor_si512(a, bias), b);
+        acc->sum = _mm512_add_epi64(acc->sum, _mm512_sad_epu8(_mm512_xor_si512(b, bias), _mm512_setzero_si512()));
+    } else {
+        acc->dot = _mm512_dpbusd_epi32(acc->dot, a, _mm512_xor_si512(b, bias));
+        acc->sum = _mm512_add_epi64(acc->sum, _mm512_sad_epu8(a, _mm512_setzero_si512()));
+    }
+}
+
+// signed sums from sad_epu8 of b ^ 0x80 include a +128 for each lane
+static inline int64_t vnni_dot_total (const vnni_acc *acc, int n, bool is_signed) {
+    if (!is_signed) return vnni_acc_total(acc, 128);
+    int64_t sum_b = (int64_t)_mm512_reduce_add_epi64(acc->sum) - 128 * (int64_t)n;
+    return (int64_t)_mm512_reduce_add_epi32(acc->dot) - 128 * sum_b;
+}
+
+// |a - b| as unsigned bytes
+static inline __m512i vnni_absdiff (__m512i a, __m512i b, bool is_signed) {
+    if (is_signed) return _mm512_sub_epi8(_mm512_max_epi8(a, b), _mm512_min_epi8(a, b));
+    return _mm512_sub_epi8(_mm512_max_epu8(a, b), _mm512_min_epu8(a, b));
+}
+
+// |a| as unsigned bytes (abs(-128) = 0x80 = 128)
+static inline __m512i vnni_abs (__m512i a, bool is_signed) {
+    return (is_signed) ? _mm512_abs_epi8(a) : a;
+}
+
+static inline float int8_distance_l2_impl_vnni (const void *v1, const void *v2, int n, bool use_sqrt, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    vnni_acc acc;
+    vnni_acc_init(&acc);
+    for (int i = 0; i < n; i += 64) {
+        __mmask64 m = tail_mask64(n - i);
+        __m512i va = _mm512_maskz_loadu_epi8(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(m, b + i);
+        vnni_square_u8(&acc, vnni_absdiff(va, vb, is_signed));
+    }
+
+    float total = (float)vnni_acc_total(&acc, 128);
+    return use_sqrt ? sqrtf(total) : total;
+}
+
+static inline float int8_distance_dot_impl_vnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    vnni_acc acc;
+    vnni_acc_init(&acc);
+    int i = 0;
+    for (; i < n; i += 64) {
+        __mmask64 m = tail_mask64(n - i);
+        vnni_dot_8(&acc, _mm512_maskz_loadu_epi8(m, a + i), _mm512_maskz_loadu_epi8(m, b + i), is_signed);
+    }
+
+    // zeroed tail lanes are also counted in the biased sum
+    return -(float)vnni_dot_total(&acc, i, is_signed);
+}
+
+static inline float int8_distance_l1_impl_vnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+
+    __m512i acc = _mm512_setzero_si512();
+    for (int i = 0; i < n; i += 64) {
+        __mmask64 m = tail_mask64(n - i);
+        __m512i va = _mm512_maskz_loadu_epi8(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(m, b + i);
+        if (is_signed) {va = _mm512_xor_si512(va, bias); vb = _mm512_xor_si512(vb, bias);}
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+    }
+
+    return (float)_mm512_reduce_add_epi64(acc);
+}
+
+static inline float int8_distance_cosine_impl_vnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    // dot product and both norms in a single pass
+    vnni_acc dot, norm_a2, norm_b2;
+    vnni_acc_init(&dot);
+    vnni_acc_init(&norm_a2);
+    vnni_acc_init(&norm_b2);
+    int i = 0;
+    for (; i < n; i += 64) {
+        __mmask64 m = tail_mask64(n - i);
+        __m512i va = _mm512_maskz_loadu_epi8(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(m, b + i);
+        vnni_dot_8(&dot, va, vb, is_signed);
+        vnni_square_u8(&norm_a2, vnni_abs(va, is_signed));
+        vnni_square_u8(&norm_b2, vnni_abs(vb, is_signed));
+    }
+
+    float norm_a = sqrtf((float)vnni_acc_total(&norm_a2, 128));
+    float norm_b = sqrtf((float)vnni_acc_total(&norm_b2, 128));
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+
+    float cosine_similarity = (float)vnni_dot_total(&dot, i, is_signed) / (norm_a * norm_b);
+    return 1.0f - cosine_similarity;
+}
+
+#define DEFINE_INT8_KERNELS_VNNI(TYPE, IS_SIGNED) \
+    float TYPE##_distance_l2_avx512vnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l2_impl_vnni(v1, v2, n, true, IS_SIGNED); \
+    } \
+    float TYPE##_distance_l2_squared_avx512vnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l2_impl_vnni(v1, v2, n, false, IS_SIGNED); \
+    } \
+    float TYPE##_distance_dot_avx512vnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_dot_impl_vnni(v1, v2, n, IS_SIGNED); \
+    } \
+    float TYPE##_distance_l1_avx512vnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l1_impl_vnni(v1, v2, n, IS_SIGNED); \
+    } \
+    float TYPE##_distance_cosine_avx512vnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_cosine_impl_vnni(v1, v2, n, IS_SIGNED); \
+    }
+
+DEFINE_INT8_KERNELS_VNNI(uint8, false)
+DEFINE_INT8_KERNELS_VNNI(int8, true)
+
+static inline float int8_batch_finalize_vnni (int64_t total, int64_t norm_a2, int64_t norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)total);
+        case VECTOR_DISTANCE_DOT: return -(float)total;
+        case VECTOR_DISTANCE_COSINE: {
+            float norm_a = sqrtf((float)norm_a2);
+            float norm_b = sqrtf((float)norm_b2);
+            if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+            return 1.0f - ((float)total / (norm_a * norm_b));
+        }
+        default: return (float)total;
+    }
+}
+
+// the query is the operand that gets the bias correction of the dot product, so it is computed once per query:
+//   u8: a.b = a.(b-128) + 128*sum(a)      s8: a.b = a.(b+128) - 128*sum(a)
+static inline void int8_distance_batch_impl_vnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)q;
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+    bool is_dot = (metric == VECTOR_DISTANCE_DOT || metric == VECTOR_DISTANCE_COSINE);
+
+    int64_t sum_a = 0, norm_a2 = 0;
+    for (int i = 0; i < n; ++i) {
+        int va = (is_signed) ? (int)((const int8_t *)a)[i] : (int)a[i];
+        sum_a += va;
+        norm_a2 += va * va;
+    }
+    int64_t dot_bias = (is_signed) ? -128 * sum_a : 128 * sum_a;
+
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+
+        vnni_acc acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {vnni_acc_init(&acc[j]); vnni_acc_init(&nrm[j]);}
+
+        for (int i = 0; i < n; i += 64) {
+            __mmask64 m = tail_mask64(n - i);
+            __m512i va = _mm512_maskz_loadu_epi8(m, a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m512i vb = _mm512_maskz_loadu_epi8(m, b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    vnni_square_u8(&acc[j], vnni_absdiff(va, vb, is_signed));
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    __m512i xa = (is_signed) ? _mm512_xor_si512(va, bias) : va;
+                    __m512i xb = (is_signed) ? _mm512_xor_si512(vb, bias) : vb;
+                    acc[j].sum = _mm512_add_epi64(acc[j].sum, _mm512_sad_epu8(xa, xb));
+                } else {
+                    // the biased row is unsigned for signed codes and signed for unsigned codes, masked lanes
+                    // of the row are not zero once biased but the matching query lanes are
+                    __m512i xb = _mm512_xor_si512(vb, bias);
+                    acc[j].dot = (is_signed) ? _mm512_dpbusd_epi32(acc[j].dot, xb, va) : _mm512_dpbusd_epi32(acc[j].dot, va, xb);
+                    if (metric == VECTOR_DISTANCE_COSINE) vnni_square_u8(&nrm[j], vnni_abs(vb, is_signed));
+                }
+            }
+        }
+
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            int64_t total;
+            if (is_dot) total = (int64_t)_mm512_reduce_add_epi32(acc[j].dot) + dot_bias;
+            else if (metric == VECTOR_DISTANCE_L1) total = (int64_t)_mm512_reduce_add_epi64(acc[j].sum);
+            else total = vnni_acc_total(&acc[j], 128);
+            int64_t norm_b2 = (metric == VECTOR_DISTANCE_COSINE) ? vnni_acc_total(&nrm[j], 128) : 0;
+            out[r + j] = int8_batch_finalize_vnni(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+#define DEFINE_INT8_BATCH_KERNELS_VNNI(NAME, METRIC) \
+    void uint8_distance_##NAME##_batch_avx512vnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_vnni(q, rows, stride, nrows, n, out, METRIC, false); \
+    } \
+    void int8_distance_##NAME##_batch_avx512vnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_vnni(q, rows, stride, nrows, n, out, METRIC, true); \
+    }
+
+DEFINE_INT8_BATCH_KERNELS_VNNI(l2, VECTOR_DISTANCE_L2)
+DEFINE_INT8_BATCH_KERNELS_VNNI(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_INT8_BATCH_KERNELS_VNNI(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_INT8_BATCH_KERNELS_VNNI(dot, VECTOR_DISTANCE_DOT)
+DEFINE_INT8_BATCH_KERNELS_VNNI(l1, VECTOR_DISTANCE_L1)
+#endif
+
+#endif
+
+// MARK: -
+
+// installed over the AVX2 tables: kernels not provided here (PQ, binary) keep their AVX2 version,
+// 8bit kernels need AVX512-VNNI and the bfloat16 dot product uses AVX512-BF16 when the CPU has them
+void init_distance_functions_avx512 (void) {
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F32] = float32_distance_l2_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F16] = float16_distance_l2_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_BF16] = bfloat16_distance_l2_avx512;
+
+    dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32] = float32_distance_l2_squared_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F16] = float16_distance_l2_squared_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_BF16] = bfloat16_distance_l2_squared_avx512;
+
+    dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F32] = float32_distance_cosine_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F16] = float16_distance_cosine_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_BF16] = bfloat16_distance_cosine_avx512;
+
+    dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F32] = float32_distance_dot_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F16] = float16_distance_dot_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_BF16] = bfloat16_distance_dot_avx512;
+
+    dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F32] = float32_distance_l1_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F16] = float16_distance_l1_avx512;
+    dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_BF16] = bfloat16_distance_l1_avx512;
+
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F32] = float32_distance_l2_batch_avx512;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32] = float32_distance_l2_squared_batch_avx512;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F32] = float32_distance_cosine_batch_avx512;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F32] = float32_distance_dot_batch_avx512;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F32] = float32_distance_l1_batch_avx512;
+
+    distance_backend_name = "AVX512";
+
+    #if defined(__AVX512BF16__)
+    if (cpu_supports_avx512_bf16()) {
+        dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_BF16] = bfloat16_distance_cosine_avx512bf16;
+        dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_BF16] = bfloat16_distance_dot_avx512bf16;
+    }
+    #endif
+
+    #if defined(__AVX512VNNI__)
+    if (cpu_supports_avx512_vnni()) {
+        dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_avx512vnni;
+        dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_avx512vnni;
+
+        dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_batch_avx512vnni;
+        dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_batch_avx512vnni;
+    }
+    #endif
+#endif
+}
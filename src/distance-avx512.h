@@ -0,0 +1,21 @@
+//
+//  distance-avx512.h
+//  sqlitevector
+//
+//  Created by Marco Bambini on 20/06/25.
+//
+
+#ifndef __VECTOR_DISTANCE_AVX512__
+#define __VECTOR_DISTANCE_AVX512__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// runtime CPU features (x86 only, implemented in distance-cpu.c)
+bool cpu_supports_avx512 (void);
+bool cpu_supports_avx512_vnni (void);
+bool cpu_supports_avx512_bf16 (void);
+
+void init_distance_functions_avx512 (void);
+
+#endif
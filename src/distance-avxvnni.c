@@ -0,0 +1,371 @@
+//
+//  distance-avxvnni.c
+//  sqlitevector
+//
+//  Created by Marco Bambini on 20/06/25.
+//
+
+#include "distance-avxvnni.h"
+#include "distance-cpu.h"
+
+#if defined(__AVX2__) && defined(__AVXVNNI__)
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern char *distance_backend_name;
+
+// Same scheme as the AVX512-VNNI kernels on 256bit registers (VEX encoded vpdpbusd, Alder Lake and Zen 4 or later).
+// vpdpbusd multiplies unsigned by signed bytes, so operands that do not fit are re-biased by 128 and corrected:
+//   u8 . u8:  a.b = a.(b-128) + 128*sum(a)
+//   s8 . s8:  a.b = (a+128).b - 128*sum(b)
+//   d.d (d unsigned, e.g. |a-b|):  d.d = d.(d-128) + 128*sum(d)
+// Blocks of 32 bytes go through vpdpbusd, the last n % 32 values are computed in scalar code.
+
+typedef struct {
+    __m256i dot;        // 32bit lanes
+    __m256i sum;        // 64bit lanes
+} avxvnni_acc;
+
+static inline int64_t hsum256_epi32_avxvnni (__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (int64_t)_mm_cvtsi128_si32(s);
+}
+
+static inline int64_t hsum256_epi64_avxvnni (__m256i v) {
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    return (int64_t)_mm_cvtsi128_si64(s);
+}
+
+static inline __m256i avxvnni_load (const uint8_t *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline int avxvnni_value (const uint8_t *p, int i, bool is_signed) {
+    return (is_signed) ? (int)((const int8_t *)p)[i] : (int)p[i];
+}
+
+static inline void avxvnni_acc_init (avxvnni_acc *acc) {
+    acc->dot = _mm256_setzero_si256();
+    acc->sum = _mm256_setzero_si256();
+}
+
+static inline void avxvnni_acc_merge (avxvnni_acc *acc, const avxvnni_acc *other) {
+    acc->dot = _mm256_add_epi32(acc->dot, other->dot);
+    acc->sum = _mm256_add_epi64(acc->sum, other->sum);
+}
+
+static inline int64_t avxvnni_acc_total (const avxvnni_acc *acc, int64_t sum_scale) {
+    return hsum256_epi32_avxvnni(acc->dot) + sum_scale * hsum256_epi64_avxvnni(acc->sum);
+}
+
+// acc += d.d for unsigned bytes (total with sum_scale 128)
+static inline void avxvnni_square_u8 (avxvnni_acc *acc, __m256i d) {
+    acc->dot = _mm256_dpbusd_avx_epi32(acc->dot, d, _mm256_xor_si256(d, _mm256_set1_epi8((char)0x80)));
+    acc->sum = _mm256_add_epi64(acc->sum, _mm256_sad_epu8(d, _mm256_setzero_si256()));
+}
+
+// acc += a.b (total with avxvnni_dot_total)
+static inline void avxvnni_dot_8 (avxvnni_acc *acc, __m256i a, __m256i b, bool is_signed) {
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    if (is_signed) {
+        acc->dot = _mm256_dpbusd_avx_epi32(acc->dot, _mm256_xor_si256(a, bias), b);
+        acc->sum = _mm256_add_epi64(acc->sum, _mm256_sad_epu8(_mm256_xor_si256(b, bias), _mm256_setzero_si256()));
+    } else {
+        acc->dot = _mm256_dpbusd_avx_epi32(acc->dot, a, _mm256_xor_si256(b, bias));
+        acc->sum = _mm256_add_epi64(acc->sum, _mm256_sad_epu8(a, _mm256_setzero_si256()));
+    }
+}
+
+// signed sums from sad_epu8 of b ^ 0x80 include a +128 for each of the count lanes
+static inline int64_t avxvnni_dot_total (const avxvnni_acc *acc, int count, bool is_signed) {
+    if (!is_signed) return avxvnni_acc_total(acc, 128);
+    int64_t sum_b = hsum256_epi64_avxvnni(acc->sum) - 128 * (int64_t)count;
+    return hsum256_epi32_avxvnni(acc->dot) - 128 * sum_b;
+}
+
+// |a - b| as unsigned bytes
+static inline __m256i avxvnni_absdiff (__m256i a, __m256i b, bool is_signed) {
+    if (is_signed) return _mm256_sub_epi8(_mm256_max_epi8(a, b), _mm256_min_epi8(a, b));
+    return _mm256_sub_epi8(_mm256_max_epu8(a, b), _mm256_min_epu8(a, b));
+}
+
+// |a| as unsigned bytes (abs(-128) = 0x80 = 128)
+static inline __m256i avxvnni_abs (__m256i a, bool is_signed) {
+    return (is_signed) ? _mm256_abs_epi8(a) : a;
+}
+
+// MARK: - UINT8/INT8 -
+
+// single row kernels use two accumulators to hide the vpdpbusd latency
+static inline float int8_distance_l2_impl_avxvnni (const void *v1, const void *v2, int n, bool use_sqrt, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    avxvnni_acc acc0, acc1;
+    avxvnni_acc_init(&acc0);
+    avxvnni_acc_init(&acc1);
+    int i = 0;
+    for (; i <= n - 64; i += 64) {
+        avxvnni_square_u8(&acc0, avxvnni_absdiff(avxvnni_load(a + i), avxvnni_load(b + i), is_signed));
+        avxvnni_square_u8(&acc1, avxvnni_absdiff(avxvnni_load(a + i + 32), avxvnni_load(b + i + 32), is_signed));
+    }
+    for (; i <= n - 32; i += 32) {
+        avxvnni_square_u8(&acc0, avxvnni_absdiff(avxvnni_load(a + i), avxvnni_load(b + i), is_signed));
+    }
+    avxvnni_acc_merge(&acc0, &acc1);
+
+    int64_t total = avxvnni_acc_total(&acc0, 128);
+    for (; i < n; ++i) {
+        int d = avxvnni_value(a, i, is_signed) - avxvnni_value(b, i, is_signed);
+        total += d * d;
+    }
+
+    return use_sqrt ? sqrtf((float)total) : (float)total;
+}
+
+static inline float int8_distance_dot_impl_avxvnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    avxvnni_acc acc0, acc1;
+    avxvnni_acc_init(&acc0);
+    avxvnni_acc_init(&acc1);
+    int i = 0;
+    for (; i <= n - 64; i += 64) {
+        avxvnni_dot_8(&acc0, avxvnni_load(a + i), avxvnni_load(b + i), is_signed);
+        avxvnni_dot_8(&acc1, avxvnni_load(a + i + 32), avxvnni_load(b + i + 32), is_signed);
+    }
+    for (; i <= n - 32; i += 32) {
+        avxvnni_dot_8(&acc0, avxvnni_load(a + i), avxvnni_load(b + i), is_signed);
+    }
+    avxvnni_acc_merge(&acc0, &acc1);
+
+    int64_t total = avxvnni_dot_total(&acc0, i, is_signed);
+    for (; i < n; ++i) {
+        total += avxvnni_value(a, i, is_signed) * avxvnni_value(b, i, is_signed);
+    }
+
+    return -(float)total;
+}
+
+static inline float int8_distance_l1_impl_avxvnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i <= n - 32; i += 32) {
+        __m256i va = avxvnni_load(a + i);
+        __m256i vb = avxvnni_load(b + i);
+        if (is_signed) {va = _mm256_xor_si256(va, bias); vb = _mm256_xor_si256(vb, bias);}
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+
+    int64_t total = hsum256_epi64_avxvnni(acc);
+    for (; i < n; ++i) {
+        total += abs(avxvnni_value(a, i, is_signed) - avxvnni_value(b, i, is_signed));
+    }
+
+    return (float)total;
+}
+
+static inline float int8_distance_cosine_impl_avxvnni (const void *v1, const void *v2, int n, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    // dot product and both norms in a single pass
+    avxvnni_acc dot, norm_a2, norm_b2;
+    avxvnni_acc_init(&dot);
+    avxvnni_acc_init(&norm_a2);
+    avxvnni_acc_init(&norm_b2);
+    int i = 0;
+    for (; i <= n - 32; i += 32) {
+        __m256i va = avxvnni_load(a + i);
+        __m256i vb = avxvnni_load(b + i);
+        avxvnni_dot_8(&dot, va, vb, is_signed);
+        avxvnni_square_u8(&norm_a2, avxvnni_abs(va, is_signed));
+        avxvnni_square_u8(&norm_b2, avxvnni_abs(vb, is_signed));
+    }
+
+    int64_t total = avxvnni_dot_total(&dot, i, is_signed);
+    int64_t total_a2 = avxvnni_acc_total(&norm_a2, 128);
+    int64_t total_b2 = avxvnni_acc_total(&norm_b2, 128);
+    for (; i < n; ++i) {
+        int va = avxvnni_value(a, i, is_signed);
+        int vb = avxvnni_value(b, i, is_signed);
+        total += va * vb;
+        total_a2 += va * va;
+        total_b2 += vb * vb;
+    }
+
+    float norm_a = sqrtf((float)total_a2);
+    float norm_b = sqrtf((float)total_b2);
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+
+    float cosine_similarity = (float)total / (norm_a * norm_b);
+    return 1.0f - cosine_similarity;
+}
+
+#define DEFINE_INT8_KERNELS_AVXVNNI(TYPE, IS_SIGNED) \
+    float TYPE##_distance_l2_avxvnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l2_impl_avxvnni(v1, v2, n, true, IS_SIGNED); \
+    } \
+    float TYPE##_distance_l2_squared_avxvnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l2_impl_avxvnni(v1, v2, n, false, IS_SIGNED); \
+    } \
+    float TYPE##_distance_dot_avxvnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_dot_impl_avxvnni(v1, v2, n, IS_SIGNED); \
+    } \
+    float TYPE##_distance_l1_avxvnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_l1_impl_avxvnni(v1, v2, n, IS_SIGNED); \
+    } \
+    float TYPE##_distance_cosine_avxvnni (const void *v1, const void *v2, int n) { \
+        return int8_distance_cosine_impl_avxvnni(v1, v2, n, IS_SIGNED); \
+    }
+
+DEFINE_INT8_KERNELS_AVXVNNI(uint8, false)
+DEFINE_INT8_KERNELS_AVXVNNI(int8, true)
+
+// MARK: - BATCH -
+
+#define BATCH_ROWS  4
+
+static inline void batch_rows_setup (const uint8_t **b, const void *rows, size_t stride, int r, int nrows) {
+    for (int j = 0; j < BATCH_ROWS; ++j) {
+        int index = (r + j < nrows) ? r + j : nrows - 1;
+        b[j] = (const uint8_t *)rows + (size_t)index * stride;
+    }
+}
+
+static inline float int8_batch_finalize_avxvnni (int64_t total, int64_t norm_a2, int64_t norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)total);
+        case VECTOR_DISTANCE_DOT: return -(float)total;
+        case VECTOR_DISTANCE_COSINE: {
+            float norm_a = sqrtf((float)norm_a2);
+            float norm_b = sqrtf((float)norm_b2);
+            if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+            return 1.0f - ((float)total / (norm_a * norm_b));
+        }
+        default: return (float)total;
+    }
+}
+
+// the query is the operand that gets the bias correction of the dot product, so it is computed once per query
+// (over the 32 byte blocks only, the scalar tail is exact):
+//   u8: a.b = a.(b-128) + 128*sum(a)      s8: a.b = a.(b+128) - 128*sum(a)
+static inline void int8_distance_batch_impl_avxvnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)q;
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    bool is_dot = (metric == VECTOR_DISTANCE_DOT || metric == VECTOR_DISTANCE_COSINE);
+    int nblock = n & ~31;
+
+    int64_t sum_a = 0, norm_a2 = 0;
+    for (int i = 0; i < n; ++i) {
+        int va = avxvnni_value(a, i, is_signed);
+        if (i < nblock) sum_a += va;
+        norm_a2 += va * va;
+    }
+    int64_t dot_bias = (is_signed) ? -128 * sum_a : 128 * sum_a;
+
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+
+        avxvnni_acc acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {avxvnni_acc_init(&acc[j]); avxvnni_acc_init(&nrm[j]);}
+
+        for (int i = 0; i < nblock; i += 32) {
+            __m256i va = avxvnni_load(a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m256i vb = avxvnni_load(b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    avxvnni_square_u8(&acc[j], avxvnni_absdiff(va, vb, is_signed));
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    __m256i xa = (is_signed) ? _mm256_xor_si256(va, bias) : va;
+                    __m256i xb = (is_signed) ? _mm256_xor_si256(vb, bias) : vb;
+                    acc[j].sum = _mm256_add_epi64(acc[j].sum, _mm256_sad_epu8(xa, xb));
+                } else {
+                    // the biased row is unsigned for signed codes and signed for unsigned codes
+                    __m256i xb = _mm256_xor_si256(vb, bias);
+                    acc[j].dot = (is_signed) ? _mm256_dpbusd_avx_epi32(acc[j].dot, xb, va) : _mm256_dpbusd_avx_epi32(acc[j].dot, va, xb);
+                    if (metric == VECTOR_DISTANCE_COSINE) avxvnni_square_u8(&nrm[j], avxvnni_abs(vb, is_signed));
+                }
+            }
+        }
+
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            int64_t total;
+            if (is_dot) total = hsum256_epi32_avxvnni(acc[j].dot) + dot_bias;
+            else if (metric == VECTOR_DISTANCE_L1) total = hsum256_epi64_avxvnni(acc[j].sum);
+            else total = avxvnni_acc_total(&acc[j], 128);
+            int64_t norm_b2 = (metric == VECTOR_DISTANCE_COSINE) ? avxvnni_acc_total(&nrm[j], 128) : 0;
+
+            for (int k = nblock; k < n; ++k) {
+                int va = avxvnni_value(a, k, is_signed);
+                int vb = avxvnni_value(b[j], k, is_signed);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += (va - vb) * (va - vb);
+                else if (metric == VECTOR_DISTANCE_L1) total += abs(va - vb);
+                else {total += va * vb; norm_b2 += vb * vb;}
+            }
+
+            out[r + j] = int8_batch_finalize_avxvnni(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+#define DEFINE_INT8_BATCH_KERNELS_AVXVNNI(NAME, METRIC) \
+    void uint8_distance_##NAME##_batch_avxvnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_avxvnni(q, rows, stride, nrows, n, out, METRIC, false); \
+    } \
+    void int8_distance_##NAME##_batch_avxvnni (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_avxvnni(q, rows, stride, nrows, n, out, METRIC, true); \
+    }
+
+DEFINE_INT8_BATCH_KERNELS_AVXVNNI(l2, VECTOR_DISTANCE_L2)
+DEFINE_INT8_BATCH_KERNELS_AVXVNNI(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_INT8_BATCH_KERNELS_AVXVNNI(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_INT8_BATCH_KERNELS_AVXVNNI(dot, VECTOR_DISTANCE_DOT)
+DEFINE_INT8_BATCH_KERNELS_AVXVNNI(l1, VECTOR_DISTANCE_L1)
+
+#endif
+
+// MARK: -
+
+// installed over the AVX2 tables, only the U8/I8 entries are replaced
+void init_distance_functions_avxvnni (void) {
+#if defined(__AVX2__) && defined(__AVXVNNI__)
+    dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_avxvnni;
+    dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_avxvnni;
+
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_batch_avxvnni;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_batch_avxvnni;
+
+    distance_backend_name = "AVX-VNNI";
+#endif
+}
@@ -0,0 +1,19 @@
+//
+//  distance-avxvnni.h
+//  sqlitevector
+//
+//  Created by Marco Bambini on 20/06/25.
+//
+
+#ifndef __VECTOR_DISTANCE_AVXVNNI__
+#define __VECTOR_DISTANCE_AVXVNNI__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// runtime CPU feature (x86 only, implemented in distance-cpu.c)
+bool cpu_supports_avx_vnni (void);
+
+void init_distance_functions_avxvnni (void);
+
+#endif
@@ -16,9 +16,17 @@
 #include "distance-neon.h"
 #include "distance-sse2.h"
 #include "distance-avx2.h"
+#include "distance-avx512.h"
+#include "distance-avxvnni.h"
 
 char *distance_backend_name = "CPU";
 distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX] = {0};
+distance_function_t dispatch_pq_distance_table[VECTOR_DISTANCE_MAX] = {0};
+distance_function_t dispatch_hamming_distance = NULL;
+distance_function_t dispatch_u4_distance_table[VECTOR_DISTANCE_MAX] = {0};
+distance_function_t dispatch_s4_distance_table[VECTOR_DISTANCE_MAX] = {0};
+distance_function_t dispatch_weighted_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX] = {0};
+distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX] = {0};
 
 #define LASSQ_UPDATE(ad_) do {                            \
         double _ad = (ad_);                               \
@@ -692,6 +700,188 @@ float int8_distance_l1_cpu (const void *v1, const void *v2, int n) {
     return sum;
 }
 
+// MARK: - PQ -
+
+float pq_distance_adc_cpu (const void *v1, const void *v2, int n) {
+    const float *lut = (const float *)v1;
+    const uint8_t *codes = (const uint8_t *)v2;
+    
+    float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+    int i = 0;
+    
+    // unroll the loop 4 times
+    for (; i <= n - 4; i += 4) {
+        sum0 += lut[(i    ) * PQ_KSUB + codes[i    ]];
+        sum1 += lut[(i + 1) * PQ_KSUB + codes[i + 1]];
+        sum2 += lut[(i + 2) * PQ_KSUB + codes[i + 2]];
+        sum3 += lut[(i + 3) * PQ_KSUB + codes[i + 3]];
+    }
+    
+    // tail loop
+    for (; i < n; ++i) {
+        sum0 += lut[i * PQ_KSUB + codes[i]];
+    }
+    
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+float pq_distance_adc_sqrt_cpu (const void *v1, const void *v2, int n) {
+    float sum = pq_distance_adc_cpu(v1, v2, n);
+    return (sum > 0.0f) ? sqrtf(sum) : 0.0f;
+}
+
+// MARK: - BINARY -
+
+static inline uint32_t popcount64 (uint64_t x) {
+    #if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_popcountll(x);
+    #else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+    #endif
+}
+
+float bit_distance_hamming_cpu (const void *v1, const void *v2, int n) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    
+    uint32_t count = 0;
+    int i = 0;
+    
+    // 64 bits at a time (memcpy avoids unaligned loads)
+    for (; i <= n - 8; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(uint64_t));
+        memcpy(&y, b + i, sizeof(uint64_t));
+        count += popcount64(x ^ y);
+    }
+    
+    // tail loop
+    for (; i < n; ++i) {
+        count += popcount64((uint64_t)(a[i] ^ b[i]));
+    }
+    
+    return (float)count;
+}
+
+// MARK: - 4BIT -
+
+// 4-bit codes are packed two per byte (even dimensions in the low nibble), signed codes are two's complement nibbles;
+// n is the number of bytes, the unused nibble of an odd dimension is 0 so it never contributes to a distance
+
+static inline int nibble_value (uint8_t x, bool is_signed) {
+    int v = x & 0x0F;
+    return (is_signed) ? (v ^ 8) - 8 : v;
+}
+
+static inline float nibble_distance_impl_cpu (const void *v1, const void *v2, int n, bool is_signed, vector_distance vd) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+
+    uint32_t sum = 0, norm_a2 = 0, norm_b2 = 0;
+    int32_t dot = 0;
+
+    for (int i = 0; i < n; ++i) {
+        int a0 = nibble_value(a[i], is_signed), a1 = nibble_value(a[i] >> 4, is_signed);
+        int b0 = nibble_value(b[i], is_signed), b1 = nibble_value(b[i] >> 4, is_signed);
+        switch (vd) {
+            case VECTOR_DISTANCE_L1: sum += (uint32_t)(abs(a0 - b0) + abs(a1 - b1)); break;
+            case VECTOR_DISTANCE_DOT: dot += a0 * b0 + a1 * b1; break;
+            case VECTOR_DISTANCE_COSINE:
+                dot += a0 * b0 + a1 * b1;
+                norm_a2 += (uint32_t)(a0 * a0 + a1 * a1);
+                norm_b2 += (uint32_t)(b0 * b0 + b1 * b1);
+                break;
+            default: sum += (uint32_t)((a0 - b0) * (a0 - b0) + (a1 - b1) * (a1 - b1)); break;
+        }
+    }
+
+    switch (vd) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)sum);
+        case VECTOR_DISTANCE_DOT: return -(float)dot;
+        case VECTOR_DISTANCE_COSINE:
+            if (norm_a2 == 0 || norm_b2 == 0) return 1.0f;
+            return 1.0f - (float)dot / (sqrtf((float)norm_a2) * sqrtf((float)norm_b2));
+        default: return (float)sum;
+    }
+}
+
+float uint4_distance_l2_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, false, VECTOR_DISTANCE_L2);
+}
+
+float uint4_distance_l2_squared_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, false, VECTOR_DISTANCE_SQUARED_L2);
+}
+
+float uint4_distance_cosine_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, false, VECTOR_DISTANCE_COSINE);
+}
+
+float uint4_distance_dot_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, false, VECTOR_DISTANCE_DOT);
+}
+
+float uint4_distance_l1_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, false, VECTOR_DISTANCE_L1);
+}
+
+float int4_distance_l2_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, true, VECTOR_DISTANCE_L2);
+}
+
+float int4_distance_l2_squared_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, true, VECTOR_DISTANCE_SQUARED_L2);
+}
+
+float int4_distance_cosine_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, true, VECTOR_DISTANCE_COSINE);
+}
+
+float int4_distance_dot_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, true, VECTOR_DISTANCE_DOT);
+}
+
+float int4_distance_l1_cpu (const void *v1, const void *v2, int n) {
+    return nibble_distance_impl_cpu(v1, v2, n, true, VECTOR_DISTANCE_L1);
+}
+
+// MARK: - WEIGHTED -
+
+static inline float weighted_dot_cpu (const float *w, const uint8_t *codes, int n, bool is_signed) {
+    float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+    int i = 0;
+    
+    #define WEIGHTED_CODE(_i)   ((is_signed) ? (float)(int8_t)codes[_i] : (float)codes[_i])
+    for (; i <= n - 4; i += 4) {
+        sum0 += w[i    ] * WEIGHTED_CODE(i    );
+        sum1 += w[i + 1] * WEIGHTED_CODE(i + 1);
+        sum2 += w[i + 2] * WEIGHTED_CODE(i + 2);
+        sum3 += w[i + 3] * WEIGHTED_CODE(i + 3);
+    }
+    for (; i < n; ++i) {
+        sum0 += w[i] * WEIGHTED_CODE(i);
+    }
+    #undef WEIGHTED_CODE
+    
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#define DEFINE_WEIGHTED_KERNELS_CPU(NAME, METRIC) \
+    float uint8_distance_##NAME##_weighted_cpu (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_cpu((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), false), v1, v2, n, METRIC); \
+    } \
+    float int8_distance_##NAME##_weighted_cpu (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_cpu((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), true), v1, v2, n, METRIC); \
+    }
+
+DEFINE_WEIGHTED_KERNELS_CPU(l2, VECTOR_DISTANCE_L2)
+DEFINE_WEIGHTED_KERNELS_CPU(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_WEIGHTED_KERNELS_CPU(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_WEIGHTED_KERNELS_CPU(dot, VECTOR_DISTANCE_DOT)
+
 // MARK: - ENTRYPOINT -
 
 #if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
@@ -719,6 +909,53 @@ float int8_distance_l1_cpu (const void *v1, const void *v2, int n) {
         #endif
     }
 
+    // ZMM and opmask registers must also be enabled by the OS (XCR0 bits 1, 2, 5, 6 and 7)
+    static bool x86_os_supports_avx512 (void) {
+        int eax, ebx, ecx, edx;
+        x86_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        if ((ecx & (1 << 27)) == 0) return false;  // OSXSAVE
+        
+        #if defined(_MSC_VER)
+            unsigned long long xcr0 = _xgetbv(0);
+        #else
+            unsigned int lo, hi;
+            __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            unsigned long long xcr0 = ((unsigned long long)hi << 32) | lo;
+        #endif
+        return (xcr0 & 0xE6) == 0xE6;
+    }
+    
+    bool cpu_supports_avx512 (void) {
+        int eax, ebx, ecx, edx;
+        x86_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        if (eax < 7) return false;
+        x86_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if ((ebx & (1 << 16)) == 0 || (ebx & (1 << 30)) == 0) return false;  // AVX512F, AVX512BW
+        return x86_os_supports_avx512();
+    }
+    
+    bool cpu_supports_avx512_vnni (void) {
+        int eax, ebx, ecx, edx;
+        x86_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        return (ecx & (1 << 11)) != 0;  // AVX512_VNNI
+    }
+    
+    bool cpu_supports_avx_vnni (void) {
+        int eax, ebx, ecx, edx;
+        x86_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (eax < 1) return false;
+        x86_cpuid(7, 1, &eax, &ebx, &ecx, &edx);
+        return (eax & (1 << 4)) != 0;  // AVX_VNNI
+    }
+    
+    bool cpu_supports_avx512_bf16 (void) {
+        int eax, ebx, ecx, edx;
+        x86_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (eax < 1) return false;
+        x86_cpuid(7, 1, &eax, &ebx, &ecx, &edx);
+        return (eax & (1 << 5)) != 0;  // AVX512_BF16
+    }
+
     bool cpu_supports_sse2 (void) {
         int eax, ebx, ecx, edx;
         x86_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
@@ -792,6 +1029,41 @@ void init_cpu_functions (void) {
     };
     
     memcpy(dispatch_distance_table, cpu_table, sizeof(cpu_table));
+    
+    // L2 lookup tables contain squared partial distances, so the sqrt is applied to the sum
+    dispatch_pq_distance_table[VECTOR_DISTANCE_L2] = pq_distance_adc_sqrt_cpu;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_SQUARED_L2] = pq_distance_adc_cpu;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_COSINE] = pq_distance_adc_cpu;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_DOT] = pq_distance_adc_cpu;
+    dispatch_pq_distance_table[VECTOR_DISTANCE_L1] = pq_distance_adc_cpu;
+    
+    dispatch_hamming_distance = bit_distance_hamming_cpu;
+
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L2] = uint4_distance_l2_cpu;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = uint4_distance_l2_squared_cpu;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_COSINE] = uint4_distance_cosine_cpu;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_DOT] = uint4_distance_dot_cpu;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L1] = uint4_distance_l1_cpu;
+
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L2] = int4_distance_l2_cpu;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = int4_distance_l2_squared_cpu;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_COSINE] = int4_distance_cosine_cpu;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_DOT] = int4_distance_dot_cpu;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L1] = int4_distance_l1_cpu;
+
+    // L1 cannot be derived from a dot product, so per-dimension ranges do not support it
+    memset(dispatch_weighted_distance_table, 0, sizeof(dispatch_weighted_distance_table));
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_weighted_cpu;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_weighted_cpu;
+
+    // no batch kernels on CPU, scans score one row at a time with dispatch_distance_table
+    memset(dispatch_batch_distance_table, 0, sizeof(dispatch_batch_distance_table));
 }
 
 void init_distance_functions (bool force_cpu) {
@@ -801,6 +1073,8 @@ void init_distance_functions (bool force_cpu) {
     #if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
     if (cpu_supports_avx2()) {
         init_distance_functions_avx2();
+        if (cpu_supports_avx_vnni()) init_distance_functions_avxvnni();
+        if (cpu_supports_avx512()) init_distance_functions_avx512();
     } else if (cpu_supports_sse2()) {
         init_distance_functions_sse2();
     }
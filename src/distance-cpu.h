@@ -10,7 +10,9 @@
 
 #include "fp16/fp16.h"
 #include <inttypes.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Detect builtin bit_cast
@@ -45,7 +47,11 @@ typedef enum {
 typedef enum {
     VECTOR_QUANT_AUTO = 0,
     VECTOR_QUANT_U8BIT = 1,
-    VECTOR_QUANT_S8BIT = 2
+    VECTOR_QUANT_S8BIT = 2,
+    VECTOR_QUANT_PQ = 3,
+    VECTOR_QUANT_BIT = 4,
+    VECTOR_QUANT_U4BIT = 5,
+    VECTOR_QUANT_S4BIT = 6
 } vector_qtype;
 
 typedef enum {
@@ -59,6 +65,17 @@ typedef enum {
 
 typedef float (*distance_function_t)(const void *v1, const void *v2, int n);
 
+// batch kernel: scores the query q against nrows rows (stride bytes apart) and writes the nrows distances in out
+typedef void (*distance_batch_function_t)(const void *q, const void *rows, size_t stride, int nrows, int n, float *out);
+
+// PQ asymmetric distance: v1 is a lookup table with PQ_KSUB floats per sub-quantizer, v2 are n codes (one byte each)
+#define PQ_KSUB                 256
+
+// per-dimension quantization ranges: n is the size of a stored code, made of n-4 8-bit codes followed by the norm of
+// the vector they stand for (little endian float); the query is a float vector with the weight of each dimension
+// (query / scale), followed by the dot product of the query with the offsets and by the norm of the query
+#define WEIGHTED_CODE_DIM(n)        ((n) - (int)sizeof(float))
+
 // ENTRYPOINT
 void init_distance_functions (bool force_cpu);
 
@@ -127,4 +144,29 @@ static inline float float16_to_float32 (uint16_t h) {
     return fp16_ieee_to_fp32_value(h);
 }
 
+// MARK: - WEIGHTED -
+
+// distance between the query and a row quantized with per-dimension ranges, given the dot product of the weights of
+// the query with the codes of the row (query . row = dot + query . offsets)
+static inline float weighted_distance_finalize (float dot, const void *v1, const void *v2, int n, vector_distance metric) {
+    int dim = WEIGHTED_CODE_DIM(n);
+    const float *w = (const float *)v1;
+    const uint8_t *p = (const uint8_t *)v2 + dim;
+    float qr = dot + w[dim];
+    float norm_q = w[dim + 1];
+    float norm_r = bits_to_f32((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    
+    switch (metric) {
+        case VECTOR_DISTANCE_DOT: return -qr;
+        case VECTOR_DISTANCE_COSINE:
+            if (norm_q == 0.0f || norm_r == 0.0f) return 1.0f;
+            return 1.0f - qr / (norm_q * norm_r);
+        default: {
+            float d2 = norm_q * norm_q - 2.0f * qr + norm_r * norm_r;
+            if (d2 < 0.0f) d2 = 0.0f;
+            return (metric == VECTOR_DISTANCE_L2) ? sqrtf(d2) : d2;
+        }
+    }
+}
+
 #endif
@@ -9,6 +9,7 @@
 #include "distance-cpu.h"
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 
@@ -17,6 +18,11 @@
 
 extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 extern char *distance_backend_name;
+extern distance_function_t dispatch_hamming_distance;
+extern distance_function_t dispatch_u4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_s4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_weighted_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 
 // MARK: FLOAT32 -
 
@@ -1102,6 +1108,413 @@ float int8_distance_l1_neon(const void *v1, const void *v2, int n) {
 
     return (float)final;
 }
+// MARK: - BINARY -
+
+float bit_distance_hamming_neon (const void *v1, const void *v2, int n) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 0;
+    
+    for (; i <= n - 16; i += 16) {
+        uint8x16_t x = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(vcntq_u8(x)));
+    }
+    
+    uint64x2_t sum64 = vpaddlq_u32(acc);
+    uint64_t count = vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+    
+    // tail loop
+    for (; i < n; ++i) {
+        uint8_t x = a[i] ^ b[i];
+        while (x) {count += (x & 1); x >>= 1;}
+    }
+    
+    return (float)count;
+}
+
+// MARK: - 4BIT -
+
+// Packed nibbles are split with shifts (arithmetic for signed codes) and never widened before the arithmetic:
+// squares (at most 15*15) come from a table lookup and products of two nibbles fit in a byte, both are then
+// accumulated with pairwise widening adds. The last partial block is copied to a zero-filled buffer.
+
+static inline uint8x16_t nibble_lookup_neon (uint8x16_t table, uint8x16_t idx) {
+    #if defined(__aarch64__)
+    return vqtbl1q_u8(table, idx);
+    #else
+    uint8x8x2_t t = {{vget_low_u8(table), vget_high_u8(table)}};
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+    #endif
+}
+
+static inline uint32_t nibble_hsum_u32_neon (uint32x4_t v) {
+    #if defined(__aarch64__)
+    return vaddvq_u32(v);
+    #else
+    uint64x2_t s = vpaddlq_u32(v);
+    return (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+    #endif
+}
+
+static inline int32_t nibble_hsum_s32_neon (int32x4_t v) {
+    #if defined(__aarch64__)
+    return vaddvq_s32(v);
+    #else
+    int64x2_t s = vpaddlq_s32(v);
+    return (int32_t)(vgetq_lane_s64(s, 0) + vgetq_lane_s64(s, 1));
+    #endif
+}
+
+// adds the bytes of lo and hi (unsigned, at most 225 each) to the 32-bit lanes of acc
+static inline uint32x4_t nibble_accumulate_neon (uint32x4_t acc, uint8x16_t lo, uint8x16_t hi) {
+    return vpadalq_u16(acc, vaddq_u16(vpaddlq_u8(lo), vpaddlq_u8(hi)));
+}
+
+static inline float nibble_distance_impl_neon (const void *v1, const void *v2, int n, bool is_signed, vector_distance metric) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    
+    const uint8x16_t squares = {0,1,4,9,16,25,36,49,64,81,100,121,144,169,196,225};
+    const uint8x16_t low_mask = vdupq_n_u8(0x0F);
+    uint32x4_t acc = vdupq_n_u32(0), norm_a = vdupq_n_u32(0), norm_b = vdupq_n_u32(0);
+    int32x4_t dot = vdupq_n_s32(0);
+    
+    for (int i = 0; i < n; i += 16) {
+        uint8x16_t x, y;
+        if (n - i >= 16) {
+            x = vld1q_u8(a + i);
+            y = vld1q_u8(b + i);
+        } else {
+            uint8_t ta[16] = {0}, tb[16] = {0};
+            memcpy(ta, a + i, (size_t)(n - i));
+            memcpy(tb, b + i, (size_t)(n - i));
+            x = vld1q_u8(ta);
+            y = vld1q_u8(tb);
+        }
+        
+        // absolute values (|a|, |b|, |a-b|) are at most 15 and index the table of squares
+        uint8x16_t alo, ahi, blo, bhi, dlo, dhi;
+        int8x16_t slo_a = vdupq_n_s8(0), shi_a = vdupq_n_s8(0), slo_b = vdupq_n_s8(0), shi_b = vdupq_n_s8(0);
+        if (is_signed) {
+            slo_a = vshrq_n_s8(vshlq_n_s8(vreinterpretq_s8_u8(x), 4), 4);
+            shi_a = vshrq_n_s8(vreinterpretq_s8_u8(x), 4);
+            slo_b = vshrq_n_s8(vshlq_n_s8(vreinterpretq_s8_u8(y), 4), 4);
+            shi_b = vshrq_n_s8(vreinterpretq_s8_u8(y), 4);
+            alo = vreinterpretq_u8_s8(vabsq_s8(slo_a)); ahi = vreinterpretq_u8_s8(vabsq_s8(shi_a));
+            blo = vreinterpretq_u8_s8(vabsq_s8(slo_b)); bhi = vreinterpretq_u8_s8(vabsq_s8(shi_b));
+            dlo = vreinterpretq_u8_s8(vabdq_s8(slo_a, slo_b)); dhi = vreinterpretq_u8_s8(vabdq_s8(shi_a, shi_b));
+        } else {
+            alo = vandq_u8(x, low_mask); ahi = vshrq_n_u8(x, 4);
+            blo = vandq_u8(y, low_mask); bhi = vshrq_n_u8(y, 4);
+            dlo = vabdq_u8(alo, blo); dhi = vabdq_u8(ahi, bhi);
+        }
+        
+        switch (metric) {
+            case VECTOR_DISTANCE_L1:
+                acc = nibble_accumulate_neon(acc, dlo, dhi);
+                break;
+            case VECTOR_DISTANCE_DOT:
+            case VECTOR_DISTANCE_COSINE:
+                if (is_signed) {
+                    int8x16_t plo = vmulq_s8(slo_a, slo_b), phi = vmulq_s8(shi_a, shi_b);
+                    dot = vpadalq_s16(dot, vaddq_s16(vpaddlq_s8(plo), vpaddlq_s8(phi)));
+                } else {
+                    dot = vreinterpretq_s32_u32(nibble_accumulate_neon(vreinterpretq_u32_s32(dot), vmulq_u8(alo, blo), vmulq_u8(ahi, bhi)));
+                }
+                if (metric == VECTOR_DISTANCE_COSINE) {
+                    norm_a = nibble_accumulate_neon(norm_a, nibble_lookup_neon(squares, alo), nibble_lookup_neon(squares, ahi));
+                    norm_b = nibble_accumulate_neon(norm_b, nibble_lookup_neon(squares, blo), nibble_lookup_neon(squares, bhi));
+                }
+                break;
+            default:
+                acc = nibble_accumulate_neon(acc, nibble_lookup_neon(squares, dlo), nibble_lookup_neon(squares, dhi));
+                break;
+        }
+    }
+    
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)nibble_hsum_u32_neon(acc));
+        case VECTOR_DISTANCE_DOT: return -(float)nibble_hsum_s32_neon(dot);
+        case VECTOR_DISTANCE_COSINE: {
+            uint32_t norm_a2 = nibble_hsum_u32_neon(norm_a), norm_b2 = nibble_hsum_u32_neon(norm_b);
+            if (norm_a2 == 0 || norm_b2 == 0) return 1.0f;
+            return 1.0f - (float)nibble_hsum_s32_neon(dot) / (sqrtf((float)norm_a2) * sqrtf((float)norm_b2));
+        }
+        default: return (float)nibble_hsum_u32_neon(acc);
+    }
+}
+
+#define DEFINE_NIBBLE_KERNELS_NEON(NAME, METRIC) \
+    float uint4_distance_##NAME##_neon (const void *v1, const void *v2, int n) { \
+        return nibble_distance_impl_neon(v1, v2, n, false, METRIC); \
+    } \
+    float int4_distance_##NAME##_neon (const void *v1, const void *v2, int n) { \
+        return nibble_distance_impl_neon(v1, v2, n, true, METRIC); \
+    }
+
+DEFINE_NIBBLE_KERNELS_NEON(l2, VECTOR_DISTANCE_L2)
+DEFINE_NIBBLE_KERNELS_NEON(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_NIBBLE_KERNELS_NEON(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_NIBBLE_KERNELS_NEON(dot, VECTOR_DISTANCE_DOT)
+DEFINE_NIBBLE_KERNELS_NEON(l1, VECTOR_DISTANCE_L1)
+
+// MARK: - WEIGHTED -
+
+static inline float weighted_dot_neon (const float *w, const uint8_t *codes, int n, bool is_signed) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    
+    for (; i <= n - 8; i += 8) {
+        uint8x8_t c = vld1_u8(codes + i);
+        int32x4_t lo, hi;
+        if (is_signed) {
+            int16x8_t c16 = vmovl_s8(vreinterpret_s8_u8(c));
+            lo = vmovl_s16(vget_low_s16(c16));
+            hi = vmovl_s16(vget_high_s16(c16));
+        } else {
+            uint16x8_t c16 = vmovl_u8(c);
+            lo = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(c16)));
+            hi = vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(c16)));
+        }
+        acc0 = vmlaq_f32(acc0, vld1q_f32(w + i), vcvtq_f32_s32(lo));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(w + i + 4), vcvtq_f32_s32(hi));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    
+    float sum;
+    #if defined(__aarch64__)
+    sum = vaddvq_f32(acc0);
+    #else
+    float tmp[4]; vst1q_f32(tmp, acc0);
+    sum = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    #endif
+    
+    for (; i < n; ++i) {
+        sum += w[i] * ((is_signed) ? (float)(int8_t)codes[i] : (float)codes[i]);
+    }
+    
+    return sum;
+}
+
+#define DEFINE_WEIGHTED_KERNELS_NEON(NAME, METRIC) \
+    float uint8_distance_##NAME##_weighted_neon (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_neon((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), false), v1, v2, n, METRIC); \
+    } \
+    float int8_distance_##NAME##_weighted_neon (const void *v1, const void *v2, int n) { \
+        return weighted_distance_finalize(weighted_dot_neon((const float *)v1, (const uint8_t *)v2, WEIGHTED_CODE_DIM(n), true), v1, v2, n, METRIC); \
+    }
+
+DEFINE_WEIGHTED_KERNELS_NEON(l2, VECTOR_DISTANCE_L2)
+DEFINE_WEIGHTED_KERNELS_NEON(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_WEIGHTED_KERNELS_NEON(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_WEIGHTED_KERNELS_NEON(dot, VECTOR_DISTANCE_DOT)
+
+// MARK: - BATCH -
+
+// Batch kernels score BATCH_ROWS rows per pass: every block of the query is loaded (and widened) once and reused
+// for all the rows, each row has its own accumulators and the horizontal reduction is done once per row.
+// When nrows is not a multiple of BATCH_ROWS the last pass repeats the last row and discards the extra results.
+#define BATCH_ROWS  4
+
+static inline void batch_rows_setup (const uint8_t **b, const void *rows, size_t stride, int r, int nrows) {
+    for (int j = 0; j < BATCH_ROWS; ++j) {
+        int index = (r + j < nrows) ? r + j : nrows - 1;
+        b[j] = (const uint8_t *)rows + (size_t)index * stride;
+    }
+}
+
+static inline float batch_hsum_f32_neon (float32x4_t v) {
+    #if defined(__aarch64__)
+    return vaddvq_f32(v);
+    #else
+    float tmp[4]; vst1q_f32(tmp, v);
+    return tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    #endif
+}
+
+static inline int32_t batch_hsum_s32_neon (int32x4_t v) {
+    #if defined(__aarch64__)
+    return vaddvq_s32(v);
+    #else
+    int32_t tmp[4]; vst1q_s32(tmp, v);
+    return tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    #endif
+}
+
+static inline float float32_batch_finalize_neon (float total, float norm_a2, float norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf(total);
+        case VECTOR_DISTANCE_DOT: return -total;
+        case VECTOR_DISTANCE_COSINE: {
+            float denom = sqrtf(norm_a2 * norm_b2);
+            if (denom == 0.0f) return 1.0f;
+            return 1.0f - (total / denom);
+        }
+        default: return total;
+    }
+}
+
+static inline void float32_distance_batch_impl_neon (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric) {
+    const float *a = (const float *)q;
+    float norm_a2 = (metric == VECTOR_DISTANCE_COSINE) ? -float32_distance_dot_neon(a, a, n) : 0.0f;
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *rb[BATCH_ROWS];
+        batch_rows_setup(rb, rows, stride, r, nrows);
+        const float *b[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) b[j] = (const float *)rb[j];
+        
+        float32x4_t acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = vdupq_n_f32(0.0f); nrm[j] = vdupq_n_f32(0.0f);}
+        
+        int i = 0;
+        for (; i <= n - 4; i += 4) {
+            float32x4_t va = vld1q_f32(a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                float32x4_t vb = vld1q_f32(b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    float32x4_t diff = vsubq_f32(va, vb);
+                    acc[j] = vmlaq_f32(acc[j], diff, diff);
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    acc[j] = vaddq_f32(acc[j], vabdq_f32(va, vb));
+                } else {
+                    acc[j] = vmlaq_f32(acc[j], va, vb);
+                    if (metric == VECTOR_DISTANCE_COSINE) nrm[j] = vmlaq_f32(nrm[j], vb, vb);
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            float total = batch_hsum_f32_neon(acc[j]);
+            float norm_b2 = batch_hsum_f32_neon(nrm[j]);
+            
+            for (int k = i; k < n; ++k) {
+                float d = a[k] - b[j][k];
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += d * d;
+                else if (metric == VECTOR_DISTANCE_L1) total += fabsf(d);
+                else {total += a[k] * b[j][k]; norm_b2 += b[j][k] * b[j][k];}
+            }
+            
+            out[r + j] = float32_batch_finalize_neon(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+static inline int int8_batch_value (const uint8_t *p, int i, bool is_signed) {
+    return (is_signed) ? (int)((const int8_t *)p)[i] : (int)p[i];
+}
+
+// widens 16 bytes to two vectors of 8 x 16bit
+static inline void int8_batch_load_neon (const uint8_t *p, bool is_signed, int16x8_t *lo, int16x8_t *hi) {
+    if (is_signed) {
+        int8x16_t v = vld1q_s8((const int8_t *)p);
+        *lo = vmovl_s8(vget_low_s8(v));
+        *hi = vmovl_s8(vget_high_s8(v));
+    } else {
+        uint8x16_t v = vld1q_u8(p);
+        *lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v)));
+        *hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v)));
+    }
+}
+
+static inline int32x4_t int8_batch_accumulate_neon (int32x4_t acc, int16x8_t va, int16x8_t vb, vector_distance metric) {
+    if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+        int16x8_t diff = vsubq_s16(va, vb);
+        acc = vmlal_s16(acc, vget_low_s16(diff), vget_low_s16(diff));
+        return vmlal_s16(acc, vget_high_s16(diff), vget_high_s16(diff));
+    }
+    if (metric == VECTOR_DISTANCE_L1) {
+        // |a - b| is at most 255, pairs are added into the 32bit lanes
+        return vpadalq_s16(acc, vabdq_s16(va, vb));
+    }
+    acc = vmlal_s16(acc, vget_low_s16(va), vget_low_s16(vb));
+    return vmlal_s16(acc, vget_high_s16(va), vget_high_s16(vb));
+}
+
+static inline float int8_batch_finalize_neon (int32_t total, int32_t norm_a2, int32_t norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)total);
+        case VECTOR_DISTANCE_DOT: return -(float)total;
+        case VECTOR_DISTANCE_COSINE: {
+            float denom = sqrtf((float)norm_a2 * (float)norm_b2);
+            if (denom == 0.0f) return 1.0f;
+            return 1.0f - (total / denom);
+        }
+        default: return (float)total;
+    }
+}
+
+// 8bit values are widened to 16bit and multiplied with widening multiply-adds, so products are accumulated in 32bit lanes
+static inline void int8_distance_batch_impl_neon (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)q;
+    
+    int32_t norm_a2 = 0;
+    if (metric == VECTOR_DISTANCE_COSINE) {
+        for (int i = 0; i < n; ++i) norm_a2 += int8_batch_value(a, i, is_signed) * int8_batch_value(a, i, is_signed);
+    }
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+        
+        int32x4_t acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = vdupq_n_s32(0); nrm[j] = vdupq_n_s32(0);}
+        
+        int i = 0;
+        for (; i <= n - 16; i += 16) {
+            int16x8_t va_lo, va_hi;
+            int8_batch_load_neon(a + i, is_signed, &va_lo, &va_hi);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                int16x8_t vb_lo, vb_hi;
+                int8_batch_load_neon(b[j] + i, is_signed, &vb_lo, &vb_hi);
+                acc[j] = int8_batch_accumulate_neon(acc[j], va_lo, vb_lo, metric);
+                acc[j] = int8_batch_accumulate_neon(acc[j], va_hi, vb_hi, metric);
+                if (metric == VECTOR_DISTANCE_COSINE) {
+                    nrm[j] = int8_batch_accumulate_neon(nrm[j], vb_lo, vb_lo, VECTOR_DISTANCE_DOT);
+                    nrm[j] = int8_batch_accumulate_neon(nrm[j], vb_hi, vb_hi, VECTOR_DISTANCE_DOT);
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            int32_t total = batch_hsum_s32_neon(acc[j]);
+            int32_t norm_b2 = batch_hsum_s32_neon(nrm[j]);
+            
+            for (int k = i; k < n; ++k) {
+                int va = int8_batch_value(a, k, is_signed);
+                int vb = int8_batch_value(b[j], k, is_signed);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += (va - vb) * (va - vb);
+                else if (metric == VECTOR_DISTANCE_L1) total += abs(va - vb);
+                else {total += va * vb; norm_b2 += vb * vb;}
+            }
+            
+            out[r + j] = int8_batch_finalize_neon(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+#define DEFINE_BATCH_KERNELS_NEON(NAME, METRIC) \
+    void float32_distance_##NAME##_batch_neon (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        float32_distance_batch_impl_neon(q, rows, stride, nrows, n, out, METRIC); \
+    } \
+    void uint8_distance_##NAME##_batch_neon (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_neon(q, rows, stride, nrows, n, out, METRIC, false); \
+    } \
+    void int8_distance_##NAME##_batch_neon (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_neon(q, rows, stride, nrows, n, out, METRIC, true); \
+    }
+
+DEFINE_BATCH_KERNELS_NEON(l2, VECTOR_DISTANCE_L2)
+DEFINE_BATCH_KERNELS_NEON(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_BATCH_KERNELS_NEON(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_BATCH_KERNELS_NEON(dot, VECTOR_DISTANCE_DOT)
+DEFINE_BATCH_KERNELS_NEON(l1, VECTOR_DISTANCE_L1)
+
 #endif
 
 // MARK: -
@@ -1138,6 +1551,49 @@ void init_distance_functions_neon (void) {
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_neon;
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_neon;
     
+    dispatch_hamming_distance = bit_distance_hamming_neon;
+    
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L2] = uint4_distance_l2_neon;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = uint4_distance_l2_squared_neon;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_COSINE] = uint4_distance_cosine_neon;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_DOT] = uint4_distance_dot_neon;
+    dispatch_u4_distance_table[VECTOR_DISTANCE_L1] = uint4_distance_l1_neon;
+    
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L2] = int4_distance_l2_neon;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_SQUARED_L2] = int4_distance_l2_squared_neon;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_COSINE] = int4_distance_cosine_neon;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_DOT] = int4_distance_dot_neon;
+    dispatch_s4_distance_table[VECTOR_DISTANCE_L1] = int4_distance_l1_neon;
+    
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_weighted_neon;
+    dispatch_weighted_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_weighted_neon;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F32] = float32_distance_l2_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_batch_neon;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32] = float32_distance_l2_squared_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_batch_neon;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F32] = float32_distance_cosine_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_batch_neon;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F32] = float32_distance_dot_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_batch_neon;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F32] = float32_distance_l1_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_batch_neon;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_batch_neon;
+    
     distance_backend_name = "NEON";
 #endif
 }
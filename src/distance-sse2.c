@@ -15,6 +15,8 @@
 
 extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 extern char *distance_backend_name;
+extern distance_function_t dispatch_hamming_distance;
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 
 // accumulate 32-bit
 #define ACCUMULATE(MUL, ACC)                    \
@@ -1006,6 +1008,229 @@ float int8_distance_cosine_sse2 (const void *v1, const void *v2, int n) {
     return 1.0f - cosine_sim;
 }
 
+// MARK: - BINARY -
+
+float bit_distance_hamming_sse2 (const void *v1, const void *v2, int n) {
+    const uint8_t *a = (const uint8_t *)v1;
+    const uint8_t *b = (const uint8_t *)v2;
+    
+    // SWAR popcount on 16 bytes, per-byte counts accumulated with sad_epu8
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    
+    for (; i <= n - 16; i += 16) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), m1));
+        x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi16(x, 2), m2));
+        x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), m4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(x, _mm_setzero_si128()));
+    }
+    
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    uint64_t count = lanes[0] + lanes[1];
+    
+    // tail loop
+    for (; i < n; ++i) {
+        uint8_t x = a[i] ^ b[i];
+        while (x) {count += (x & 1); x >>= 1;}
+    }
+    
+    return (float)count;
+}
+
+// MARK: - BATCH -
+
+// Batch kernels score BATCH_ROWS rows per pass: every block of the query is loaded (and widened) once and reused
+// for all the rows, each row has its own accumulators and the horizontal reduction is done once per row.
+// When nrows is not a multiple of BATCH_ROWS the last pass repeats the last row and discards the extra results.
+#define BATCH_ROWS  4
+
+static inline void batch_rows_setup (const uint8_t **b, const void *rows, size_t stride, int r, int nrows) {
+    for (int j = 0; j < BATCH_ROWS; ++j) {
+        int index = (r + j < nrows) ? r + j : nrows - 1;
+        b[j] = (const uint8_t *)rows + (size_t)index * stride;
+    }
+}
+
+static inline float float32_batch_finalize_sse2 (float total, float norm_a2, float norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf(total);
+        case VECTOR_DISTANCE_DOT: return -total;
+        case VECTOR_DISTANCE_COSINE: {
+            float denom = sqrtf(norm_a2 * norm_b2);
+            if (denom == 0.0f) return 1.0f;
+            return 1.0f - (total / denom);
+        }
+        default: return total;
+    }
+}
+
+static inline void float32_distance_batch_impl_sse2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric) {
+    const float *a = (const float *)q;
+    float norm_a2 = (metric == VECTOR_DISTANCE_COSINE) ? -float32_distance_dot_sse2(a, a, n) : 0.0f;
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *rb[BATCH_ROWS];
+        batch_rows_setup(rb, rows, stride, r, nrows);
+        const float *b[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) b[j] = (const float *)rb[j];
+        
+        __m128 acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = _mm_setzero_ps(); nrm[j] = _mm_setzero_ps();}
+        
+        int i = 0;
+        for (; i <= n - 4; i += 4) {
+            __m128 va = _mm_loadu_ps(a + i);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m128 vb = _mm_loadu_ps(b[j] + i);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+                    __m128 diff = _mm_sub_ps(va, vb);
+                    acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(diff, diff));
+                } else if (metric == VECTOR_DISTANCE_L1) {
+                    acc[j] = _mm_add_ps(acc[j], _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(va, vb)));
+                } else {
+                    acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(va, vb));
+                    if (metric == VECTOR_DISTANCE_COSINE) nrm[j] = _mm_add_ps(nrm[j], _mm_mul_ps(vb, vb));
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            float partial[4], npartial[4];
+            _mm_storeu_ps(partial, acc[j]);
+            _mm_storeu_ps(npartial, nrm[j]);
+            float total = partial[0] + partial[1] + partial[2] + partial[3];
+            float norm_b2 = npartial[0] + npartial[1] + npartial[2] + npartial[3];
+            
+            for (int k = i; k < n; ++k) {
+                float d = a[k] - b[j][k];
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += d * d;
+                else if (metric == VECTOR_DISTANCE_L1) total += fabsf(d);
+                else {total += a[k] * b[j][k]; norm_b2 += b[j][k] * b[j][k];}
+            }
+            
+            out[r + j] = float32_batch_finalize_sse2(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+static inline int int8_batch_value (const uint8_t *p, int i, bool is_signed) {
+    return (is_signed) ? (int)((const int8_t *)p)[i] : (int)p[i];
+}
+
+// widens 16 bytes to two vectors of 8 x 16bit
+static inline void int8_batch_load_sse2 (const uint8_t *p, bool is_signed, __m128i *lo, __m128i *hi) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i ext = (is_signed) ? _mm_cmpgt_epi8(_mm_setzero_si128(), v) : _mm_setzero_si128();
+    *lo = _mm_unpacklo_epi8(v, ext);
+    *hi = _mm_unpackhi_epi8(v, ext);
+}
+
+static inline __m128i int8_batch_accumulate_sse2 (__m128i acc, __m128i va, __m128i vb, vector_distance metric) {
+    if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) {
+        __m128i diff = _mm_sub_epi16(va, vb);
+        return _mm_add_epi32(acc, _mm_madd_epi16(diff, diff));
+    }
+    if (metric == VECTOR_DISTANCE_L1) {
+        // absolute value via max since _mm_abs_epi16 is SSSE3+
+        __m128i diff = _mm_sub_epi16(va, vb);
+        diff = _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+        return _mm_add_epi32(acc, _mm_madd_epi16(diff, _mm_set1_epi16(1)));
+    }
+    return _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+}
+
+static inline int32_t hsum128_epi32 (__m128i v) {
+    int32_t partial[4];
+    _mm_storeu_si128((__m128i *)partial, v);
+    return partial[0] + partial[1] + partial[2] + partial[3];
+}
+
+static inline float int8_batch_finalize_sse2 (int32_t total, int32_t norm_a2, int32_t norm_b2, vector_distance metric) {
+    switch (metric) {
+        case VECTOR_DISTANCE_L2: return sqrtf((float)total);
+        case VECTOR_DISTANCE_DOT: return -(float)total;
+        case VECTOR_DISTANCE_COSINE: {
+            float denom = sqrtf((float)norm_a2 * (float)norm_b2);
+            if (denom == 0.0f) return 1.0f;
+            return 1.0f - (total / denom);
+        }
+        default: return (float)total;
+    }
+}
+
+// 8bit values are widened to 16bit and multiplied with madd, so products are accumulated in 32bit lanes
+static inline void int8_distance_batch_impl_sse2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out, vector_distance metric, bool is_signed) {
+    const uint8_t *a = (const uint8_t *)q;
+    
+    int32_t norm_a2 = 0;
+    if (metric == VECTOR_DISTANCE_COSINE) {
+        for (int i = 0; i < n; ++i) norm_a2 += int8_batch_value(a, i, is_signed) * int8_batch_value(a, i, is_signed);
+    }
+    
+    for (int r = 0; r < nrows; r += BATCH_ROWS) {
+        const uint8_t *b[BATCH_ROWS];
+        batch_rows_setup(b, rows, stride, r, nrows);
+        
+        __m128i acc[BATCH_ROWS], nrm[BATCH_ROWS];
+        for (int j = 0; j < BATCH_ROWS; ++j) {acc[j] = _mm_setzero_si128(); nrm[j] = _mm_setzero_si128();}
+        
+        int i = 0;
+        for (; i <= n - 16; i += 16) {
+            __m128i va_lo, va_hi;
+            int8_batch_load_sse2(a + i, is_signed, &va_lo, &va_hi);
+            for (int j = 0; j < BATCH_ROWS; ++j) {
+                __m128i vb_lo, vb_hi;
+                int8_batch_load_sse2(b[j] + i, is_signed, &vb_lo, &vb_hi);
+                acc[j] = int8_batch_accumulate_sse2(acc[j], va_lo, vb_lo, metric);
+                acc[j] = int8_batch_accumulate_sse2(acc[j], va_hi, vb_hi, metric);
+                if (metric == VECTOR_DISTANCE_COSINE) {
+                    nrm[j] = _mm_add_epi32(nrm[j], _mm_madd_epi16(vb_lo, vb_lo));
+                    nrm[j] = _mm_add_epi32(nrm[j], _mm_madd_epi16(vb_hi, vb_hi));
+                }
+            }
+        }
+        
+        int count = (nrows - r < BATCH_ROWS) ? nrows - r : BATCH_ROWS;
+        for (int j = 0; j < count; ++j) {
+            int32_t total = hsum128_epi32(acc[j]);
+            int32_t norm_b2 = hsum128_epi32(nrm[j]);
+            
+            for (int k = i; k < n; ++k) {
+                int va = int8_batch_value(a, k, is_signed);
+                int vb = int8_batch_value(b[j], k, is_signed);
+                if (metric == VECTOR_DISTANCE_L2 || metric == VECTOR_DISTANCE_SQUARED_L2) total += (va - vb) * (va - vb);
+                else if (metric == VECTOR_DISTANCE_L1) total += abs(va - vb);
+                else {total += va * vb; norm_b2 += vb * vb;}
+            }
+            
+            out[r + j] = int8_batch_finalize_sse2(total, norm_a2, norm_b2, metric);
+        }
+    }
+}
+
+#define DEFINE_BATCH_KERNELS_SSE2(NAME, METRIC) \
+    void float32_distance_##NAME##_batch_sse2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        float32_distance_batch_impl_sse2(q, rows, stride, nrows, n, out, METRIC); \
+    } \
+    void uint8_distance_##NAME##_batch_sse2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_sse2(q, rows, stride, nrows, n, out, METRIC, false); \
+    } \
+    void int8_distance_##NAME##_batch_sse2 (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        int8_distance_batch_impl_sse2(q, rows, stride, nrows, n, out, METRIC, true); \
+    }
+
+DEFINE_BATCH_KERNELS_SSE2(l2, VECTOR_DISTANCE_L2)
+DEFINE_BATCH_KERNELS_SSE2(l2_squared, VECTOR_DISTANCE_SQUARED_L2)
+DEFINE_BATCH_KERNELS_SSE2(cosine, VECTOR_DISTANCE_COSINE)
+DEFINE_BATCH_KERNELS_SSE2(dot, VECTOR_DISTANCE_DOT)
+DEFINE_BATCH_KERNELS_SSE2(l1, VECTOR_DISTANCE_L1)
+
 #endif
 
 // MARK: -
@@ -1042,6 +1267,28 @@ void init_distance_functions_sse2 (void) {
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_sse2;
     dispatch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_sse2;
     
+    dispatch_hamming_distance = bit_distance_hamming_sse2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_F32] = float32_distance_l2_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_U8] = uint8_distance_l2_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L2][VECTOR_TYPE_I8] = int8_distance_l2_batch_sse2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32] = float32_distance_l2_squared_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_U8] = uint8_distance_l2_squared_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_I8] = int8_distance_l2_squared_batch_sse2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_F32] = float32_distance_cosine_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_U8] = uint8_distance_cosine_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_COSINE][VECTOR_TYPE_I8] = int8_distance_cosine_batch_sse2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_F32] = float32_distance_dot_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_U8] = uint8_distance_dot_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][VECTOR_TYPE_I8] = int8_distance_dot_batch_sse2;
+    
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_F32] = float32_distance_l1_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_U8] = uint8_distance_l1_batch_sse2;
+    dispatch_batch_distance_table[VECTOR_DISTANCE_L1][VECTOR_TYPE_I8] = int8_distance_l1_batch_sse2;
+    
     distance_backend_name = "SSE2";
 #endif
 }
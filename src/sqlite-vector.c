@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -46,6 +47,18 @@ char *strcasestr(const char *haystack, const char *needle) {
 #include <float.h>
 #endif
 
+#if defined(SQLITE_WASM_EXTRA_INIT) || defined(__EMSCRIPTEN__)
+#define VECTOR_THREADS_DISABLED                     1
+#define VECTOR_MMAP_DISABLED                        1
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifndef SQLITE_CORE
 SQLITE_EXTENSION_INIT1
 #endif
@@ -70,6 +83,8 @@ SQLITE_EXTENSION_INIT1
 
 #define DEFAULT_MAX_MEMORY                          30*1024*1024
 #define MAX_TABLES                                  128
+#define VECTOR_MAX_THREADS                          64
+#define VECTOR_CACHE_MAX_ENTRIES                    65536
 #define STATIC_SQL_SIZE                             2048
 
 #define INT64_TO_INT8PTR(_val, _ptr)                do { \
@@ -99,8 +114,19 @@ SQLITE_EXTENSION_INIT1
 #define VECTOR_COLUMN_VECTOR                        1
 #define VECTOR_COLUMN_K                             2
 #define VECTOR_COLUMN_MEMIDX                        3
-#define VECTOR_COLUMN_ROWID                         4
-#define VECTOR_COLUMN_DISTANCE                      5
+#define VECTOR_COLUMN_OPTIONS                       4
+#define VECTOR_COLUMN_FILTER                        5
+#define VECTOR_COLUMN_ROWID                         6
+#define VECTOR_COLUMN_DISTANCE                      7
+#define VECTOR_COLUMN_QUERY_IDX                     8
+
+// idxNum flags: bit N is set when hidden column N is an argument, followed by the constraints on the id column
+#define VECTOR_IDX_ROWID_EQ                         0x0100
+#define VECTOR_IDX_ROWID_IN                         0x0200
+#define VECTOR_IDX_ROWID_GT                         0x0400
+#define VECTOR_IDX_ROWID_GE                         0x0800
+#define VECTOR_IDX_ROWID_LT                         0x1000
+#define VECTOR_IDX_ROWID_LE                         0x2000
 
 #define OPTION_KEY_TYPE                             "type"
 #define OPTION_KEY_DIMENSION                        "dimension"
@@ -110,6 +136,33 @@ SQLITE_EXTENSION_INIT1
 #define OPTION_KEY_QUANTTYPE                        "qtype"
 #define OPTION_KEY_QUANTSCALE                       "qscale"        // used only in serialize/unserialize
 #define OPTION_KEY_QUANTOFFSET                      "qoffset"       // used only in serialize/unserialize
+#define OPTION_KEY_QUANTRANGE                       "qrange"
+#define OPTION_KEY_QUANTCLIP                        "clip"
+#define OPTION_KEY_QUANTDIMS                        "qdims"         // used only in serialize/unserialize
+#define OPTION_KEY_IVF_NLIST                        "nlist"
+#define OPTION_KEY_IVF_NPROBE                       "nprobe"
+#define OPTION_KEY_RERANK                           "rerank"
+#define OPTION_KEY_OVERSAMPLE                       "oversample"
+#define OPTION_KEY_THREADS                          "threads"
+#define OPTION_KEY_READER                           "reader"
+#define OPTION_KEY_CACHE                            "cache"
+#define OPTION_KEY_PQ_M                             "m"
+#define OPTION_KEY_PQ_NBITS                         "nbits"
+#define OPTION_KEY_PQ_SUBQUANTIZERS                 "pq_m"          // used only in serialize/unserialize
+#define OPTION_KEY_PQ_BITS                          "pq_nbits"      // used only in serialize/unserialize
+#define OPTION_KEY_AUTO_QUANTIZE                    "auto_quantize"
+#define OPTION_KEY_PRELOAD_FILE                     "file"
+#define OPTION_KEY_QUANTGENERATION                  "qgen"          // used only in serialize/unserialize
+#define OPTION_KEY_QUANTROWS                        "qrows"         // used only in serialize/vector_quantize_stats
+#define OPTION_KEY_QUANTTIME                        "qtime"         // used only in serialize/vector_quantize_stats
+#define OPTION_KEY_QUANTTHREADS                     "qthreads"      // used only in serialize/vector_quantize_stats
+#define OPTION_KEY_INDEXTYPE                        "type"          // used only in vector_index
+#define OPTION_KEY_HNSW_M                           "m"
+#define OPTION_KEY_HNSW_EFCONSTRUCTION              "ef_construction"
+#define OPTION_KEY_HNSW_EFSEARCH                    "ef_search"
+#define OPTION_KEY_HNSW_MAXM                        "hnsw_m"        // used only in serialize/unserialize
+#define OPTION_KEY_HNSW_ENTRY                       "hnsw_entry"    // used only in serialize/unserialize
+#define OPTION_KEY_HNSW_MAXLEVEL                    "hnsw_level"    // used only in serialize/unserialize
 
 #define VECTOR_INTERNAL_TABLE                       "CREATE TABLE IF NOT EXISTS _sqliteai_vector (tblname TEXT, colname TEXT, key TEXT, value ANY, PRIMARY KEY(tblname, colname, key));"
 
@@ -121,8 +174,71 @@ typedef struct {
     
     vector_qtype    q_type;                 // quantization type
     uint64_t        max_memory;             // max memory
+    int             nlist;                  // number of IVF partitions (0 means no partitioning)
+    int             pq_m;                   // number of PQ sub-quantizers (0 means default)
+    int             pq_nbits;               // bits per PQ code (0 means default)
+    int             threads;                // number of threads used by scans (0 means single-threaded)
+    int             cache_size;             // vector_quantize_scan queries whose results are cached (0 means no cache)
+    bool            auto_quantize;          // writes are quantized by triggers into the delta table
+    bool            dim_ranges;             // each dimension is quantized with its own range (qrange=dimension)
+    double          clip;                   // quantile used as the top of the quantization range, 1-clip as the bottom (0 means min/max)
 } vector_options;
 
+// view on quantized rows: codes and rowids are read with their own stride, so the same view describes a chunk
+// (codes block followed by the rowids block), the rows preloaded in memory and the interleaved rows of legacy chunks
+typedef struct {
+    const uint8_t   *codes;                 // first quantized code
+    const uint8_t   *rowids;                // first rowid (little endian int64)
+    size_t          code_stride;            // bytes between two consecutive codes
+    size_t          rowid_stride;           // bytes between two consecutive rowids
+    int             count;                  // number of rows
+    const uint8_t   *norms;                 // norm of each code (little endian float), NULL when not stored
+} vector_chunk;
+
+// preloaded quantized rows, shared (read-only) by all the connections of the process that opened the same database file
+typedef struct vector_preload {
+    char                    *key;           // database file, table, column and quantization generation (NULL if not shared)
+    int                     refcount;
+    void                    *data;          // allocated memory (NULL when mapped)
+    uint8_t                 *codes;         // codes of all the rows (64-byte aligned), followed by their rowids
+    uint8_t                 *rowids;
+    uint8_t                 *norms;         // norms of the codes (little endian float), NULL when not stored
+    int                     counter;
+    int                     *partitions;    // IVF partition offsets (in rows) inside data, nlist+1 entries
+    uint8_t                 *centroids;     // IVF centroids
+    bool                    sorted;         // rows (of each IVF partition) are in ascending rowid order
+    int64_t                 generation;     // quantization generation the rows belong to
+    void                    *map;           // read-only mapping of a preload file (data, partitions and centroids point into it)
+    size_t                  map_size;
+    struct vector_preload   *next;
+} vector_preload;
+
+// cached results of a vector_quantize_scan query
+typedef struct {
+    uint64_t        hash;                   // hash of the key
+    uint8_t         *data;                  // key (query, k, options and filter) followed by the rowids and the distances
+    int             key_size;
+    int             count;                  // number of results
+    int             next;                   // next entry of the same bucket (-1 at the end of the chain)
+    int             lru_prev;               // more recently used entry (-1 for the most recent one)
+    int             lru_next;               // less recently used entry (-1 for the least recent one)
+} vector_cache_entry;
+
+// LRU cache of the results of vector_quantize_scan queries (see vQuantCacheLookup)
+typedef struct {
+    vector_cache_entry  *entries;           // capacity entries, the first count are in use
+    int                 *buckets;           // first entry of each bucket (-1 when empty), nbuckets is a power of 2
+    int                 nbuckets;
+    int                 capacity;
+    int                 count;
+    int                 lru_head;           // most recently used entry
+    int                 lru_tail;           // least recently used entry, the first one to be evicted
+    uint32_t            data_version;       // state of the database the cached results belong to
+    int64_t             total_changes;
+    int64_t             hits;
+    int64_t             misses;
+} vector_cache;
+
 typedef struct {
     char            *t_name;                // table name
     char            *c_name;                // column name
@@ -131,9 +247,24 @@ typedef struct {
     vector_options  options;                // options parsed in key=value arguments
     float           scale;                  // computed value by quantization
     float           offset;                 // computed value by quantization
+    float           *qdims;                 // per-dimension scales followed by per-dimension offsets (qrange=dimension)
     
-    void            *preloaded;
+    vector_preload  *preload;               // shared preloaded rows (preloaded, precounter, ... point into it)
+    char            *preload_file;          // file the preloaded rows are mapped from (NULL if loaded in memory)
+    const uint8_t   *preloaded;             // codes of the preloaded rows (64-byte aligned, code size bytes each)
+    const uint8_t   *prerowids;             // rowids of the preloaded rows (little endian int64)
+    const uint8_t   *prenorms;              // norms of the preloaded codes (little endian float), NULL when not stored
     int             precounter;
+    int             *prepartitions;         // IVF partition offsets (in rows) inside preloaded, nlist+1 entries
+    uint8_t         *precentroids;          // IVF centroids loaded together with preloaded
+    bool            presorted;              // rows of preloaded (of each IVF partition) are in ascending rowid order
+    float           *pq_codebook;           // PQ codebook (lazily loaded), pq_m * PQ_KSUB centroids of dim/pq_m floats
+    
+    vector_cache    cache;                  // results of recent vector_quantize_scan queries (options.cache_size entries)
+    
+    int             hnsw_m;                 // HNSW max neighbors per upper layer (0 means no index)
+    int             hnsw_max_level;         // HNSW top layer
+    int64_t         hnsw_entry;             // HNSW entry point rowid
 } table_context;
 
 typedef struct {
@@ -141,6 +272,28 @@ typedef struct {
     int             table_count;            // number of entries in tables array
 } vector_context;
 
+typedef struct {
+    int             ef_search;              // HNSW dynamic candidate list size (0 means default)
+    int             nprobe;                 // number of IVF partitions to scan (0 means default)
+    int             rerank;                 // candidates multiplier reranked with exact distances (0 means default)
+    int             threads;                // number of threads (0 means use the table setting)
+    bool            blob_reader;            // full scans read vectors through incremental blob I/O (reader=blob)
+} vector_scan_options;
+
+typedef struct {
+    int64_t         min_rowid;              // smallest matching rowid
+    int64_t         max_rowid;              // largest matching rowid
+    uint8_t         *bitmap;                // bit (rowid - min_rowid) is set for matching rows
+    int64_t         *rowids;                // sorted matching rowids (only when bitmap is NULL)
+    int64_t         count;                  // number of matching rows
+} vector_rowset;
+
+typedef struct {
+    vector_rowset   *ids;                   // ids in the delta table (their rows in the quantized chunks are stale)
+    uint8_t         *rows;                  // delta rows with a quantized code (rowid followed by the code)
+    int             count;                  // number of rows in rows
+} vector_delta;
+
 typedef struct {
     sqlite3_vtab    base;                   // Base class - must be first
     sqlite3         *db;
@@ -150,6 +303,14 @@ typedef struct {
 typedef struct {
     sqlite3_vtab_cursor base;               // Base class - must be first
     table_context       *table;
+    vector_scan_options options;            // per-query options parsed from the optional last argument
+    const char          *filter;            // SQL WHERE fragment, valid only while the scan runs
+    vector_rowset       *rowset;            // rowids matching filter (quantized and HNSW scans)
+    bool                rowid_constrained;  // id constraints were pushed down by xBestIndex
+    int64_t             rowid_min;          // only rows with rowid_min <= id <= rowid_max are returned
+    int64_t             rowid_max;
+    vector_rowset       *rowid_in;          // values of an id = or id IN (...) constraint
+    vector_delta        delta;              // rows written after the last quantization (auto_quantize)
     
     // STREAMING VT INTERFACE
     bool                is_streaming;
@@ -160,23 +321,26 @@ typedef struct {
         distance_function_t distance_fn;
         
         sqlite3_stmt        *vm;
+        struct vector_row_reader *reader;       // blob reader of a full-scan stream (reader=blob), vm only returns rowids
         void                *vector;
         int                 vsize;
         int                 vdim;
         
-        void                *data;
+        vector_chunk        chunk;              // quantized rows being scanned (rows dindex..dcounter-1)
         int                 dcounter;
         int                 dindex;
         int                 is_eof;
+        bool                in_delta;           // data points to the delta rows
+        vector_preload      *preload;           // preloaded rows data points to (kept alive until the cursor is closed)
     } stream;
     
     // NON-STREAMING VT INTERFACE
     int64_t             *rowids;
     double              *distance;
     int                 size;
-    int                 max_index;
     int                 row_index;
     int                 row_count;
+    int                 *query_idx;         // query of each result (batch scans only)
 } vFullScanCursor;
 
 typedef bool (*keyvalue_callback)(sqlite3_context *context, void *xdata, const char *key, int key_len, const char *value, int value_len);
@@ -184,6 +348,12 @@ typedef int (*vcursor_run_callback)(sqlite3 *db, vFullScanCursor *c, const void
 typedef int (*vcursor_sort_callback)(vFullScanCursor *c);
 
 extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_function_t dispatch_pq_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_hamming_distance;
+extern distance_function_t dispatch_u4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_s4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_weighted_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
 extern char *distance_backend_name;
 
 // MARK: - SQLite Utils -
@@ -448,6 +618,35 @@ cleanup:
     return rc;
 }
 
+static int sqlite_serialize_blob (sqlite3_context *context, const char *table_name, const char *column_name, const char *key, const void *blob, int size) {
+    const char *sql = "REPLACE INTO _sqliteai_vector (tblname, colname, key, value) VALUES (?, ?, ?, ?);";
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_stmt *vm = NULL;
+    
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_text(vm, 1, table_name, -1, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_text(vm, 2, column_name, -1, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_text(vm, 3, key, -1, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = (blob) ? sqlite3_bind_blob(vm, 4, blob, size, SQLITE_STATIC) : sqlite3_bind_null(vm, 4);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_step(vm);
+    if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    
+cleanup:
+    if (rc != SQLITE_OK) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
 static int sqlite_unserialize (sqlite3_context *context, table_context *ctx) {
     const char *sql = "SELECT key, value FROM _sqliteai_vector WHERE tblname = ? AND colname = ?;";
     sqlite3 *db = sqlite3_context_db_handle(context);
@@ -482,8 +681,63 @@ static int sqlite_unserialize (sqlite3_context *context, table_context *ctx) {
             ctx->offset = (float)sqlite3_column_double(vm, 1);
             continue;
         }
+        
+        if (strcmp(key, OPTION_KEY_QUANTRANGE) == 0) {
+            ctx->options.dim_ranges = (sqlite3_column_int(vm, 1) != 0);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_QUANTDIMS) == 0) {
+            size_t size = (size_t)ctx->options.v_dim * 2 * sizeof(float);
+            const void *blob = sqlite3_column_blob(vm, 1);
+            if (!blob || (size_t)sqlite3_column_bytes(vm, 1) != size) continue;
+            float *qdims = (float *)sqlite3_malloc64((sqlite3_uint64)size);
+            if (!qdims) {rc = SQLITE_NOMEM; break;}
+            memcpy(qdims, blob, size);
+            if (ctx->qdims) sqlite3_free(ctx->qdims);
+            ctx->qdims = qdims;
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_IVF_NLIST) == 0) {
+            ctx->options.nlist = sqlite3_column_int(vm, 1);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_PQ_SUBQUANTIZERS) == 0) {
+            ctx->options.pq_m = sqlite3_column_int(vm, 1);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_PQ_BITS) == 0) {
+            ctx->options.pq_nbits = sqlite3_column_int(vm, 1);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_AUTO_QUANTIZE) == 0) {
+            ctx->options.auto_quantize = (sqlite3_column_int(vm, 1) != 0);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_HNSW_MAXM) == 0) {
+            ctx->hnsw_m = sqlite3_column_int(vm, 1);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_HNSW_MAXLEVEL) == 0) {
+            ctx->hnsw_max_level = sqlite3_column_int(vm, 1);
+            continue;
+        }
+        
+        if (strcmp(key, OPTION_KEY_HNSW_ENTRY) == 0) {
+            ctx->hnsw_entry = (int64_t)sqlite3_column_int64(vm, 1);
+            continue;
+        }
     }
     
+    // per-dimension ranges are only used when both the mode and the ranges were stored
+    if (!ctx->qdims) ctx->options.dim_ranges = false;
+    
 cleanup:
     //if (rc != SQLITE_OK) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
     if (vm) sqlite3_finalize(vm);
@@ -756,6 +1010,224 @@ static inline void quantize_i8 (const int8_t *v, uint8_t *q, float offset, float
     else quantize_i8_to_signed8bit(v, (int8_t *)q, offset, scale, dim);
 }
 
+// 4-bit quantization: two codes per byte, dimension 2i in the low nibble and 2i+1 in the high nibble (the high nibble
+// of the last byte of an odd dimension is 0). Signed codes are symmetric (-7..7) and stored as two's complement nibbles.
+static inline uint8_t q_round_u4 (float s) {
+    if (!(s > 0.0f)) return 0;          /* NaN and negatives -> 0 */
+    if (s >= 14.5f) return 15;
+    return (uint8_t)(int)(s + 0.5f);
+}
+
+static inline uint8_t q_round_s4 (float s) {
+    if (isnan(s)) return 0;
+    if (s >= 6.5f) return 7;
+    if (s <= -6.5f) return (uint8_t)(-7 & 0x0F);
+    int r = (int)(s + 0.5f * (1.0f - 2.0f * (s < 0.0f)));   /* half away from zero */
+    return (uint8_t)(r & 0x0F);
+}
+
+static inline void quantize_float32_to_unsigned4bit (const float *v, uint8_t *q, float offset, float scale, int n) {
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        q[i >> 1] = (uint8_t)(q_round_u4((v[i] - offset) * scale) | (q_round_u4((v[i + 1] - offset) * scale) << 4));
+    }
+    if (i < n) q[i >> 1] = q_round_u4((v[i] - offset) * scale);
+}
+
+static inline void quantize_float32_to_signed4bit (const float *v, uint8_t *q, float offset, float scale, int n) {
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        q[i >> 1] = (uint8_t)(q_round_s4((v[i] - offset) * scale) | (q_round_s4((v[i + 1] - offset) * scale) << 4));
+    }
+    if (i < n) q[i >> 1] = q_round_s4((v[i] - offset) * scale);
+}
+
+// 4-bit quantization of the other vector types (elements are converted one at a time)
+static inline void quantize_nibble (const void *v, uint8_t *q, float offset, float scale, int dim, vector_type type, vector_qtype qtype) {
+    memset(q, 0, (size_t)(dim + 1) / 2);
+    for (int i=0; i<dim; ++i) {
+        float x = 0.0f;
+        switch (type) {
+            case VECTOR_TYPE_F32: x = ((const float *)v)[i]; break;
+            case VECTOR_TYPE_F16: x = float16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_BF16: x = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_U8: x = (float)((const uint8_t *)v)[i]; break;
+            case VECTOR_TYPE_I8: x = (float)((const int8_t *)v)[i]; break;
+        }
+        uint8_t code = (qtype == VECTOR_QUANT_U4BIT) ? q_round_u4((x - offset) * scale) : q_round_s4((x - offset) * scale);
+        q[i >> 1] |= (uint8_t)(code << ((i & 1) * 4));
+    }
+}
+
+// 1-bit quantization: bit i is set when dimension i is above threshold (bits are packed LSB first)
+static inline void quantize_binary (const void *v, uint8_t *q, float threshold, int dim, vector_type type) {
+    memset(q, 0, (size_t)(dim + 7) / 8);
+    for (int i=0; i<dim; ++i) {
+        float x = 0.0f;
+        switch (type) {
+            case VECTOR_TYPE_F32: x = ((const float *)v)[i]; break;
+            case VECTOR_TYPE_F16: x = float16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_BF16: x = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_U8: x = (float)((const uint8_t *)v)[i]; break;
+            case VECTOR_TYPE_I8: x = (float)((const int8_t *)v)[i]; break;
+        }
+        if (x > threshold) q[i >> 3] |= (uint8_t)(1u << (i & 7));
+    }
+}
+
+static inline bool quant_is_nibble (vector_qtype qtype) {
+    return (qtype == VECTOR_QUANT_U4BIT || qtype == VECTOR_QUANT_S4BIT);
+}
+
+static inline void quantize_vector (const void *v, uint8_t *q, float offset, float scale, int dim, vector_type type, vector_qtype qtype) {
+    if (qtype == VECTOR_QUANT_BIT) {
+        quantize_binary(v, q, offset, dim, type);
+        return;
+    }
+    
+    if (quant_is_nibble(qtype)) {
+        if (type != VECTOR_TYPE_F32) quantize_nibble(v, q, offset, scale, dim, type, qtype);
+        else if (qtype == VECTOR_QUANT_U4BIT) quantize_float32_to_unsigned4bit((const float *)v, q, offset, scale, dim);
+        else quantize_float32_to_signed4bit((const float *)v, q, offset, scale, dim);
+        return;
+    }
+    
+    switch (type) {
+        case VECTOR_TYPE_F32: quantize_float32((const float *)v, q, offset, scale, dim, qtype); break;
+        case VECTOR_TYPE_F16: quantize_float16((const uint16_t *)v, q, offset, scale, dim, qtype); break;
+        case VECTOR_TYPE_BF16: quantize_bfloat16((const uint16_t *)v, q, offset, scale, dim, qtype); break;
+        case VECTOR_TYPE_U8: quantize_u8((const uint8_t *)v, q, offset, scale, dim, qtype); break;
+        case VECTOR_TYPE_I8: quantize_i8((const int8_t *)v, q, offset, scale, dim, qtype); break;
+    }
+}
+
+static inline vector_type quant_code_type (vector_qtype qtype) {
+    return (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8;
+}
+
+// 8-bit quantization with per-dimension ranges (qrange=dimension): dims holds the scale of each dimension followed by
+// its offset, codes are c = (x - offset) * scale so every dimension uses all the levels of its own range
+static inline void quantize_dims (const void *v, uint8_t *q, const float *dims, int dim, vector_type type, vector_qtype qtype) {
+    const float *scales = dims;
+    const float *offsets = dims + dim;
+    for (int i=0; i<dim; ++i) {
+        float x = 0.0f;
+        switch (type) {
+            case VECTOR_TYPE_F32: x = ((const float *)v)[i]; break;
+            case VECTOR_TYPE_F16: x = float16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_BF16: x = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_U8: x = (float)((const uint8_t *)v)[i]; break;
+            case VECTOR_TYPE_I8: x = (float)((const int8_t *)v)[i]; break;
+        }
+        float s = (x - offsets[i]) * scales[i];
+        q[i] = (qtype == VECTOR_QUANT_U8BIT) ? q_round_u8(s) : (uint8_t)q_round_s8(s);
+    }
+}
+
+// norm of the vector the codes stand for (code / scale + offset of each dimension)
+static inline float quantize_dims_norm (const uint8_t *q, const float *dims, int dim, vector_qtype qtype) {
+    double sum = 0.0;
+    for (int i=0; i<dim; ++i) {
+        float c = (qtype == VECTOR_QUANT_U8BIT) ? (float)q[i] : (float)(int8_t)q[i];
+        double y = (double)(c / dims[i] + dims[dim + i]);
+        sum += y * y;
+    }
+    return (float)sqrt(sum);
+}
+
+// stored code of a row quantized with per-dimension ranges: dim codes followed by their norm (little endian float),
+// the norm of the row is all the distance kernels need besides the dot product (see weighted_distance_finalize)
+static inline void quantize_vector_dims (const void *v, uint8_t *q, const float *dims, int dim, vector_type type, vector_qtype qtype) {
+    quantize_dims(v, q, dims, dim, type, qtype);
+    float norm = quantize_dims_norm(q, dims, dim, qtype);
+    uint32_t bits = f32_to_bits(norm);
+    for (int i=0; i<4; ++i) q[dim + i] = (uint8_t)(bits >> (i * 8));
+}
+
+// 8bit codes of COSINE tables are stored together with their norm, so that scans only compute the dot product;
+// returns the type of the codes whose norm is stored, 0 when no norm is stored
+static inline vector_type quant_norm_type (const vector_options *options) {
+    if (options->v_distance != VECTOR_DISTANCE_COSINE || options->dim_ranges) return 0;
+    if (options->q_type != VECTOR_QUANT_U8BIT && options->q_type != VECTOR_QUANT_S8BIT) return 0;
+    return quant_code_type(options->q_type);
+}
+
+// same computation of the norm done by the cosine kernels (exact integer sum of squares)
+static inline float quant_code_norm (const uint8_t *code, int dim, vector_type type) {
+    int64_t sum = 0;
+    if (type == VECTOR_TYPE_I8) for (int i=0; i<dim; ++i) sum += (int)((const int8_t *)code)[i] * (int)((const int8_t *)code)[i];
+    else for (int i=0; i<dim; ++i) sum += (int)code[i] * (int)code[i];
+    return sqrtf((float)sum);
+}
+
+// number of bytes used to store a single quantized vector
+static inline int quant_code_size (const vector_options *options) {
+    if (options->q_type == VECTOR_QUANT_PQ) return options->pq_m;
+    if (options->q_type == VECTOR_QUANT_BIT) return (options->v_dim + 7) / 8;
+    if (quant_is_nibble(options->q_type)) return (options->v_dim + 1) / 2;
+    if (options->dim_ranges) return options->v_dim + (int)sizeof(float);
+    return options->v_dim;
+}
+
+// cosine distance of normalized vectors (normalized=1) is 1 - a.b, so it is computed with the dot kernels (which
+// return -a.b) without the two passes over the norms of the cosine kernels
+#define DEFINE_COSINE_NORMALIZED(NAME, TYPE) \
+    static float NAME##_distance_cosine_normalized (const void *v1, const void *v2, int n) { \
+        return 1.0f + dispatch_distance_table[VECTOR_DISTANCE_DOT][TYPE](v1, v2, n); \
+    } \
+    static void NAME##_distance_cosine_normalized_batch (const void *q, const void *rows, size_t stride, int nrows, int n, float *out) { \
+        dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][TYPE](q, rows, stride, nrows, n, out); \
+        for (int i=0; i<nrows; ++i) out[i] += 1.0f; \
+    }
+
+DEFINE_COSINE_NORMALIZED(float32, VECTOR_TYPE_F32)
+DEFINE_COSINE_NORMALIZED(float16, VECTOR_TYPE_F16)
+DEFINE_COSINE_NORMALIZED(bfloat16, VECTOR_TYPE_BF16)
+DEFINE_COSINE_NORMALIZED(uint8, VECTOR_TYPE_U8)
+DEFINE_COSINE_NORMALIZED(int8, VECTOR_TYPE_I8)
+
+static const distance_function_t cosine_normalized_table[VECTOR_TYPE_MAX] = {
+    NULL, float32_distance_cosine_normalized, float16_distance_cosine_normalized, bfloat16_distance_cosine_normalized, uint8_distance_cosine_normalized, int8_distance_cosine_normalized
+};
+
+static const distance_batch_function_t cosine_normalized_batch_table[VECTOR_TYPE_MAX] = {
+    NULL, float32_distance_cosine_normalized_batch, float16_distance_cosine_normalized_batch, bfloat16_distance_cosine_normalized_batch, uint8_distance_cosine_normalized_batch, int8_distance_cosine_normalized_batch
+};
+
+static inline bool table_cosine_normalized (const vector_options *options) {
+    return (options->v_distance == VECTOR_DISTANCE_COSINE) && options->v_normalized;
+}
+
+// kernel used on the vectors of the table (quantized codes use their own kernels)
+static distance_function_t table_distance_function (const vector_options *options) {
+    if (table_cosine_normalized(options)) return cosine_normalized_table[options->v_type];
+    return dispatch_distance_table[options->v_distance][options->v_type];
+}
+
+// batch kernel used on the vectors of the table, NULL when the backend has none
+static distance_batch_function_t table_batch_distance_function (const vector_options *options) {
+    if (table_cosine_normalized(options)) return (dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][options->v_type]) ? cosine_normalized_batch_table[options->v_type] : NULL;
+    return dispatch_batch_distance_table[options->v_distance][options->v_type];
+}
+
+static inline void vector_to_float32 (const void *v, float *out, int dim, vector_type type) {
+    switch (type) {
+        case VECTOR_TYPE_F32: memcpy(out, v, (size_t)dim * sizeof(float)); break;
+        case VECTOR_TYPE_F16: for (int i=0; i<dim; ++i) out[i] = float16_to_float32(((const uint16_t *)v)[i]); break;
+        case VECTOR_TYPE_BF16: for (int i=0; i<dim; ++i) out[i] = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+        case VECTOR_TYPE_U8: for (int i=0; i<dim; ++i) out[i] = (float)((const uint8_t *)v)[i]; break;
+        case VECTOR_TYPE_I8: for (int i=0; i<dim; ++i) out[i] = (float)((const int8_t *)v)[i]; break;
+    }
+}
+
+static inline void vector_normalize_float32 (float *v, int dim) {
+    double norm = 0.0;
+    for (int i=0; i<dim; ++i) norm += (double)v[i] * (double)v[i];
+    if (norm == 0.0) return;
+    float inv = (float)(1.0 / sqrt(norm));
+    for (int i=0; i<dim; ++i) v[i] *= inv;
+}
+
 // MARK: - General Utils -
 
 static size_t vector_type_to_size (vector_type type) {
@@ -792,6 +1264,13 @@ const char *vector_type_to_name (vector_type type) {
 static vector_qtype quant_name_to_type (const char *qname) {
     if (strcasecmp(qname, "UINT8") == 0) return VECTOR_QUANT_U8BIT;
     if (strcasecmp(qname, "INT8") == 0) return VECTOR_QUANT_S8BIT;
+    if (strcasecmp(qname, "UINT4") == 0) return VECTOR_QUANT_U4BIT;
+    if (strcasecmp(qname, "U4") == 0) return VECTOR_QUANT_U4BIT;
+    if (strcasecmp(qname, "INT4") == 0) return VECTOR_QUANT_S4BIT;
+    if (strcasecmp(qname, "S4") == 0) return VECTOR_QUANT_S4BIT;
+    if (strcasecmp(qname, "PQ") == 0) return VECTOR_QUANT_PQ;
+    if (strcasecmp(qname, "BIT") == 0) return VECTOR_QUANT_BIT;
+    if (strcasecmp(qname, "BINARY") == 0) return VECTOR_QUANT_BIT;
     return -1;
 }
 
@@ -913,6 +1392,10 @@ static bool parse_keyvalue_string (sqlite3_context *context, const char *str, ke
     return true;
 }
 
+static inline bool keyvalue_match (const char *key, int key_len, const char *name) {
+    return ((size_t)key_len == strlen(name)) && (strncasecmp(key, name, key_len) == 0);
+}
+
 static uint64_t human_to_number (const char *s) {
     char *end = NULL;
     double d = strtod(s, &end);
@@ -947,46 +1430,152 @@ bool vector_keyvalue_callback (sqlite3_context *context, void *xdata, const char
     size_t len = (value_len > sizeof(buffer)-1) ? sizeof(buffer)-1 : value_len;
     memcpy(buffer, value, len);
     
-    if (strncasecmp(key, OPTION_KEY_TYPE, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_TYPE)) {
         vector_type type = vector_name_to_type(buffer);
         if (type == 0) return context_result_error(context, SQLITE_ERROR, "Invalid vector type: '%s' is not a recognized type.", buffer);
         options->v_type = type;
         return true;
     }
     
-    if (strncasecmp(key, OPTION_KEY_DIMENSION, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_DIMENSION)) {
         int dimension = (int)strtol(buffer, NULL, 0);
         if (dimension <= 0) return context_result_error(context, SQLITE_ERROR, "Invalid vector dimension: expected a positive integer, got '%s'.", buffer);
         options->v_dim = dimension;
         return true;
     }
     
-    if (strncasecmp(key, OPTION_KEY_NORMALIZED, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_NORMALIZED)) {
         int normalized = (int)strtol(buffer, NULL, 0);
         options->v_normalized = (normalized != 0);
         return true;
     }
     
-    if (strncasecmp(key, OPTION_KEY_MAXMEMORY, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_MAXMEMORY)) {
         uint64_t max_memory = human_to_number(buffer);
         if (max_memory >= 0) options->max_memory = (int)max_memory;
         return true;
     }
     
-    if (strncasecmp(key, OPTION_KEY_QUANTTYPE, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_QUANTTYPE)) {
         vector_qtype type = quant_name_to_type(buffer);
         if (type == -1) return context_result_error(context, SQLITE_ERROR, "Invalid quantization type: '%s' is not a recognized or supported quantization type.", buffer);
         options->q_type = type;
         return true;
     }
     
-    if (strncasecmp(key, OPTION_KEY_DISTANCE, key_len) == 0) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_DISTANCE)) {
         vector_distance type = distance_name_to_type(buffer);
         if (type == 0) return context_result_error(context, SQLITE_ERROR, "Invalid distance name: '%s' is not a recognized or supported distance.", buffer);
         options->v_distance = type;
         return true;
     }
     
+    if (keyvalue_match(key, key_len, OPTION_KEY_IVF_NLIST)) {
+        int nlist = (int)strtol(buffer, NULL, 0);
+        if (nlist < 0 || nlist > 65536) return context_result_error(context, SQLITE_ERROR, "Invalid nlist value: expected an integer between 0 and 65536, got '%s'.", buffer);
+        options->nlist = nlist;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_THREADS)) {
+        int threads = (int)strtol(buffer, NULL, 0);
+        if (threads < 0 || threads > VECTOR_MAX_THREADS) return context_result_error(context, SQLITE_ERROR, "Invalid threads value: expected an integer between 0 and %d, got '%s'.", VECTOR_MAX_THREADS, buffer);
+        options->threads = threads;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_CACHE)) {
+        int cache_size = (int)strtol(buffer, NULL, 0);
+        if (cache_size < 0 || cache_size > VECTOR_CACHE_MAX_ENTRIES) return context_result_error(context, SQLITE_ERROR, "Invalid cache value: expected an integer between 0 and %d, got '%s'.", VECTOR_CACHE_MAX_ENTRIES, buffer);
+        options->cache_size = cache_size;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_PQ_M)) {
+        int m = (int)strtol(buffer, NULL, 0);
+        if (m <= 0) return context_result_error(context, SQLITE_ERROR, "Invalid m value: expected a positive integer, got '%s'.", buffer);
+        options->pq_m = m;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_PQ_NBITS)) {
+        int nbits = (int)strtol(buffer, NULL, 0);
+        if (nbits < 1 || nbits > 8) return context_result_error(context, SQLITE_ERROR, "Invalid nbits value: expected an integer between 1 and 8, got '%s'.", buffer);
+        options->pq_nbits = nbits;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_AUTO_QUANTIZE)) {
+        int auto_quantize = (int)strtol(buffer, NULL, 0);
+        options->auto_quantize = (auto_quantize != 0);
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_QUANTCLIP)) {
+        double clip = strtod(buffer, NULL);
+        if (!(clip > 0.5 && clip <= 1.0)) return context_result_error(context, SQLITE_ERROR, "Invalid clip value: expected a number greater than 0.5 and at most 1, got '%s'.", buffer);
+        options->clip = (clip < 1.0) ? clip : 0.0;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_QUANTRANGE)) {
+        if (strcasecmp(buffer, "GLOBAL") == 0) options->dim_ranges = false;
+        else if (strcasecmp(buffer, "DIMENSION") == 0 || strcasecmp(buffer, "DIM") == 0) options->dim_ranges = true;
+        else return context_result_error(context, SQLITE_ERROR, "Invalid qrange value: expected 'global' or 'dimension', got '%s'.", buffer);
+        return true;
+    }
+    
+    // means ignore unknown keys
+    return true;
+}
+
+bool scan_keyvalue_callback (sqlite3_context *context, void *xdata, const char *key, int key_len, const char *value, int value_len) {
+    vector_scan_options *options = (vector_scan_options *)xdata;
+    
+    // sanity check
+    if (!key || key_len == 0) return false;
+    if (!value || value_len == 0) return false;
+    
+    // convert value to c-string
+    char buffer[256] = {0};
+    size_t len = ((size_t)value_len > sizeof(buffer)-1) ? sizeof(buffer)-1 : (size_t)value_len;
+    memcpy(buffer, value, len);
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_HNSW_EFSEARCH)) {
+        int ef_search = (int)strtol(buffer, NULL, 0);
+        if (ef_search <= 0) return false;
+        options->ef_search = ef_search;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_IVF_NPROBE)) {
+        int nprobe = (int)strtol(buffer, NULL, 0);
+        if (nprobe <= 0) return false;
+        options->nprobe = nprobe;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_RERANK) || keyvalue_match(key, key_len, OPTION_KEY_OVERSAMPLE)) {
+        int rerank = (int)strtol(buffer, NULL, 0);
+        if (rerank <= 0) return false;
+        options->rerank = rerank;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_THREADS)) {
+        int threads = (int)strtol(buffer, NULL, 0);
+        if (threads <= 0 || threads > VECTOR_MAX_THREADS) return false;
+        options->threads = threads;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_READER)) {
+        if (strcasecmp(buffer, "blob") == 0) options->blob_reader = true;
+        else if (strcasecmp(buffer, "sql") == 0) options->blob_reader = false;
+        else return false;
+        return true;
+    }
+    
     // means ignore unknown keys
     return true;
 }
@@ -995,62 +1584,735 @@ static inline int nearly_zero_float32 (float x) {
     return fabsf(x) <= 8.0f * FLT_EPSILON;  // tweak factor for your use
 }
 
+static inline uint64_t random_next (uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t random_seed (void) {
+    uint64_t seed = 0;
+    sqlite3_randomness(sizeof(seed), &seed);
+    return (seed) ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+// wall clock time in milliseconds, as reported by the default VFS (0 when not available)
+static int64_t vector_time_ms (void) {
+    sqlite3_vfs *vfs = sqlite3_vfs_find(NULL);
+    sqlite3_int64 now = 0;
+    if (vfs && vfs->iVersion >= 2 && vfs->xCurrentTimeInt64) vfs->xCurrentTimeInt64(vfs, &now);
+    return (int64_t)now;
+}
+
+// MARK: - Threads -
+
+typedef void (*vector_thread_function)(void *arg);
+
+typedef struct {
+    vector_thread_function  fn;
+    void                    *arg;
+    bool                    running;        // false when fn was executed synchronously
+    #if defined(VECTOR_THREADS_DISABLED)
+    #elif defined(_WIN32)
+    HANDLE                  handle;
+    #else
+    pthread_t               handle;
+    #endif
+} vector_thread;
+
+#if defined(VECTOR_THREADS_DISABLED)
+#elif defined(_WIN32)
+static DWORD WINAPI vector_thread_entry (LPVOID arg) {
+    vector_thread *t = (vector_thread *)arg;
+    t->fn(t->arg);
+    return 0;
+}
+#else
+static void *vector_thread_entry (void *arg) {
+    vector_thread *t = (vector_thread *)arg;
+    t->fn(t->arg);
+    return NULL;
+}
+#endif
+
+// starts fn(arg) in a new thread, if a thread cannot be created fn is executed before returning
+static void vector_thread_start (vector_thread *t, vector_thread_function fn, void *arg) {
+    t->fn = fn;
+    t->arg = arg;
+    t->running = false;
+    
+    #if defined(VECTOR_THREADS_DISABLED)
+    #elif defined(_WIN32)
+    t->handle = CreateThread(NULL, 0, vector_thread_entry, t, 0, NULL);
+    t->running = (t->handle != NULL);
+    #else
+    t->running = (pthread_create(&t->handle, NULL, vector_thread_entry, t) == 0);
+    #endif
+    
+    if (!t->running) fn(arg);
+}
+
+static void vector_thread_join (vector_thread *t) {
+    if (!t->running) return;
+    
+    #if defined(VECTOR_THREADS_DISABLED)
+    #elif defined(_WIN32)
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    #else
+    pthread_join(t->handle, NULL);
+    #endif
+    t->running = false;
+}
+
+// name of the VFS the main database of db is accessed through, worker connections must open the file with the same
+// VFS (NULL means the default one)
+static const char *vector_thread_vfs (sqlite3 *db) {
+    sqlite3_vfs *vfs = NULL;
+    if ((sqlite3_file_control(db, "main", SQLITE_FCNTL_VFS_POINTER, &vfs) != SQLITE_OK) || !vfs) return NULL;
+    return vfs->zName;
+}
+
+#if defined(VECTOR_THREADS_DISABLED)
+typedef int vector_mutex;
+#define VECTOR_MUTEX_INITIALIZER                    0
+static void vector_mutex_enter (vector_mutex *m) {}
+static void vector_mutex_leave (vector_mutex *m) {}
+#elif defined(_WIN32)
+typedef SRWLOCK vector_mutex;
+#define VECTOR_MUTEX_INITIALIZER                    SRWLOCK_INIT
+static void vector_mutex_enter (vector_mutex *m) {AcquireSRWLockExclusive(m);}
+static void vector_mutex_leave (vector_mutex *m) {ReleaseSRWLockExclusive(m);}
+#else
+typedef pthread_mutex_t vector_mutex;
+#define VECTOR_MUTEX_INITIALIZER                    PTHREAD_MUTEX_INITIALIZER
+static void vector_mutex_enter (vector_mutex *m) {pthread_mutex_lock(m);}
+static void vector_mutex_leave (vector_mutex *m) {pthread_mutex_unlock(m);}
+#endif
+
 // MARK: - SQL -
 
 static char *generate_create_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q (rowid1 INTEGER, rowid2 INTEGER, counter INTEGER, data BLOB);", table_name, column_name);
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q (rowid1 INTEGER, rowid2 INTEGER, counter INTEGER, data BLOB, partid INTEGER DEFAULT 0);", table_name, column_name);
 }
 
 static char *generate_drop_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
     return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TABLE IF EXISTS vector0_%q_%q;", table_name, column_name);
 }
 
-static char *generate_select_from_table (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT %q, %q FROM %q ORDER BY %q;", pk_name, column_name, table_name, pk_name);
+static char *generate_create_quant_index (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE INDEX IF NOT EXISTS vector0_%q_%q_partid ON vector0_%q_%q (partid);", table_name, column_name, table_name, column_name);
 }
 
-static char *generate_select_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data FROM vector0_%q_%q;", table_name, column_name);
+static char *generate_create_ivf_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q_ivf (partid INTEGER PRIMARY KEY, centroid BLOB);", table_name, column_name);
 }
 
-static char *generate_memory_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT SUM(LENGTH(data)) FROM vector0_%q_%q;", table_name, column_name);
+static char *generate_drop_ivf_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TABLE IF EXISTS vector0_%q_%q_ivf;", table_name, column_name);
 }
 
-static char *generate_insert_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "INSERT INTO vector0_%q_%q (rowid1, rowid2, counter, data) VALUES (?, ?, ?, ?);", table_name, column_name);
+static char *generate_insert_ivf_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "INSERT INTO vector0_%q_%q_ivf (partid, centroid) VALUES (?, ?);", table_name, column_name);
 }
 
-static char *generate_quant_table_name (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
-    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "vector0_%q_%q", table_name, column_name);
+static char *generate_select_ivf_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT partid, centroid FROM vector0_%q_%q_ivf ORDER BY partid;", table_name, column_name);
 }
 
-// MARK: - Vector Context and Options -
+static char *generate_create_pq_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q_pq (id INTEGER PRIMARY KEY, codebook BLOB);", table_name, column_name);
+}
 
-void *vector_context_create (void) {
-    vector_context *ctx = (vector_context *)sqlite3_malloc(sizeof(vector_context));
-    if (!ctx) return NULL;
-    
-    memset(ctx, 0, sizeof(vector_context));
-    return (void *)ctx;
+static char *generate_drop_pq_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TABLE IF EXISTS vector0_%q_%q_pq;", table_name, column_name);
 }
 
-void vector_context_free (void *p) {
-    if (p) {
-        vector_context *ctx = (vector_context *)p;
-        for (int i=0; i<ctx->table_count; ++i) {
-            if (ctx->tables[i].t_name) sqlite3_free(ctx->tables[i].t_name);
-            if (ctx->tables[i].c_name) sqlite3_free(ctx->tables[i].c_name);
-            if (ctx->tables[i].pk_name) sqlite3_free(ctx->tables[i].pk_name);
-            if (ctx->tables[i].preloaded) sqlite3_free(ctx->tables[i].preloaded);
-        }
-        sqlite3_free(p);
-    }
+static char *generate_insert_pq_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "INSERT INTO vector0_%q_%q_pq (id, codebook) VALUES (0, ?);", table_name, column_name);
 }
 
-table_context *vector_context_lookup (vector_context *ctx, const char *table_name, const char *column_name) {
-    if ((table_name == NULL) || (column_name == NULL)) return NULL;
-    
+static char *generate_select_pq_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT codebook FROM vector0_%q_%q_pq WHERE id=0;", table_name, column_name);
+}
+
+static char *generate_select_from_table (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT %q, %q FROM %q ORDER BY %q;", pk_name, column_name, table_name, pk_name);
+}
+
+static char *generate_select_from_table_range (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT %q, %q FROM %q WHERE %q BETWEEN ?1 AND ?2 ORDER BY %q;", pk_name, column_name, table_name, pk_name, pk_name);
+}
+
+static char *generate_select_from_table_seek (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT %q, %q FROM %q WHERE %q >= ?1 ORDER BY %q LIMIT 1;", pk_name, column_name, table_name, pk_name, pk_name);
+}
+
+static char *generate_select_pk_bounds (const char *table_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT (SELECT min(%q) FROM %q), (SELECT max(%q) FROM %q);", pk_name, table_name, pk_name, table_name);
+}
+
+static char *generate_select_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data FROM vector0_%q_%q;", table_name, column_name);
+}
+
+static char *generate_select_quant_range (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data FROM vector0_%q_%q WHERE rowid2>=?1 AND rowid1<=?2;", table_name, column_name);
+}
+
+static char *generate_select_quant_partition (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data FROM vector0_%q_%q WHERE partid=?3 AND rowid2>=?1 AND rowid1<=?2;", table_name, column_name);
+}
+
+static char *generate_select_quant_partitions (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data, partid FROM vector0_%q_%q ORDER BY partid;", table_name, column_name);
+}
+
+static char *generate_select_quant_range_partitions (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data, partid FROM vector0_%q_%q WHERE rowid2>=?1 AND rowid1<=?2;", table_name, column_name);
+}
+
+static char *generate_select_quant_generation (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT value FROM _sqliteai_vector WHERE tblname=%Q AND colname=%Q AND key='" OPTION_KEY_QUANTGENERATION "';", table_name, column_name);
+}
+
+static char *generate_count_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT SUM(counter) FROM vector0_%q_%q;", table_name, column_name);
+}
+
+static char *generate_memory_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT SUM(LENGTH(data)) FROM vector0_%q_%q;", table_name, column_name);
+}
+
+static char *generate_insert_quant_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "INSERT INTO vector0_%q_%q (rowid1, rowid2, counter, data, partid) VALUES (?, ?, ?, ?, ?);", table_name, column_name);
+}
+
+static char *generate_quant_table_name (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "vector0_%q_%q", table_name, column_name);
+}
+
+static char *generate_select_quant_chunks (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT rowid FROM vector0_%q_%q WHERE rowid2>=?1 AND rowid1<=?2;", table_name, column_name);
+}
+
+static char *generate_select_quant_chunk (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT counter, data FROM vector0_%q_%q WHERE rowid=?1;", table_name, column_name);
+}
+
+static char *generate_update_quant_chunk (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "UPDATE vector0_%q_%q SET rowid1=?1, rowid2=?2, counter=?3, data=?4 WHERE rowid=?5;", table_name, column_name);
+}
+
+static char *generate_delete_quant_chunk (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DELETE FROM vector0_%q_%q WHERE rowid=?1;", table_name, column_name);
+}
+
+static char *generate_create_delta_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q_delta (id INTEGER PRIMARY KEY);", table_name, column_name);
+}
+
+static char *generate_drop_delta_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TABLE IF EXISTS vector0_%q_%q_delta;", table_name, column_name);
+}
+
+// current vector of every id in the delta table, NULL when the row has been deleted
+static char *generate_select_delta_table (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT d.id, t.%q FROM vector0_%q_%q_delta AS d LEFT JOIN %q AS t ON t.%q = d.id ORDER BY d.id;", column_name, table_name, column_name, table_name, pk_name);
+}
+
+static char *generate_clear_delta_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DELETE FROM vector0_%q_%q_delta;", table_name, column_name);
+}
+
+// the ids of inserted, updated and deleted rows (and the old id of a row whose id changed) are recorded in the delta table,
+// the triggers only use plain SQL so that the table can still be written by connections that do not load the extension
+static char *generate_create_delta_triggers (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql,
+        "CREATE TRIGGER IF NOT EXISTS vector0_%q_%q_insert AFTER INSERT ON %q BEGIN "
+            "INSERT OR IGNORE INTO vector0_%q_%q_delta (id) VALUES (NEW.%q); END;"
+        "CREATE TRIGGER IF NOT EXISTS vector0_%q_%q_update AFTER UPDATE ON %q WHEN OLD.%q IS NOT NEW.%q OR OLD.%q IS NOT NEW.%q BEGIN "
+            "INSERT OR IGNORE INTO vector0_%q_%q_delta (id) VALUES (OLD.%q); "
+            "INSERT OR IGNORE INTO vector0_%q_%q_delta (id) VALUES (NEW.%q); END;"
+        "CREATE TRIGGER IF NOT EXISTS vector0_%q_%q_delete AFTER DELETE ON %q BEGIN "
+            "INSERT OR IGNORE INTO vector0_%q_%q_delta (id) VALUES (OLD.%q); END;",
+        table_name, column_name, table_name, table_name, column_name, pk_name,
+        table_name, column_name, table_name, pk_name, pk_name, column_name, column_name,
+        table_name, column_name, pk_name,
+        table_name, column_name, pk_name,
+        table_name, column_name, table_name, table_name, column_name, pk_name);
+}
+
+static char *generate_drop_delta_triggers (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TRIGGER IF EXISTS vector0_%q_%q_insert; DROP TRIGGER IF EXISTS vector0_%q_%q_update; DROP TRIGGER IF EXISTS vector0_%q_%q_delete;", table_name, column_name, table_name, column_name, table_name, column_name);
+}
+
+static char *generate_create_hnsw_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "CREATE TABLE IF NOT EXISTS vector0_%q_%q_hnsw (id INTEGER PRIMARY KEY, level INTEGER, neighbors BLOB);", table_name, column_name);
+}
+
+static char *generate_drop_hnsw_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "DROP TABLE IF EXISTS vector0_%q_%q_hnsw;", table_name, column_name);
+}
+
+static char *generate_insert_hnsw_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "INSERT INTO vector0_%q_%q_hnsw (id, level, neighbors) VALUES (?, ?, ?);", table_name, column_name);
+}
+
+static char *generate_select_hnsw_table (const char *table_name, const char *column_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT level, neighbors FROM vector0_%q_%q_hnsw WHERE id=?;", table_name, column_name);
+}
+
+static char *generate_select_vector_by_pk (const char *table_name, const char *column_name, const char *pk_name, char sql[STATIC_SQL_SIZE]) {
+    return sqlite3_snprintf(STATIC_SQL_SIZE, sql, "SELECT %q FROM %q WHERE %q=?;", column_name, table_name, pk_name);
+}
+
+// MARK: - Row Reader -
+
+// reads single vectors by rowid, through incremental blob I/O when the table has a real rowid
+// (sqlite3_blob_reopen only needs to seek the b-tree) or through a prepared SELECT otherwise
+typedef struct vector_row_reader {
+    sqlite3         *db;
+    const char      *t_name;
+    const char      *c_name;
+    sqlite3_blob    *blob;                  // open blob handle (rowid tables)
+    sqlite3_stmt    *vm;                    // SELECT by primary key (WITHOUT ROWID tables)
+    void            *buffer;                // destination of sqlite3_blob_read
+    size_t          size;                   // expected vector size in bytes
+} vector_row_reader;
+
+static int vector_row_reader_init (vector_row_reader *r, sqlite3 *db, table_context *t_ctx) {
+    memset(r, 0, sizeof(vector_row_reader));
+    r->db = db;
+    r->t_name = t_ctx->t_name;
+    r->c_name = t_ctx->c_name;
+    r->size = (size_t)t_ctx->options.v_dim * vector_type_to_size(t_ctx->options.v_type);
+    
+    if (t_ctx->pk_name && strcmp(t_ctx->pk_name, "rowid") == 0) {
+        r->buffer = sqlite3_malloc64(r->size);
+        return (r->buffer) ? SQLITE_OK : SQLITE_NOMEM;
+    }
+    
+    char sql[STATIC_SQL_SIZE];
+    generate_select_vector_by_pk(t_ctx->t_name, t_ctx->c_name, t_ctx->pk_name, sql);
+    return sqlite3_prepare_v2(db, sql, -1, &r->vm, NULL);
+}
+
+// copies the vector of rowid into dest through the blob handle (rowid tables only), with the same return codes of vector_row_reader_read
+static int vector_row_reader_copy (vector_row_reader *r, int64_t rowid, void *dest) {
+    // a failed reopen leaves the handle aborted, so the blob is opened again on the next read
+    int rc = (r->blob) ? sqlite3_blob_reopen(r->blob, (sqlite3_int64)rowid) : sqlite3_blob_open(r->db, "main", r->t_name, r->c_name, (sqlite3_int64)rowid, 0, &r->blob);
+    if (rc != SQLITE_OK) {
+        if (r->blob) sqlite3_blob_close(r->blob);
+        r->blob = NULL;
+        // missing row or non-BLOB value
+        return (rc == SQLITE_ERROR || rc == SQLITE_ABORT) ? SQLITE_DONE : rc;
+    }
+    
+    if ((size_t)sqlite3_blob_bytes(r->blob) < r->size) return SQLITE_DONE;
+    rc = sqlite3_blob_read(r->blob, dest, (int)r->size, 0);
+    return (rc == SQLITE_OK) ? SQLITE_ROW : rc;
+}
+
+// returns SQLITE_ROW and sets *data when the row exists and holds a full vector, SQLITE_DONE when the row must be skipped
+static int vector_row_reader_read (vector_row_reader *r, int64_t rowid, const void **data) {
+    *data = NULL;
+    
+    if (r->vm) {
+        sqlite3_reset(r->vm);
+        int rc = sqlite3_bind_int64(r->vm, 1, (sqlite3_int64)rowid);
+        if (rc != SQLITE_OK) return rc;
+        rc = sqlite3_step(r->vm);
+        if (rc != SQLITE_ROW) return rc;
+        const void *blob = sqlite3_column_blob(r->vm, 0);
+        if (!blob || (size_t)sqlite3_column_bytes(r->vm, 0) < r->size) return SQLITE_DONE;
+        *data = blob;
+        return SQLITE_ROW;
+    }
+    
+    int rc = vector_row_reader_copy(r, rowid, r->buffer);
+    if (rc == SQLITE_ROW) *data = r->buffer;
+    return rc;
+}
+
+static void vector_row_reader_finalize (vector_row_reader *r) {
+    if (r->blob) sqlite3_blob_close(r->blob);
+    if (r->vm) sqlite3_finalize(r->vm);
+    if (r->buffer) sqlite3_free(r->buffer);
+    memset(r, 0, sizeof(vector_row_reader));
+}
+
+// MARK: - Row Set -
+
+#define VECTOR_ROWSET_MIN_BITMAP_BYTES              (1024*1024)
+
+static int vector_rowid_compare (const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// a filter is stored as a bitmap over [min_rowid, max_rowid] when it is dense enough, as a sorted array of rowids otherwise
+static inline bool vector_rowset_contains (const vector_rowset *set, int64_t rowid) {
+    if ((rowid < set->min_rowid) || (rowid > set->max_rowid)) return false;
+    
+    if (set->bitmap) {
+        uint64_t bit = (uint64_t)rowid - (uint64_t)set->min_rowid;
+        return (set->bitmap[bit >> 3] >> (bit & 7)) & 1;
+    }
+    
+    int64_t lo = 0, hi = set->count - 1;
+    while (lo <= hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (set->rowids[mid] == rowid) return true;
+        if (set->rowids[mid] < rowid) lo = mid + 1; else hi = mid - 1;
+    }
+    return false;
+}
+
+static void vector_rowset_free (vector_rowset *set) {
+    if (!set) return;
+    if (set->bitmap) sqlite3_free(set->bitmap);
+    if (set->rowids) sqlite3_free(set->rowids);
+    sqlite3_free(set);
+}
+
+// compiles sql making sure that a filter fragment did not add further statements
+static int vector_filter_prepare (sqlite3 *db, const char *sql, sqlite3_stmt **vm) {
+    const char *tail = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, vm, &tail);
+    if (rc != SQLITE_OK) return rc;
+    
+    SKIP_SPACES(tail);
+    if (tail && *tail) {
+        sqlite3_finalize(*vm);
+        *vm = NULL;
+        return SQLITE_MISUSE;
+    }
+    return SQLITE_OK;
+}
+
+// sets the bounds of a set whose rowids have been collected in ascending order, converting it to a bitmap when convenient
+static int vector_rowset_finalize (vector_rowset *set) {
+    // an empty set never matches
+    if (set->count == 0) {
+        set->min_rowid = 1;
+        set->max_rowid = 0;
+        return SQLITE_OK;
+    }
+    set->min_rowid = set->rowids[0];
+    set->max_rowid = set->rowids[set->count - 1];
+    
+    // switch to a bitmap unless it would be both large and much bigger than the rowid array
+    uint64_t nbytes = (((uint64_t)set->max_rowid - (uint64_t)set->min_rowid) >> 3) + 1;
+    if ((nbytes <= VECTOR_ROWSET_MIN_BITMAP_BYTES) || (nbytes <= (uint64_t)set->count * sizeof(int64_t))) {
+        set->bitmap = (uint8_t *)sqlite3_malloc64(nbytes);
+        if (!set->bitmap) return SQLITE_NOMEM;
+        memset(set->bitmap, 0, (size_t)nbytes);
+        for (int64_t i=0; i<set->count; ++i) {
+            uint64_t bit = (uint64_t)set->rowids[i] - (uint64_t)set->min_rowid;
+            set->bitmap[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+        }
+        sqlite3_free(set->rowids);
+        set->rowids = NULL;
+    }
+    return SQLITE_OK;
+}
+
+// SELECT pk FROM table WHERE (filter) ORDER BY pk
+static int vector_rowset_build (sqlite3 *db, table_context *t_ctx, const char *filter, vector_rowset **out) {
+    *out = NULL;
+    
+    char *sql = sqlite3_mprintf("SELECT %q FROM %q WHERE (%s) ORDER BY %q;", t_ctx->pk_name, t_ctx->t_name, filter, t_ctx->pk_name);
+    if (!sql) return SQLITE_NOMEM;
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = vector_filter_prepare(db, sql, &vm);
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) return rc;
+    
+    vector_rowset *set = (vector_rowset *)sqlite3_malloc(sizeof(vector_rowset));
+    if (!set) {rc = SQLITE_NOMEM; goto rowset_cleanup;}
+    memset(set, 0, sizeof(vector_rowset));
+    
+    int64_t capacity = 0;
+    while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        if (set->count == capacity) {
+            capacity = (capacity) ? capacity * 2 : 1024;
+            int64_t *rowids = (int64_t *)sqlite3_realloc64(set->rowids, (sqlite3_uint64)capacity * sizeof(int64_t));
+            if (!rowids) {rc = SQLITE_NOMEM; goto rowset_cleanup;}
+            set->rowids = rowids;
+        }
+        set->rowids[set->count++] = (int64_t)sqlite3_column_int64(vm, 0);
+    }
+    if (rc != SQLITE_DONE) goto rowset_cleanup;
+    rc = vector_rowset_finalize(set);
+    
+rowset_cleanup:
+    if (vm) sqlite3_finalize(vm);
+    if (rc != SQLITE_OK) {
+        vector_rowset_free(set);
+        return rc;
+    }
+    *out = set;
+    return SQLITE_OK;
+}
+
+// MARK: - Preload Registry -
+
+// Preloaded quantized rows are read-only, so connections of the same process that opened the same database file
+// share a single refcounted buffer. The key includes the quantization generation (bumped by every vector_quantize),
+// so a connection never attaches to rows quantized with different parameters.
+
+static vector_mutex vector_preload_mutex = VECTOR_MUTEX_INITIALIZER;
+static vector_preload *vector_preload_list = NULL;
+
+static void vector_preload_file_unmap (void *map, size_t size);
+
+static void vector_preload_free (vector_preload *p) {
+    if (p->key) sqlite3_free(p->key);
+    if (p->map) {
+        vector_preload_file_unmap(p->map, p->map_size);
+    } else {
+        if (p->data) sqlite3_free(p->data);
+        if (p->partitions) sqlite3_free(p->partitions);
+        if (p->centroids) sqlite3_free(p->centroids);
+    }
+    sqlite3_free(p);
+}
+
+static vector_preload *vector_preload_acquire (const char *key) {
+    if (!key) return NULL;
+    
+    vector_mutex_enter(&vector_preload_mutex);
+    vector_preload *p = vector_preload_list;
+    while (p && strcmp(p->key, key) != 0) p = p->next;
+    if (p) ++p->refcount;
+    vector_mutex_leave(&vector_preload_mutex);
+    
+    return p;
+}
+
+static vector_preload *vector_preload_register (vector_preload *p) {
+    // private (in-memory or temporary databases)
+    if (!p->key) return p;
+    
+    vector_mutex_enter(&vector_preload_mutex);
+    vector_preload *q = vector_preload_list;
+    while (q && strcmp(q->key, p->key) != 0) q = q->next;
+    if (q) {
+        // another connection registered the same rows while this one was loading them
+        ++q->refcount;
+    } else {
+        p->next = vector_preload_list;
+        vector_preload_list = p;
+    }
+    vector_mutex_leave(&vector_preload_mutex);
+    
+    if (q) vector_preload_free(p);
+    return (q) ? q : p;
+}
+
+static void vector_preload_retain (vector_preload *p) {
+    vector_mutex_enter(&vector_preload_mutex);
+    ++p->refcount;
+    vector_mutex_leave(&vector_preload_mutex);
+}
+
+static void vector_preload_release (vector_preload *p) {
+    vector_mutex_enter(&vector_preload_mutex);
+    bool last = (--p->refcount == 0);
+    if (last && p->key) {
+        vector_preload **pp = &vector_preload_list;
+        while (*pp && *pp != p) pp = &(*pp)->next;
+        if (*pp) *pp = p->next;
+    }
+    vector_mutex_leave(&vector_preload_mutex);
+    
+    if (last) vector_preload_free(p);
+}
+
+// MARK: - Vector Context and Options -
+
+void *vector_context_create (void) {
+    vector_context *ctx = (vector_context *)sqlite3_malloc(sizeof(vector_context));
+    if (!ctx) return NULL;
+    
+    memset(ctx, 0, sizeof(vector_context));
+    return (void *)ctx;
+}
+
+static void table_context_attach_preload (table_context *t_ctx, vector_preload *p) {
+    t_ctx->preload = p;
+    t_ctx->preloaded = p->codes;
+    t_ctx->prerowids = p->rowids;
+    t_ctx->prenorms = p->norms;
+    t_ctx->precounter = p->counter;
+    t_ctx->prepartitions = p->partitions;
+    t_ctx->precentroids = p->centroids;
+    t_ctx->presorted = p->sorted;
+}
+
+static void table_context_release_preload (table_context *t_ctx) {
+    if (t_ctx->preload) vector_preload_release(t_ctx->preload);
+    t_ctx->preload = NULL;
+    t_ctx->preloaded = NULL;
+    t_ctx->prerowids = NULL;
+    t_ctx->prenorms = NULL;
+    t_ctx->prepartitions = NULL;
+    t_ctx->precentroids = NULL;
+    t_ctx->precounter = 0;
+    t_ctx->presorted = false;
+}
+
+// MARK: - Query Cache -
+
+// Results of vector_quantize_scan are cached per table when vector_init is called with cache=N: entries are found
+// through a hash table of chains and evicted in least recently used order. Cached results are only valid for the
+// state of the database they were computed on, so the cache is emptied whenever the data version of the main database
+// (changed by the commits of every connection) or the number of changes made by this connection are different, which
+// also covers a new quantization generation; vector_quantize, vector_quantize_compact and vector_quantize_cleanup
+// empty it explicitly.
+
+static uint64_t vector_cache_hash (const uint8_t *data, int size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for (; i < size; ++i) h = (h ^ data[i]) * 0x100000001b3ULL;
+    return h ^ (h >> 32);
+}
+
+static void vector_cache_clear (vector_cache *cache) {
+    for (int i=0; i<cache->count; ++i) sqlite3_free(cache->entries[i].data);
+    for (int i=0; i<cache->nbuckets; ++i) cache->buckets[i] = -1;
+    cache->count = 0;
+    cache->lru_head = cache->lru_tail = -1;
+}
+
+static void vector_cache_free (vector_cache *cache) {
+    vector_cache_clear(cache);
+    if (cache->entries) sqlite3_free(cache->entries);
+    if (cache->buckets) sqlite3_free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->nbuckets = 0;
+    cache->capacity = 0;
+}
+
+// (re)allocates the cache for capacity entries, cached results are dropped when the capacity changes
+static int vector_cache_reserve (vector_cache *cache, int capacity) {
+    if (cache->capacity == capacity) return SQLITE_OK;
+    vector_cache_free(cache);
+    
+    int nbuckets = 16;
+    while (nbuckets < capacity * 2) nbuckets *= 2;
+    cache->entries = (vector_cache_entry *)sqlite3_malloc64((sqlite3_uint64)capacity * sizeof(vector_cache_entry));
+    cache->buckets = (int *)sqlite3_malloc64((sqlite3_uint64)nbuckets * sizeof(int));
+    if (!cache->entries || !cache->buckets) {
+        vector_cache_free(cache);
+        return SQLITE_NOMEM;
+    }
+    
+    cache->nbuckets = nbuckets;
+    cache->capacity = capacity;
+    vector_cache_clear(cache);
+    return SQLITE_OK;
+}
+
+static void vector_cache_unlink (vector_cache *cache, int i) {
+    vector_cache_entry *e = &cache->entries[i];
+    if (e->lru_prev >= 0) cache->entries[e->lru_prev].lru_next = e->lru_next;
+    else cache->lru_head = e->lru_next;
+    if (e->lru_next >= 0) cache->entries[e->lru_next].lru_prev = e->lru_prev;
+    else cache->lru_tail = e->lru_prev;
+}
+
+static void vector_cache_link_head (vector_cache *cache, int i) {
+    vector_cache_entry *e = &cache->entries[i];
+    e->lru_prev = -1;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head >= 0) cache->entries[cache->lru_head].lru_prev = i;
+    cache->lru_head = i;
+    if (cache->lru_tail < 0) cache->lru_tail = i;
+}
+
+// returns the entry with the given key (which becomes the most recently used one), -1 if not found
+static int vector_cache_find (vector_cache *cache, uint64_t hash, const uint8_t *key, int key_size) {
+    if (cache->count == 0) return -1;
+    for (int i = cache->buckets[hash & (cache->nbuckets - 1)]; i >= 0; i = cache->entries[i].next) {
+        vector_cache_entry *e = &cache->entries[i];
+        if (e->hash != hash || e->key_size != key_size || memcmp(e->data, key, key_size) != 0) continue;
+        if (cache->lru_head != i) {
+            vector_cache_unlink(cache, i);
+            vector_cache_link_head(cache, i);
+        }
+        return i;
+    }
+    return -1;
+}
+
+// adds the results of a query, evicting the least recently used entry when the cache is full
+static int vector_cache_insert (vector_cache *cache, uint64_t hash, const uint8_t *key, int key_size, const int64_t *rowids, const double *distances, int count) {
+    if (cache->capacity == 0) return SQLITE_OK;
+    
+    size_t size = (size_t)key_size + (size_t)count * (sizeof(int64_t) + sizeof(double));
+    uint8_t *data = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)size);
+    if (!data) return SQLITE_NOMEM;
+    memcpy(data, key, key_size);
+    memcpy(data + key_size, rowids, (size_t)count * sizeof(int64_t));
+    memcpy(data + key_size + (size_t)count * sizeof(int64_t), distances, (size_t)count * sizeof(double));
+    
+    int i = cache->count;
+    if (cache->count == cache->capacity) {
+        // the least recently used entry is removed from its chain and its slot reused
+        i = cache->lru_tail;
+        vector_cache_unlink(cache, i);
+        int *link = &cache->buckets[cache->entries[i].hash & (cache->nbuckets - 1)];
+        while (*link != i) link = &cache->entries[*link].next;
+        *link = cache->entries[i].next;
+        sqlite3_free(cache->entries[i].data);
+    } else {
+        ++cache->count;
+    }
+    
+    vector_cache_entry *e = &cache->entries[i];
+    e->hash = hash;
+    e->data = data;
+    e->key_size = key_size;
+    e->count = count;
+    e->next = cache->buckets[hash & (cache->nbuckets - 1)];
+    cache->buckets[hash & (cache->nbuckets - 1)] = i;
+    vector_cache_link_head(cache, i);
+    return SQLITE_OK;
+}
+
+void vector_context_free (void *p) {
+    if (p) {
+        vector_context *ctx = (vector_context *)p;
+        for (int i=0; i<ctx->table_count; ++i) {
+            if (ctx->tables[i].t_name) sqlite3_free(ctx->tables[i].t_name);
+            if (ctx->tables[i].c_name) sqlite3_free(ctx->tables[i].c_name);
+            if (ctx->tables[i].pk_name) sqlite3_free(ctx->tables[i].pk_name);
+            table_context_release_preload(&ctx->tables[i]);
+            if (ctx->tables[i].preload_file) sqlite3_free(ctx->tables[i].preload_file);
+            if (ctx->tables[i].pq_codebook) sqlite3_free(ctx->tables[i].pq_codebook);
+            if (ctx->tables[i].qdims) sqlite3_free(ctx->tables[i].qdims);
+            vector_cache_free(&ctx->tables[i].cache);
+        }
+        sqlite3_free(p);
+    }
+}
+
+table_context *vector_context_lookup (vector_context *ctx, const char *table_name, const char *column_name) {
+    if ((table_name == NULL) || (column_name == NULL)) return NULL;
+    
     for (int i=0; i<ctx->table_count; ++i) {
         // tname and cname can be NULL after adding vector_cleanup function
         const char *tname = ctx->tables[i].t_name;
@@ -1112,15 +2374,157 @@ vector_options vector_options_create (void) {
 }
 
 
+// MARK: - Quantized Chunks -
+
+// Quantized rows are stored in chunks (the data column of vector0_<table>_<column>). A chunk is a header followed by
+// the codes of all its rows and then by their rowids, so that scans read the codes sequentially:
+//
+//  header (VECTOR_CHUNK_HEADER_SIZE bytes) | counter codes (padded to VECTOR_CHUNK_ALIGN) | counter rowids (int64) | counter norms (float, optional)
+//
+// Codes and rowids start at a multiple of VECTOR_CHUNK_ALIGN from the beginning of the chunk. Header fields, rowids
+// and norms are little endian. Norms are only stored by format version 3 and when VECTOR_CHUNK_FLAG_NORMS is set
+// (see quant_norm_type). Chunks written before format version 2 interleave each rowid with its code; they are still
+// read and are recognized by their size (a chunk with a header is always bigger than a legacy chunk with the same counter).
+
+#define VECTOR_CHUNK_MAGIC                          0x4B435156      // "VQCK"
+#define VECTOR_CHUNK_VERSION                        3
+#define VECTOR_CHUNK_ALIGN                          64
+#define VECTOR_CHUNK_HEADER_SIZE                    64
+#define VECTOR_CHUNK_FLAG_NORMS                     0x01
+
+static inline size_t vector_chunk_align (size_t n) {
+    return (n + VECTOR_CHUNK_ALIGN - 1) & ~(size_t)(VECTOR_CHUNK_ALIGN - 1);
+}
+
+static inline size_t vector_chunk_size (int count, int code_size, bool norms) {
+    size_t size = VECTOR_CHUNK_HEADER_SIZE + vector_chunk_align((size_t)count * (size_t)code_size) + (size_t)count * sizeof(int64_t);
+    return (norms) ? size + (size_t)count * sizeof(float) : size;
+}
+
+static inline void vector_chunk_put32 (uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value & 0xFF); p[1] = (uint8_t)((value >> 8) & 0xFF); p[2] = (uint8_t)((value >> 16) & 0xFF); p[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+static inline uint32_t vector_chunk_get32 (const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline int64_t vector_chunk_rowid (const vector_chunk *chunk, int i) {
+    return INT64_FROM_INT8PTR(chunk->rowids + (size_t)i * chunk->rowid_stride);
+}
+
+static inline const uint8_t *vector_chunk_code (const vector_chunk *chunk, int i) {
+    return chunk->codes + (size_t)i * chunk->code_stride;
+}
+
+static inline float vector_chunk_norm (const vector_chunk *chunk, int i) {
+    uint32_t bits = vector_chunk_get32(chunk->norms + (size_t)i * sizeof(float));
+    float norm;
+    memcpy(&norm, &bits, sizeof(float));
+    return norm;
+}
+
+static inline void vector_chunk_put_norm (uint8_t *p, float norm) {
+    uint32_t bits;
+    memcpy(&bits, &norm, sizeof(float));
+    vector_chunk_put32(p, bits);
+}
+
+static inline vector_chunk vector_chunk_slice (const vector_chunk *chunk, int first, int count) {
+    vector_chunk slice = *chunk;
+    slice.codes += (size_t)first * chunk->code_stride;
+    slice.rowids += (size_t)first * chunk->rowid_stride;
+    if (slice.norms) slice.norms += (size_t)first * sizeof(float);
+    slice.count = count;
+    return slice;
+}
+
+// view on count interleaved rows (rowid followed by the code), as built by the quantization and by the delta table
+static inline vector_chunk vector_chunk_rows (const uint8_t *rows, int count, int code_size) {
+    vector_chunk chunk = {rows + sizeof(int64_t), rows, sizeof(int64_t) + (size_t)code_size, sizeof(int64_t) + (size_t)code_size, count, NULL};
+    return chunk;
+}
+
+static bool vector_chunk_decode (vector_chunk *chunk, const void *blob, int bytes, int count, int code_size) {
+    const uint8_t *data = (const uint8_t *)blob;
+    if (!data || count < 0 || bytes < 0) return false;
+    
+    bool norms = ((size_t)bytes == vector_chunk_size(count, code_size, true));
+    if (norms || (size_t)bytes == vector_chunk_size(count, code_size, false)) {
+        uint32_t version = vector_chunk_get32(data + 4);
+        if (vector_chunk_get32(data) != VECTOR_CHUNK_MAGIC || version < 2 || version > VECTOR_CHUNK_VERSION) return false;
+        if (vector_chunk_get32(data + 8) != (uint32_t)count || vector_chunk_get32(data + 12) != (uint32_t)code_size) return false;
+        uint32_t flags = (version >= 3) ? vector_chunk_get32(data + 16) : 0;
+        if (norms != ((flags & VECTOR_CHUNK_FLAG_NORMS) != 0)) return false;
+        chunk->codes = data + VECTOR_CHUNK_HEADER_SIZE;
+        chunk->rowids = chunk->codes + vector_chunk_align((size_t)count * (size_t)code_size);
+        chunk->code_stride = (size_t)code_size;
+        chunk->rowid_stride = sizeof(int64_t);
+        chunk->count = count;
+        chunk->norms = (norms) ? chunk->rowids + (size_t)count * sizeof(int64_t) : NULL;
+        return true;
+    }
+    
+    // legacy chunk
+    if ((size_t)bytes != (size_t)count * (sizeof(int64_t) + (size_t)code_size)) return false;
+    *chunk = vector_chunk_rows(data, count, code_size);
+    return true;
+}
+
+// copies the rows of chunk into the codes and rowids blocks
+static void vector_chunk_copy (const vector_chunk *chunk, uint8_t *codes, uint8_t *rowids, int code_size) {
+    if (chunk->code_stride == (size_t)code_size) memcpy(codes, chunk->codes, (size_t)chunk->count * (size_t)code_size);
+    else for (int i=0; i<chunk->count; ++i) memcpy(codes + (size_t)i * code_size, vector_chunk_code(chunk, i), (size_t)code_size);
+    
+    if (chunk->rowid_stride == sizeof(int64_t)) memcpy(rowids, chunk->rowids, (size_t)chunk->count * sizeof(int64_t));
+    else for (int i=0; i<chunk->count; ++i) memcpy(rowids + i * sizeof(int64_t), chunk->rowids + (size_t)i * chunk->rowid_stride, sizeof(int64_t));
+}
+
+// writes the norms of the rows of chunk (copied when the chunk stores them, computed from the codes otherwise)
+static void vector_chunk_copy_norms (const vector_chunk *chunk, uint8_t *norms, int code_size, vector_type norm_type) {
+    if (chunk->norms) {
+        memcpy(norms, chunk->norms, (size_t)chunk->count * sizeof(float));
+        return;
+    }
+    for (int i=0; i<chunk->count; ++i) {
+        vector_chunk_put_norm(norms + (size_t)i * sizeof(float), quant_code_norm(vector_chunk_code(chunk, i), code_size, norm_type));
+    }
+}
+
+// builds a chunk from count interleaved rows (rowid followed by the code), the returned buffer must be freed with sqlite3_free;
+// the norms of the codes are also stored when norm_type is not 0
+static uint8_t *vector_chunk_encode (const uint8_t *rows, int count, int code_size, vector_type norm_type, size_t *size) {
+    *size = vector_chunk_size(count, code_size, norm_type != 0);
+    uint8_t *buffer = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)*size);
+    if (!buffer) return NULL;
+    
+    memset(buffer, 0, *size);
+    vector_chunk_put32(buffer, VECTOR_CHUNK_MAGIC);
+    vector_chunk_put32(buffer + 4, VECTOR_CHUNK_VERSION);
+    vector_chunk_put32(buffer + 8, (uint32_t)count);
+    vector_chunk_put32(buffer + 12, (uint32_t)code_size);
+    vector_chunk_put32(buffer + 16, (norm_type) ? VECTOR_CHUNK_FLAG_NORMS : 0);
+    
+    vector_chunk chunk = vector_chunk_rows(rows, count, code_size);
+    uint8_t *codes = buffer + VECTOR_CHUNK_HEADER_SIZE;
+    uint8_t *rowids = codes + vector_chunk_align((size_t)count * (size_t)code_size);
+    vector_chunk_copy(&chunk, codes, rowids, code_size);
+    if (norm_type) vector_chunk_copy_norms(&chunk, rowids + (size_t)count * sizeof(int64_t), code_size, norm_type);
+    return buffer;
+}
+
 // MARK: - Public -
 
-static int vector_serialize_quantization (sqlite3 *db, const char *table_name, const char *column_name, uint32_t nrows, uint8_t *data, ptrdiff_t data_size, int64_t min_rowid, int64_t max_rowid) {
+// rows are nrows interleaved rowids and codes, serialized as a single chunk (with the norms of the codes when norm_type is not 0)
+static int vector_serialize_quantization (sqlite3 *db, const char *table_name, const char *column_name, uint32_t nrows, const uint8_t *rows, int code_size, vector_type norm_type, int64_t min_rowid, int64_t max_rowid, int partid) {
     
     char sql[STATIC_SQL_SIZE];
     generate_insert_quant_table(table_name, column_name, sql);
     
+    size_t data_size = 0;
     sqlite3_stmt *vm = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    uint8_t *data = vector_chunk_encode(rows, (int)nrows, code_size, norm_type, &data_size);
+    int rc = (data) ? sqlite3_prepare_v2(db, sql, -1, &vm, NULL) : SQLITE_NOMEM;
     if (rc != SQLITE_OK) goto vector_serialize_quantization_cleanup;
     
     rc = sqlite3_bind_int64(vm, 1, min_rowid);
@@ -1132,553 +2536,3134 @@ static int vector_serialize_quantization (sqlite3 *db, const char *table_name, c
     rc = sqlite3_bind_int(vm, 3, nrows);
     if (rc != SQLITE_OK) goto vector_serialize_quantization_cleanup;
     
-    rc = sqlite3_bind_blob(vm, 4, (const void *)data, (int)data_size, SQLITE_STATIC);
+    rc = sqlite3_bind_blob64(vm, 4, (const void *)data, (sqlite3_uint64)data_size, SQLITE_STATIC);
     if (rc != SQLITE_OK) goto vector_serialize_quantization_cleanup;
     
-    rc = sqlite3_step(vm);
+    rc = sqlite3_bind_int(vm, 5, partid);
+    if (rc != SQLITE_OK) goto vector_serialize_quantization_cleanup;
+    
+    rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
     
 vector_serialize_quantization_cleanup:
     if (rc != SQLITE_OK) printf("Error in vector_serialize_quantization: %s\n", sqlite3_errmsg(db));
     if (vm) sqlite3_finalize(vm);
+    if (data) sqlite3_free(data);
     return rc;
 }
 
-static int vector_rebuild_quantization (sqlite3_context *context, const char *table_name, const char *column_name, table_context *t_ctx, vector_qtype qtype, uint64_t max_memory, uint32_t *count) {
-    
-    int rc = SQLITE_NOMEM;
-    sqlite3_stmt *vm = NULL;
-    char sql[STATIC_SQL_SIZE];
-    sqlite3 *db = sqlite3_context_db_handle(context);
-    uint32_t tot_processed = 0;
+// MARK: - IVF -
+
+#define IVF_DEFAULT_NPROBE                          8
+#define IVF_TRAINING_POINTS_PER_LIST                64
+#define IVF_MAX_TRAINING_POINTS                     65536
+#define IVF_KMEANS_ITERATIONS                       10
+
+typedef struct {
+    uint8_t         *data;                  // quantized records (rowid + vector) waiting to be serialized
+    uint32_t        count;
+    uint32_t        capacity;
+    int64_t         min_rowid;
+    int64_t         max_rowid;
+} ivf_partition;
+
+typedef struct {
+    float           distance;
+    int             partid;
+} ivf_candidate;
+
+// coarse quantizer always uses squared L2 in the quantized space, both to build and to probe partitions
+static inline distance_function_t ivf_distance_function (vector_qtype qtype) {
+    return dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][quant_code_type(qtype)];
+}
+
+static int ivf_nearest (const uint8_t *code, const uint8_t *centroids, int nlist, int dim, distance_function_t distance_fn) {
+    int best = 0;
+    float best_distance = INFINITY;
+    for (int i=0; i<nlist; ++i) {
+        float d = distance_fn((const void *)code, (const void *)(centroids + (size_t)i * dim), dim);
+        if (d < best_distance) {best_distance = d; best = i;}
+    }
+    return best;
+}
+
+// k-means (Lloyd) on the quantized training samples, centroids are rounded back to the quantized representation
+static int ivf_train (const uint8_t *samples, int nsamples, int dim, int nlist, vector_qtype qtype, uint8_t *centroids) {
+    distance_function_t distance_fn = ivf_distance_function(qtype);
+    uint64_t rng = random_seed();
     
-    const char *pk_name = t_ctx->pk_name;
-    int dim = t_ctx->options.v_dim;
-    vector_type type = t_ctx->options.v_type;
-    float *tempv = NULL;
+    float *sums = (float *)sqlite3_malloc64((sqlite3_uint64)nlist * (sqlite3_uint64)dim * sizeof(float));
+    int *counts = (int *)sqlite3_malloc64((sqlite3_uint64)nlist * sizeof(int));
+    if (!sums || !counts) {
+        if (sums) sqlite3_free(sums);
+        if (counts) sqlite3_free(counts);
+        return SQLITE_NOMEM;
+    }
     
-    // compute size of a single quant, format is: rowid + quantize dimensions
-    size_t q_size = sizeof(int64_t) + (size_t)dim * sizeof(uint8_t);
-    if (q_size == 0) {
-        sqlite3_result_error(context, "Vector dimension is zero, which is not possible.", -1);
-        return SQLITE_MISUSE;
+    // init centroids with distinct random samples (partial Fisher-Yates on sample indexes)
+    int *indexes = (int *)sqlite3_malloc64((sqlite3_uint64)nsamples * sizeof(int));
+    if (!indexes) {sqlite3_free(sums); sqlite3_free(counts); return SQLITE_NOMEM;}
+    for (int i=0; i<nsamples; ++i) indexes[i] = i;
+    for (int i=0; i<nlist; ++i) {
+        int j = i + (int)(random_next(&rng) % (uint64_t)(nsamples - i));
+        SWAP(int, indexes[i], indexes[j]);
+        memcpy(centroids + (size_t)i * dim, samples + (size_t)indexes[i] * dim, dim);
     }
+    sqlite3_free(indexes);
     
-    // max_memory == 0 means use all required memory
-    if (max_memory == 0) {
-        sqlite3_snprintf(sizeof(sql), sql, "SELECT COUNT(*) FROM %q;", table_name);
-        int64_t count = sqlite_read_int64(db, sql);
-        max_memory = (count == 0) ? DEFAULT_MAX_MEMORY : (uint64_t)count * (uint64_t)q_size;
-        if (count <= 0) {
-            // no vectors
-            t_ctx->options.q_type = (qtype == VECTOR_QUANT_AUTO) ? VECTOR_QUANT_U8BIT : qtype;
-            t_ctx->scale = 1.0f;
-            t_ctx->offset = 0.0f;
-            return SQLITE_OK;
+    for (int iter=0; iter<IVF_KMEANS_ITERATIONS; ++iter) {
+        memset(sums, 0, (size_t)nlist * (size_t)dim * sizeof(float));
+        memset(counts, 0, (size_t)nlist * sizeof(int));
+        
+        // assignment step
+        for (int i=0; i<nsamples; ++i) {
+            const uint8_t *sample = samples + (size_t)i * dim;
+            int p = ivf_nearest(sample, centroids, nlist, dim, distance_fn);
+            float *sum = sums + (size_t)p * dim;
+            if (qtype == VECTOR_QUANT_U8BIT) for (int d=0; d<dim; ++d) sum[d] += (float)sample[d];
+            else for (int d=0; d<dim; ++d) sum[d] += (float)((const int8_t *)sample)[d];
+            counts[p]++;
+        }
+        
+        // update step (empty partitions are re-seeded with a random sample)
+        for (int p=0; p<nlist; ++p) {
+            uint8_t *centroid = centroids + (size_t)p * dim;
+            if (counts[p] == 0) {
+                memcpy(centroid, samples + (size_t)(random_next(&rng) % (uint64_t)nsamples) * dim, dim);
+                continue;
+            }
+            float inv = 1.0f / (float)counts[p];
+            float *sum = sums + (size_t)p * dim;
+            if (qtype == VECTOR_QUANT_U8BIT) for (int d=0; d<dim; ++d) centroid[d] = q_round_u8(sum[d] * inv);
+            else for (int d=0; d<dim; ++d) ((int8_t *)centroid)[d] = q_round_s8(sum[d] * inv);
         }
     }
     
-    // max number of vectors that fits in max_memory (per batch; force at least 1)
-    uint32_t max_vectors = (uint32_t)(max_memory / (uint64_t)q_size);
-    if (max_vectors == 0) max_vectors = 1;
+    sqlite3_free(sums);
+    sqlite3_free(counts);
+    return SQLITE_OK;
+}
+
+static int ivf_serialize_centroids (sqlite3 *db, const char *table_name, const char *column_name, const uint8_t *centroids, int nlist, int dim) {
+    char sql[STATIC_SQL_SIZE];
+    generate_insert_ivf_table(table_name, column_name, sql);
     
-    sqlite3_uint64 out_bytes = (sqlite3_uint64)max_vectors * (sqlite3_uint64)q_size;
-    uint8_t *data = sqlite3_malloc64(out_bytes);
-    uint8_t *original = data;
-    if (!data) goto vector_rebuild_quantization_cleanup;
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto ivf_serialize_centroids_cleanup;
     
-    sqlite3_uint64 temp_bytes = (sqlite3_uint64)dim * (sqlite3_uint64)sizeof(float);
-    tempv = (float *)sqlite3_malloc64(temp_bytes);
-    if (!tempv) goto vector_rebuild_quantization_cleanup;
+    for (int i=0; i<nlist; ++i) {
+        rc = sqlite3_bind_int(vm, 1, i);
+        if (rc != SQLITE_OK) goto ivf_serialize_centroids_cleanup;
         
-    // SELECT rowid, embedding FROM table
-    generate_select_from_table(table_name, column_name, pk_name, sql);
-    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+        rc = sqlite3_bind_blob(vm, 2, (const void *)(centroids + (size_t)i * dim), dim, SQLITE_STATIC);
+        if (rc != SQLITE_OK) goto ivf_serialize_centroids_cleanup;
+        
+        rc = sqlite3_step(vm);
+        if (rc != SQLITE_DONE) goto ivf_serialize_centroids_cleanup;
+        rc = sqlite3_reset(vm);
+        if (rc != SQLITE_OK) goto ivf_serialize_centroids_cleanup;
+    }
     
-    // STEP 1
-    // find global min/max across ALL vectors
-    #if defined(_WIN32) || defined(__linux__)
-    float min_val = FLT_MAX;
-    float max_val = -FLT_MAX;
-    #else 
-    float min_val = MAXFLOAT;
-    float max_val = -MAXFLOAT;
-    #endif
-    bool contains_negative = false;
+ivf_serialize_centroids_cleanup:
+    if (rc != SQLITE_OK) printf("Error in ivf_serialize_centroids: %s\n", sqlite3_errmsg(db));
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
+static uint8_t *ivf_load_centroids (sqlite3 *db, const char *table_name, const char *column_name, int nlist, int dim) {
+    char sql[STATIC_SQL_SIZE];
+    generate_select_ivf_table(table_name, column_name, sql);
+    
+    uint8_t *centroids = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)nlist * (sqlite3_uint64)dim);
+    if (!centroids) return NULL;
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto ivf_load_centroids_cleanup;
     
+    int count = 0;
     while (1) {
         rc = sqlite3_step(vm);
         if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
-        else if (rc != SQLITE_ROW) break;
-        if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
-        
-        const void *blob = (float *)sqlite3_column_blob(vm, 1);
-        if (!blob) continue;
-        
-        int blob_size = sqlite3_column_bytes(vm, 1);
-        size_t need_bytes = (size_t)dim * (size_t)vector_type_to_size(type);
-        if (blob_size < need_bytes) {
-            context_result_error(context, SQLITE_ERROR, "Invalid vector blob found at rowid %lld.", (long long)sqlite3_column_int64(vm, 0));
-            rc = SQLITE_ERROR;
-            goto vector_rebuild_quantization_cleanup;
-        }
+        else if (rc != SQLITE_ROW) goto ivf_load_centroids_cleanup;
         
-        for (int i = 0; i < dim; ++i) {
-            float val = 0.0f;
-            switch (type) {
-                case VECTOR_TYPE_F32:
-                    val = ((float *)blob)[i];
-                    break;
-                case VECTOR_TYPE_F16:
-                    val = float16_to_float32(((uint16_t *)blob)[i]);
-                    break;
-                case VECTOR_TYPE_BF16:
-                    val = bfloat16_to_float32(((uint16_t *)blob)[i]);
-                    break;
-                case VECTOR_TYPE_U8:
-                    val = (float)(((uint8_t *)blob)[i]);
-                    break;
-                case VECTOR_TYPE_I8:
-                    val = (float)(((int8_t *)blob)[i]);
-                    break;
-                default:
-                    context_result_error(context, SQLITE_ERROR, "Unsupported vector type.");
-                    rc = SQLITE_ERROR;
-                    goto vector_rebuild_quantization_cleanup;
-            }
-
-            if (val < min_val) min_val = val;
-            if (val > max_val) max_val = val;
-            if (val < 0.0) contains_negative = true;
-        }
+        int partid = sqlite3_column_int(vm, 0);
+        const void *centroid = sqlite3_column_blob(vm, 1);
+        if ((partid < 0) || (partid >= nlist) || !centroid || (sqlite3_column_bytes(vm, 1) != dim)) {rc = SQLITE_CORRUPT; goto ivf_load_centroids_cleanup;}
+        memcpy(centroids + (size_t)partid * dim, centroid, dim);
+        ++count;
     }
+    if (count != nlist) rc = SQLITE_CORRUPT;
     
-    // set proper format
-    if (qtype == VECTOR_QUANT_AUTO) {
-        if (contains_negative == true) qtype = VECTOR_QUANT_S8BIT;
-        else qtype = VECTOR_QUANT_U8BIT;
+ivf_load_centroids_cleanup:
+    if (vm) sqlite3_finalize(vm);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(centroids);
+        return NULL;
+    }
+    return centroids;
+}
+
+static int ivf_candidate_cmp (const void *a, const void *b) {
+    float da = ((const ivf_candidate *)a)->distance;
+    float db = ((const ivf_candidate *)b)->distance;
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+// selects the nprobe partitions closest to the quantized query vector (returned array must be freed by the caller)
+static int *ivf_probe (const uint8_t *code, const uint8_t *centroids, int nlist, int dim, vector_qtype qtype, int nprobe) {
+    distance_function_t distance_fn = ivf_distance_function(qtype);
+    if (nprobe > nlist) nprobe = nlist;
+    
+    int *probes = (int *)sqlite3_malloc64((sqlite3_uint64)nprobe * sizeof(int));
+    ivf_candidate *candidates = (ivf_candidate *)sqlite3_malloc64((sqlite3_uint64)nlist * sizeof(ivf_candidate));
+    if (!probes || !candidates) {
+        if (probes) sqlite3_free(probes);
+        if (candidates) sqlite3_free(candidates);
+        return NULL;
     }
     
-    // STEP 2
-    // compute scale and offset and set table them to table context standard min-max linear quantization
-    float abs_max = fmaxf(fabsf(min_val), fabsf(max_val)); // only used in VECTOR_QUANT_S8BIT
-    float scale = (qtype == VECTOR_QUANT_U8BIT) ? (255.0f / (max_val - min_val)) : (127.0f / abs_max);
-    // in the VECTOR_QUANT_S8BIT version I am assuming a symmetric quantization, for asymmetric quantization min_val should be used
-    float offset = (qtype == VECTOR_QUANT_U8BIT) ? min_val : 0.0f;
+    for (int i=0; i<nlist; ++i) {
+        candidates[i].distance = distance_fn((const void *)code, (const void *)(centroids + (size_t)i * dim), dim);
+        candidates[i].partid = i;
+    }
+    qsort(candidates, nlist, sizeof(ivf_candidate), ivf_candidate_cmp);
+    for (int i=0; i<nprobe; ++i) probes[i] = candidates[i].partid;
     
-    t_ctx->options.q_type = qtype;
-    t_ctx->scale = scale;
-    t_ctx->offset = offset;
+    sqlite3_free(candidates);
+    return probes;
+}
+
+static int ivf_flush_partition (sqlite3 *db, const char *table_name, const char *column_name, ivf_partition *part, size_t q_size, vector_type norm_type, int partid) {
+    if (part->count == 0) return SQLITE_OK;
+    int rc = vector_serialize_quantization(db, table_name, column_name, part->count, part->data, (int)(q_size - sizeof(int64_t)), norm_type, part->min_rowid, part->max_rowid, partid);
+    part->count = 0;
+    return rc;
+}
+
+static int ivf_append_partition (ivf_partition *part, size_t q_size, int64_t rowid, uint8_t **slot) {
+    if (part->count == part->capacity) {
+        uint32_t capacity = (part->capacity) ? part->capacity * 2 : 64;
+        uint8_t *data = (uint8_t *)sqlite3_realloc64(part->data, (sqlite3_uint64)capacity * (sqlite3_uint64)q_size);
+        if (!data) return SQLITE_NOMEM;
+        part->data = data;
+        part->capacity = capacity;
+    }
+    if (part->count == 0) part->min_rowid = rowid;
+    part->max_rowid = rowid;
+    *slot = part->data + (size_t)part->count * q_size;
+    part->count++;
+    return SQLITE_OK;
+}
+
+static void ivf_free_partitions (ivf_partition *parts, int nlist) {
+    if (!parts) return;
+    for (int i=0; i<nlist; ++i) {
+        if (parts[i].data) sqlite3_free(parts[i].data);
+    }
+    sqlite3_free(parts);
+}
+
+// MARK: - PQ -
+
+#define PQ_DEFAULT_NBITS                            8
+#define PQ_DEFAULT_SUBVECTOR_DIM                    8
+#define PQ_TRAINING_POINTS_PER_CENTROID             32
+#define PQ_KMEANS_ITERATIONS                        10
+
+// default number of sub-quantizers: sub-vectors of PQ_DEFAULT_SUBVECTOR_DIM dimensions (or the closest smaller divisor of dim)
+static int pq_default_m (int dim) {
+    int dsub = PQ_DEFAULT_SUBVECTOR_DIM;
+    while (dsub > 1 && (dim % dsub) != 0) --dsub;
+    return dim / dsub;
+}
+
+// k-means (Lloyd) in float space, used to train each sub-quantizer codebook
+static int pq_kmeans (const float *points, int npoints, int d, int k, uint64_t *rng, float *centroids) {
+    distance_function_t distance_fn = dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32];
     
-    // restart processing from the beginning
-    rc = sqlite3_reset(vm);
-    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+    double *sums = (double *)sqlite3_malloc64((sqlite3_uint64)k * (sqlite3_uint64)d * sizeof(double));
+    int *counts = (int *)sqlite3_malloc64((sqlite3_uint64)k * sizeof(int));
+    int *indexes = (int *)sqlite3_malloc64((sqlite3_uint64)npoints * sizeof(int));
+    int rc = SQLITE_NOMEM;
+    if (!sums || !counts || !indexes) goto pq_kmeans_cleanup;
+    
+    // init centroids with distinct random points (partial Fisher-Yates on point indexes)
+    for (int i=0; i<npoints; ++i) indexes[i] = i;
+    for (int i=0; i<k; ++i) {
+        int j = i + (int)(random_next(rng) % (uint64_t)(npoints - i));
+        SWAP(int, indexes[i], indexes[j]);
+        memcpy(centroids + (size_t)i * d, points + (size_t)indexes[i] * d, (size_t)d * sizeof(float));
+    }
     
-    // STEP 3
-    // actual quantization (ONLY 8bit is supported in this version)
-    uint32_t n_processed = 0;
-    int64_t min_rowid = 0, max_rowid = 0;
-    while (1) {
-        rc = sqlite3_step(vm);
-        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
-        else if (rc != SQLITE_ROW) break;
-        if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
-        
-        int64_t rowid = (int64_t)sqlite3_column_int64(vm, 0);
-        const void *blob = sqlite3_column_blob(vm, 1);
-        if (!blob) continue;
-        
-        if (n_processed == 0) min_rowid = rowid;
-        VECTOR_PRINT((void *)blob, type, dim);
+    for (int iter=0; iter<PQ_KMEANS_ITERATIONS; ++iter) {
+        memset(sums, 0, (size_t)k * (size_t)d * sizeof(double));
+        memset(counts, 0, (size_t)k * sizeof(int));
         
-        // copy rowid
-        INT64_TO_INT8PTR(rowid, data);
-        data += sizeof(int64_t);
-        
-        // quantize vector
-        switch (type) {
-            case VECTOR_TYPE_F32: quantize_float32((const float *)blob, data, offset, scale, dim, qtype); break;
-            case VECTOR_TYPE_F16: quantize_float16((const uint16_t *)blob, data, offset, scale, dim, qtype); break;
-            case VECTOR_TYPE_BF16: quantize_bfloat16((const uint16_t *)blob, data, offset, scale, dim, qtype); break;
-            case VECTOR_TYPE_U8: quantize_u8((const uint8_t *)blob, data, offset, scale, dim, qtype); break;
-            case VECTOR_TYPE_I8: quantize_i8((const int8_t *)blob, data, offset, scale, dim, qtype); break;
+        // assignment step
+        for (int i=0; i<npoints; ++i) {
+            const float *point = points + (size_t)i * d;
+            int best = 0;
+            float best_distance = INFINITY;
+            for (int c=0; c<k; ++c) {
+                float dist = distance_fn((const void *)point, (const void *)(centroids + (size_t)c * d), d);
+                if (dist < best_distance) {best_distance = dist; best = c;}
+            }
+            double *sum = sums + (size_t)best * d;
+            for (int j=0; j<d; ++j) sum[j] += point[j];
+            counts[best]++;
         }
-        VECTOR_PRINT((void *)data, (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8, dim);
-        
-        data += (dim * sizeof(uint8_t));
-        max_rowid = rowid;
-        ++n_processed;
-        ++tot_processed;
         
-        if (n_processed == max_vectors) {
-            size_t batch_size = data - original;  // compute actual bytes used
-            rc = vector_serialize_quantization(db, table_name, column_name, n_processed, original, batch_size, min_rowid, max_rowid);
-            if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
-            n_processed = 0;
-            data = original;
+        // update step (empty clusters are re-seeded with a random point)
+        for (int c=0; c<k; ++c) {
+            float *centroid = centroids + (size_t)c * d;
+            if (counts[c] == 0) {
+                memcpy(centroid, points + (size_t)(random_next(rng) % (uint64_t)npoints) * d, (size_t)d * sizeof(float));
+                continue;
+            }
+            double *sum = sums + (size_t)c * d;
+            for (int j=0; j<d; ++j) centroid[j] = (float)(sum[j] / (double)counts[c]);
         }
     }
+    rc = SQLITE_OK;
     
-    // handle remaining vectors
-    if (n_processed > 0 && rc == SQLITE_OK) {
-        size_t batch_size = data - original;
-        rc = vector_serialize_quantization(db, table_name, column_name, n_processed, original, batch_size, min_rowid, max_rowid);
-    }
-    
-vector_rebuild_quantization_cleanup:
-    if (rc != SQLITE_OK) printf("Error in vector_rebuild_quantization: %s\n", sqlite3_errmsg(db));
-    if (original) sqlite3_free(original);
-    if (tempv) sqlite3_free(tempv);
-    if (vm) sqlite3_finalize(vm);
-    if (count) *count = tot_processed;
+pq_kmeans_cleanup:
+    if (sums) sqlite3_free(sums);
+    if (counts) sqlite3_free(counts);
+    if (indexes) sqlite3_free(indexes);
     return rc;
 }
 
-static void vector_quantize_preload (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
-    if (sanity_check_args(context, "vector_quantize_preload", argc, argv, 2, types) == false) return;
+// trains m independent codebooks of ksub centroids, codebook layout is [m][ksub][dim/m]
+static int pq_train (const float *samples, int nsamples, int dim, int m, int ksub, float *codebook) {
+    int dsub = dim / m;
+    uint64_t rng = random_seed();
     
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    float *points = (float *)sqlite3_malloc64((sqlite3_uint64)nsamples * (sqlite3_uint64)dsub * sizeof(float));
+    if (!points) return SQLITE_NOMEM;
     
-    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
-    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
-    if (!t_ctx) {
-        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize_preload().", table_name, column_name);
-        return;
+    int rc = SQLITE_OK;
+    for (int j=0; j<m && rc == SQLITE_OK; ++j) {
+        // gather the j-th sub-vector of every sample
+        for (int i=0; i<nsamples; ++i) {
+            memcpy(points + (size_t)i * dsub, samples + (size_t)i * dim + (size_t)j * dsub, (size_t)dsub * sizeof(float));
+        }
+        rc = pq_kmeans(points, nsamples, dsub, ksub, &rng, codebook + (size_t)j * ksub * dsub);
     }
     
-    if (t_ctx->preloaded) {
-        sqlite3_free(t_ctx->preloaded);
-        t_ctx->preloaded = NULL;
-        t_ctx->precounter = 0;
+    sqlite3_free(points);
+    return rc;
+}
+
+static void pq_encode (const float *v, const float *codebook, int dim, int m, int ksub, uint8_t *code) {
+    distance_function_t distance_fn = dispatch_distance_table[VECTOR_DISTANCE_SQUARED_L2][VECTOR_TYPE_F32];
+    int dsub = dim / m;
+    
+    for (int j=0; j<m; ++j) {
+        const float *sub = v + (size_t)j * dsub;
+        const float *centroids = codebook + (size_t)j * ksub * dsub;
+        int best = 0;
+        float best_distance = INFINITY;
+        for (int c=0; c<ksub; ++c) {
+            float dist = distance_fn((const void *)sub, (const void *)(centroids + (size_t)c * dsub), dsub);
+            if (dist < best_distance) {best_distance = dist; best = c;}
+        }
+        code[j] = (uint8_t)best;
     }
+}
+
+// builds the asymmetric distance lookup table for the query: lut[j * PQ_KSUB + c] is the partial distance between
+// the j-th query sub-vector and centroid c, so that summing one entry per sub-quantizer gives the distance to a code
+static void pq_build_lut (const float *q, const float *codebook, int dim, int m, int ksub, vector_distance vd, float *lut) {
+    int dsub = dim / m;
+    
+    // L2 tables contain squared partial distances (sqrt is applied by the PQ kernel), COSINE works on normalized vectors
+    // so it becomes 1 - dot spread across the m tables
+    vector_distance partial = vd;
+    if (vd == VECTOR_DISTANCE_L2) partial = VECTOR_DISTANCE_SQUARED_L2;
+    else if (vd == VECTOR_DISTANCE_COSINE) partial = VECTOR_DISTANCE_DOT;
+    distance_function_t distance_fn = dispatch_distance_table[partial][VECTOR_TYPE_F32];
+    float bias = (vd == VECTOR_DISTANCE_COSINE) ? (1.0f / (float)m) : 0.0f;
+    
+    for (int j=0; j<m; ++j) {
+        const float *sub = q + (size_t)j * dsub;
+        const float *centroids = codebook + (size_t)j * ksub * dsub;
+        float *table = lut + (size_t)j * PQ_KSUB;
+        for (int c=0; c<ksub; ++c) {
+            table[c] = bias + distance_fn((const void *)sub, (const void *)(centroids + (size_t)c * dsub), dsub);
+        }
+    }
+}
+
+static int pq_serialize_codebook (sqlite3 *db, const char *table_name, const char *column_name, const float *codebook, size_t size) {
+    char sql[STATIC_SQL_SIZE];
+    generate_insert_pq_table(table_name, column_name, sql);
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto pq_serialize_codebook_cleanup;
+    
+    rc = sqlite3_bind_blob64(vm, 1, (const void *)codebook, (sqlite3_uint64)size, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto pq_serialize_codebook_cleanup;
+    
+    rc = sqlite3_step(vm);
+    if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    
+pq_serialize_codebook_cleanup:
+    if (rc != SQLITE_OK) printf("Error in pq_serialize_codebook: %s\n", sqlite3_errmsg(db));
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
+// returns the PQ codebook of the table, loading it from the database the first time it is needed
+static float *table_context_pq_codebook (sqlite3 *db, table_context *t_ctx) {
+    if (t_ctx->pq_codebook) return t_ctx->pq_codebook;
+    
+    int dim = t_ctx->options.v_dim;
+    int m = t_ctx->options.pq_m;
+    int nbits = t_ctx->options.pq_nbits;
+    if (m <= 0 || (dim % m) != 0 || nbits < 1 || nbits > 8) return NULL;
+    size_t size = ((size_t)1 << nbits) * (size_t)dim * sizeof(float);
     
     char sql[STATIC_SQL_SIZE];
-    generate_memory_quant_table(table_name, column_name, sql);
-    sqlite3 *db = sqlite3_context_db_handle(context);
-    sqlite3_int64 required = sqlite_read_int64(db, sql);
-    if (required == 0) {
-        context_result_error(context, SQLITE_ERROR, "Unable to read data from database. Ensure that vector_quantize() has been called before using vector_quantize_preload().");
-        return;
-    }
+    generate_select_pq_table(t_ctx->t_name, t_ctx->c_name, sql);
     
-    int counter = 0;
-    void *buffer = (void *)sqlite3_malloc64(required);
-    if (!buffer) {
-        context_result_error(context, SQLITE_NOMEM, "Out of memory: unable to allocate %lld bytes for quant buffer.", (long long)required);
-        return;
-    }
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto table_context_pq_codebook_cleanup;
+    
+    rc = sqlite3_step(vm);
+    if (rc != SQLITE_ROW) goto table_context_pq_codebook_cleanup;
+    
+    const void *blob = sqlite3_column_blob(vm, 0);
+    if (!blob || (size_t)sqlite3_column_bytes(vm, 0) != size) goto table_context_pq_codebook_cleanup;
+    
+    t_ctx->pq_codebook = (float *)sqlite3_malloc64((sqlite3_uint64)size);
+    if (t_ctx->pq_codebook) memcpy(t_ctx->pq_codebook, blob, size);
+    
+table_context_pq_codebook_cleanup:
+    if (vm) sqlite3_finalize(vm);
+    return t_ctx->pq_codebook;
+}
+
+static void table_context_release_codebook (table_context *t_ctx) {
+    if (t_ctx->pq_codebook) sqlite3_free(t_ctx->pq_codebook);
+    t_ctx->pq_codebook = NULL;
+}
+
+static int vector_train_partitions (sqlite3_context *context, const char *table_name, const char *column_name, table_context *t_ctx, const int64_t *rowids, int nsamples, int nlist, uint8_t **centroids) {
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    int dim = t_ctx->options.v_dim;
+    vector_type type = t_ctx->options.v_type;
+    vector_qtype qtype = t_ctx->options.q_type;
+    size_t need_bytes = (size_t)dim * (size_t)vector_type_to_size(type);
     
-    generate_select_quant_table(table_name, column_name, sql);
+    uint8_t *samples = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)nsamples * (sqlite3_uint64)dim);
+    *centroids = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)nlist * (sqlite3_uint64)dim);
     
     int rc = SQLITE_NOMEM;
     sqlite3_stmt *vm = NULL;
+    if (!samples || !*centroids) goto vector_train_partitions_cleanup;
+    
+    // SELECT embedding FROM table WHERE pk=?
+    char sql[STATIC_SQL_SIZE];
+    generate_select_vector_by_pk(table_name, column_name, t_ctx->pk_name, sql);
     rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto vector_preload_cleanup;
+    if (rc != SQLITE_OK) goto vector_train_partitions_cleanup;
     
-    int seek = 0;
-    while (1) {
+    // training happens directly in the quantized space, so centroids can be compared with the stored codes
+    for (int i=0; i<nsamples; ++i) {
+        rc = sqlite3_bind_int64(vm, 1, (sqlite3_int64)rowids[i]);
+        if (rc != SQLITE_OK) goto vector_train_partitions_cleanup;
+        
         rc = sqlite3_step(vm);
-        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;} // return error: rebuild must be call (only if first time run)
-        else if (rc != SQLITE_ROW) goto vector_preload_cleanup;
+        if (rc != SQLITE_ROW) {rc = (rc == SQLITE_DONE) ? SQLITE_CORRUPT : rc; goto vector_train_partitions_cleanup;}
         
-        int n = sqlite3_column_int(vm, 0);
-        int bytes = sqlite3_column_bytes(vm, 1);
-        uint8_t *data = (uint8_t *)sqlite3_column_blob(vm, 1);
+        const void *blob = sqlite3_column_blob(vm, 0);
+        if (!blob || (size_t)sqlite3_column_bytes(vm, 0) < need_bytes) {rc = SQLITE_CORRUPT; goto vector_train_partitions_cleanup;}
+        quantize_vector(blob, samples + (size_t)i * dim, t_ctx->offset, t_ctx->scale, dim, type, qtype);
         
-        memcpy(buffer+seek, data, bytes);
-        seek += bytes;
-        counter += n;
+        rc = sqlite3_reset(vm);
+        if (rc != SQLITE_OK) goto vector_train_partitions_cleanup;
     }
-    rc = SQLITE_OK;
     
-    t_ctx->preloaded = buffer;
-    t_ctx->precounter = counter;
+    rc = ivf_train(samples, nsamples, dim, nlist, qtype, *centroids);
+    if (rc != SQLITE_OK) goto vector_train_partitions_cleanup;
     
-vector_preload_cleanup:
-    if (rc != SQLITE_OK) printf("Error in vector_quantize_preload: %s\n", sqlite3_errmsg(db));
+    rc = ivf_serialize_centroids(db, table_name, column_name, *centroids, nlist, dim);
+    
+vector_train_partitions_cleanup:
+    if (rc != SQLITE_OK) {
+        printf("Error in vector_train_partitions: %s\n", sqlite3_errmsg(db));
+        if (*centroids) sqlite3_free(*centroids);
+        *centroids = NULL;
+    }
+    if (samples) sqlite3_free(samples);
     if (vm) sqlite3_finalize(vm);
-    return;
+    return rc;
 }
 
-static int vector_quantize (sqlite3_context *context, const char *table_name, const char *column_name, const char *arg_options, bool *was_preloaded) {
-    table_context *t_ctx = vector_context_lookup((vector_context *)sqlite3_user_data(context), table_name, column_name);
-    if (!t_ctx) {
-        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize().", table_name, column_name);
-        return SQLITE_ERROR;
-    }
-    
-    uint32_t counter = 0;
-    int rc = SQLITE_ERROR;
-    char sql[STATIC_SQL_SIZE];
+static int vector_train_codebook (sqlite3_context *context, const char *table_name, const char *column_name, table_context *t_ctx, const int64_t *rowids, int nsamples, int m, int nbits) {
     sqlite3 *db = sqlite3_context_db_handle(context);
+    int dim = t_ctx->options.v_dim;
+    int ksub = 1 << nbits;
+    vector_type type = t_ctx->options.v_type;
+    size_t need_bytes = (size_t)dim * (size_t)vector_type_to_size(type);
+    bool normalize = (t_ctx->options.v_distance == VECTOR_DISTANCE_COSINE);
     
-    rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
-    
-    generate_drop_quant_table(table_name, column_name, sql);
-    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
+    float *samples = (float *)sqlite3_malloc64((sqlite3_uint64)nsamples * (sqlite3_uint64)dim * sizeof(float));
+    float *codebook = (float *)sqlite3_malloc64((sqlite3_uint64)ksub * (sqlite3_uint64)dim * sizeof(float));
     
-    generate_create_quant_table(table_name, column_name, sql);
-    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
+    int rc = SQLITE_NOMEM;
+    sqlite3_stmt *vm = NULL;
+    if (!samples || !codebook) goto vector_train_codebook_cleanup;
     
-    vector_options options = t_ctx->options; // t_ctx guarantees to exist
-    bool res = parse_keyvalue_string(context, arg_options, vector_keyvalue_callback, &options);
-    if (res == false) return SQLITE_ERROR;
+    // SELECT embedding FROM table WHERE pk=?
+    char sql[STATIC_SQL_SIZE];
+    generate_select_vector_by_pk(table_name, column_name, t_ctx->pk_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto vector_train_codebook_cleanup;
     
-    rc = vector_rebuild_quantization(context, table_name, column_name, t_ctx, options.q_type, options.max_memory, &counter);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
+    for (int i=0; i<nsamples; ++i) {
+        rc = sqlite3_bind_int64(vm, 1, (sqlite3_int64)rowids[i]);
+        if (rc != SQLITE_OK) goto vector_train_codebook_cleanup;
+        
+        rc = sqlite3_step(vm);
+        if (rc != SQLITE_ROW) {rc = (rc == SQLITE_DONE) ? SQLITE_CORRUPT : rc; goto vector_train_codebook_cleanup;}
+        
+        const void *blob = sqlite3_column_blob(vm, 0);
+        if (!blob || (size_t)sqlite3_column_bytes(vm, 0) < need_bytes) {rc = SQLITE_CORRUPT; goto vector_train_codebook_cleanup;}
+        float *sample = samples + (size_t)i * dim;
+        vector_to_float32(blob, sample, dim, type);
+        if (normalize) vector_normalize_float32(sample, dim);
+        
+        rc = sqlite3_reset(vm);
+        if (rc != SQLITE_OK) goto vector_train_codebook_cleanup;
+    }
     
-    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = pq_train(samples, nsamples, dim, m, ksub, codebook);
+    if (rc != SQLITE_OK) goto vector_train_codebook_cleanup;
     
-    // serialize quantization options
-    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTTYPE, t_ctx->options.q_type, 0);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
-    rc = sqlite_serialize(context, table_name, column_name, SQLITE_FLOAT, OPTION_KEY_QUANTSCALE, 0, t_ctx->scale);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
-    rc = sqlite_serialize(context, table_name, column_name, SQLITE_FLOAT, OPTION_KEY_QUANTOFFSET, 0, t_ctx->offset);
-    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = pq_serialize_codebook(db, table_name, column_name, codebook, (size_t)ksub * (size_t)dim * sizeof(float));
+    if (rc != SQLITE_OK) goto vector_train_codebook_cleanup;
     
-quantize_cleanup:
-    if (rc != SQLITE_OK) {
-        printf("%s", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
-        sqlite3_result_error_code(context, rc);
-        return rc;
-    }
+    // the freshly trained codebook becomes the cached one
+    table_context_release_codebook(t_ctx);
+    t_ctx->pq_codebook = codebook;
+    t_ctx->options.pq_m = m;
+    t_ctx->options.pq_nbits = nbits;
+    codebook = NULL;
     
-    // returns the total number of quantized rows
-    sqlite3_result_int64(context, (sqlite3_int64)counter);
-    if (was_preloaded) *was_preloaded = (t_ctx->preloaded != NULL);
-    return SQLITE_OK;
+vector_train_codebook_cleanup:
+    if (rc != SQLITE_OK) printf("Error in vector_train_codebook: %s\n", sqlite3_errmsg(db));
+    if (samples) sqlite3_free(samples);
+    if (codebook) sqlite3_free(codebook);
+    if (vm) sqlite3_finalize(vm);
+    return rc;
 }
 
-static void vector_quantize3 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    int types[] = {SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT};
-    if (sanity_check_args(context, "vector_quantize", argc, argv, 3, types) == false) return;
-    
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
-    const char *options = (const char *)sqlite3_value_text(argv[2]);
+// The rebuild reads the table once. Scale and offset (and the rows used to train IVF centroids and PQ codebooks) are
+// computed on a sample of VECTOR_QUANT_STATS_SAMPLES rows found by seeking random rowids, or on every row when the rowid
+// space is small enough that a sequential pass is cheaper than the seeks; values outside the sampled range are clamped
+// by quantization. The rowid space is then split in
+// ranges (at the sampled rowids, so that ranges hold about the same number of rows) quantized in rounds: each round
+// quantizes one range per thread, every worker with its own read-only connection, then the calling thread writes the
+// quantized rows in rowid order. A range a worker cannot read is quantized again on the calling connection.
+
+#define VECTOR_QUANT_STATS_SAMPLES                  65536
+#define VECTOR_QUANT_STATS_MIN_SPAN                 (4 * VECTOR_QUANT_STATS_SAMPLES)    // smaller rowid spaces are read entirely
+#define VECTOR_QUANT_ROUND_ROWS                     65536       // max rows quantized (by all the threads) in a round
+#define VECTOR_QUANT_CLIP_BINS                      4096        // bins of the histogram of all the values (clip)
+#define VECTOR_QUANT_CLIP_DIM_BINS                  512         // bins of the histogram of each dimension (clip with qrange=dimension)
+
+typedef struct {
+    int64_t             rows;                   // number of quantized rows
+    double              seconds;                // time spent by the rebuild
+    int                 threads;                // number of threads that quantized the rows
+} vector_rebuild_stats;
+
+typedef struct {
+    table_context       *t_ctx;
+    const char          *path;                  // database file opened by the workers
+    const char          *vfs;                   // VFS of the calling connection
+    vector_qtype        qtype;
+    float               offset;
+    float               scale;
+    const float         *dims;                  // per-dimension scales and offsets (NULL with a global range)
+    size_t              q_size;                 // rowid followed by the code
+    int                 pq_m;
+    int                 pq_ksub;
+    const uint8_t       *centroids;             // IVF centroids (NULL without partitions)
+    int                 nlist;
+    distance_function_t ivf_fn;
+} vector_rebuild_job;
+
+// rows with rowid in [first, last] quantized in ascending rowid order (rowid followed by the code, like the rows of a chunk)
+typedef struct {
+    const vector_rebuild_job *job;
+    sqlite3             *db;                    // connection the rows are read from
+    bool                own_db;                 // db is the private read-only connection of a worker
+    sqlite3_stmt        *vm;
+    int64_t             first;
+    int64_t             last;
+    uint8_t             *rows;                  // q_size bytes each
+    int                 *partids;               // IVF partition of each row (NULL without partitions)
+    int                 count;
+    int                 capacity;
+    float               *tempv;
+    int64_t             bad_rowid;              // row whose vector is shorter than the dimension (rc is SQLITE_ERROR)
+    int                 rc;
+} vector_rebuild_task;
+
+// updates the range of the values of v
+static void quant_stats_update (const void *v, int dim, vector_type type, float *min_val, float *max_val) {
+    float lo = *min_val, hi = *max_val;
+    
+    #define QUANT_STATS_LOOP(_expr)     for (int i=0; i<dim; ++i) {float val = (_expr); if (val < lo) lo = val; if (val > hi) hi = val;}
+    switch (type) {
+        case VECTOR_TYPE_F32: QUANT_STATS_LOOP(((const float *)v)[i]); break;
+        case VECTOR_TYPE_F16: QUANT_STATS_LOOP(float16_to_float32(((const uint16_t *)v)[i])); break;
+        case VECTOR_TYPE_BF16: QUANT_STATS_LOOP(bfloat16_to_float32(((const uint16_t *)v)[i])); break;
+        case VECTOR_TYPE_U8: QUANT_STATS_LOOP((float)((const uint8_t *)v)[i]); break;
+        case VECTOR_TYPE_I8: QUANT_STATS_LOOP((float)((const int8_t *)v)[i]); break;
+    }
+    #undef QUANT_STATS_LOOP
     
-    bool was_preloaded = false;
-    int rc = vector_quantize(context, table_name, column_name, options, &was_preloaded);
-    if ((rc == SQLITE_OK) && (was_preloaded)) vector_quantize_preload(context, argc, argv);
+    *min_val = lo;
+    *max_val = hi;
 }
 
-static void vector_quantize2 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
-    if (sanity_check_args(context, "vector_quantize", argc, argv, 2, types) == false) return;
-    
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
-    
-    bool was_preloaded = false;
-    int rc = vector_quantize(context, table_name, column_name, NULL, &was_preloaded);
-    if ((rc == SQLITE_OK) && (was_preloaded)) vector_quantize_preload(context, argc, argv);
+// updates the range of the values of each dimension of v (dim_min and dim_max hold dim values each)
+static void quant_stats_update_dims (const void *v, int dim, vector_type type, float *dim_min, float *dim_max) {
+    for (int i=0; i<dim; ++i) {
+        float val = 0.0f;
+        switch (type) {
+            case VECTOR_TYPE_F32: val = ((const float *)v)[i]; break;
+            case VECTOR_TYPE_F16: val = float16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_BF16: val = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_U8: val = (float)((const uint8_t *)v)[i]; break;
+            case VECTOR_TYPE_I8: val = (float)((const int8_t *)v)[i]; break;
+        }
+        if (val < dim_min[i]) dim_min[i] = val;
+        if (val > dim_max[i]) dim_max[i] = val;
+    }
 }
 
-static void vector_quantize_memory (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
-    if (sanity_check_args(context, "vector_quantize_memory", argc, argv, 2, types) == false) return;
-    
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
-    
-    char sql[STATIC_SQL_SIZE];
-    generate_memory_quant_table(table_name, column_name, sql);
-    
-    sqlite3 *db = sqlite3_context_db_handle(context);
-    sqlite3_int64 memory = sqlite_read_int64(db, sql);
-    sqlite3_result_int64(context, memory);
+// Streaming histogram used to estimate the quantiles of the sampled values (clip) without knowing their range in advance:
+// bins cover [lo, lo + width * nbins) and when a value falls outside, the width is doubled (merging pairs of bins) and
+// the covered range is extended on the side of the value, so the error of a quantile is at most one bin.
+typedef struct {
+    float               lo;
+    float               width;
+    int                 nbins;
+    uint32_t            *bins;
+    int64_t             count;
+} quant_histogram;
+
+static void quant_histogram_grow (quant_histogram *h, bool left) {
+    int half = h->nbins / 2;
+    if (left) {
+        for (int i=h->nbins-1; i>=half; --i) h->bins[i] = h->bins[(i - half) * 2] + h->bins[(i - half) * 2 + 1];
+        memset(h->bins, 0, (size_t)half * sizeof(uint32_t));
+        h->lo -= h->width * (float)h->nbins;
+    } else {
+        for (int i=0; i<half; ++i) h->bins[i] = h->bins[i * 2] + h->bins[i * 2 + 1];
+        memset(h->bins + half, 0, (size_t)half * sizeof(uint32_t));
+    }
+    h->width *= 2.0f;
 }
 
-static void vector_quantize_cleanup (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
-    if (sanity_check_args(context, "vector_quantize_cleanup", argc, argv, 2, types) == false) return;
-    
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+static void quant_histogram_add (quant_histogram *h, float x) {
+    if (!isfinite(x)) return;
     
-    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
-    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
-    if (!t_ctx) return; // if no table context exists then do nothing
+    // the first value sets the initial range to [x - |x|, x + |x|]
+    if (h->count == 0) {
+        float span = (fabsf(x) > 1e-6f) ? fabsf(x) : 1e-6f;
+        h->width = 2.0f * span / (float)h->nbins;
+        h->lo = x - span;
+    }
     
-    // release any memory used in quantization
-    if (t_ctx->preloaded) {
-        sqlite3_free(t_ctx->preloaded);
-        t_ctx->preloaded = NULL;
-        t_ctx->precounter = 0;
+    for (int i=0; i<256; ++i) {
+        if (x < h->lo) quant_histogram_grow(h, true);
+        else if (x >= h->lo + h->width * (float)h->nbins) quant_histogram_grow(h, false);
+        else break;
     }
     
-    // drop quant table (if any)
-    char sql[STATIC_SQL_SIZE];
-    sqlite3 *db = sqlite3_context_db_handle(context);
-    generate_drop_quant_table(table_name, column_name, sql);
-    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    int bin = (int)((x - h->lo) / h->width);
+    if (bin < 0) bin = 0;
+    if (bin >= h->nbins) bin = h->nbins - 1;
+    ++h->bins[bin];
+    ++h->count;
 }
 
-// MARK: -
+// value below which a fraction q of the values fall (linearly interpolated inside its bin)
+static float quant_histogram_quantile (const quant_histogram *h, double q) {
+    if (h->count == 0) return 0.0f;
+    double target = q * (double)h->count;
+    double seen = 0.0;
+    for (int i=0; i<h->nbins; ++i) {
+        if (h->bins[i] == 0) continue;
+        if (seen + h->bins[i] >= target) {
+            double frac = (target - seen) / (double)h->bins[i];
+            return h->lo + h->width * (float)((double)i + frac);
+        }
+        seen += h->bins[i];
+    }
+    return h->lo + h->width * (float)h->nbins;
+}
 
-static void *vector_from_json (sqlite3_context *context, sqlite3_vtab *vtab, vector_type type, const char *json, int *size, int dimension) {
-    char *blob = NULL;
-    
-    // skip leading whitespace
-    SKIP_SPACES(json);
-    
-    // sanity check the JSON start array character
-    if (*json != '[') {
-        return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: expected '[' at the beginning of the array.");
+// histograms of the values (a single one, or one for each dimension), the bins of all of them are allocated at once
+static quant_histogram *quant_histograms_create (int count, int nbins) {
+    size_t size = (size_t)count * (sizeof(quant_histogram) + (size_t)nbins * sizeof(uint32_t));
+    quant_histogram *h = (quant_histogram *)sqlite3_malloc64((sqlite3_uint64)size);
+    if (!h) return NULL;
+    memset(h, 0, size);
+    
+    uint32_t *bins = (uint32_t *)(h + count);
+    for (int i=0; i<count; ++i) {
+        h[i].nbins = nbins;
+        h[i].bins = bins + (size_t)i * nbins;
     }
-    json++;
+    return h;
+}
+
+// adds the values of v to the histogram of all the values (count == 1) or to the histogram of their dimension
+static void quant_histograms_update (quant_histogram *h, int count, const void *v, int dim, vector_type type) {
+    for (int i=0; i<dim; ++i) {
+        float val = 0.0f;
+        switch (type) {
+            case VECTOR_TYPE_F32: val = ((const float *)v)[i]; break;
+            case VECTOR_TYPE_F16: val = float16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_BF16: val = bfloat16_to_float32(((const uint16_t *)v)[i]); break;
+            case VECTOR_TYPE_U8: val = (float)((const uint8_t *)v)[i]; break;
+            case VECTOR_TYPE_I8: val = (float)((const int8_t *)v)[i]; break;
+        }
+        quant_histogram_add((count == 1) ? h : &h[i], val);
+    }
+}
+
+// narrows [*lo, *hi] to the 1-clip and clip quantiles of the values
+static void quant_histogram_clip (const quant_histogram *h, double clip, float *lo, float *hi) {
+    if (h->count == 0) return;
+    float qlo = quant_histogram_quantile(h, 1.0 - clip);
+    float qhi = quant_histogram_quantile(h, clip);
+    if (qlo > *lo) *lo = qlo;
+    if (qhi < *hi) *hi = qhi;
+    if (*hi < *lo) *hi = *lo;
+}
 
+static int vector_rebuild_task_grow (vector_rebuild_task *t) {
+    int capacity = (t->capacity) ? t->capacity * 2 : 1024;
+    uint8_t *rows = (uint8_t *)sqlite3_realloc64(t->rows, (sqlite3_uint64)capacity * t->job->q_size);
+    if (!rows) return SQLITE_NOMEM;
+    t->rows = rows;
     
-    // count number of commas to estimate (over-estimate) the number of entries in the json
-    int estimated_count = 0;
-    for (const char *p = json; *p; ++p) {
-        if (*p == ',') estimated_count++;
+    if (t->job->centroids) {
+        int *partids = (int *)sqlite3_realloc64(t->partids, (sqlite3_uint64)capacity * sizeof(int));
+        if (!partids) return SQLITE_NOMEM;
+        t->partids = partids;
     }
     
-    // allocate blob
-    size_t item_size = vector_type_to_size(type);
-    size_t alloc = (estimated_count + 1) * item_size;
-    blob = sqlite3_malloc((int)alloc);
-    if (!blob) {
-        return sqlite_common_set_error(context, vtab, SQLITE_NOMEM, "Out of memory: unable to allocate %lld bytes for BLOB buffer.", (long long)alloc);
+    t->capacity = capacity;
+    return SQLITE_OK;
+}
+
+static void vector_rebuild_task_run (void *arg) {
+    vector_rebuild_task *t = (vector_rebuild_task *)arg;
+    const vector_rebuild_job *job = t->job;
+    table_context *t_ctx = job->t_ctx;
+    int dim = t_ctx->options.v_dim;
+    vector_type type = t_ctx->options.v_type;
+    size_t need_bytes = (size_t)dim * vector_type_to_size(type);
+    int rc = SQLITE_OK;
+    t->count = 0;
+    t->bad_rowid = 0;
+    
+    // workers open their connection (and prepare their statement) once, the first time they run
+    if (!t->db) {
+        t->own_db = true;
+        rc = sqlite3_open_v2(job->path, &t->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, job->vfs);
+        if (rc != SQLITE_OK) goto task_done;
     }
     
-    // typed pointers
-    float      *float_blob    = (float *)blob;
-    uint8_t    *uint8_blob    = (uint8_t *)blob;
-    int8_t     *int8_blob     = (int8_t *)blob;
-    uint16_t   *uint16_blob   = (uint16_t *)blob;
-    uint16_t   *bfloat16_blob = (uint16_t *)blob;
+    if (!t->vm) {
+        char sql[STATIC_SQL_SIZE];
+        generate_select_from_table_range(t_ctx->t_name, t_ctx->c_name, t_ctx->pk_name, sql);
+        rc = sqlite3_prepare_v2(t->db, sql, -1, &t->vm, NULL);
+        if (rc != SQLITE_OK) goto task_done;
+    }
     
-    int count = 0;
-    const char *p = json;
-    while (*p) {
-        // skip whitespace
-        SKIP_SPACES(p);
-        
-        // check for end-of-array character
-        if (*p == ']') break;
-        
-        // parse number
-        char *endptr;
-        double value = strtod(p, &endptr);
-        
-        // sanity check
-        if (p == endptr) {
-            // parsing failed
-            sqlite3_free(blob);
-            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: expected a number at position %d (found '%c').", (int)(p - json) + 1, *p ? *p : '?');
-        }
+    if (!t->tempv && job->qtype == VECTOR_QUANT_PQ) {
+        t->tempv = (float *)sqlite3_malloc64((sqlite3_uint64)dim * sizeof(float));
+        if (!t->tempv) {rc = SQLITE_NOMEM; goto task_done;}
+    }
+    
+    sqlite3_bind_int64(t->vm, 1, (sqlite3_int64)t->first);
+    sqlite3_bind_int64(t->vm, 2, (sqlite3_int64)t->last);
+    while (1) {
+        rc = sqlite3_step(t->vm);
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
+        else if (rc != SQLITE_ROW) break;
+        if (sqlite3_column_type(t->vm, 1) == SQLITE_NULL) continue;
         
-        if (count >= (int)(alloc / item_size)) {
-            sqlite3_free(blob);
-            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Too many elements in JSON array.");
+        int64_t rowid = (int64_t)sqlite3_column_int64(t->vm, 0);
+        const void *blob = sqlite3_column_blob(t->vm, 1);
+        if (!blob) continue;
+        if ((size_t)sqlite3_column_bytes(t->vm, 1) < need_bytes) {
+            t->bad_rowid = rowid;
+            rc = SQLITE_ERROR;
+            break;
         }
         
-        // convert to proper type
-        switch (type) {
-            case VECTOR_TYPE_F32:
-                float_blob[count++] = (float)value;
-                break;
-                
-            case VECTOR_TYPE_F16:
-                uint16_blob[count++] = float32_to_float16((float)value);
-                break;
-
-            case VECTOR_TYPE_BF16:
-                bfloat16_blob[count++] = float32_to_bfloat16((float)value);
-                break;
-                
-            case VECTOR_TYPE_U8:
-                if (value < 0 || value > 255) {
-                    sqlite3_free(blob);
-                    return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Value out of range for uint8_t.");
-                }
-                uint8_blob[count++] = (uint8_t)value;
-                break;
-                
-            case VECTOR_TYPE_I8:
-                if (value < -128 || value > 127) {
-                    sqlite3_free(blob);
-                    return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Value out of range for int8_t.");
-                }
-                int8_blob[count++] = (int8_t)value;
-                break;
-                
-            default:
-                sqlite3_free(blob);
-                return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Unsupported vector type.");
+        if (t->count == t->capacity) {
+            rc = vector_rebuild_task_grow(t);
+            if (rc != SQLITE_OK) break;
         }
         
-        p = endptr;
-        
-        // skip whitespace
-        SKIP_SPACES(p);
+        uint8_t *slot = t->rows + (size_t)t->count * job->q_size;
+        uint8_t *code = slot + sizeof(int64_t);
+        INT64_TO_INT8PTR(rowid, slot);
         
-        if (*p == ',') {
-            // skip comma
-            p++;
-            
-            // skip any whitespace after comma
-            SKIP_SPACES(p);
-
-            // allow trailing comma before closing ]
-            if (*p == ']') break;
-        } else if (*p == ']') {
-            //end-of-array
-            break;
+        if (job->qtype == VECTOR_QUANT_PQ) {
+            vector_to_float32(blob, t->tempv, dim, type);
+            if (t_ctx->options.v_distance == VECTOR_DISTANCE_COSINE) vector_normalize_float32(t->tempv, dim);
+            pq_encode(t->tempv, t_ctx->pq_codebook, dim, job->pq_m, job->pq_ksub, code);
+        } else if (job->dims) {
+            quantize_vector_dims(blob, code, job->dims, dim, type, job->qtype);
         } else {
-            sqlite3_free(blob);
-            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: unexpected character '%c' at position %d.", *p ? *p : '?', (int)(p - json) + 1);
+            quantize_vector(blob, code, job->offset, job->scale, dim, type, job->qtype);
         }
+        
+        if (job->centroids) t->partids[t->count] = ivf_nearest(code, job->centroids, job->nlist, dim, job->ivf_fn);
+        ++t->count;
     }
+    sqlite3_reset(t->vm);
     
-    // sanity check vector dimension
-    if ((dimension > 0) && (dimension != count)) {
-        sqlite3_free(blob);
-        return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Invalid JSON vector dimension: expected %d but found %d.", dimension, count);
-    }
-    
-    if (size) *size = (int)(count * item_size);
-    return blob;
+task_done:
+    t->rc = rc;
 }
 
-static void vector_as_type (sqlite3_context *context, vector_type type, int argc, sqlite3_value **argv) {
-    sqlite3_value *value = argv[0];
-    int value_size = sqlite3_value_bytes(value);
-    int value_type = sqlite3_value_type(value);
+static void vector_rebuild_task_free (vector_rebuild_task *t) {
+    if (t->vm) sqlite3_finalize(t->vm);
+    if (t->db && t->own_db) sqlite3_close(t->db);
+    if (t->rows) sqlite3_free(t->rows);
+    if (t->partids) sqlite3_free(t->partids);
+    if (t->tempv) sqlite3_free(t->tempv);
+    memset(t, 0, sizeof(vector_rebuild_task));
+}
+
+static int vector_rebuild_quantization (sqlite3_context *context, const char *table_name, const char *column_name, table_context *t_ctx, const vector_options *options, vector_rebuild_stats *stats) {
     
-    // dimension is an optional argument
-    int dimension = (argc == 2) ? sqlite3_value_int(argv[1]) : 0;
+    vector_qtype qtype = options->q_type;
+    uint64_t max_memory = options->max_memory;
+    int nlist = options->nlist;
+    int rc = SQLITE_NOMEM;
+    sqlite3_stmt *vm = NULL;
+    char sql[STATIC_SQL_SIZE];
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    uint32_t tot_processed = 0;
+    int64_t start_time = vector_time_ms();
     
-    if (value_type == SQLITE_BLOB) {
-        // the only check we can perform is that the blob size is an exact multiplier of the vector type
-        if (value_size % vector_type_to_size(type) != 0) {
-            context_result_error(context, SQLITE_ERROR, "Invalid BLOB size for format '%s': size must be a multiple of %d bytes.", vector_type_to_name(type), vector_type_to_size(type));
-            return;
-        }
-        if (dimension > 0) {
-            int expected_size = (int)vector_type_to_size(type) * dimension;
-            if (value_size != expected_size) {
-                context_result_error(context, SQLITE_ERROR, "Invalid BLOB size for format '%s': expected dimension should be %d (BLOB is %d bytes instead of %d).", vector_type_to_name(type), dimension, value_size, expected_size);
-                return;
-            }
+    const char *pk_name = t_ctx->pk_name;
+    int dim = t_ctx->options.v_dim;
+    vector_type type = t_ctx->options.v_type;
+    
+    // PQ splits each vector in pq_m sub-vectors, each one encoded as a single byte
+    int pq_m = 0, pq_nbits = 0;
+    if (qtype == VECTOR_QUANT_PQ) {
+        pq_m = (options->pq_m > 0) ? options->pq_m : pq_default_m(dim);
+        pq_nbits = (options->pq_nbits > 0) ? options->pq_nbits : PQ_DEFAULT_NBITS;
+        if (pq_m > dim || (dim % pq_m) != 0) {
+            context_result_error(context, SQLITE_ERROR, "Invalid m value: vector dimension %d must be a multiple of m (%d).", dim, pq_m);
+            return SQLITE_ERROR;
         }
-        
-        sqlite3_result_value(context, value);
-        return;
     }
-    
-    if (value_type == SQLITE_TEXT) {
+    int code_size = (qtype == VECTOR_QUANT_PQ) ? pq_m : ((qtype == VECTOR_QUANT_BIT) ? (dim + 7) / 8 : dim);
+    if (quant_is_nibble(qtype)) code_size = (dim + 1) / 2;
+    
+    // per-dimension ranges (8-bit only), codes are followed by their norm
+    bool dim_ranges = options->dim_ranges;
+    float *dims = NULL;
+    quant_histogram *hist = NULL;
+    int nhist = 0;
+    if (dim_ranges) code_size = dim + (int)sizeof(float);
+    t_ctx->options.dim_ranges = false;
+    
+    // IVF state (only used when nlist > 0)
+    int64_t *samples = NULL;
+    uint8_t *centroids = NULL;
+    ivf_partition *parts = NULL;
+    int max_samples = 0, nsamples = 0;
+    int64_t nseen = 0;
+    uint64_t rng = random_seed();
+    distance_function_t ivf_fn = NULL;
+    t_ctx->options.nlist = 0;
+    
+    // rebuild state
+    int64_t *bounds = NULL;
+    int nbounds = 0;
+    int nthreads = 1;
+    vector_rebuild_task *tasks = NULL;
+    vector_thread *threads = NULL;
+    vector_rebuild_task local = {0};
+    
+    // compute size of a single quant, format is: rowid + quantize dimensions (or PQ codes)
+    size_t q_size = sizeof(int64_t) + (size_t)code_size * sizeof(uint8_t);
+    if (q_size == 0) {
+        sqlite3_result_error(context, "Vector dimension is zero, which is not possible.", -1);
+        return SQLITE_MISUSE;
+    }
+    
+    // max_memory == 0 means use all required memory
+    int64_t nrows = -1;
+    if (max_memory == 0) {
+        sqlite3_snprintf(sizeof(sql), sql, "SELECT COUNT(*) FROM %q;", table_name);
+        nrows = sqlite_read_int64(db, sql);
+        max_memory = (nrows == 0) ? DEFAULT_MAX_MEMORY : (uint64_t)nrows * (uint64_t)q_size;
+        if (nrows <= 0) {
+            // no vectors (and nothing to train a PQ codebook on)
+            t_ctx->options.q_type = (qtype == VECTOR_QUANT_AUTO || qtype == VECTOR_QUANT_PQ) ? VECTOR_QUANT_U8BIT : qtype;
+            t_ctx->scale = 1.0f;
+            t_ctx->offset = 0.0f;
+            if (t_ctx->qdims) sqlite3_free(t_ctx->qdims);
+            t_ctx->qdims = NULL;
+            return SQLITE_OK;
+        }
+    }
+    
+    // max number of vectors that fits in max_memory (per batch; force at least 1)
+    uint32_t max_vectors = (uint32_t)(max_memory / (uint64_t)q_size);
+    if (max_vectors == 0) max_vectors = 1;
+    
+    sqlite3_uint64 out_bytes = (sqlite3_uint64)max_vectors * (sqlite3_uint64)q_size;
+    uint8_t *data = sqlite3_malloc64(out_bytes);
+    uint8_t *original = data;
+    if (!data) goto vector_rebuild_quantization_cleanup;
+    
+    // per-dimension minimum and maximum, replaced by the scales and offsets of the dimensions in STEP 3
+    if (dim_ranges) {
+        dims = (float *)sqlite3_malloc64((sqlite3_uint64)dim * 2 * sizeof(float));
+        if (!dims) goto vector_rebuild_quantization_cleanup;
+        for (int i=0; i<dim; ++i) {
+            #if defined(_WIN32) || defined(__linux__)
+            dims[i] = FLT_MAX;
+            dims[dim + i] = -FLT_MAX;
+            #else
+            dims[i] = MAXFLOAT;
+            dims[dim + i] = -MAXFLOAT;
+            #endif
+        }
+    }
+    
+    // histograms of the sampled values, used to clip the outliers out of the quantization range
+    if (options->clip > 0.0 && qtype != VECTOR_QUANT_PQ) {
+        nhist = (dims) ? dim : 1;
+        hist = quant_histograms_create(nhist, (dims) ? VECTOR_QUANT_CLIP_DIM_BINS : VECTOR_QUANT_CLIP_BINS);
+        if (!hist) goto vector_rebuild_quantization_cleanup;
+    }
+    
+    if (nlist > 0 || qtype == VECTOR_QUANT_PQ) {
+        // reservoir of rowids used to train the coarse quantizer and/or the PQ codebooks
+        int64_t points = (int64_t)nlist * IVF_TRAINING_POINTS_PER_LIST;
+        if (qtype == VECTOR_QUANT_PQ) points = ((int64_t)1 << pq_nbits) * PQ_TRAINING_POINTS_PER_CENTROID;
+        max_samples = (points > IVF_MAX_TRAINING_POINTS) ? IVF_MAX_TRAINING_POINTS : (int)points;
+        samples = (int64_t *)sqlite3_malloc64((sqlite3_uint64)max_samples * sizeof(int64_t));
+        if (!samples) goto vector_rebuild_quantization_cleanup;
+    }
+    
+    // STEP 1
+    // rowid space of the table, rows are sampled when it holds at least VECTOR_QUANT_STATS_MIN_SPAN rowids
+    generate_select_pk_bounds(table_name, pk_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+    rc = sqlite3_step(vm);
+    if (rc != SQLITE_ROW) goto vector_rebuild_quantization_cleanup;
+    bool empty = (sqlite3_column_type(vm, 0) == SQLITE_NULL);
+    int64_t first_rowid = (int64_t)sqlite3_column_int64(vm, 0);
+    int64_t last_rowid = (int64_t)sqlite3_column_int64(vm, 1);
+    sqlite3_finalize(vm);
+    vm = NULL;
+    
+    // span is 0 when the rowids cover the whole int64 range
+    uint64_t span = (uint64_t)last_rowid - (uint64_t)first_rowid + 1;
+    bool sampled = (!empty) && ((span == 0) || (span >= VECTOR_QUANT_STATS_MIN_SPAN));
+    
+    // rowids of the sampled rows (all of them when the rowid space is smaller than VECTOR_QUANT_STATS_MIN_SPAN),
+    // a small table only needs room for the rowids of its span
+    int bounds_capacity = (sampled) ? VECTOR_QUANT_STATS_SAMPLES : ((empty) ? 1 : (int)span);
+    bounds = (int64_t *)sqlite3_malloc64((sqlite3_uint64)bounds_capacity * sizeof(int64_t));
+    if (!bounds) {rc = SQLITE_NOMEM; goto vector_rebuild_quantization_cleanup;}
+    
+    // STEP 2
+    // find global min/max across the sampled vectors (the rowids they belong to split the table in ranges)
+    #if defined(_WIN32) || defined(__linux__)
+    float min_val = FLT_MAX;
+    float max_val = -FLT_MAX;
+    #else 
+    float min_val = MAXFLOAT;
+    float max_val = -MAXFLOAT;
+    #endif
+    
+    if (sampled) generate_select_from_table_seek(table_name, column_name, pk_name, sql);
+    else generate_select_from_table(table_name, column_name, pk_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+    
+    int nseeks = 0;
+    while (!empty) {
+        if (sampled) {
+            if (nseeks == VECTOR_QUANT_STATS_SAMPLES) {rc = SQLITE_OK; break;}
+            uint64_t delta = random_next(&rng);
+            if (span) delta %= span;
+            sqlite3_reset(vm);
+            sqlite3_bind_int64(vm, 1, (sqlite3_int64)((uint64_t)first_rowid + delta));
+            ++nseeks;
+        }
+        
+        rc = sqlite3_step(vm);
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; if (sampled) continue; break;}
+        else if (rc != SQLITE_ROW) break;
+        
+        int64_t rowid = (int64_t)sqlite3_column_int64(vm, 0);
+        if (nbounds < bounds_capacity) bounds[nbounds++] = rowid;
+        if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
+        
+        const void *blob = sqlite3_column_blob(vm, 1);
+        if (!blob) continue;
+        
+        size_t need_bytes = (size_t)dim * (size_t)vector_type_to_size(type);
+        if ((size_t)sqlite3_column_bytes(vm, 1) < need_bytes) {
+            context_result_error(context, SQLITE_ERROR, "Invalid vector blob found at rowid %lld.", (long long)rowid);
+            rc = SQLITE_ERROR;
+            goto vector_rebuild_quantization_cleanup;
+        }
+        
+        quant_stats_update(blob, dim, type, &min_val, &max_val);
+        if (dims) quant_stats_update_dims(blob, dim, type, dims, dims + dim);
+        if (hist) quant_histograms_update(hist, nhist, blob, dim, type);
+        
+        if (samples) {
+            if (nsamples < max_samples) samples[nsamples++] = rowid;
+            else {
+                uint64_t j = random_next(&rng) % (uint64_t)(nseen + 1);
+                if (j < (uint64_t)max_samples) samples[j] = rowid;
+            }
+            ++nseen;
+        }
+    }
+    if (rc == SQLITE_ROW) rc = SQLITE_OK;
+    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+    sqlite3_finalize(vm);
+    vm = NULL;
+    
+    // sampled rowids are in random order (and can repeat)
+    if (sampled) {
+        qsort(bounds, (size_t)nbounds, sizeof(int64_t), vector_rowid_compare);
+        int n = 0;
+        for (int i=0; i<nbounds; ++i) if (n == 0 || bounds[i] != bounds[n-1]) bounds[n++] = bounds[i];
+        nbounds = n;
+    }
+    bool contains_negative = (min_val < 0.0f);
+    
+    // values outside the clipped range saturate to the first and last levels
+    if (hist) {
+        if (dims) for (int i=0; i<dim; ++i) quant_histogram_clip(&hist[i], options->clip, &dims[i], &dims[dim + i]);
+        else quant_histogram_clip(hist, options->clip, &min_val, &max_val);
+    }
+    
+    // set proper format
+    if (qtype == VECTOR_QUANT_AUTO) {
+        if (contains_negative == true) qtype = VECTOR_QUANT_S8BIT;
+        else qtype = VECTOR_QUANT_U8BIT;
+    }
+    
+    // STEP 3
+    // compute scale and offset and set table them to table context standard min-max linear quantization
+    float abs_max = fmaxf(fabsf(min_val), fabsf(max_val)); // only used in VECTOR_QUANT_S8BIT
+    float scale = (qtype == VECTOR_QUANT_U8BIT) ? (255.0f / (max_val - min_val)) : (127.0f / abs_max);
+    // in the VECTOR_QUANT_S8BIT version I am assuming a symmetric quantization, for asymmetric quantization min_val should be used
+    float offset = (qtype == VECTOR_QUANT_U8BIT) ? min_val : 0.0f;
+    
+    // 4-bit versions use the same mappings on 0..15 and -7..7
+    if (qtype == VECTOR_QUANT_U4BIT) scale = 15.0f / (max_val - min_val);
+    if (qtype == VECTOR_QUANT_S4BIT) scale = 7.0f / abs_max;
+    if (quant_is_nibble(qtype)) offset = (qtype == VECTOR_QUANT_U4BIT) ? min_val : 0.0f;
+    
+    // in the VECTOR_QUANT_BIT version offset is the threshold: the sign for signed data, the middle of the range otherwise
+    if (qtype == VECTOR_QUANT_BIT) {
+        scale = 1.0f;
+        offset = (contains_negative) ? 0.0f : (min_val + max_val) * 0.5f;
+    }
+    
+    // with per-dimension ranges the same mappings are applied to the range of each dimension (a dimension with a
+    // single value keeps a unit scale), the global scale and offset are kept for reference only
+    if (dims) {
+        for (int i=0; i<dim; ++i) {
+            float lo = dims[i], hi = dims[dim + i];
+            float range = (qtype == VECTOR_QUANT_U8BIT) ? (hi - lo) : fmaxf(fabsf(lo), fabsf(hi));
+            float levels = (qtype == VECTOR_QUANT_U8BIT) ? 255.0f : 127.0f;
+            dims[i] = (range > 0.0f && isfinite(range)) ? levels / range : 1.0f;
+            dims[dim + i] = (qtype == VECTOR_QUANT_U8BIT && lo <= hi) ? lo : 0.0f;
+        }
+    }
+    
+    t_ctx->options.q_type = qtype;
+    t_ctx->scale = scale;
+    t_ctx->offset = offset;
+    if (t_ctx->qdims) sqlite3_free(t_ctx->qdims);
+    t_ctx->qdims = dims;
+    t_ctx->options.dim_ranges = (dims != NULL);
+    dims = NULL;
+    
+    // OPTIONAL STEP
+    // train PQ codebooks on the sampled rows (codebook size cannot exceed the number of available samples)
+    if (qtype == VECTOR_QUANT_PQ && nsamples == 0) {
+        // no vectors
+        qtype = VECTOR_QUANT_U8BIT;
+        t_ctx->options.q_type = qtype;
+    }
+    if (qtype == VECTOR_QUANT_PQ) {
+        while (pq_nbits > 1 && (1 << pq_nbits) > nsamples) --pq_nbits;
+        if (nsamples < (1 << pq_nbits)) {
+            context_result_error(context, SQLITE_ERROR, "Not enough vectors to train PQ codebooks (found %d).", nsamples);
+            rc = SQLITE_ERROR;
+            goto vector_rebuild_quantization_cleanup;
+        }
+        rc = vector_train_codebook(context, table_name, column_name, t_ctx, samples, nsamples, pq_m, pq_nbits);
+        if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+    }
+    
+    // OPTIONAL STEP
+    // train IVF centroids on the sampled rows (nlist cannot exceed the number of available samples)
+    if (nlist > 0 && nsamples > 0) {
+        if (nlist > nsamples) nlist = nsamples;
+        rc = vector_train_partitions(context, table_name, column_name, t_ctx, samples, nsamples, nlist, &centroids);
+        if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+        
+        parts = (ivf_partition *)sqlite3_malloc64((sqlite3_uint64)nlist * sizeof(ivf_partition));
+        if (!parts) {rc = SQLITE_NOMEM; goto vector_rebuild_quantization_cleanup;}
+        memset(parts, 0, (size_t)nlist * sizeof(ivf_partition));
+        
+        ivf_fn = ivf_distance_function(qtype);
+        t_ctx->options.nlist = nlist;
+    }
+    
+    // STEP 4
+    // actual quantization, in rounds of ranges of rows (workers only see committed data of a file based database,
+    // the source table has no pending writes because the rebuild runs in its own transaction)
+    vector_rebuild_job job = {t_ctx, sqlite3_db_filename(db, "main"), vector_thread_vfs(db), qtype, offset, scale, t_ctx->qdims, q_size, pq_m, 1 << pq_nbits, (parts) ? centroids : NULL, nlist, ivf_fn};
+    nthreads = (options->threads > 1) ? options->threads : 1;
+    if (!job.path || job.path[0] == 0) nthreads = 1;
+    
+    tasks = (vector_rebuild_task *)sqlite3_malloc64(sizeof(vector_rebuild_task) * nthreads);
+    threads = (vector_thread *)sqlite3_malloc64(sizeof(vector_thread) * nthreads);
+    if (!tasks || !threads) {rc = SQLITE_NOMEM; goto vector_rebuild_quantization_cleanup;}
+    memset(tasks, 0, sizeof(vector_rebuild_task) * nthreads);
+    for (int i=0; i<nthreads; ++i) tasks[i].job = &job;
+    if (nthreads == 1) tasks[0].db = db;
+    local.job = &job;
+    local.db = db;
+    
+    // a round quantizes at most VECTOR_QUANT_ROUND_ROWS rows (and no more than max_memory), a range covers step bounds:
+    // each bound is a row when every row was sampled, otherwise the rowid span (an upper bound of the number of rows) is used
+    int64_t range_rows = (int64_t)((max_vectors < VECTOR_QUANT_ROUND_ROWS) ? max_vectors : VECTOR_QUANT_ROUND_ROWS) / nthreads;
+    if (range_rows < 1) range_rows = 1;
+    double total_rows = (!sampled) ? (double)nbounds : ((nrows > 0) ? (double)nrows : ((span) ? (double)span : 18446744073709551616.0));
+    double bound_rows = (nbounds > 0) ? total_rows / nbounds : 1.0;
+    double range_bounds = ceil((double)range_rows / bound_rows);
+    int step = (range_bounds < 1.0) ? 1 : ((range_bounds > (double)VECTOR_QUANT_STATS_MIN_SPAN) ? VECTOR_QUANT_STATS_MIN_SPAN : (int)range_bounds);
+    
+    vector_type norm_type = quant_norm_type(&t_ctx->options);
+    uint32_t n_processed = 0;
+    int64_t min_rowid = 0, max_rowid = 0;
+    int bindex = 0;
+    int64_t next_rowid = first_rowid;
+    bool done = empty;
+    while (!done) {
+        int ntasks = 0;
+        while ((ntasks < nthreads) && !done) {
+            vector_rebuild_task *t = &tasks[ntasks++];
+            bindex += step;
+            t->first = next_rowid;
+            t->last = (bindex < nbounds) ? bounds[bindex] - 1 : last_rowid;
+            done = (t->last == last_rowid);
+            if (!done) next_rowid = t->last + 1;
+        }
+        
+        if (nthreads == 1) vector_rebuild_task_run(&tasks[0]);
+        else {
+            for (int i=0; i<ntasks; ++i) vector_thread_start(&threads[i], vector_rebuild_task_run, &tasks[i]);
+            for (int i=0; i<ntasks; ++i) vector_thread_join(&threads[i]);
+        }
+        
+        // ranges are written in rowid order
+        for (int i=0; i<ntasks; ++i) {
+            vector_rebuild_task *t = &tasks[i];
+            
+            // a range a worker cannot read (for example because of locking) is quantized on the calling connection
+            if ((t->rc != SQLITE_OK) && (t->db != db)) {
+                local.first = t->first;
+                local.last = t->last;
+                vector_rebuild_task_run(&local);
+                t = &local;
+            }
+            
+            rc = t->rc;
+            if (rc != SQLITE_OK) {
+                if (t->bad_rowid) context_result_error(context, SQLITE_ERROR, "Invalid vector blob found at rowid %lld.", (long long)t->bad_rowid);
+                goto vector_rebuild_quantization_cleanup;
+            }
+            
+            for (int j=0; j<t->count; ++j) {
+                const uint8_t *row = t->rows + (size_t)j * q_size;
+                int64_t rowid = INT64_FROM_INT8PTR(row);
+                
+                if (parts) {
+                    // append to the closest partition
+                    uint8_t *slot = NULL;
+                    rc = ivf_append_partition(&parts[t->partids[j]], q_size, rowid, &slot);
+                    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+                    memcpy(slot, row, q_size);
+                    ++n_processed;
+                    ++tot_processed;
+                    
+                    // buffered rows exceed max_memory, so flush the largest partition
+                    if (n_processed >= max_vectors) {
+                        int largest = 0;
+                        for (int k=1; k<nlist; ++k) if (parts[k].count > parts[largest].count) largest = k;
+                        n_processed -= parts[largest].count;
+                        rc = ivf_flush_partition(db, table_name, column_name, &parts[largest], q_size, norm_type, largest);
+                        if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+                    }
+                    continue;
+                }
+                
+                if (n_processed == 0) min_rowid = rowid;
+                memcpy(data, row, q_size);
+                data += q_size;
+                max_rowid = rowid;
+                ++n_processed;
+                ++tot_processed;
+                
+                if (n_processed == max_vectors) {
+                    rc = vector_serialize_quantization(db, table_name, column_name, n_processed, original, code_size, norm_type, min_rowid, max_rowid, 0);
+                    if (rc != SQLITE_OK) goto vector_rebuild_quantization_cleanup;
+                    n_processed = 0;
+                    data = original;
+                }
+            }
+        }
+    }
+    
+    // handle remaining vectors
+    if (parts) {
+        for (int i=0; i<nlist && rc == SQLITE_OK; ++i) {
+            rc = ivf_flush_partition(db, table_name, column_name, &parts[i], q_size, norm_type, i);
+        }
+    } else if (n_processed > 0 && rc == SQLITE_OK) {
+        rc = vector_serialize_quantization(db, table_name, column_name, n_processed, original, code_size, norm_type, min_rowid, max_rowid, 0);
+    }
+    
+vector_rebuild_quantization_cleanup:
+    if (rc != SQLITE_OK) printf("Error in vector_rebuild_quantization: %s\n", sqlite3_errmsg(db));
+    if (original) sqlite3_free(original);
+    if (samples) sqlite3_free(samples);
+    if (centroids) sqlite3_free(centroids);
+    ivf_free_partitions(parts, nlist);
+    if (bounds) sqlite3_free(bounds);
+    if (dims) sqlite3_free(dims);
+    if (hist) sqlite3_free(hist);
+    if (tasks) {
+        for (int i=0; i<nthreads; ++i) vector_rebuild_task_free(&tasks[i]);
+        sqlite3_free(tasks);
+    }
+    if (threads) sqlite3_free(threads);
+    vector_rebuild_task_free(&local);
+    if (vm) sqlite3_finalize(vm);
+    if (stats) {
+        stats->rows = tot_processed;
+        stats->seconds = (double)(vector_time_ms() - start_time) / 1000.0;
+        stats->threads = nthreads;
+    }
+    return rc;
+}
+
+// MARK: - Preload File -
+
+// A preload file holds the same rows vector_quantize_preload copies in memory, so that they can be mapped read-only:
+// startup does not read nor copy them, the page cache is shared by all the processes of the host and cold pages
+// can be evicted by the kernel. Each section starts at a page aligned offset. The file is written with the native
+// byte order, and it is rewritten every time its header does not match the current quantization.
+
+#define VECTOR_PRELOAD_FILE_MAGIC                   "SQLVQNT1"
+#define VECTOR_PRELOAD_FILE_VERSION                 3
+#define VECTOR_PRELOAD_FILE_ALIGN                   4096
+
+typedef struct {
+    char            magic[8];
+    uint32_t        version;                // also detects a file written with a different byte order
+    uint32_t        header_size;
+    int32_t         dim;
+    int32_t         qtype;
+    int32_t         nlist;
+    int32_t         sorted;
+    float           scale;
+    float           offset;
+    int64_t         count;                  // number of rows
+    int64_t         generation;             // quantization generation the rows belong to
+    int64_t         code_size;              // bytes per quantized code
+    int64_t         codes_offset;           // codes of all the rows
+    int64_t         rowids_offset;          // rowids of all the rows
+    int64_t         norms_offset;           // norms of all the codes (0 when not stored)
+    int64_t         partitions_offset;      // IVF partition offsets (0 without IVF)
+    int64_t         centroids_offset;       // IVF centroids (0 without IVF)
+    int64_t         size;                   // total file size
+} vector_preload_header;
+
+static int64_t vector_preload_file_align (int64_t n) {
+    return (n + VECTOR_PRELOAD_FILE_ALIGN - 1) & ~(int64_t)(VECTOR_PRELOAD_FILE_ALIGN - 1);
+}
+
+static void vector_preload_file_layout (vector_preload_header *h, const table_context *t_ctx, int64_t generation, int64_t count, bool sorted) {
+    memset(h, 0, sizeof(vector_preload_header));
+    memcpy(h->magic, VECTOR_PRELOAD_FILE_MAGIC, sizeof(h->magic));
+    h->version = VECTOR_PRELOAD_FILE_VERSION;
+    h->header_size = (uint32_t)sizeof(vector_preload_header);
+    h->dim = t_ctx->options.v_dim;
+    h->qtype = t_ctx->options.q_type;
+    h->nlist = t_ctx->options.nlist;
+    h->sorted = sorted;
+    h->scale = t_ctx->scale;
+    h->offset = t_ctx->offset;
+    h->count = count;
+    h->generation = generation;
+    h->code_size = quant_code_size(&t_ctx->options);
+    h->codes_offset = VECTOR_PRELOAD_FILE_ALIGN;
+    h->rowids_offset = vector_preload_file_align(h->codes_offset + count * h->code_size);
+    h->size = h->rowids_offset + count * (int64_t)sizeof(int64_t);
+    
+    if (quant_norm_type(&t_ctx->options)) {
+        h->norms_offset = vector_preload_file_align(h->size);
+        h->size = h->norms_offset + count * (int64_t)sizeof(float);
+    }
+    
+    if (h->nlist > 0) {
+        h->partitions_offset = vector_preload_file_align(h->size);
+        h->centroids_offset = vector_preload_file_align(h->partitions_offset + (int64_t)(h->nlist + 1) * (int64_t)sizeof(int));
+        h->size = h->centroids_offset + (int64_t)h->nlist * h->dim;
+    }
+}
+
+#if defined(VECTOR_MMAP_DISABLED)
+static void *vector_preload_file_map (const char *path, size_t *size) {
+    return NULL;
+}
+
+static void vector_preload_file_unmap (void *map, size_t size) {
+}
+#elif defined(_WIN32)
+static void *vector_preload_file_map (const char *path, size_t *size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    
+    void *map = NULL;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && (file_size.QuadPart > 0) && ((uint64_t)file_size.QuadPart <= SIZE_MAX)) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return map;
+}
+
+static void vector_preload_file_unmap (void *map, size_t size) {
+    UnmapViewOfFile(map);
+}
+#else
+static void *vector_preload_file_map (const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    
+    void *map = NULL;
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0) && ((uint64_t)st.st_size <= SIZE_MAX)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+static void vector_preload_file_unmap (void *map, size_t size) {
+    munmap(map, size);
+}
+#endif
+
+static vector_preload *vector_preload_file_open (const char *path, const vector_preload_header *expected) {
+    size_t size = 0;
+    uint8_t *map = (uint8_t *)vector_preload_file_map(path, &size);
+    if (!map) return NULL;
+    
+    // the sorted flag is the only field that cannot be known before reading the rows
+    vector_preload_header h, e = *expected;
+    memset(&h, 0, sizeof(vector_preload_header));
+    if (size >= sizeof(vector_preload_header)) memcpy(&h, map, sizeof(vector_preload_header));
+    e.sorted = h.sorted;
+    if ((size < sizeof(vector_preload_header)) || (memcmp(&h, &e, sizeof(vector_preload_header)) != 0) || ((uint64_t)h.size != (uint64_t)size)) {
+        vector_preload_file_unmap(map, size);
+        return NULL;
+    }
+    
+    vector_preload *p = (vector_preload *)sqlite3_malloc(sizeof(vector_preload));
+    if (!p) {
+        vector_preload_file_unmap(map, size);
+        return NULL;
+    }
+    
+    memset(p, 0, sizeof(vector_preload));
+    p->refcount = 1;
+    p->map = map;
+    p->map_size = size;
+    p->codes = map + h.codes_offset;
+    p->rowids = map + h.rowids_offset;
+    p->norms = (h.norms_offset) ? map + h.norms_offset : NULL;
+    p->counter = (int)h.count;
+    p->partitions = (h.partitions_offset) ? (int *)(map + h.partitions_offset) : NULL;
+    p->centroids = (h.centroids_offset) ? map + h.centroids_offset : NULL;
+    p->sorted = (h.sorted != 0);
+    return p;
+}
+
+// the path passed with file= is only overwritten or removed if it does not exist or holds a preload file,
+// so that a wrong path cannot destroy an unrelated file
+static bool vector_preload_file_replaceable (const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return (errno == ENOENT);
+    
+    char magic[sizeof(VECTOR_PRELOAD_FILE_MAGIC) - 1];
+    bool replaceable = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) && (memcmp(magic, VECTOR_PRELOAD_FILE_MAGIC, sizeof(magic)) == 0);
+    fclose(f);
+    return replaceable;
+}
+
+static int vector_preload_file_write (FILE *f, int64_t offset, const void *data, size_t size) {
+    if (fseek(f, (long)offset, SEEK_SET) != 0) return SQLITE_IOERR;
+    if (size && fwrite(data, 1, size, f) != size) return SQLITE_IOERR;
+    return SQLITE_OK;
+}
+
+static int vector_preload_file_export (const char *path, const vector_preload_header *h, const vector_preload *p) {
+    if ((h->size > LONG_MAX) || (h->count != p->counter)) return SQLITE_TOOBIG;
+    
+    // rows are written to a temporary file and then renamed, so that other processes still mapping the previous file are not affected
+    char *temp = sqlite3_mprintf("%s-tmp", path);
+    if (!temp) return SQLITE_NOMEM;
+    
+    int rc = SQLITE_PERM;
+    FILE *f = NULL;
+    if (!vector_preload_file_replaceable(path) || !vector_preload_file_replaceable(temp)) goto export_cleanup;
+    
+    rc = SQLITE_CANTOPEN;
+    f = fopen(temp, "wb");
+    if (!f) goto export_cleanup;
+    
+    rc = vector_preload_file_write(f, 0, h, sizeof(vector_preload_header));
+    if (rc == SQLITE_OK) rc = vector_preload_file_write(f, h->codes_offset, p->codes, (size_t)(h->count * h->code_size));
+    if (rc == SQLITE_OK) rc = vector_preload_file_write(f, h->rowids_offset, p->rowids, (size_t)h->count * sizeof(int64_t));
+    if ((rc == SQLITE_OK) && (h->norms_offset > 0)) rc = vector_preload_file_write(f, h->norms_offset, p->norms, (size_t)h->count * sizeof(float));
+    if ((rc == SQLITE_OK) && (h->nlist > 0)) rc = vector_preload_file_write(f, h->partitions_offset, p->partitions, (size_t)(h->nlist + 1) * sizeof(int));
+    if ((rc == SQLITE_OK) && (h->nlist > 0)) rc = vector_preload_file_write(f, h->centroids_offset, p->centroids, (size_t)h->nlist * (size_t)h->dim);
+    if ((fclose(f) != 0) && (rc == SQLITE_OK)) rc = SQLITE_IOERR;
+    if (rc != SQLITE_OK) goto export_cleanup;
+    
+    #if defined(_WIN32)
+    if (!MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING)) rc = SQLITE_IOERR;
+    #else
+    if (rename(temp, path) != 0) rc = SQLITE_IOERR;
+    #endif
+    
+export_cleanup:
+    // a temporary path that is not a preload file is left alone
+    if ((rc != SQLITE_OK) && (rc != SQLITE_PERM)) remove(temp);
+    sqlite3_free(temp);
+    return rc;
+}
+
+// MARK: - Preload -
+
+// rows are count in total, all the codes are copied in a single 64-byte aligned block followed by the block of their rowids
+// (and by the block of their norms, see quant_norm_type)
+static int vector_preload_load (sqlite3 *db, table_context *t_ctx, const char *table_name, const char *column_name, sqlite3_int64 count, vector_preload **out) {
+    char sql[STATIC_SQL_SIZE];
+    int counter = 0;
+    int code_size = quant_code_size(&t_ctx->options);
+    vector_type norm_type = quant_norm_type(&t_ctx->options);
+    size_t codes_size = vector_chunk_align((size_t)count * (size_t)code_size);
+    size_t norms_size = (norm_type) ? (size_t)count * sizeof(float) : 0;
+    void *buffer = (void *)sqlite3_malloc64((sqlite3_uint64)(VECTOR_CHUNK_ALIGN + codes_size + (size_t)count * sizeof(int64_t) + norms_size));
+    if (!buffer) return SQLITE_NOMEM;
+    uint8_t *codes = (uint8_t *)vector_chunk_align((size_t)(uintptr_t)buffer);
+    uint8_t *rowids = codes + codes_size;
+    uint8_t *norms = (norm_type) ? rowids + (size_t)count * sizeof(int64_t) : NULL;
+    
+    // with IVF, chunks are loaded grouped by partition so that each partition is a contiguous range of rows
+    int nlist = t_ctx->options.nlist;
+    int *partitions = NULL;
+    uint8_t *centroids = NULL;
+    vector_preload *p = NULL;
+    if (nlist > 0) generate_select_quant_partitions(table_name, column_name, sql);
+    else generate_select_quant_table(table_name, column_name, sql);
+    
+    int rc = SQLITE_NOMEM;
+    sqlite3_stmt *vm = NULL;
+    if (nlist > 0) {
+        partitions = (int *)sqlite3_malloc64((sqlite3_uint64)(nlist + 1) * sizeof(int));
+        centroids = ivf_load_centroids(db, table_name, column_name, nlist, t_ctx->options.v_dim);
+        if (!partitions || !centroids) goto vector_preload_cleanup;
+        memset(partitions, 0, (size_t)(nlist + 1) * sizeof(int));
+    }
+    
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto vector_preload_cleanup;
+    
+    while (1) {
+        rc = sqlite3_step(vm);
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;} // return error: rebuild must be call (only if first time run)
+        else if (rc != SQLITE_ROW) goto vector_preload_cleanup;
+        
+        vector_chunk chunk;
+        int n = sqlite3_column_int(vm, 0);
+        if (!vector_chunk_decode(&chunk, sqlite3_column_blob(vm, 1), sqlite3_column_bytes(vm, 1), n, code_size)) {rc = SQLITE_CORRUPT; goto vector_preload_cleanup;}
+        
+        if (partitions) {
+            int partid = sqlite3_column_int(vm, 2);
+            if (partid < 0 || partid >= nlist) {rc = SQLITE_CORRUPT; goto vector_preload_cleanup;}
+            partitions[partid + 1] += n;
+        }
+        
+        if ((sqlite3_int64)counter + n > count) {rc = SQLITE_CORRUPT; goto vector_preload_cleanup;}
+        vector_chunk_copy(&chunk, codes + (size_t)counter * code_size, rowids + (size_t)counter * sizeof(int64_t), code_size);
+        if (norms) vector_chunk_copy_norms(&chunk, norms + (size_t)counter * sizeof(float), code_size, norm_type);
+        counter += n;
+    }
+    rc = SQLITE_OK;
+    
+    // convert per-partition counts into row offsets
+    if (partitions) {
+        for (int i=0; i<nlist; ++i) partitions[i + 1] += partitions[i];
+    }
+    
+    // rows are normally stored in rowid order, which lets scans binary search id ranges
+    bool sorted = true;
+    for (int i=1; i<counter && sorted; ++i) {
+        if (INT64_FROM_INT8PTR(rowids + (size_t)i * sizeof(int64_t)) >= INT64_FROM_INT8PTR(rowids + (size_t)(i - 1) * sizeof(int64_t))) continue;
+        
+        // with IVF only the order inside each partition matters
+        bool partition_start = false;
+        for (int j=0; partitions && j<nlist && !partition_start; ++j) partition_start = (partitions[j] == i);
+        sorted = partition_start;
+    }
+    
+    p = (vector_preload *)sqlite3_malloc(sizeof(vector_preload));
+    if (!p) {rc = SQLITE_NOMEM; goto vector_preload_cleanup;}
+    memset(p, 0, sizeof(vector_preload));
+    p->refcount = 1;
+    p->data = buffer;
+    p->codes = codes;
+    p->rowids = rowids;
+    p->norms = norms;
+    p->counter = counter;
+    p->partitions = partitions;
+    p->centroids = centroids;
+    p->sorted = sorted;
+    *out = p;
+    
+vector_preload_cleanup:
+    if (rc != SQLITE_OK) {
+        sqlite3_free(buffer);
+        if (partitions) sqlite3_free(partitions);
+        if (centroids) sqlite3_free(centroids);
+    }
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
+// errors are reported to context, if not NULL
+static int vector_preload_table (sqlite3_context *context, sqlite3 *db, table_context *t_ctx, const char *file) {
+    const char *table_name = t_ctx->t_name;
+    const char *column_name = t_ctx->c_name;
+    table_context_release_preload(t_ctx);
+    
+    // attach to the rows already preloaded by another connection to the same database file (if any)
+    char sql[STATIC_SQL_SIZE];
+    const char *path = sqlite3_db_filename(db, "main");
+    generate_select_quant_generation(table_name, column_name, sql);
+    int64_t generation = sqlite_read_int64(db, sql);
+    char *key = (path && path[0]) ? sqlite3_mprintf("%s|%s|%s|%lld", path, table_name, column_name, (long long)generation) : NULL;
+    vector_preload *p = vector_preload_acquire(key);
+    if (p) {
+        table_context_attach_preload(t_ctx, p);
+        sqlite3_free(key);
+        return SQLITE_OK;
+    }
+    
+    generate_count_quant_table(table_name, column_name, sql);
+    sqlite3_int64 count = sqlite_read_int64(db, sql);
+    if (count == 0) {
+        sqlite3_free(key);
+        context_result_error(context, SQLITE_ERROR, "Unable to read data from database. Ensure that vector_quantize() has been called before using vector_quantize_preload().");
+        return SQLITE_ERROR;
+    }
+    
+    // map the preload file, if it is still up to date
+    vector_preload_header header;
+    if (file) {
+        vector_preload_file_layout(&header, t_ctx, generation, count, false);
+        p = vector_preload_file_open(file, &header);
+    }
+    
+    if (file && !p && !vector_preload_file_replaceable(file)) {
+        sqlite3_free(key);
+        context_result_error(context, SQLITE_PERM, "Preload file '%s' already exists and was not written by vector_quantize_preload().", file);
+        return SQLITE_PERM;
+    }
+    
+    if (!p) {
+        int rc = vector_preload_load(db, t_ctx, table_name, column_name, count, &p);
+        if (rc != SQLITE_OK) {
+            printf("Error in vector_quantize_preload: %s\n", sqlite3_errmsg(db));
+            sqlite3_free(key);
+            if (rc == SQLITE_NOMEM) context_result_error(context, SQLITE_NOMEM, "Out of memory: unable to allocate %lld bytes for quant buffer.", (long long)count * (long long)(sizeof(int64_t) + quant_code_size(&t_ctx->options)));
+            return rc;
+        }
+        
+        // (re)write the preload file and map it in place of the in-memory copy
+        if (file) {
+            vector_preload *m = NULL;
+            header.count = p->counter;
+            header.sorted = p->sorted;
+            rc = vector_preload_file_export(file, &header, p);
+            if (rc == SQLITE_OK) m = vector_preload_file_open(file, &header);
+            vector_preload_free(p);
+            p = m;
+            if (!p) {
+                sqlite3_free(key);
+                context_result_error(context, (rc == SQLITE_OK) ? SQLITE_IOERR : rc, "Unable to write or map preload file '%s'.", file);
+                return (rc == SQLITE_OK) ? SQLITE_IOERR : rc;
+            }
+        }
+    }
+    
+    p->key = key;
+    p->generation = generation;
+    table_context_attach_preload(t_ctx, vector_preload_register(p));
+    return SQLITE_OK;
+}
+
+static bool vector_preload_keyvalue_callback (sqlite3_context *context, void *xdata, const char *key, int key_len, const char *value, int value_len) {
+    char **file = (char **)xdata;
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_PRELOAD_FILE)) {
+        if (*file) sqlite3_free(*file);
+        *file = (value_len > 0) ? sqlite3_mprintf("%.*s", value_len, value) : NULL;
+        return true;
+    }
+    
+    // means ignore unknown keys
+    return true;
+}
+
+static void vector_quantize_preload (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_preload", argc, argv, argc, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    const char *options = (argc == 3) ? (const char *)sqlite3_value_text(argv[2]) : NULL;
+    
+    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
+    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize_preload().", table_name, column_name);
+        return;
+    }
+    
+    char *file = NULL;
+    parse_keyvalue_string(context, options, vector_preload_keyvalue_callback, &file);
+    #if defined(VECTOR_MMAP_DISABLED)
+    if (file) {
+        sqlite3_free(file);
+        context_result_error(context, SQLITE_ERROR, "Preload files are not supported on this platform.");
+        return;
+    }
+    #endif
+    
+    // remembered so that vector_quantize reloads the rows the same way
+    if (t_ctx->preload_file) sqlite3_free(t_ctx->preload_file);
+    t_ctx->preload_file = file;
+    vector_preload_table(context, sqlite3_context_db_handle(context), t_ctx, file);
+}
+
+static bool vector_quantrange_keyvalue_callback (sqlite3_context *context, void *xdata, const char *key, int key_len, const char *value, int value_len) {
+    if (keyvalue_match(key, key_len, OPTION_KEY_QUANTRANGE)) *(bool *)xdata = true;
+    
+    // means ignore unknown keys
+    return true;
+}
+
+static int vector_quantize (sqlite3_context *context, const char *table_name, const char *column_name, const char *arg_options, bool *was_preloaded) {
+    table_context *t_ctx = vector_context_lookup((vector_context *)sqlite3_user_data(context), table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize().", table_name, column_name);
+        return SQLITE_ERROR;
+    }
+    
+    vector_rebuild_stats stats = {0};
+    int rc = SQLITE_ERROR;
+    char sql[STATIC_SQL_SIZE];
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    
+    vector_options options = t_ctx->options; // t_ctx guarantees to exist
+    bool res = parse_keyvalue_string(context, arg_options, vector_keyvalue_callback, &options);
+    if (res == false) return SQLITE_ERROR;
+    
+    if (((options.q_type == VECTOR_QUANT_PQ) || (options.q_type == VECTOR_QUANT_BIT) || quant_is_nibble(options.q_type)) && (options.nlist > 0)) {
+        context_result_error(context, SQLITE_ERROR, "IVF partitioning (nlist) is only supported with 8-bit quantization.");
+        return SQLITE_ERROR;
+    }
+    
+    // per-dimension ranges inherited from the previous quantization are dropped when the new type does not support them
+    bool is_8bit = (options.q_type != VECTOR_QUANT_PQ) && (options.q_type != VECTOR_QUANT_BIT) && !quant_is_nibble(options.q_type);
+    if (options.dim_ranges && !is_8bit) {
+        bool explicit_qrange = false;
+        parse_keyvalue_string(context, arg_options, vector_quantrange_keyvalue_callback, &explicit_qrange);
+        if (!explicit_qrange) options.dim_ranges = false;
+    }
+    
+    // rows quantized with per-dimension ranges are scored from a dot product (see weighted_distance_finalize)
+    if (options.dim_ranges) {
+        if (!is_8bit) {
+            context_result_error(context, SQLITE_ERROR, "Per-dimension ranges (qrange=dimension) are only supported with 8-bit quantization, use qrange=global.");
+            return SQLITE_ERROR;
+        }
+        if (options.nlist > 0) {
+            context_result_error(context, SQLITE_ERROR, "IVF partitioning (nlist) is not supported with per-dimension ranges (qrange=dimension).");
+            return SQLITE_ERROR;
+        }
+        if (t_ctx->options.v_distance == VECTOR_DISTANCE_L1) {
+            context_result_error(context, SQLITE_ERROR, "Per-dimension ranges (qrange=dimension) are not supported with the L1 distance.");
+            return SQLITE_ERROR;
+        }
+    }
+    
+    rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    generate_drop_quant_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    generate_drop_ivf_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    generate_drop_pq_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    table_context_release_codebook(t_ctx);
+    
+    generate_create_quant_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    if (options.nlist > 0) {
+        generate_create_ivf_table(table_name, column_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto quantize_cleanup;
+        
+        generate_create_quant_index(table_name, column_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto quantize_cleanup;
+    }
+    
+    if (options.q_type == VECTOR_QUANT_PQ) {
+        generate_create_pq_table(table_name, column_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto quantize_cleanup;
+    }
+    
+    rc = vector_rebuild_quantization(context, table_name, column_name, t_ctx, &options, &stats);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    // the rebuild covers every row, so the delta table starts empty
+    generate_drop_delta_triggers(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    generate_drop_delta_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    if (options.auto_quantize) {
+        generate_create_delta_table(table_name, column_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto quantize_cleanup;
+        
+        generate_create_delta_triggers(table_name, column_name, t_ctx->pk_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto quantize_cleanup;
+    }
+    t_ctx->options.auto_quantize = options.auto_quantize;
+    
+    // quantization options and the new generation are written in the same transaction as the rows, so that the
+    // rows are never visible (or left after a crash) with the metadata of the previous quantization
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTTYPE, t_ctx->options.q_type, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_FLOAT, OPTION_KEY_QUANTSCALE, 0, t_ctx->scale);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_FLOAT, OPTION_KEY_QUANTOFFSET, 0, t_ctx->offset);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_IVF_NLIST, t_ctx->options.nlist, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_PQ_SUBQUANTIZERS, t_ctx->options.pq_m, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_PQ_BITS, t_ctx->options.pq_nbits, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_AUTO_QUANTIZE, t_ctx->options.auto_quantize, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTRANGE, t_ctx->options.dim_ranges, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize_blob(context, table_name, column_name, OPTION_KEY_QUANTDIMS, t_ctx->qdims, t_ctx->options.v_dim * 2 * (int)sizeof(float));
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    // statistics of the rebuild, reported by vector_quantize_stats
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTROWS, stats.rows, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_FLOAT, OPTION_KEY_QUANTTIME, 0, stats.seconds);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTTHREADS, stats.threads, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    // new generation, so that connections with rows preloaded from the previous quantization do not share them
+    generate_select_quant_generation(table_name, column_name, sql);
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTGENERATION, sqlite_read_int64(db, sql) + 1, 0);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto quantize_cleanup;
+    
+quantize_cleanup:
+    vector_cache_clear(&t_ctx->cache);
+    if (rc != SQLITE_OK) {
+        printf("%s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        table_context_release_codebook(t_ctx);
+        sqlite3_result_error_code(context, rc);
+        return rc;
+    }
+    
+    // returns the total number of quantized rows
+    sqlite3_result_int64(context, (sqlite3_int64)stats.rows);
+    if (was_preloaded) *was_preloaded = (t_ctx->preloaded != NULL);
+    return SQLITE_OK;
+}
+
+static void vector_quantize_reload (sqlite3_context *context, const char *table_name, const char *column_name) {
+    table_context *t_ctx = vector_context_lookup((vector_context *)sqlite3_user_data(context), table_name, column_name);
+    if (t_ctx) vector_preload_table(context, sqlite3_context_db_handle(context), t_ctx, t_ctx->preload_file);
+}
+
+static void vector_quantize3 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize", argc, argv, 3, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    const char *options = (const char *)sqlite3_value_text(argv[2]);
+    
+    bool was_preloaded = false;
+    int rc = vector_quantize(context, table_name, column_name, options, &was_preloaded);
+    if ((rc == SQLITE_OK) && (was_preloaded)) vector_quantize_reload(context, table_name, column_name);
+}
+
+static void vector_quantize2 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    bool was_preloaded = false;
+    int rc = vector_quantize(context, table_name, column_name, NULL, &was_preloaded);
+    if ((rc == SQLITE_OK) && (was_preloaded)) vector_quantize_reload(context, table_name, column_name);
+}
+
+// MARK: - Delta -
+
+// With auto_quantize=1, triggers on the base table keep the quantization up to date without a rebuild: the id of every
+// written or deleted row is recorded in the delta table. Scans hide the ids found in the delta table from the quantized
+// chunks, quantize the current vector of the ids still present in the base table (with the current scale/offset,
+// PQ codebook) and score them on their own, until vector_quantize_compact folds them into the chunks.
+
+static void vector_delta_free (vector_delta *d) {
+    vector_rowset_free(d->ids);
+    if (d->rows) sqlite3_free(d->rows);
+    memset(d, 0, sizeof(vector_delta));
+}
+
+// quantizes a vector with the current quantization of the table, SQLITE_DONE if blob is not a full vector
+static int vector_delta_quantize (sqlite3 *db, table_context *t_ctx, const void *blob, int bytes, uint8_t *code) {
+    // like in vector_quantize, values that are not full vectors are not quantized
+    int dim = t_ctx->options.v_dim;
+    vector_type type = t_ctx->options.v_type;
+    if (!blob || (size_t)bytes < (size_t)dim * vector_type_to_size(type)) return SQLITE_DONE;
+    
+    if (t_ctx->options.q_type == VECTOR_QUANT_PQ) {
+        float *codebook = table_context_pq_codebook(db, t_ctx);
+        if (!codebook) return SQLITE_ERROR;
+        float *tempv = (float *)sqlite3_malloc64((sqlite3_uint64)dim * sizeof(float));
+        if (!tempv) return SQLITE_NOMEM;
+        vector_to_float32(blob, tempv, dim, type);
+        if (t_ctx->options.v_distance == VECTOR_DISTANCE_COSINE) vector_normalize_float32(tempv, dim);
+        pq_encode(tempv, codebook, dim, t_ctx->options.pq_m, 1 << t_ctx->options.pq_nbits, code);
+        sqlite3_free(tempv);
+    } else if (t_ctx->options.dim_ranges) {
+        quantize_vector_dims(blob, code, t_ctx->qdims, dim, type, t_ctx->options.q_type);
+    } else {
+        quantize_vector(blob, code, t_ctx->offset, t_ctx->scale, dim, type, t_ctx->options.q_type);
+    }
+    return SQLITE_OK;
+}
+
+static int vector_delta_load (sqlite3 *db, table_context *t_ctx, vector_delta *d) {
+    memset(d, 0, sizeof(vector_delta));
+    
+    char sql[STATIC_SQL_SIZE];
+    generate_select_delta_table(t_ctx->t_name, t_ctx->c_name, t_ctx->pk_name, sql);
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
+    vector_rowset *set = (vector_rowset *)sqlite3_malloc(sizeof(vector_rowset));
+    if (!set) {rc = SQLITE_NOMEM; goto delta_load_cleanup;}
+    memset(set, 0, sizeof(vector_rowset));
+    d->ids = set;
+    
+    int code_size = quant_code_size(&t_ctx->options);
+    size_t stride = sizeof(int64_t) + (size_t)code_size;
+    int64_t capacity = 0;
+    int rows_capacity = 0;
+    while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        int64_t rowid = (int64_t)sqlite3_column_int64(vm, 0);
+        if (set->count == capacity) {
+            capacity = (capacity) ? capacity * 2 : 1024;
+            int64_t *rowids = (int64_t *)sqlite3_realloc64(set->rowids, (sqlite3_uint64)capacity * sizeof(int64_t));
+            if (!rowids) {rc = SQLITE_NOMEM; goto delta_load_cleanup;}
+            set->rowids = rowids;
+        }
+        set->rowids[set->count++] = rowid;
+        
+        // deleted rows (and values that are not full vectors) are not scored
+        const void *blob = sqlite3_column_blob(vm, 1);
+        if (!blob) continue;
+        
+        if (d->count == rows_capacity) {
+            rows_capacity = (rows_capacity) ? rows_capacity * 2 : 1024;
+            uint8_t *rows = (uint8_t *)sqlite3_realloc64(d->rows, (sqlite3_uint64)rows_capacity * stride);
+            if (!rows) {rc = SQLITE_NOMEM; goto delta_load_cleanup;}
+            d->rows = rows;
+        }
+        uint8_t *row = d->rows + (size_t)d->count * stride;
+        int qrc = vector_delta_quantize(db, t_ctx, blob, sqlite3_column_bytes(vm, 1), row + sizeof(int64_t));
+        if (qrc == SQLITE_DONE) continue;
+        if (qrc != SQLITE_OK) {rc = qrc; goto delta_load_cleanup;}
+        INT64_TO_INT8PTR(rowid, row);
+        d->count++;
+    }
+    if (rc != SQLITE_DONE) goto delta_load_cleanup;
+    
+    // an empty delta table does not need any check
+    if (set->count == 0) {
+        vector_rowset_free(set);
+        d->ids = NULL;
+        rc = SQLITE_OK;
+    } else {
+        rc = vector_rowset_finalize(set);
+    }
+    
+delta_load_cleanup:
+    if (rc != SQLITE_OK) vector_delta_free(d);
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
+static void vector_quantize_code (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_code", 2, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
+    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize_code().", table_name, column_name);
+        return;
+    }
+    
+    int code_size = quant_code_size(&t_ctx->options);
+    uint8_t *code = (uint8_t *)sqlite3_malloc(code_size);
+    if (!code) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    
+    const void *blob = (sqlite3_value_type(argv[2]) == SQLITE_BLOB) ? sqlite3_value_blob(argv[2]) : NULL;
+    int rc = vector_delta_quantize(sqlite3_context_db_handle(context), t_ctx, blob, sqlite3_value_bytes(argv[2]), code);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(code);
+        if (rc == SQLITE_DONE) sqlite3_result_null(context);
+        else if (rc == SQLITE_NOMEM) sqlite3_result_error_nomem(context);
+        else context_result_error(context, SQLITE_ERROR, "Unable to load the PQ codebook for table '%s' and column '%s'.", table_name, column_name);
+        return;
+    }
+    
+    sqlite3_result_blob(context, code, code_size, sqlite3_free);
+}
+
+// removes the rows listed in the delta table from the quantized chunks that contain them
+static int vector_compact_chunks (sqlite3 *db, table_context *t_ctx, const vector_delta *delta) {
+    const char *table_name = t_ctx->t_name;
+    const char *column_name = t_ctx->c_name;
+    int code_size = quant_code_size(&t_ctx->options);
+    size_t stride = sizeof(int64_t) + (size_t)code_size;
+    
+    char sql[STATIC_SQL_SIZE];
+    sqlite3_stmt *vm_chunks = NULL, *vm_chunk = NULL, *vm_update = NULL, *vm_delete = NULL;
+    int64_t *chunks = NULL;
+    uint8_t *buffer = NULL, *encoded = NULL;
+    int64_t nchunks = 0, capacity = 0;
+    
+    // only chunks whose rowid range overlaps the delta ids can contain stale rows
+    generate_select_quant_chunks(table_name, column_name, sql);
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm_chunks, NULL);
+    if (rc != SQLITE_OK) goto compact_chunks_cleanup;
+    sqlite3_bind_int64(vm_chunks, 1, (sqlite3_int64)delta->ids->min_rowid);
+    sqlite3_bind_int64(vm_chunks, 2, (sqlite3_int64)delta->ids->max_rowid);
+    while ((rc = sqlite3_step(vm_chunks)) == SQLITE_ROW) {
+        if (nchunks == capacity) {
+            capacity = (capacity) ? capacity * 2 : 64;
+            int64_t *temp = (int64_t *)sqlite3_realloc64(chunks, (sqlite3_uint64)capacity * sizeof(int64_t));
+            if (!temp) {rc = SQLITE_NOMEM; goto compact_chunks_cleanup;}
+            chunks = temp;
+        }
+        chunks[nchunks++] = (int64_t)sqlite3_column_int64(vm_chunks, 0);
+    }
+    if (rc != SQLITE_DONE) goto compact_chunks_cleanup;
+    
+    generate_select_quant_chunk(table_name, column_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm_chunk, NULL);
+    if (rc != SQLITE_OK) goto compact_chunks_cleanup;
+    generate_update_quant_chunk(table_name, column_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm_update, NULL);
+    if (rc != SQLITE_OK) goto compact_chunks_cleanup;
+    generate_delete_quant_chunk(table_name, column_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm_delete, NULL);
+    if (rc != SQLITE_OK) goto compact_chunks_cleanup;
+    
+    for (int64_t i=0; i<nchunks; ++i) {
+        sqlite3_reset(vm_chunk);
+        sqlite3_bind_int64(vm_chunk, 1, (sqlite3_int64)chunks[i]);
+        rc = sqlite3_step(vm_chunk);
+        if (rc != SQLITE_ROW) goto compact_chunks_cleanup;
+        
+        vector_chunk chunk;
+        int counter = sqlite3_column_int(vm_chunk, 0);
+        if (!vector_chunk_decode(&chunk, sqlite3_column_blob(vm_chunk, 1), sqlite3_column_bytes(vm_chunk, 1), counter, code_size)) {rc = SQLITE_CORRUPT; goto compact_chunks_cleanup;}
+        
+        // keep the rows that are not in the delta table
+        buffer = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)counter * stride + 1);
+        if (!buffer) {rc = SQLITE_NOMEM; goto compact_chunks_cleanup;}
+        
+        int kept = 0;
+        int64_t min_rowid = INT64_MAX, max_rowid = INT64_MIN;
+        for (int j=0; j<counter; ++j) {
+            int64_t rowid = vector_chunk_rowid(&chunk, j);
+            if (vector_rowset_contains(delta->ids, rowid)) continue;
+            
+            uint8_t *row = buffer + (size_t)kept * stride;
+            INT64_TO_INT8PTR(rowid, row);
+            memcpy(row + sizeof(int64_t), vector_chunk_code(&chunk, j), (size_t)code_size);
+            if (rowid < min_rowid) min_rowid = rowid;
+            if (rowid > max_rowid) max_rowid = rowid;
+            ++kept;
+        }
+        if (kept == counter) {
+            sqlite3_free(buffer);
+            buffer = NULL;
+            continue;
+        }
+        
+        if (kept == 0) {
+            sqlite3_reset(vm_delete);
+            sqlite3_bind_int64(vm_delete, 1, (sqlite3_int64)chunks[i]);
+            rc = sqlite3_step(vm_delete);
+        } else {
+            size_t size = 0;
+            encoded = vector_chunk_encode(buffer, kept, code_size, quant_norm_type(&t_ctx->options), &size);
+            if (!encoded) {rc = SQLITE_NOMEM; goto compact_chunks_cleanup;}
+            
+            sqlite3_reset(vm_update);
+            sqlite3_bind_int64(vm_update, 1, (sqlite3_int64)min_rowid);
+            sqlite3_bind_int64(vm_update, 2, (sqlite3_int64)max_rowid);
+            sqlite3_bind_int(vm_update, 3, kept);
+            sqlite3_bind_blob64(vm_update, 4, encoded, (sqlite3_uint64)size, SQLITE_STATIC);
+            sqlite3_bind_int64(vm_update, 5, (sqlite3_int64)chunks[i]);
+            rc = sqlite3_step(vm_update);
+            sqlite3_free(encoded);
+            encoded = NULL;
+        }
+        sqlite3_free(buffer);
+        buffer = NULL;
+        if (rc != SQLITE_DONE) goto compact_chunks_cleanup;
+    }
+    rc = SQLITE_OK;
+    
+compact_chunks_cleanup:
+    if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    if (vm_chunks) sqlite3_finalize(vm_chunks);
+    if (vm_chunk) sqlite3_finalize(vm_chunk);
+    if (vm_update) sqlite3_finalize(vm_update);
+    if (vm_delete) sqlite3_finalize(vm_delete);
+    if (chunks) sqlite3_free(chunks);
+    if (buffer) sqlite3_free(buffer);
+    if (encoded) sqlite3_free(encoded);
+    return rc;
+}
+
+// appends the delta rows with a quantized code as new chunks (one per IVF partition)
+static int vector_compact_append (sqlite3 *db, table_context *t_ctx, const vector_delta *delta) {
+    if (delta->count == 0) return SQLITE_OK;
+    
+    const char *table_name = t_ctx->t_name;
+    const char *column_name = t_ctx->c_name;
+    size_t stride = sizeof(int64_t) + (size_t)quant_code_size(&t_ctx->options);
+    int nlist = t_ctx->options.nlist;
+    
+    if (nlist == 0) {
+        uint64_t max_memory = (t_ctx->options.max_memory) ? t_ctx->options.max_memory : DEFAULT_MAX_MEMORY;
+        int max_vectors = (int)(max_memory / stride);
+        if (max_vectors == 0) max_vectors = 1;
+        
+        // delta rows are sorted by id
+        for (int i=0; i<delta->count; i+=max_vectors) {
+            int n = (delta->count - i < max_vectors) ? delta->count - i : max_vectors;
+            uint8_t *rows = delta->rows + (size_t)i * stride;
+            int64_t min_rowid = INT64_FROM_INT8PTR(rows);
+            int64_t max_rowid = INT64_FROM_INT8PTR(rows + (size_t)(n - 1) * stride);
+            int rc = vector_serialize_quantization(db, table_name, column_name, (uint32_t)n, rows, (int)(stride - sizeof(int64_t)), quant_norm_type(&t_ctx->options), min_rowid, max_rowid, 0);
+            if (rc != SQLITE_OK) return rc;
+        }
+        return SQLITE_OK;
+    }
+    
+    int dim = t_ctx->options.v_dim;
+    int rc = SQLITE_NOMEM;
+    uint8_t *centroids = ivf_load_centroids(db, table_name, column_name, nlist, dim);
+    ivf_partition *parts = (ivf_partition *)sqlite3_malloc64((sqlite3_uint64)nlist * sizeof(ivf_partition));
+    if (!centroids || !parts) goto compact_append_cleanup;
+    memset(parts, 0, (size_t)nlist * sizeof(ivf_partition));
+    
+    distance_function_t ivf_fn = ivf_distance_function(t_ctx->options.q_type);
+    for (int i=0; i<delta->count; ++i) {
+        const uint8_t *row = delta->rows + (size_t)i * stride;
+        int partid = ivf_nearest(row + sizeof(int64_t), centroids, nlist, dim, ivf_fn);
+        
+        uint8_t *slot = NULL;
+        rc = ivf_append_partition(&parts[partid], stride, INT64_FROM_INT8PTR(row), &slot);
+        if (rc != SQLITE_OK) goto compact_append_cleanup;
+        memcpy(slot, row, stride);
+    }
+    
+    rc = SQLITE_OK;
+    for (int i=0; i<nlist && rc == SQLITE_OK; ++i) {
+        rc = ivf_flush_partition(db, table_name, column_name, &parts[i], stride, quant_norm_type(&t_ctx->options), i);
+    }
+    
+compact_append_cleanup:
+    if (centroids) sqlite3_free(centroids);
+    ivf_free_partitions(parts, nlist);
+    return rc;
+}
+
+static void vector_quantize_compact (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_compact", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
+    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize_compact().", table_name, column_name);
+        return;
+    }
+    
+    if (!t_ctx->options.auto_quantize) {
+        context_result_error(context, SQLITE_ERROR, "No delta table for table '%s' and column '%s'. Ensure that vector_quantize() has been called with auto_quantize=1 before using vector_quantize_compact().", table_name, column_name);
+        return;
+    }
+    
+    // the write lock is taken immediately, so that no rows can be added to the delta table while they are folded
+    char sql[STATIC_SQL_SIZE];
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    vector_delta delta;
+    memset(&delta, 0, sizeof(vector_delta));
+    int64_t count = 0;
+    
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto compact_cleanup;
+    
+    rc = vector_delta_load(db, t_ctx, &delta);
+    if (rc != SQLITE_OK) goto compact_cleanup;
+    
+    if (delta.ids) {
+        count = delta.ids->count;
+        
+        rc = vector_compact_chunks(db, t_ctx, &delta);
+        if (rc != SQLITE_OK) goto compact_cleanup;
+        
+        rc = vector_compact_append(db, t_ctx, &delta);
+        if (rc != SQLITE_OK) goto compact_cleanup;
+        
+        generate_clear_delta_table(table_name, column_name, sql);
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto compact_cleanup;
+        
+        // new generation, so that rows preloaded before the compaction are reloaded
+        generate_select_quant_generation(table_name, column_name, sql);
+        rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTGENERATION, sqlite_read_int64(db, sql) + 1, 0);
+        if (rc != SQLITE_OK) goto compact_cleanup;
+    }
+    
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    
+compact_cleanup:
+    vector_delta_free(&delta);
+    if (rc != SQLITE_OK) {
+        context_result_error(context, rc, "Error in vector_quantize_compact: %s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return;
+    }
+    
+    if (count) vector_cache_clear(&t_ctx->cache);
+    if (count && t_ctx->preload) vector_preload_table(context, db, t_ctx, t_ctx->preload_file);
+    
+    // returns the number of delta rows folded into the quantized chunks
+    sqlite3_result_int64(context, (sqlite3_int64)count);
+}
+
+static void vector_quantize_memory (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_memory", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    char sql[STATIC_SQL_SIZE];
+    generate_memory_quant_table(table_name, column_name, sql);
+    
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_int64 memory = sqlite_read_int64(db, sql);
+    sqlite3_result_int64(context, memory);
+}
+
+// statistics of the last vector_quantize rebuild as a JSON object, NULL if they were not recorded
+static void vector_quantize_stats (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_stats", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    const char *sql = "SELECT key, value FROM _sqliteai_vector WHERE tblname = ? AND colname = ? AND key IN ('" OPTION_KEY_QUANTROWS "', '" OPTION_KEY_QUANTTIME "', '" OPTION_KEY_QUANTTHREADS "');";
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    sqlite3_bind_text(vm, 1, table_name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(vm, 2, column_name, -1, SQLITE_STATIC);
+    
+    int found = 0;
+    sqlite3_int64 rows = 0;
+    double seconds = 0.0;
+    int threads = 0;
+    while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        const char *key = (const char *)sqlite3_column_text(vm, 0);
+        if (strcmp(key, OPTION_KEY_QUANTROWS) == 0) rows = sqlite3_column_int64(vm, 1);
+        else if (strcmp(key, OPTION_KEY_QUANTTIME) == 0) seconds = sqlite3_column_double(vm, 1);
+        else if (strcmp(key, OPTION_KEY_QUANTTHREADS) == 0) threads = sqlite3_column_int(vm, 1);
+        ++found;
+    }
+    if (rc != SQLITE_DONE) goto cleanup;
+    rc = SQLITE_OK;
+    
+    if (found == 0) {
+        sqlite3_result_null(context);
+        goto cleanup;
+    }
+    
+    double rate = (seconds > 0.0) ? (double)rows / seconds : 0.0;
+    char *json = sqlite3_mprintf("{\"rows\":%lld,\"seconds\":%.3f,\"rows_per_second\":%.0f,\"threads\":%d}", rows, seconds, rate, threads);
+    if (!json) {rc = SQLITE_NOMEM; goto cleanup;}
+    sqlite3_result_text(context, json, -1, sqlite3_free);
+    
+cleanup:
+    if (rc != SQLITE_OK) sqlite3_result_error_code(context, rc);
+    if (vm) sqlite3_finalize(vm);
+}
+
+// counters of the vector_quantize_scan cache as a JSON object
+static void vector_quantize_cache_stats (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_cache_stats", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
+    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_quantize_cache_stats().", table_name, column_name);
+        return;
+    }
+    
+    vector_cache *cache = &t_ctx->cache;
+    char *json = sqlite3_mprintf("{\"capacity\":%d,\"entries\":%d,\"hits\":%lld,\"misses\":%lld}", t_ctx->options.cache_size, cache->count, (long long)cache->hits, (long long)cache->misses);
+    if (!json) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    sqlite3_result_text(context, json, -1, sqlite3_free);
+}
+
+static void vector_quantize_cleanup (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_quantize_cleanup", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    
+    vector_context *v_ctx = (vector_context *)sqlite3_user_data(context);
+    table_context *t_ctx = vector_context_lookup(v_ctx, table_name, column_name);
+    if (!t_ctx) return; // if no table context exists then do nothing
+    
+    // release any memory used in quantization
+    table_context_release_preload(t_ctx);
+    vector_cache_clear(&t_ctx->cache);
+    t_ctx->options.nlist = 0;
+    t_ctx->options.clip = 0.0;
+    if (t_ctx->qdims) {
+        sqlite3_free(t_ctx->qdims);
+        t_ctx->qdims = NULL;
+    }
+    if (t_ctx->preload_file) {
+        if (vector_preload_file_replaceable(t_ctx->preload_file)) remove(t_ctx->preload_file);
+        sqlite3_free(t_ctx->preload_file);
+        t_ctx->preload_file = NULL;
+    }
+    
+    // drop quant and IVF tables (if any)
+    char sql[STATIC_SQL_SIZE];
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    generate_drop_quant_table(table_name, column_name, sql);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    generate_drop_ivf_table(table_name, column_name, sql);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    generate_drop_pq_table(table_name, column_name, sql);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    table_context_release_codebook(t_ctx);
+    
+    // stop maintaining the quantization on writes
+    generate_drop_delta_triggers(table_name, column_name, sql);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    generate_drop_delta_table(table_name, column_name, sql);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (t_ctx->options.auto_quantize) sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_AUTO_QUANTIZE, 0, 0);
+    t_ctx->options.auto_quantize = false;
+    
+    // the next vector_quantize starts again from global ranges
+    if (t_ctx->options.dim_ranges) sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_QUANTRANGE, 0, 0);
+    t_ctx->options.dim_ranges = false;
+}
+
+// MARK: - HNSW -
+
+#define HNSW_DEFAULT_M                              16
+#define HNSW_DEFAULT_EF_CONSTRUCTION                200
+#define HNSW_DEFAULT_EF_SEARCH                      64
+#define HNSW_MAX_LEVEL                              16
+
+typedef struct {
+    int             m;                      // max neighbors per node in upper layers (layer 0 uses 2*m)
+    int             ef_construction;        // dynamic candidate list size used while building
+} hnsw_options;
+
+typedef struct {
+    float           distance;
+    int64_t         id;                     // node index while building, rowid while searching
+} hnsw_candidate;
+
+typedef struct {
+    hnsw_candidate  *items;
+    int             count;
+    int             capacity;
+    bool            is_max;                 // max-heap if true, min-heap otherwise
+} hnsw_heap;
+
+typedef struct {
+    int             level;
+    int             *links;                 // per layer: count followed by layer capacity slots
+} hnsw_node;
+
+typedef struct {
+    int             m;
+    int             m0;
+    int             ef_construction;
+    double          level_mult;
+    
+    int             dim;
+    size_t          vsize;
+    int             count;
+    uint8_t         *vectors;
+    int64_t         *rowids;
+    hnsw_node       *nodes;
+    
+    uint32_t        *visited;
+    uint32_t        visited_tag;
+    uint64_t        rng;
+    
+    int             entry;
+    int             max_level;
+    distance_function_t distance_fn;
+} hnsw_build;
+
+static inline bool hnsw_heap_before (hnsw_heap *h, const hnsw_candidate *a, const hnsw_candidate *b) {
+    return (h->is_max) ? (a->distance > b->distance) : (a->distance < b->distance);
+}
+
+static bool hnsw_heap_push (hnsw_heap *h, float distance, int64_t id) {
+    if (h->count == h->capacity) {
+        int capacity = (h->capacity) ? h->capacity * 2 : 64;
+        hnsw_candidate *items = (hnsw_candidate *)sqlite3_realloc64(h->items, (sqlite3_uint64)capacity * sizeof(hnsw_candidate));
+        if (!items) return false;
+        h->items = items;
+        h->capacity = capacity;
+    }
+    
+    int i = h->count++;
+    h->items[i].distance = distance;
+    h->items[i].id = id;
+    
+    // sift up
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!hnsw_heap_before(h, &h->items[i], &h->items[parent])) break;
+        SWAP(hnsw_candidate, h->items[i], h->items[parent]);
+        i = parent;
+    }
+    return true;
+}
+
+static hnsw_candidate hnsw_heap_pop (hnsw_heap *h) {
+    hnsw_candidate top = h->items[0];
+    h->items[0] = h->items[--h->count];
+    
+    // sift down
+    int i = 0;
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, best = i;
+        if (l < h->count && hnsw_heap_before(h, &h->items[l], &h->items[best])) best = l;
+        if (r < h->count && hnsw_heap_before(h, &h->items[r], &h->items[best])) best = r;
+        if (best == i) break;
+        SWAP(hnsw_candidate, h->items[i], h->items[best]);
+        i = best;
+    }
+    return top;
+}
+
+static void hnsw_heap_free (hnsw_heap *h) {
+    if (h->items) sqlite3_free(h->items);
+    h->items = NULL;
+    h->count = h->capacity = 0;
+}
+
+static inline int *hnsw_node_links (hnsw_build *b, int index, int level) {
+    // layer 0 holds m0 slots, upper layers hold m slots, each list is prefixed by its count
+    int offset = (level == 0) ? 0 : (b->m0 + 1) + (level - 1) * (b->m + 1);
+    return b->nodes[index].links + offset;
+}
+
+static inline float hnsw_build_distance (hnsw_build *b, int i, int j) {
+    return b->distance_fn(b->vectors + (size_t)i * b->vsize, b->vectors + (size_t)j * b->vsize, b->dim);
+}
+
+static int hnsw_random_level (hnsw_build *b) {
+    uint64_t r = random_next(&b->rng);
+    double u = ((double)(r >> 11) + 1.0) / 9007199254740993.0; // (0, 1]
+    int level = (int)(-log(u) * b->level_mult);
+    return (level > HNSW_MAX_LEVEL) ? HNSW_MAX_LEVEL : level;
+}
+
+// search a single layer starting from the candidates in W, on return W contains the ef closest nodes found (max-heap)
+static int hnsw_build_search_layer (hnsw_build *b, int q, hnsw_heap *W, int ef, int level) {
+    hnsw_heap C = {.is_max = false};
+    
+    if (++b->visited_tag == 0) {
+        memset(b->visited, 0, (size_t)b->count * sizeof(uint32_t));
+        b->visited_tag = 1;
+    }
+    uint32_t tag = b->visited_tag;
+    
+    for (int i=0; i<W->count; ++i) {
+        b->visited[W->items[i].id] = tag;
+        if (!hnsw_heap_push(&C, W->items[i].distance, W->items[i].id)) goto abort_nomem;
+    }
+    
+    while (C.count > 0) {
+        hnsw_candidate c = hnsw_heap_pop(&C);
+        if ((W->count >= ef) && (c.distance > W->items[0].distance)) break;
+        
+        int *links = hnsw_node_links(b, (int)c.id, level);
+        for (int i=1; i<=links[0]; ++i) {
+            int e = links[i];
+            if (b->visited[e] == tag) continue;
+            b->visited[e] = tag;
+            
+            float d = hnsw_build_distance(b, q, e);
+            if ((W->count < ef) || (d < W->items[0].distance)) {
+                if (!hnsw_heap_push(&C, d, e)) goto abort_nomem;
+                if (!hnsw_heap_push(W, d, e)) goto abort_nomem;
+                if (W->count > ef) hnsw_heap_pop(W);
+            }
+        }
+    }
+    
+    hnsw_heap_free(&C);
+    return SQLITE_OK;
+    
+abort_nomem:
+    hnsw_heap_free(&C);
+    return SQLITE_NOMEM;
+}
+
+// neighbor selection heuristic (Malkov & Yashunin, algorithm 4), candidates must be sorted by ascending distance from base
+static int hnsw_select_neighbors (hnsw_build *b, hnsw_candidate *candidates, int count, int max_count, int *selected) {
+    int nselected = 0;
+    for (int i=0; i<count && nselected<max_count; ++i) {
+        bool keep = true;
+        for (int j=0; j<nselected; ++j) {
+            if (hnsw_build_distance(b, (int)candidates[i].id, selected[j]) < candidates[i].distance) {keep = false; break;}
+        }
+        if (keep) selected[nselected++] = (int)candidates[i].id;
+    }
+    return nselected;
+}
+
+static int hnsw_candidate_cmp (const void *a, const void *b) {
+    float da = ((const hnsw_candidate *)a)->distance;
+    float db = ((const hnsw_candidate *)b)->distance;
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static int hnsw_connect (hnsw_build *b, int node, int neighbor, int level, hnsw_candidate *scratch) {
+    int max_count = (level == 0) ? b->m0 : b->m;
+    int *links = hnsw_node_links(b, neighbor, level);
+    
+    if (links[0] < max_count) {
+        links[++links[0]] = node;
+        return SQLITE_OK;
+    }
+    
+    // neighbor list is full: shrink it using the selection heuristic
+    int count = 0;
+    for (int i=1; i<=links[0]; ++i) {
+        scratch[count].id = links[i];
+        scratch[count].distance = hnsw_build_distance(b, neighbor, links[i]);
+        ++count;
+    }
+    scratch[count].id = node;
+    scratch[count].distance = hnsw_build_distance(b, neighbor, node);
+    ++count;
+    
+    qsort(scratch, count, sizeof(hnsw_candidate), hnsw_candidate_cmp);
+    links[0] = hnsw_select_neighbors(b, scratch, count, max_count, links + 1);
+    return SQLITE_OK;
+}
+
+static int hnsw_insert (hnsw_build *b, int q) {
+    int level = hnsw_random_level(b);
+    
+    size_t nlinks = (size_t)(b->m0 + 1) + (size_t)level * (size_t)(b->m + 1);
+    b->nodes[q].level = level;
+    b->nodes[q].links = (int *)sqlite3_malloc64(nlinks * sizeof(int));
+    if (!b->nodes[q].links) return SQLITE_NOMEM;
+    for (int l=0; l<=level; ++l) hnsw_node_links(b, q, l)[0] = 0;
+    
+    if (b->entry < 0) {
+        b->entry = q;
+        b->max_level = level;
+        return SQLITE_OK;
+    }
+    
+    // greedy descent through the layers above the node level
+    int ep = b->entry;
+    float epd = hnsw_build_distance(b, q, ep);
+    for (int l=b->max_level; l>level; --l) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            int *links = hnsw_node_links(b, ep, l);
+            for (int i=1; i<=links[0]; ++i) {
+                float d = hnsw_build_distance(b, q, links[i]);
+                if (d < epd) {epd = d; ep = links[i]; changed = true;}
+            }
+        }
+    }
+    
+    int rc = SQLITE_OK;
+    hnsw_heap W = {.is_max = true};
+    hnsw_candidate *sorted = (hnsw_candidate *)sqlite3_malloc64((sqlite3_uint64)(b->ef_construction + b->m0 + 1) * sizeof(hnsw_candidate));
+    int *selected = (int *)sqlite3_malloc64((sqlite3_uint64)(b->m0 + 1) * sizeof(int));
+    if (!sorted || !selected) {rc = SQLITE_NOMEM; goto hnsw_insert_cleanup;}
+    
+    if (!hnsw_heap_push(&W, epd, ep)) {rc = SQLITE_NOMEM; goto hnsw_insert_cleanup;}
+    for (int l=(level < b->max_level) ? level : b->max_level; l>=0; --l) {
+        rc = hnsw_build_search_layer(b, q, &W, b->ef_construction, l);
+        if (rc != SQLITE_OK) goto hnsw_insert_cleanup;
+        
+        int count = W.count;
+        memcpy(sorted, W.items, (size_t)count * sizeof(hnsw_candidate));
+        qsort(sorted, count, sizeof(hnsw_candidate), hnsw_candidate_cmp);
+        
+        int *links = hnsw_node_links(b, q, l);
+        links[0] = hnsw_select_neighbors(b, sorted, count, b->m, links + 1);
+        memcpy(selected, links + 1, (size_t)links[0] * sizeof(int));
+        
+        for (int i=0, n=links[0]; i<n; ++i) {
+            rc = hnsw_connect(b, q, selected[i], l, sorted);
+            if (rc != SQLITE_OK) goto hnsw_insert_cleanup;
+        }
+        
+        // W is left untouched so that the nodes found in this layer become the entry points of the next one
+    }
+    
+    if (level > b->max_level) {
+        b->entry = q;
+        b->max_level = level;
+    }
+    
+hnsw_insert_cleanup:
+    hnsw_heap_free(&W);
+    if (sorted) sqlite3_free(sorted);
+    if (selected) sqlite3_free(selected);
+    return rc;
+}
+
+static int hnsw_serialize (sqlite3 *db, hnsw_build *b, const char *table_name, const char *column_name) {
+    // neighbors blob format is, for each layer from 0 to level: int32 count followed by count int64 rowids
+    size_t max_size = (size_t)(HNSW_MAX_LEVEL + 1) * sizeof(int32_t) + ((size_t)b->m0 + (size_t)HNSW_MAX_LEVEL * (size_t)b->m) * sizeof(int64_t);
+    uint8_t *buffer = (uint8_t *)sqlite3_malloc64(max_size);
+    if (!buffer) return SQLITE_NOMEM;
+    
+    char sql[STATIC_SQL_SIZE];
+    generate_insert_hnsw_table(table_name, column_name, sql);
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto hnsw_serialize_cleanup;
+    
+    for (int i=0; i<b->count; ++i) {
+        uint8_t *p = buffer;
+        for (int l=0; l<=b->nodes[i].level; ++l) {
+            int *links = hnsw_node_links(b, i, l);
+            int32_t n = links[0];
+            p[0] = (uint8_t)(n & 0xFF); p[1] = (uint8_t)((n >> 8) & 0xFF); p[2] = (uint8_t)((n >> 16) & 0xFF); p[3] = (uint8_t)((n >> 24) & 0xFF);
+            p += sizeof(int32_t);
+            for (int j=1; j<=n; ++j) {
+                INT64_TO_INT8PTR(b->rowids[links[j]], p);
+                p += sizeof(int64_t);
+            }
+        }
+        
+        rc = sqlite3_bind_int64(vm, 1, (sqlite3_int64)b->rowids[i]);
+        if (rc != SQLITE_OK) goto hnsw_serialize_cleanup;
+        
+        rc = sqlite3_bind_int(vm, 2, b->nodes[i].level);
+        if (rc != SQLITE_OK) goto hnsw_serialize_cleanup;
+        
+        rc = sqlite3_bind_blob(vm, 3, (const void *)buffer, (int)(p - buffer), SQLITE_STATIC);
+        if (rc != SQLITE_OK) goto hnsw_serialize_cleanup;
+        
+        rc = sqlite3_step(vm);
+        if (rc != SQLITE_DONE) goto hnsw_serialize_cleanup;
+        rc = sqlite3_reset(vm);
+        if (rc != SQLITE_OK) goto hnsw_serialize_cleanup;
+    }
+    
+hnsw_serialize_cleanup:
+    if (rc != SQLITE_OK) printf("Error in hnsw_serialize: %s\n", sqlite3_errmsg(db));
+    if (vm) sqlite3_finalize(vm);
+    sqlite3_free(buffer);
+    return rc;
+}
+
+static int vector_rebuild_hnsw (sqlite3_context *context, const char *table_name, const char *column_name, table_context *t_ctx, hnsw_options *options, uint32_t *count) {
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_stmt *vm = NULL;
+    char sql[STATIC_SQL_SIZE];
+    int rc = SQLITE_NOMEM;
+    
+    hnsw_build b;
+    memset(&b, 0, sizeof(hnsw_build));
+    b.m = options->m;
+    b.m0 = options->m * 2;
+    b.ef_construction = options->ef_construction;
+    b.level_mult = 1.0 / log((double)options->m);
+    b.dim = t_ctx->options.v_dim;
+    b.vsize = (size_t)b.dim * vector_type_to_size(t_ctx->options.v_type);
+    b.entry = -1;
+    b.distance_fn = table_distance_function(&t_ctx->options);
+    b.rng = random_seed();
+    
+    // STEP 1
+    // load all vectors in memory (the graph is built in memory and then serialized)
+    generate_select_from_table(table_name, column_name, t_ctx->pk_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto vector_rebuild_hnsw_cleanup;
+    
+    int capacity = 0;
+    while (1) {
+        rc = sqlite3_step(vm);
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
+        else if (rc != SQLITE_ROW) goto vector_rebuild_hnsw_cleanup;
+        if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
+        
+        const void *blob = sqlite3_column_blob(vm, 1);
+        if (!blob) continue;
+        
+        if ((size_t)sqlite3_column_bytes(vm, 1) < b.vsize) {
+            context_result_error(context, SQLITE_ERROR, "Invalid vector blob found at rowid %lld.", (long long)sqlite3_column_int64(vm, 0));
+            rc = SQLITE_ERROR;
+            goto vector_rebuild_hnsw_cleanup;
+        }
+        
+        if (b.count == capacity) {
+            capacity = (capacity) ? capacity * 2 : 1024;
+            uint8_t *vectors = (uint8_t *)sqlite3_realloc64(b.vectors, (sqlite3_uint64)capacity * b.vsize);
+            if (vectors) b.vectors = vectors;
+            int64_t *rowids = (int64_t *)sqlite3_realloc64(b.rowids, (sqlite3_uint64)capacity * sizeof(int64_t));
+            if (rowids) b.rowids = rowids;
+            if (!vectors || !rowids) {rc = SQLITE_NOMEM; goto vector_rebuild_hnsw_cleanup;}
+        }
+        
+        memcpy(b.vectors + (size_t)b.count * b.vsize, blob, b.vsize);
+        b.rowids[b.count] = (int64_t)sqlite3_column_int64(vm, 0);
+        ++b.count;
+    }
+    sqlite3_finalize(vm);
+    vm = NULL;
+    
+    if (b.count == 0) goto vector_rebuild_hnsw_cleanup;
+    
+    b.nodes = (hnsw_node *)sqlite3_malloc64((sqlite3_uint64)b.count * sizeof(hnsw_node));
+    b.visited = (uint32_t *)sqlite3_malloc64((sqlite3_uint64)b.count * sizeof(uint32_t));
+    if (!b.nodes || !b.visited) {rc = SQLITE_NOMEM; goto vector_rebuild_hnsw_cleanup;}
+    memset(b.nodes, 0, (size_t)b.count * sizeof(hnsw_node));
+    memset(b.visited, 0, (size_t)b.count * sizeof(uint32_t));
+    
+    // STEP 2
+    // build graph
+    for (int i=0; i<b.count; ++i) {
+        rc = hnsw_insert(&b, i);
+        if (rc != SQLITE_OK) goto vector_rebuild_hnsw_cleanup;
+    }
+    
+    // STEP 3
+    // serialize graph into the shadow table
+    rc = hnsw_serialize(db, &b, table_name, column_name);
+    if (rc != SQLITE_OK) goto vector_rebuild_hnsw_cleanup;
+    
+vector_rebuild_hnsw_cleanup:
+    if (rc == SQLITE_OK) {
+        t_ctx->hnsw_m = (b.count > 0) ? b.m : 0;
+        t_ctx->hnsw_max_level = (b.count > 0) ? b.max_level : 0;
+        t_ctx->hnsw_entry = (b.count > 0) ? b.rowids[b.entry] : 0;
+    } else {
+        printf("Error in vector_rebuild_hnsw: %s\n", sqlite3_errmsg(db));
+    }
+    if (count) *count = (uint32_t)b.count;
+    if (vm) sqlite3_finalize(vm);
+    if (b.nodes) {
+        for (int i=0; i<b.count; ++i) if (b.nodes[i].links) sqlite3_free(b.nodes[i].links);
+        sqlite3_free(b.nodes);
+    }
+    if (b.visited) sqlite3_free(b.visited);
+    if (b.vectors) sqlite3_free(b.vectors);
+    if (b.rowids) sqlite3_free(b.rowids);
+    return rc;
+}
+
+bool index_keyvalue_callback (sqlite3_context *context, void *xdata, const char *key, int key_len, const char *value, int value_len) {
+    hnsw_options *options = (hnsw_options *)xdata;
+    
+    // sanity check
+    if (!key || key_len == 0) return false;
+    if (!value || value_len == 0) return false;
+    
+    // convert value to c-string
+    char buffer[256] = {0};
+    size_t len = ((size_t)value_len > sizeof(buffer)-1) ? sizeof(buffer)-1 : (size_t)value_len;
+    memcpy(buffer, value, len);
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_INDEXTYPE)) {
+        if (strcasecmp(buffer, "HNSW") != 0) return context_result_error(context, SQLITE_ERROR, "Invalid index type: '%s' is not a recognized or supported index type.", buffer);
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_HNSW_M)) {
+        int m = (int)strtol(buffer, NULL, 0);
+        if (m < 2 || m > 256) return context_result_error(context, SQLITE_ERROR, "Invalid HNSW m value: expected an integer between 2 and 256, got '%s'.", buffer);
+        options->m = m;
+        return true;
+    }
+    
+    if (keyvalue_match(key, key_len, OPTION_KEY_HNSW_EFCONSTRUCTION)) {
+        int ef = (int)strtol(buffer, NULL, 0);
+        if (ef <= 0) return context_result_error(context, SQLITE_ERROR, "Invalid HNSW ef_construction value: expected a positive integer, got '%s'.", buffer);
+        options->ef_construction = ef;
+        return true;
+    }
+    
+    // means ignore unknown keys
+    return true;
+}
+
+static void vector_index_build (sqlite3_context *context, const char *table_name, const char *column_name, const char *arg_options) {
+    table_context *t_ctx = vector_context_lookup((vector_context *)sqlite3_user_data(context), table_name, column_name);
+    if (!t_ctx) {
+        context_result_error(context, SQLITE_ERROR, "Vector context not found for table '%s' and column '%s'. Ensure that vector_init() has been called before using vector_index().", table_name, column_name);
+        return;
+    }
+    
+    hnsw_options options = {.m = HNSW_DEFAULT_M, .ef_construction = HNSW_DEFAULT_EF_CONSTRUCTION};
+    if (parse_keyvalue_string(context, arg_options, index_keyvalue_callback, &options) == false) return;
+    
+    uint32_t counter = 0;
+    int rc = SQLITE_ERROR;
+    char sql[STATIC_SQL_SIZE];
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    
+    rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    
+    generate_drop_hnsw_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    
+    generate_create_hnsw_table(table_name, column_name, sql);
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    
+    rc = vector_rebuild_hnsw(context, table_name, column_name, t_ctx, &options, &counter);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    
+    // serialize index options
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_HNSW_MAXM, t_ctx->hnsw_m, 0);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_HNSW_MAXLEVEL, t_ctx->hnsw_max_level, 0);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    rc = sqlite_serialize(context, table_name, column_name, SQLITE_INTEGER, OPTION_KEY_HNSW_ENTRY, t_ctx->hnsw_entry, 0);
+    if (rc != SQLITE_OK) goto index_cleanup;
+    
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    
+index_cleanup:
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        t_ctx->hnsw_m = 0;
+        sqlite3_result_error_code(context, rc);
+        return;
+    }
+    
+    // returns the total number of indexed rows
+    sqlite3_result_int64(context, (sqlite3_int64)counter);
+}
+
+static void vector_index3 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_index", argc, argv, 3, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    const char *options = (const char *)sqlite3_value_text(argv[2]);
+    vector_index_build(context, table_name, column_name, options);
+}
+
+static void vector_index2 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int types[] = {SQLITE_TEXT, SQLITE_TEXT};
+    if (sanity_check_args(context, "vector_index", argc, argv, 2, types) == false) return;
+    
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
+    vector_index_build(context, table_name, column_name, NULL);
+}
+
+// MARK: -
+
+static void *vector_from_json (sqlite3_context *context, sqlite3_vtab *vtab, vector_type type, const char *json, int *size, int dimension) {
+    char *blob = NULL;
+    
+    // skip leading whitespace
+    SKIP_SPACES(json);
+    
+    // sanity check the JSON start array character
+    if (*json != '[') {
+        return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: expected '[' at the beginning of the array.");
+    }
+    json++;
+
+    
+    // count number of commas to estimate (over-estimate) the number of entries in the json
+    int estimated_count = 0;
+    for (const char *p = json; *p; ++p) {
+        if (*p == ',') estimated_count++;
+    }
+    
+    // allocate blob
+    size_t item_size = vector_type_to_size(type);
+    size_t alloc = (estimated_count + 1) * item_size;
+    blob = sqlite3_malloc((int)alloc);
+    if (!blob) {
+        return sqlite_common_set_error(context, vtab, SQLITE_NOMEM, "Out of memory: unable to allocate %lld bytes for BLOB buffer.", (long long)alloc);
+    }
+    
+    // typed pointers
+    float      *float_blob    = (float *)blob;
+    uint8_t    *uint8_blob    = (uint8_t *)blob;
+    int8_t     *int8_blob     = (int8_t *)blob;
+    uint16_t   *uint16_blob   = (uint16_t *)blob;
+    uint16_t   *bfloat16_blob = (uint16_t *)blob;
+    
+    int count = 0;
+    const char *p = json;
+    while (*p) {
+        // skip whitespace
+        SKIP_SPACES(p);
+        
+        // check for end-of-array character
+        if (*p == ']') break;
+        
+        // parse number
+        char *endptr;
+        double value = strtod(p, &endptr);
+        
+        // sanity check
+        if (p == endptr) {
+            // parsing failed
+            sqlite3_free(blob);
+            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: expected a number at position %d (found '%c').", (int)(p - json) + 1, *p ? *p : '?');
+        }
+        
+        if (count >= (int)(alloc / item_size)) {
+            sqlite3_free(blob);
+            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Too many elements in JSON array.");
+        }
+        
+        // convert to proper type
+        switch (type) {
+            case VECTOR_TYPE_F32:
+                float_blob[count++] = (float)value;
+                break;
+                
+            case VECTOR_TYPE_F16:
+                uint16_blob[count++] = float32_to_float16((float)value);
+                break;
+
+            case VECTOR_TYPE_BF16:
+                bfloat16_blob[count++] = float32_to_bfloat16((float)value);
+                break;
+                
+            case VECTOR_TYPE_U8:
+                if (value < 0 || value > 255) {
+                    sqlite3_free(blob);
+                    return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Value out of range for uint8_t.");
+                }
+                uint8_blob[count++] = (uint8_t)value;
+                break;
+                
+            case VECTOR_TYPE_I8:
+                if (value < -128 || value > 127) {
+                    sqlite3_free(blob);
+                    return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Value out of range for int8_t.");
+                }
+                int8_blob[count++] = (int8_t)value;
+                break;
+                
+            default:
+                sqlite3_free(blob);
+                return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Unsupported vector type.");
+        }
+        
+        p = endptr;
+        
+        // skip whitespace
+        SKIP_SPACES(p);
+        
+        if (*p == ',') {
+            // skip comma
+            p++;
+            
+            // skip any whitespace after comma
+            SKIP_SPACES(p);
+
+            // allow trailing comma before closing ]
+            if (*p == ']') break;
+        } else if (*p == ']') {
+            //end-of-array
+            break;
+        } else {
+            sqlite3_free(blob);
+            return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Malformed JSON: unexpected character '%c' at position %d.", *p ? *p : '?', (int)(p - json) + 1);
+        }
+    }
+    
+    // sanity check vector dimension
+    if ((dimension > 0) && (dimension != count)) {
+        sqlite3_free(blob);
+        return sqlite_common_set_error(context, vtab, SQLITE_ERROR, "Invalid JSON vector dimension: expected %d but found %d.", dimension, count);
+    }
+    
+    if (size) *size = (int)(count * item_size);
+    return blob;
+}
+
+// parses a JSON array of vectors (e.g. [[1,2],[3,4]]) into one buffer of count concatenated vectors of the given dimension
+static void *vector_batch_from_json (sqlite3_vtab *vtab, vector_type type, const char *json, int dimension, int *count) {
+    char *vectors = NULL;
+    char *item = NULL;
+    int nvectors = 0, capacity = 0, item_capacity = 0;
+    
+    const char *p = json;
+    SKIP_SPACES(p);
+    if (*p != '[') {
+        return sqlite_common_set_error(NULL, vtab, SQLITE_ERROR, "Malformed JSON: expected '[' at the beginning of the array of vectors.");
+    }
+    p++;
+    
+    while (1) {
+        SKIP_SPACES(p);
+        if (*p == ']') break;
+        if (*p != '[') {
+            sqlite_common_set_error(NULL, vtab, SQLITE_ERROR, "Malformed JSON: expected '[' at position %d (found '%c').", (int)(p - json) + 1, *p ? *p : '?');
+            goto batch_json_error;
+        }
+        
+        const char *end = strchr(p, ']');
+        if (!end) {
+            sqlite_common_set_error(NULL, vtab, SQLITE_ERROR, "Malformed JSON: unterminated vector at position %d.", (int)(p - json) + 1);
+            goto batch_json_error;
+        }
+        
+        // vector_from_json scans up to the terminator, so each vector is copied out to keep parsing linear
+        int len = (int)(end - p) + 1;
+        if (len + 1 > item_capacity) {
+            item_capacity = len + 1;
+            char *buffer = sqlite3_realloc(item, item_capacity);
+            if (!buffer) goto batch_json_nomem;
+            item = buffer;
+        }
+        memcpy(item, p, len);
+        item[len] = 0;
+        
+        int size = 0;
+        void *vector = vector_from_json(NULL, vtab, type, item, &size, dimension);
+        if (!vector) goto batch_json_error; // error already set inside vector_from_json
+        
+        if (nvectors == capacity) {
+            capacity = (capacity) ? capacity * 2 : 16;
+            char *buffer = sqlite3_realloc64(vectors, (sqlite3_uint64)capacity * size);
+            if (!buffer) {
+                sqlite3_free(vector);
+                goto batch_json_nomem;
+            }
+            vectors = buffer;
+        }
+        memcpy(vectors + (size_t)nvectors * size, vector, size);
+        sqlite3_free(vector);
+        nvectors++;
+        
+        p = end + 1;
+        SKIP_SPACES(p);
+        if (*p == ',') {
+            p++;
+        } else if (*p != ']') {
+            sqlite_common_set_error(NULL, vtab, SQLITE_ERROR, "Malformed JSON: unexpected character '%c' at position %d.", *p ? *p : '?', (int)(p - json) + 1);
+            goto batch_json_error;
+        }
+    }
+    
+    if (nvectors == 0) {
+        sqlite_common_set_error(NULL, vtab, SQLITE_ERROR, "The array of vectors cannot be empty.");
+        goto batch_json_error;
+    }
+    
+    if (item) sqlite3_free(item);
+    *count = nvectors;
+    return vectors;
+    
+batch_json_nomem:
+    sqlite_common_set_error(NULL, vtab, SQLITE_NOMEM, "Out of memory: unable to parse the array of vectors.");
+batch_json_error:
+    if (item) sqlite3_free(item);
+    if (vectors) sqlite3_free(vectors);
+    return NULL;
+}
+
+static void vector_as_type (sqlite3_context *context, vector_type type, int argc, sqlite3_value **argv) {
+    sqlite3_value *value = argv[0];
+    int value_size = sqlite3_value_bytes(value);
+    int value_type = sqlite3_value_type(value);
+    
+    // dimension is an optional argument
+    int dimension = (argc == 2) ? sqlite3_value_int(argv[1]) : 0;
+    
+    if (value_type == SQLITE_BLOB) {
+        // the only check we can perform is that the blob size is an exact multiplier of the vector type
+        if (value_size % vector_type_to_size(type) != 0) {
+            context_result_error(context, SQLITE_ERROR, "Invalid BLOB size for format '%s': size must be a multiple of %d bytes.", vector_type_to_name(type), vector_type_to_size(type));
+            return;
+        }
+        if (dimension > 0) {
+            int expected_size = (int)vector_type_to_size(type) * dimension;
+            if (value_size != expected_size) {
+                context_result_error(context, SQLITE_ERROR, "Invalid BLOB size for format '%s': expected dimension should be %d (BLOB is %d bytes instead of %d).", vector_type_to_name(type), dimension, value_size, expected_size);
+                return;
+            }
+        }
+        
+        sqlite3_result_value(context, value);
+        return;
+    }
+    
+    if (value_type == SQLITE_TEXT) {
         // try to parse JSON array value
         const char *json = (const char *)sqlite3_value_text(value);
         if (!json) {
@@ -1686,558 +5671,2087 @@ static void vector_as_type (sqlite3_context *context, vector_type type, int argc
             return;
         }
         
-        char *blob = vector_from_json(context, NULL, type, json, &value_size, dimension);
-        if (!blob) return; // error is set in the context
+        char *blob = vector_from_json(context, NULL, type, json, &value_size, dimension);
+        if (!blob) return; // error is set in the context
+        
+        VECTOR_PRINT((void *)blob, type, (dimension == 0) ? (value_size / vector_type_to_size(type)) : dimension);
+        
+        sqlite3_result_blob(context, (const void *)blob, value_size, sqlite3_free);
+        return;
+    }
+    
+    context_result_error(context, SQLITE_ERROR, "Unsupported input type: only BLOB and TEXT values are accepted (received %s).", sqlite_type_name(value_type));
+}
+
+static void vector_as_f32 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    vector_as_type(context, VECTOR_TYPE_F32, argc, argv);
+}
+
+static void vector_as_f16 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    vector_as_type(context, VECTOR_TYPE_F16, argc, argv);
+}
+
+static void vector_as_bf16 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    vector_as_type(context, VECTOR_TYPE_BF16, argc, argv);
+}
+
+static void vector_as_u8 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    vector_as_type(context, VECTOR_TYPE_U8, argc, argv);
+}
+
+static void vector_as_i8 (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    vector_as_type(context, VECTOR_TYPE_I8, argc, argv);
+}
+
+// MARK: - Modules -
+
+// converts the right-hand side of an id comparison into an inclusive bound, returns false when no row can match
+static bool vCursorRowidBound (sqlite3_value *value, bool lower, bool strict, int64_t *bound) {
+    switch (sqlite3_value_type(value)) {
+        case SQLITE_NULL:
+            return false;
+            
+        case SQLITE_INTEGER: {
+            int64_t v = (int64_t)sqlite3_value_int64(value);
+            if (strict && (v == (lower ? INT64_MAX : INT64_MIN))) return false;
+            *bound = (strict) ? (lower ? v + 1 : v - 1) : v;
+            return true;
+        }
+            
+        case SQLITE_FLOAT: {
+            double d = sqlite3_value_double(value);
+            double r = (lower) ? ceil(d) : floor(d);
+            if (strict && (r == d)) r += (lower) ? 1.0 : -1.0;
+            // out of the int64 range (2^63 is the first double above INT64_MAX)
+            if (r >= 9223372036854775808.0) {*bound = INT64_MAX; return !lower;}
+            if (r < -9223372036854775808.0) {*bound = INT64_MIN; return lower;}
+            *bound = (int64_t)r;
+            return true;
+        }
+    }
+    
+    // TEXT and BLOB values are always greater than integers
+    if (lower) return false;
+    *bound = INT64_MAX;
+    return true;
+}
+
+// converts the right-hand side of an id = / id IN comparison into a rowid (no type conversion is applied, as for the
+// id column), returns false when the value cannot be equal to any rowid
+static bool vCursorRowidValue (sqlite3_value *value, int64_t *rowid) {
+    switch (sqlite3_value_type(value)) {
+        case SQLITE_INTEGER:
+            *rowid = (int64_t)sqlite3_value_int64(value);
+            return true;
+            
+        case SQLITE_FLOAT: {
+            double d = sqlite3_value_double(value);
+            // whole numbers in the int64 range only (2^63 is the first double above INT64_MAX)
+            if ((d != floor(d)) || (d >= 9223372036854775808.0) || (d < -9223372036854775808.0)) return false;
+            *rowid = (int64_t)d;
+            return true;
+        }
+    }
+    
+    // NULL, TEXT and BLOB values never match
+    return false;
+}
+
+static int vCursorSetRowidConstraints (vFullScanCursor *c, int idxNum, sqlite3_value **argv, int argc) {
+    vector_rowset_free(c->rowid_in);
+    c->rowid_in = NULL;
+    c->rowid_min = INT64_MIN;
+    c->rowid_max = INT64_MAX;
+    c->rowid_constrained = false;
+    
+    int index = 0;
+    if (idxNum & (VECTOR_IDX_ROWID_EQ | VECTOR_IDX_ROWID_IN)) {
+        if (index >= argc) return SQLITE_ERROR;
+        sqlite3_value *value = argv[index++];
+        
+        vector_rowset *set = (vector_rowset *)sqlite3_malloc(sizeof(vector_rowset));
+        if (!set) return SQLITE_NOMEM;
+        memset(set, 0, sizeof(vector_rowset));
+        c->rowid_in = set;
+        
+        int64_t capacity = 0;
+        sqlite3_value *item = NULL;
+        int rc = (idxNum & VECTOR_IDX_ROWID_IN) ? sqlite3_vtab_in_first(value, &item) : SQLITE_OK;
+        if (idxNum & VECTOR_IDX_ROWID_EQ) item = value;
+        while ((rc == SQLITE_OK) && item) {
+            int64_t rowid;
+            if (vCursorRowidValue(item, &rowid)) {
+                if (set->count == capacity) {
+                    capacity = (capacity) ? capacity * 2 : 16;
+                    int64_t *rowids = (int64_t *)sqlite3_realloc64(set->rowids, (sqlite3_uint64)capacity * sizeof(int64_t));
+                    if (!rowids) return SQLITE_NOMEM;
+                    set->rowids = rowids;
+                }
+                set->rowids[set->count++] = rowid;
+            }
+            if (idxNum & VECTOR_IDX_ROWID_EQ) break;
+            rc = sqlite3_vtab_in_next(value, &item);
+        }
+        if ((rc != SQLITE_OK) && (rc != SQLITE_DONE)) return rc;
+        
+        qsort(set->rowids, (size_t)set->count, sizeof(int64_t), vector_rowid_compare);
+        set->min_rowid = (set->count) ? set->rowids[0] : 1;
+        set->max_rowid = (set->count) ? set->rowids[set->count - 1] : 0;
+        c->rowid_min = set->min_rowid;
+        c->rowid_max = set->max_rowid;
+        c->rowid_constrained = true;
+    }
+    
+    if (idxNum & (VECTOR_IDX_ROWID_GT | VECTOR_IDX_ROWID_GE)) {
+        if (index >= argc) return SQLITE_ERROR;
+        int64_t bound;
+        if (vCursorRowidBound(argv[index++], true, (idxNum & VECTOR_IDX_ROWID_GT) != 0, &bound) == false) {c->rowid_min = INT64_MAX; c->rowid_max = INT64_MIN;}
+        else if (bound > c->rowid_min) c->rowid_min = bound;
+        c->rowid_constrained = true;
+    }
+    
+    if (idxNum & (VECTOR_IDX_ROWID_LT | VECTOR_IDX_ROWID_LE)) {
+        if (index >= argc) return SQLITE_ERROR;
+        int64_t bound;
+        if (vCursorRowidBound(argv[index++], false, (idxNum & VECTOR_IDX_ROWID_LT) != 0, &bound) == false) {c->rowid_min = INT64_MAX; c->rowid_max = INT64_MIN;}
+        else if (bound < c->rowid_max) c->rowid_max = bound;
+        c->rowid_constrained = true;
+    }
+    
+    return SQLITE_OK;
+}
+
+static inline bool vCursorRowidMatch (const vFullScanCursor *c, int64_t rowid) {
+    if ((rowid < c->rowid_min) || (rowid > c->rowid_max)) return false;
+    if (c->rowid_in && !vector_rowset_contains(c->rowid_in, rowid)) return false;
+    if (c->rowset && !vector_rowset_contains(c->rowset, rowid)) return false;
+    if (c->delta.ids && vector_rowset_contains(c->delta.ids, rowid)) return false;
+    return true;
+}
+
+// maps the xFilter arguments back to the hidden columns they belong to (see vScanBestIndex), applies the id constraints
+// that follow them, validates the arguments and parses the per-query options. On success argv and argc describe the
+// hidden column arguments and c->table is the context of the scanned table.
+static int vCursorParseArguments (vFullScanCursor *c, int idxNum, int *argc, sqlite3_value ***argv, sqlite3_value **hidden, const char *fname, int nargs, int max_args, bool quantized) {
+    vFullScan *vtab = (vFullScan *)c->base.pVtab;
+    
+    int nhidden = 0, next_arg = 0;
+    for (int i=0; i<VECTOR_COLUMN_ROWID; ++i) {
+        hidden[i] = NULL;
+        if ((idxNum & (1 << i)) == 0 || next_arg >= *argc) continue;
+        hidden[i] = (*argv)[next_arg++];
+        nhidden = i + 1;
+    }
+    int rc = vCursorSetRowidConstraints(c, idxNum, *argv + next_arg, *argc - next_arg);
+    if (rc != SQLITE_OK) return rc;
+    *argv = hidden;
+    *argc = nhidden;
+    
+    // sanity check arguments (optional options and filter strings can follow the mandatory arguments)
+    bool missing = false;
+    for (int i=0; i<nargs; ++i) missing |= (hidden[i] == NULL);
+    if (missing || (nhidden < nargs) || (nhidden > max_args)) {
+        return sqlite_vtab_set_error(&vtab->base, "%s expects %d arguments, but %d were provided.", fname, nargs, nhidden);
+    }
+    
+    // SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT or SQLITE_BLOB, SQLITE_INTEGER, SQLITE_TEXT (optional), SQLITE_TEXT (optional)
+    for (int i=0; i<nhidden; ++i) {
+        int actual_type = (hidden[i]) ? sqlite3_value_type(hidden[i]) : SQLITE_NULL;
+        if (i >= nargs) {
+            if ((actual_type != SQLITE_TEXT) && (actual_type != SQLITE_NULL))
+                return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type TEXT (got %s).", fname, (i+1), sqlite_type_name(actual_type));
+            continue;
+        }
+        switch (i) {
+            case 0:
+            case 1:
+                if (actual_type != SQLITE_TEXT)
+                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type TEXT (got %s).", fname, (i+1), sqlite_type_name(actual_type));
+                break;
+            case 2:
+                if ((actual_type != SQLITE_TEXT) && (actual_type != SQLITE_BLOB))
+                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type TEXT or BLOB (got %s).", fname, (i+1), sqlite_type_name(actual_type));
+                break;
+            case 3:
+                if (actual_type != SQLITE_INTEGER)
+                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type INTEGER (got %s).", fname, (i+1), sqlite_type_name(actual_type));
+                break;
+        }
+    }
+    
+    // parse per-query options
+    memset(&c->options, 0, sizeof(vector_scan_options));
+    if ((nhidden > nargs) && hidden[nargs]) {
+        const char *scan_options = (const char *)sqlite3_value_text(hidden[nargs]);
+        if (parse_keyvalue_string(NULL, scan_options, scan_keyvalue_callback, &c->options) == false) {
+            return sqlite_vtab_set_error(&vtab->base, "%s: invalid options '%s'.", fname, scan_options);
+        }
+    }
+    
+    // retrieve arguments
+    const char *table_name = (const char *)sqlite3_value_text(hidden[0]);
+    const char *column_name = (const char *)sqlite3_value_text(hidden[1]);
+    table_context *t_ctx = vector_context_lookup(vtab->ctx, table_name, column_name);
+    if (!t_ctx) {
+        return sqlite_vtab_set_error(&vtab->base, "%s: unable to retrieve context.", fname);
+    }
+    
+    if (quantized) {
+        char buffer[STATIC_SQL_SIZE];
+        char *name = generate_quant_table_name(table_name, column_name, buffer);
+        if (!name || !sqlite_table_exists(vtab->db, name)) {
+            sqlite_vtab_set_error(&vtab->base, "Quantization table not found for table '%s' and column '%s'. Ensure that vector_quantize() has been called before using %s().", table_name, column_name, fname);
+            return SQLITE_ERROR;
+        }
+    }
+    
+    c->table = t_ctx;
+    return SQLITE_OK;
+}
+
+static void vStreamCursorReset (vFullScanCursor *c);
+static int vFullScanCursorNext (sqlite3_vtab_cursor *cur);
+
+// parameters of a vector_quantize_scan query that change its results, followed in the key by the filter,
+// the values of an id IN (...) constraint and the query vector
+typedef struct {
+    int                 k;
+    int                 filter_size;
+    int64_t             rowid_count;        // -1 without an id = or id IN (...) constraint
+    int64_t             rowid_min;
+    int64_t             rowid_max;
+    vector_scan_options options;
+} vQuantCacheKeyHeader;
+
+// builds the cache key of the query and looks it up, the key is returned (in key/key_size/hash) for vQuantCacheStore
+static int vQuantCacheLookup (sqlite3 *db, vFullScanCursor *c, const void *vector, int vsize, int k, uint8_t **key, int *key_size, uint64_t *hash, bool *found) {
+    vector_cache *cache = &c->table->cache;
+    *found = false;
+    *key = NULL;
+    
+    int rc = vector_cache_reserve(cache, c->table->options.cache_size);
+    if (rc != SQLITE_OK) return rc;
+    
+    // results are only valid for the database they were computed on
+    int data_version = 0;
+    sqlite3_file_control(db, "main", SQLITE_FCNTL_DATA_VERSION, &data_version);
+    int64_t total_changes = (int64_t)sqlite3_total_changes64(db);
+    if (((uint32_t)data_version != cache->data_version) || (total_changes != cache->total_changes)) {
+        vector_cache_clear(cache);
+        cache->data_version = (uint32_t)data_version;
+        cache->total_changes = total_changes;
+    }
+    
+    vQuantCacheKeyHeader header;
+    memset(&header, 0, sizeof(header));
+    header.k = k;
+    header.filter_size = (c->filter) ? (int)strlen(c->filter) : 0;
+    header.rowid_count = (c->rowid_in) ? c->rowid_in->count : -1;
+    header.rowid_min = c->rowid_min;
+    header.rowid_max = c->rowid_max;
+    header.options = c->options;
+    header.options.threads = 0;             // does not change the results
+    
+    size_t rowids_size = (c->rowid_in) ? (size_t)c->rowid_in->count * sizeof(int64_t) : 0;
+    size_t size = sizeof(header) + (size_t)header.filter_size + rowids_size + (size_t)vsize;
+    if (size > INT_MAX) return SQLITE_OK;
+    
+    uint8_t *buffer = (uint8_t *)sqlite3_malloc64((sqlite3_uint64)size);
+    if (!buffer) return SQLITE_NOMEM;
+    uint8_t *p = buffer;
+    memcpy(p, &header, sizeof(header)); p += sizeof(header);
+    if (header.filter_size) {memcpy(p, c->filter, header.filter_size); p += header.filter_size;}
+    if (rowids_size) {memcpy(p, c->rowid_in->rowids, rowids_size); p += rowids_size;}
+    if (vsize) memcpy(p, vector, vsize);
+    
+    *key = buffer;
+    *key_size = (int)size;
+    *hash = vector_cache_hash(buffer, (int)size);
+    
+    int i = vector_cache_find(cache, *hash, buffer, (int)size);
+    if (i < 0) {
+        ++cache->misses;
+        return SQLITE_OK;
+    }
+    
+    vector_cache_entry *e = &cache->entries[i];
+    memcpy(c->rowids, e->data + e->key_size, (size_t)e->count * sizeof(int64_t));
+    memcpy(c->distance, e->data + e->key_size + (size_t)e->count * sizeof(int64_t), (size_t)e->count * sizeof(double));
+    c->row_count = e->count;
+    ++cache->hits;
+    *found = true;
+    return SQLITE_OK;
+}
+
+static void vQuantCacheStore (sqlite3 *db, vFullScanCursor *c, const uint8_t *key, int key_size, uint64_t hash) {
+    vector_cache *cache = &c->table->cache;
+    
+    // the scan reads the database without changing it, but a concurrent commit could have changed what it read
+    int data_version = 0;
+    sqlite3_file_control(db, "main", SQLITE_FCNTL_DATA_VERSION, &data_version);
+    if (((uint32_t)data_version != cache->data_version) || ((int64_t)sqlite3_total_changes64(db) != cache->total_changes)) return;
+    
+    vector_cache_insert(cache, hash, key, key_size, c->rowids, c->distance, c->row_count);
+}
+
+static int vCursorFilterCommon (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv, const char *fname, vcursor_run_callback run_callback, vcursor_sort_callback sort_callback, bool quantized) {
+    
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    vFullScan *vtab = (vFullScan *)cur->pVtab;
+    
+    bool is_streaming = (sort_callback == NULL);
+    bool is_quantized = quantized;
+    c->is_streaming = is_streaming;
+    c->is_quantized = is_quantized;
+    
+    sqlite3_value *hidden[VECTOR_COLUMN_ROWID];
+    int nargs = (is_streaming) ? 3 : 4;
+    int max_args = (is_streaming) ? nargs + 1 : nargs + 2;
+    int rc = vCursorParseArguments(c, idxNum, &argc, &argv, hidden, fname, nargs, max_args, quantized);
+    if (rc != SQLITE_OK) return rc;
+    table_context *t_ctx = c->table;
+    
+    const void *vector = NULL;
+    int vsize = 0;
+    if (sqlite3_value_type(argv[2]) == SQLITE_TEXT) {
+        vsize = sqlite3_value_bytes(argv[2]);
+        vector = (const void *)vector_from_json(NULL, &vtab->base, t_ctx->options.v_type, (const char *)sqlite3_value_text(argv[2]), &vsize, t_ctx->options.v_dim);
+        if (!vector) return SQLITE_ERROR; // error already set inside vector_from_json
+    } else {
+        vector = (const void *)sqlite3_value_blob(argv[2]);
+        vsize = sqlite3_value_bytes(argv[2]);
+        if (!vector) return sqlite_vtab_set_error(&vtab->base, "%s: input vector cannot be NULL.", fname);
+    }
+    VECTOR_PRINT((void*)vector, t_ctx->options.v_type, t_ctx->options.v_dim);
+    
+    // a streaming cursor must point to its first row when xFilter returns
+    if (is_streaming) {
+        vStreamCursorReset(c);
+        rc = run_callback(vtab->db, c, vector, vsize);
+        return (rc == SQLITE_OK) ? vFullScanCursorNext(cur) : rc;
+    }
+    
+    // optional filter, only rows matching the WHERE fragment compete for the top-k
+    c->filter = ((argc > nargs + 1) && argv[nargs + 1]) ? (const char *)sqlite3_value_text(argv[nargs + 1]) : NULL;
+    if (c->filter && c->filter[0] == 0) c->filter = NULL;
+    
+    // non-streaming flow
+    int k = (is_streaming) ? 0 : sqlite3_value_int(argv[3]);
+    if (k == 0) return SQLITE_DONE;
+    
+    if (c->row_count != k) {
+        if (c->rowids) sqlite3_free(c->rowids);
+        c->rowids = (int64_t *)sqlite3_malloc(k * sizeof(int64_t));
+        if (c->rowids == NULL) return SQLITE_NOMEM;
+        
+        if (c->distance) sqlite3_free(c->distance);
+        c->distance = (double *)sqlite3_malloc(k * sizeof(double));
+        if (c->distance == NULL) return SQLITE_NOMEM;
+    }
+    
+    memset(c->rowids, 0, k * sizeof(int64_t));
+    for (int i=0; i<k; ++i) c->distance[i] = INFINITY;
+    
+    c->size = 0;
+    c->row_index = 0;
+    c->row_count = k;
+    
+    // results of recent queries are cached per table (vector_init with cache=N)
+    uint8_t *cache_key = NULL;
+    int cache_key_size = 0;
+    uint64_t cache_hash = 0;
+    bool cached = false;
+    if (is_quantized && (t_ctx->options.cache_size > 0)) {
+        rc = vQuantCacheLookup(vtab->db, c, vector, vsize, k, &cache_key, &cache_key_size, &cache_hash, &cached);
+        if (rc != SQLITE_OK) {c->filter = NULL; return rc;}
+    }
+    
+    if (!cached) {
+        rc = run_callback(vtab->db, c, vector, vsize);
+        int count = sort_callback(c);
+        c->row_count -= count;
+        if ((rc == SQLITE_OK) && cache_key) vQuantCacheStore(vtab->db, c, cache_key, cache_key_size, cache_hash);
+    }
+    if (cache_key) sqlite3_free(cache_key);
+    
+    vector_rowset_free(c->rowset);
+    c->rowset = NULL;
+    c->filter = NULL;
+    if ((rc == SQLITE_MISUSE) && (vtab->base.zErrMsg == NULL)) sqlite_vtab_set_error(&vtab->base, "%s: filter must be a single SQL expression.", fname);
+    
+    #if 0
+    for (int i=0; i<c->row_count; ++i) {
+        printf("%lld\t%f\n", (long long)c->rowids[i], c->distance[i]);
+    }
+    #endif
+    
+    return rc;
+}
+
+static int vFullScanConnect (sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr) {
+    // https://www.sqlite.org/vtab.html#table_valued_functions
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(tbl hidden, vector hidden, k hidden, memidx hidden, options hidden, filter hidden, id, distance);");
+    if (rc != SQLITE_OK) return rc;
+    
+    vFullScan *vtab = (vFullScan *)sqlite3_malloc(sizeof(vFullScan));
+    if (!vtab) return SQLITE_NOMEM;
+    
+    memset(vtab, 0, sizeof(vFullScan));
+    vtab->db = db;
+    vtab->ctx = (vector_context *)pAux;
+    
+    *ppVtab = (sqlite3_vtab *)vtab;
+    return SQLITE_OK;
+}
+
+static int vFullScanDisconnect (sqlite3_vtab *pVtab) {
+    vFullScan *vtab = (vFullScan *)pVtab;
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+// hidden columns are passed to xFilter as contiguous arguments (in column order) followed by the id constraints,
+// idxNum records which of them are present so that vCursorFilterCommon can map them back
+static int vScanBestIndex (sqlite3_index_info *pIdxInfo, int nmandatory) {
+    int columns[VECTOR_COLUMN_ROWID];
+    int rowid_eq = -1, rowid_lower = -1, rowid_upper = -1;
+    int idx_num = 0;
+    for (int i=0; i<VECTOR_COLUMN_ROWID; ++i) columns[i] = -1;
+    
+    const struct sqlite3_index_constraint *pConstraint = pIdxInfo->aConstraint;
+    for(int i=0; i<pIdxInfo->nConstraint; i++, pConstraint++){
+        if( pConstraint->usable == 0 ) continue;
+        int iColumn = pConstraint->iColumn;
+        unsigned char op = pConstraint->op;
+        
+        if ((iColumn >= VECTOR_COLUMN_IDX) && (iColumn < VECTOR_COLUMN_ROWID)) {
+            if ((op == SQLITE_INDEX_CONSTRAINT_EQ) && (columns[iColumn] == -1)) columns[iColumn] = i;
+            continue;
+        }
+        
+        if (iColumn != VECTOR_COLUMN_ROWID) continue;
+        switch (op) {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+                if (rowid_eq == -1) rowid_eq = i;
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT:
+            case SQLITE_INDEX_CONSTRAINT_GE:
+                if (rowid_lower == -1) rowid_lower = i;
+                break;
+            case SQLITE_INDEX_CONSTRAINT_LT:
+            case SQLITE_INDEX_CONSTRAINT_LE:
+                if (rowid_upper == -1) rowid_upper = i;
+                break;
+        }
+    }
+    
+    int argv_index = 0;
+    for (int i=0; i<VECTOR_COLUMN_ROWID; ++i) {
+        if (columns[i] == -1) continue;
+        pIdxInfo->aConstraintUsage[columns[i]].argvIndex = ++argv_index;
+        pIdxInfo->aConstraintUsage[columns[i]].omit = 1;
+        idx_num |= (1 << i);
+    }
+    
+    if (rowid_eq != -1) {
+        // IN lists are received all at once (sqlite3_vtab_in is available since 3.38.0)
+        bool is_in = (sqlite3_libversion_number() >= 3038000) && sqlite3_vtab_in(pIdxInfo, rowid_eq, -1);
+        if (is_in) sqlite3_vtab_in(pIdxInfo, rowid_eq, 1);
+        pIdxInfo->aConstraintUsage[rowid_eq].argvIndex = ++argv_index;
+        pIdxInfo->aConstraintUsage[rowid_eq].omit = 1;
+        idx_num |= (is_in) ? VECTOR_IDX_ROWID_IN : VECTOR_IDX_ROWID_EQ;
+    }
+    
+    if (rowid_lower != -1) {
+        pIdxInfo->aConstraintUsage[rowid_lower].argvIndex = ++argv_index;
+        pIdxInfo->aConstraintUsage[rowid_lower].omit = 1;
+        idx_num |= (pIdxInfo->aConstraint[rowid_lower].op == SQLITE_INDEX_CONSTRAINT_GT) ? VECTOR_IDX_ROWID_GT : VECTOR_IDX_ROWID_GE;
+    }
+    
+    if (rowid_upper != -1) {
+        pIdxInfo->aConstraintUsage[rowid_upper].argvIndex = ++argv_index;
+        pIdxInfo->aConstraintUsage[rowid_upper].omit = 1;
+        idx_num |= (pIdxInfo->aConstraint[rowid_upper].op == SQLITE_INDEX_CONSTRAINT_LT) ? VECTOR_IDX_ROWID_LT : VECTOR_IDX_ROWID_LE;
+    }
+    
+    pIdxInfo->idxNum = idx_num;
+    
+    // a plan without all the mandatory arguments cannot run, so make sure it is never preferred
+    // (for example when the query vector comes from a joined table)
+    for (int i=0; i<nmandatory; ++i) {
+        if (columns[i] == -1) {
+            pIdxInfo->estimatedCost = 1e30;
+            break;
+        }
+    }
+    if (idx_num & (VECTOR_IDX_ROWID_EQ | VECTOR_IDX_ROWID_IN)) pIdxInfo->estimatedCost /= 10;
+    else if (idx_num & (VECTOR_IDX_ROWID_GT | VECTOR_IDX_ROWID_GE | VECTOR_IDX_ROWID_LT | VECTOR_IDX_ROWID_LE)) pIdxInfo->estimatedCost /= 2;
+    
+    return SQLITE_OK;
+}
+
+static int vFullScanBestIndex (sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+    pIdxInfo->estimatedCost = (double)1;
+    pIdxInfo->estimatedRows = 100;
+    pIdxInfo->orderByConsumed = 1;
+    return vScanBestIndex(pIdxInfo, 4);
+}
+
+static int vFullScanCursorOpen (sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+    vFullScanCursor *c = (vFullScanCursor *)sqlite3_malloc(sizeof(vFullScanCursor));
+    if (!c) return SQLITE_NOMEM;
+    
+    memset(c, 0, sizeof(vFullScanCursor));
+    *ppCursor = (sqlite3_vtab_cursor *)c;
+    return SQLITE_OK;
+}
+
+// releases the state of the previous scan of a streaming cursor (a cursor is filtered again, for example, as the inner loop of a join)
+static void vStreamCursorReset (vFullScanCursor *c) {
+    if (c->stream.vector) sqlite3_free(c->stream.vector);
+    if (c->stream.vm) sqlite3_finalize(c->stream.vm);
+    if (c->stream.reader) {
+        vector_row_reader_finalize(c->stream.reader);
+        sqlite3_free(c->stream.reader);
+    }
+    if (c->stream.preload) vector_preload_release(c->stream.preload);
+    memset(&c->stream, 0, sizeof(c->stream));
+}
+
+static int vFullScanCursorClose (sqlite3_vtab_cursor *cur){
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    if (c->rowids) sqlite3_free(c->rowids);
+    if (c->distance) sqlite3_free(c->distance);
+    if (c->query_idx) sqlite3_free(c->query_idx);
+    vStreamCursorReset(c);
+    vector_rowset_free(c->rowset);
+    vector_rowset_free(c->rowid_in);
+    vector_delta_free(&c->delta);
+    sqlite3_free(c);
+    return SQLITE_OK;
+}
+
+// once the quantized rows are exhausted, a quantized stream continues with the delta rows (if any)
+// with stored norms (see quant_norm_type) the cosine distance of quantized rows is computed from the dot product:
+// dot kernels return -a.b and the norm of the query is stored right after its code by vQuantPrepareQuery
+static inline bool vQuantUsesNorms (const vFullScanCursor *c, const vector_chunk *chunk) {
+    return (chunk->norms != NULL) && (quant_norm_type(&c->table->options) != 0);
+}
+
+static inline float vQuantQueryNorm (const void *v, int n) {
+    float norm;
+    memcpy(&norm, (const uint8_t *)v + n, sizeof(float));
+    return norm;
+}
+
+static inline float vQuantCosine (float dot, float norm_a, float norm_b) {
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+    return 1.0f + dot / (norm_a * norm_b);
+}
+
+static float vStreamQuantDistance (vFullScanCursor *c, const vector_chunk *chunk, int i) {
+    const void *v = c->stream.vector;
+    int n = c->stream.vdim;
+    if (vQuantUsesNorms(c, chunk)) {
+        distance_function_t dot_fn = dispatch_distance_table[VECTOR_DISTANCE_DOT][quant_code_type(c->table->options.q_type)];
+        return vQuantCosine(dot_fn(v, (const void *)vector_chunk_code(chunk, i), n), vQuantQueryNorm(v, n), vector_chunk_norm(chunk, i));
+    }
+    return c->stream.distance_fn(v, (const void *)vector_chunk_code(chunk, i), n);
+}
+
+static bool vStreamQuantSwitchToDelta (vFullScanCursor *c) {
+    if (c->stream.in_delta || c->delta.count == 0) return false;
+    
+    if (c->stream.vm) sqlite3_finalize(c->stream.vm);
+    c->stream.vm = NULL;
+    c->stream.in_delta = true;
+    c->stream.chunk = vector_chunk_rows(c->delta.rows, c->delta.count, c->stream.vdim);
+    c->stream.dindex = 0;
+    c->stream.dcounter = c->delta.count;
+    
+    // delta rows are the current version of their ids, so they must not be hidden
+    vector_rowset_free(c->delta.ids);
+    c->delta.ids = NULL;
+    return true;
+}
+
+static int vFullScanCursorNext (sqlite3_vtab_cursor *cur){
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+
+    // non-streaming flow
+    if (!c->is_streaming) { c->row_index++; return SQLITE_OK; }
+
+    // streaming flow
+    sqlite3_stmt *vm = c->stream.vm;
+    void *v1 = c->stream.vector;
+    int dimension = c->stream.vdim;
+    distance_function_t distance_fn = c->stream.distance_fn;
+
+    // FULL-SCAN
+    if (!c->is_quantized) {
+        while (1) {
+            int rc = sqlite3_step(vm);
+            if (rc == SQLITE_DONE) { c->stream.is_eof = 1; return SQLITE_OK; }
+            else if (rc != SQLITE_ROW) return rc;
+            
+            int64_t rowid = (int64_t)sqlite3_column_int64(vm, 0);
+            if (c->rowid_in && !vCursorRowidMatch(c, rowid)) continue;
+            
+            // skip NULL values
+            const void *v2 = NULL;
+            if (c->stream.reader) {
+                rc = vector_row_reader_read(c->stream.reader, rowid, &v2);
+                if (rc == SQLITE_DONE) continue;
+                if (rc != SQLITE_ROW) return rc;
+            } else {
+                if (sqlite3_column_type(vm, 1) != SQLITE_BLOB) continue;
+                v2 = sqlite3_column_blob(vm, 1);
+                if ((v2 == NULL) || ((size_t)sqlite3_column_bytes(vm, 1) < (size_t)dimension * vector_type_to_size(c->table->options.v_type))) continue;
+            }
+
+            float distance = distance_fn((const void *)v1, (const void *)v2, dimension);
+            if (nearly_zero_float32(distance)) distance = 0.0f;
+
+            c->stream.distance = distance;
+            c->stream.rowid = rowid;
+            return SQLITE_OK;
+        }
+    }
+
+    // QUANTIZED IN-MEMORY
+    const vector_chunk *chunk = &c->stream.chunk;
+    if (vm == NULL) {
+        if ((c->is_quantized == false) || (chunk->codes == NULL)) return SQLITE_MISUSE;
+        
+        // skip rows excluded by the id constraints (or replaced by delta rows)
+        bool check_rowid = (c->rowid_constrained || c->delta.ids);
+        while (c->stream.dindex < c->stream.dcounter) {
+            if (!check_rowid || vCursorRowidMatch(c, vector_chunk_rowid(chunk, c->stream.dindex))) break;
+            c->stream.dindex++;
+        }
         
-        VECTOR_PRINT((void *)blob, type, (dimension == 0) ? (value_size / vector_type_to_size(type)) : dimension);
+        // EOF if we've already consumed all items (delta rows included)
+        if (c->stream.dindex >= c->stream.dcounter) {
+            if (vStreamQuantSwitchToDelta(c)) return vFullScanCursorNext(cur);
+            c->stream.is_eof = 1;
+            return SQLITE_OK;
+        }
+
+        // no NULL vectors here by construction
+        float distance = vStreamQuantDistance(c, chunk, c->stream.dindex);
+        if (nearly_zero_float32(distance)) distance = 0.0f;
+
+        c->stream.distance = distance;
+        c->stream.rowid    = vector_chunk_rowid(chunk, c->stream.dindex);
+        c->stream.dindex++;
+        return SQLITE_OK;
+    }
+
+    // QUANTIZED FROM DISK (chunked)
+    bool check_rowid = (c->rowid_constrained || c->delta.ids);
+    while (1) {
+        if (c->stream.dcounter == 0) {
+            int rc = sqlite3_step(vm);
+            if (rc == SQLITE_DONE) {
+                if (vStreamQuantSwitchToDelta(c)) return vFullScanCursorNext(cur);
+                c->stream.is_eof = 1;
+                return SQLITE_OK;
+            }
+            else if (rc != SQLITE_ROW) return rc;
+
+            if (!vector_chunk_decode(&c->stream.chunk, sqlite3_column_blob(vm, 1), sqlite3_column_bytes(vm, 1), sqlite3_column_int(vm, 0), dimension)) return SQLITE_CORRUPT;
+            c->stream.dcounter = c->stream.chunk.count;
+            c->stream.dindex   = 0; // reset index for the new chunk
+            if (c->stream.dcounter == 0) continue;
+        }
         
-        sqlite3_result_blob(context, (const void *)blob, value_size, sqlite3_free);
-        return;
+        if (!check_rowid || vCursorRowidMatch(c, vector_chunk_rowid(chunk, c->stream.dindex))) break;
+        
+        // skip rows excluded by the id constraints
+        if (++c->stream.dindex == c->stream.dcounter) {
+            c->stream.dcounter = 0;
+            memset(&c->stream.chunk, 0, sizeof(vector_chunk));
+        }
     }
     
-    context_result_error(context, SQLITE_ERROR, "Unsupported input type: only BLOB and TEXT values are accepted (received %s).", sqlite_type_name(value_type));
+    float distance = vStreamQuantDistance(c, chunk, c->stream.dindex);
+    if (nearly_zero_float32(distance)) distance = 0.0f;
+
+    c->stream.distance = distance;
+    c->stream.rowid    = vector_chunk_rowid(chunk, c->stream.dindex);
+    c->stream.dindex++;
+
+    if (c->stream.dindex == c->stream.dcounter) {
+        // finished current chunk; force reload on next call
+        c->stream.dcounter = 0;
+        memset(&c->stream.chunk, 0, sizeof(vector_chunk)); // clear stale pointers to blob memory
+    }
+
+    return SQLITE_OK;
 }
 
-static void vector_as_f32 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    vector_as_type(context, VECTOR_TYPE_F32, argc, argv);
+
+static int vFullScanCursorEof (sqlite3_vtab_cursor *cur){
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    return (c->is_streaming) ? c->stream.is_eof : (c->row_index == c->row_count);
 }
 
-static void vector_as_f16 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    vector_as_type(context, VECTOR_TYPE_F16, argc, argv);
+static int vFullScanCursorColumn (sqlite3_vtab_cursor *cur, sqlite3_context *context, int iCol) {
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    if (iCol == VECTOR_COLUMN_ROWID) {
+        sqlite3_result_int64(context, (c->is_streaming) ? (sqlite3_int64)c->stream.rowid : (sqlite3_int64)c->rowids[c->row_index]);
+    } else if (iCol == VECTOR_COLUMN_DISTANCE) {
+        sqlite3_result_double(context, (c->is_streaming) ? c->stream.distance : c->distance[c->row_index]);
+    } else if (iCol == VECTOR_COLUMN_QUERY_IDX) {
+        sqlite3_result_int(context, (c->query_idx) ? c->query_idx[c->row_index] : 0);
+    }
+    return SQLITE_OK;
 }
 
-static void vector_as_bf16 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    vector_as_type(context, VECTOR_TYPE_BF16, argc, argv);
+static int vFullScanCursorRowid (sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    *pRowid = (c->is_streaming) ? (sqlite3_int64)c->stream.rowid : (sqlite_int64)c->rowids[c->row_index];
+    return SQLITE_OK;
 }
 
-static void vector_as_u8 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    vector_as_type(context, VECTOR_TYPE_U8, argc, argv);
+// the k result slots of a cursor are kept as a binary max-heap on distance (slot 0 holds the worst candidate),
+// so accepting a candidate costs O(log k) and results are ordered with a heapsort
+static inline void vTopKSiftDown (double *distance, int64_t *rowids, int n, int i) {
+    double d = distance[i];
+    int64_t rowid = rowids[i];
+    
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if ((child + 1 < n) && (distance[child + 1] > distance[child])) ++child;
+        if (distance[child] <= d) break;
+        distance[i] = distance[child];
+        rowids[i] = rowids[child];
+        i = child;
+    }
+    
+    distance[i] = d;
+    rowids[i] = rowid;
 }
 
-static void vector_as_i8 (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    vector_as_type(context, VECTOR_TYPE_I8, argc, argv);
+static inline void vTopKReplaceTop (double *distance, int64_t *rowids, int n, double d, int64_t rowid) {
+    distance[0] = d;
+    rowids[0] = rowid;
+    vTopKSiftDown(distance, rowids, n, 0);
 }
 
-// MARK: - Modules -
+// sorts the slots in ascending order (they do not need to form a heap) and returns the number of empty slots
+static int vFullScanSortSlots (vFullScanCursor *c) {
+    int     row_count = c->row_count;
+    double  *distance = c->distance;
+    int64_t *rowids = c->rowids;
+    
+    for (int i = row_count / 2 - 1; i >= 0; --i) vTopKSiftDown(distance, rowids, row_count, i);
+    for (int i = row_count - 1; i > 0; --i) {
+        SWAP(double, distance[0], distance[i]);
+        SWAP(int64_t, rowids[0], rowids[i]);
+        vTopKSiftDown(distance, rowids, i, 0);
+    }
+    
+    int counter = 0;
+    while ((counter < row_count) && (distance[row_count - counter - 1] == INFINITY)) ++counter;
+    return counter;
+}
 
-static int vCursorFilterCommon (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv, const char *fname, vcursor_run_callback run_callback, vcursor_sort_callback sort_callback, bool quantized) {
+#define VECTOR_MIN_ROWS_PER_THREAD                  16384
+
+static int vScanThreadCount (vFullScanCursor *c, int64_t nrows) {
+    int threads = (c->options.threads > 0) ? c->options.threads : c->table->options.threads;
+    int64_t max_threads = nrows / VECTOR_MIN_ROWS_PER_THREAD;
+    if (threads > max_threads) threads = (int)max_threads;
+    return (threads < 1) ? 1 : threads;
+}
+
+static void vScanMergeSlots (vFullScanCursor *c, const int64_t *rowids, const double *distance, int count) {
+    for (int i=0; i<count; ++i) {
+        if (distance[i] < c->distance[0]) vTopKReplaceTop(c->distance, c->rowids, c->row_count, distance[i], rowids[i]);
+    }
+}
+
+// rows are handed to batch kernels in blocks of VECTOR_SCAN_BLOCK_ROWS
+#define VECTOR_SCAN_BLOCK_ROWS                      64
+
+// scores a block of count rows (stride bytes apart) with a batch kernel and keeps the best ones in the k slots of c
+static void vScanBlock (vFullScanCursor *c, const void *v, const uint8_t *rows, size_t stride, const int64_t *rowids, int count, int n, distance_batch_function_t batch_fn) {
+    float block[VECTOR_SCAN_BLOCK_ROWS];
+    batch_fn(v, (const void *)rows, stride, count, n, block);
     
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-    vFullScan *vtab = (vFullScan *)cur->pVtab;
+    for (int i=0; i<count; ++i) {
+        float dist = block[i];
+        if (nearly_zero_float32(dist)) dist = 0.0;
+        if (dist < c->distance[0]) vTopKReplaceTop(c->distance, c->rowids, c->row_count, dist, rowids[i]);
+    }
+}
+
+// scores every row returned by vm (pk, vector) into the k slots of c; with a reader, vm only returns the pk and
+// vectors are copied by the reader straight into the block of rows (see vFullScanUseReader)
+static int vFullScanRows (sqlite3_stmt *vm, vector_row_reader *reader, vFullScanCursor *c, const void *v1, distance_function_t distance_fn, distance_batch_function_t batch_fn) {
+    int dimension = c->table->options.v_dim;
+    bool check_rowid = (c->rowid_in != NULL);
+    
+    // with a batch kernel, vectors are copied in a block of rows scored with a single call
+    size_t vsize = (size_t)dimension * vector_type_to_size(c->table->options.v_type);
+    void *buffer = (batch_fn || reader) ? sqlite3_malloc64(VECTOR_CHUNK_ALIGN + vsize * VECTOR_SCAN_BLOCK_ROWS) : NULL;
+    if ((batch_fn || reader) && !buffer) return SQLITE_NOMEM;
+    uint8_t *block = (buffer) ? (uint8_t *)vector_chunk_align((size_t)(uintptr_t)buffer) : NULL;
+    int64_t block_rowids[VECTOR_SCAN_BLOCK_ROWS];
+    int count = 0;
     
-    bool is_streaming = (sort_callback == NULL);
-    bool is_quantized = quantized;
-    c->is_streaming = is_streaming;
-    c->is_quantized = is_quantized;
+    int rc;
+    while (1) {
+        rc = sqlite3_step(vm);
+        if ((rc != SQLITE_ROW) && (count > 0)) {
+            vScanBlock(c, v1, block, vsize, block_rowids, count, dimension, batch_fn);
+            count = 0;
+        }
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
+        if (rc != SQLITE_ROW) break;
+        
+        int64_t rowid = (int64_t)sqlite3_column_int64(vm, 0);
+        if (check_rowid && !vCursorRowidMatch(c, rowid)) continue;
+        
+        const void *v2 = NULL;
+        if (reader) {
+            uint8_t *dest = (batch_fn) ? block + (size_t)count * vsize : block;
+            rc = vector_row_reader_copy(reader, rowid, dest);
+            if (rc == SQLITE_DONE) continue;
+            if (rc != SQLITE_ROW) break;
+            v2 = (const void *)dest;
+        } else {
+            if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
+            v2 = sqlite3_column_blob(vm, 1);
+            if (v2 == NULL) continue;
+            if (block && (size_t)sqlite3_column_bytes(vm, 1) < vsize) continue;
+        }
+        VECTOR_PRINT((void*)v2, c->table->options.v_type, dimension);
+        
+        if (batch_fn) {
+            if (!reader) memcpy(block + (size_t)count * vsize, v2, vsize);
+            block_rowids[count++] = rowid;
+            if (count == VECTOR_SCAN_BLOCK_ROWS) {
+                vScanBlock(c, v1, block, vsize, block_rowids, count, dimension, batch_fn);
+                count = 0;
+            }
+            continue;
+        }
+        
+        float distance = distance_fn(v1, v2, dimension);
+        if (nearly_zero_float32(distance)) distance = 0.0;
+        
+        if (distance < c->distance[0]) vTopKReplaceTop(c->distance, c->rowids, c->row_count, distance, rowid);
+    }
     
-    // sanity check arguments
-    int nargs = (is_streaming) ? 3 : 4;
-    if (argc != nargs) {
-        return sqlite_vtab_set_error(&vtab->base, "%s expects %d arguments, but %d were provided.", fname, nargs, argc);
+    if (buffer) sqlite3_free(buffer);
+    return rc;
+}
+
+// with reader=blob (and a table with a real rowid) the statement only walks the rowids and every vector is copied
+// by sqlite3_blob_read into the block of rows, so the column value is never materialized by the VDBE
+static bool vFullScanUseReader (vFullScanCursor *c) {
+    return c->options.blob_reader && c->table->pk_name && (strcmp(c->table->pk_name, "rowid") == 0);
+}
+
+// prepares the statement that walks the rows with rowid in [?1, ?2] matching the filter of c (and the reader, if used)
+static int vFullScanPrepare (sqlite3 *db, vFullScanCursor *c, sqlite3_stmt **vm, vector_row_reader *reader, bool *use_reader) {
+    const char *pk_name = c->table->pk_name;
+    const char *col_name = c->table->c_name;
+    const char *table_name = c->table->t_name;
+    const char *filter = c->filter;
+    *use_reader = vFullScanUseReader(c);
+    
+    char *sql = NULL;
+    if (*use_reader) sql = (filter) ? sqlite3_mprintf("SELECT %q FROM %q WHERE %q BETWEEN ?1 AND ?2 AND (%s);", pk_name, table_name, pk_name, filter) : sqlite3_mprintf("SELECT %q FROM %q WHERE %q BETWEEN ?1 AND ?2;", pk_name, table_name, pk_name);
+    else sql = (filter) ? sqlite3_mprintf("SELECT %q, %q FROM %q WHERE %q BETWEEN ?1 AND ?2 AND (%s);", pk_name, col_name, table_name, pk_name, filter) : sqlite3_mprintf("SELECT %q, %q FROM %q WHERE %q BETWEEN ?1 AND ?2;", pk_name, col_name, table_name, pk_name);
+    if (!sql) return SQLITE_NOMEM;
+    
+    int rc = vector_filter_prepare(db, sql, vm);
+    sqlite3_free(sql);
+    if ((rc == SQLITE_OK) && *use_reader) rc = vector_row_reader_init(reader, db, c->table);
+    return rc;
+}
+
+typedef struct {
+    vFullScanCursor     cursor;             // private copy of the cursor with its own top-k slots
+    const char          *path;
+    const char          *vfs;
+    const void          *v1;
+    distance_function_t distance_fn;
+    distance_batch_function_t batch_fn;
+    int64_t             first;              // rowid range scanned by the worker
+    int64_t             last;
+    int                 rc;
+} vFullScanWorker;
+
+static void vFullScanWorkerRun (void *arg) {
+    vFullScanWorker *w = (vFullScanWorker *)arg;
+    sqlite3 *db = NULL;
+    sqlite3_stmt *vm = NULL;
+    vector_row_reader reader = {0};
+    bool use_reader = false;
+    
+    // every worker uses its own read-only connection, so rows are read concurrently (and without blocking writers in WAL mode)
+    int rc = sqlite3_open_v2(w->path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, w->vfs);
+    if (rc != SQLITE_OK) goto worker_cleanup;
+    
+    rc = vFullScanPrepare(db, &w->cursor, &vm, &reader, &use_reader);
+    if (rc != SQLITE_OK) goto worker_cleanup;
+    
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)w->first);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)w->last);
+    rc = vFullScanRows(vm, (use_reader) ? &reader : NULL, &w->cursor, w->v1, w->distance_fn, w->batch_fn);
+    
+worker_cleanup:
+    vector_row_reader_finalize(&reader);
+    if (vm) sqlite3_finalize(vm);
+    if (db) sqlite3_close(db);
+    w->rc = rc;
+}
+
+// splits the rowid space in ranges scanned by worker threads, returns SQLITE_DONE when a parallel scan is not possible
+static int vFullScanRunParallel (sqlite3 *db, vFullScanCursor *c, const void *v1, distance_function_t distance_fn, distance_batch_function_t batch_fn) {
+    // workers only see committed data of a file based database, and they would not read the snapshot of an explicit
+    // transaction (a read transaction included)
+    const char *path = sqlite3_db_filename(db, "main");
+    if (!path || path[0] == 0) return SQLITE_DONE;
+    if (sqlite3_get_autocommit(db) == 0) return SQLITE_DONE;
+    
+    table_context *t_ctx = c->table;
+    char *sql = sqlite3_mprintf("SELECT min(%q), max(%q) FROM %q WHERE %q BETWEEN ?1 AND ?2;", t_ctx->pk_name, t_ctx->pk_name, t_ctx->t_name, t_ctx->pk_name);
+    if (!sql) return SQLITE_NOMEM;
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) return rc;
+    
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
+    
+    rc = sqlite3_step(vm);
+    if ((rc != SQLITE_ROW) || (sqlite3_column_type(vm, 0) == SQLITE_NULL)) {
+        sqlite3_finalize(vm);
+        return (rc == SQLITE_ROW || rc == SQLITE_DONE) ? SQLITE_DONE : rc;
+    }
+    int64_t min_rowid = (int64_t)sqlite3_column_int64(vm, 0);
+    int64_t max_rowid = (int64_t)sqlite3_column_int64(vm, 1);
+    sqlite3_finalize(vm);
+    
+    // the rowid span is an upper bound of the number of rows
+    uint64_t span = (uint64_t)max_rowid - (uint64_t)min_rowid + 1;
+    int nthreads = vScanThreadCount(c, (span > INT64_MAX) ? INT64_MAX : (int64_t)span);
+    if (nthreads == 1) return SQLITE_DONE;
+    
+    int k = c->row_count;
+    vFullScanWorker *workers = (vFullScanWorker *)sqlite3_malloc64(sizeof(vFullScanWorker) * nthreads);
+    vector_thread *threads = (vector_thread *)sqlite3_malloc64(sizeof(vector_thread) * nthreads);
+    int64_t *rowids = (int64_t *)sqlite3_malloc64(sizeof(int64_t) * k * nthreads);
+    double *distance = (double *)sqlite3_malloc64(sizeof(double) * k * nthreads);
+    rc = (workers && threads && rowids && distance) ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc != SQLITE_OK) goto parallel_cleanup;
+    
+    const char *vfs = vector_thread_vfs(db);
+    uint64_t first = (uint64_t)min_rowid;
+    for (int i=0; i<nthreads; ++i) {
+        vFullScanWorker *w = &workers[i];
+        w->cursor = *c;
+        w->cursor.rowids = rowids + (size_t)i * k;
+        w->cursor.distance = distance + (size_t)i * k;
+        for (int j=0; j<k; ++j) {w->cursor.rowids[j] = 0; w->cursor.distance[j] = INFINITY;}
+        w->path = path;
+        w->vfs = vfs;
+        w->v1 = v1;
+        w->distance_fn = distance_fn;
+        w->batch_fn = batch_fn;
+        w->first = (int64_t)first;
+        w->last = (i == nthreads - 1) ? max_rowid : (int64_t)(first + span / nthreads - 1);
+        w->rc = SQLITE_OK;
+        first += span / nthreads;
     }
     
-    // SQLITE_TEXT, SQLITE_TEXT, SQLITE_TEXT or SQLITE_BLOB, SQLITE_INTEGER
-    for (int i=0; i<argc; ++i) {
-        int actual_type = sqlite3_value_type(argv[i]);
-        switch (i) {
-            case 0:
-            case 1:
-                if (actual_type != SQLITE_TEXT)
-                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type TEXT (got %s).", fname, (i+1), argc, sqlite_type_name(actual_type));
-                break;
-            case 2:
-                if ((actual_type != SQLITE_TEXT) && (actual_type != SQLITE_BLOB))
-                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type TEXT or BLOB (got %s).", fname, (i+1), argc, sqlite_type_name(actual_type));
-                break;
-            case 3:
-                if (actual_type != SQLITE_INTEGER)
-                    return sqlite_vtab_set_error(&vtab->base, "%s: argument %d must be of type INTEGER (got %s).", fname, (i+1), argc, sqlite_type_name(actual_type));
-                break;
+    for (int i=0; i<nthreads; ++i) vector_thread_start(&threads[i], vFullScanWorkerRun, &workers[i]);
+    for (int i=0; i<nthreads; ++i) vector_thread_join(&threads[i]);
+    
+    // a worker that cannot read its range (for example because of locking) means a serial scan on the caller connection
+    for (int i=0; i<nthreads; ++i) {
+        if (workers[i].rc != SQLITE_OK) {rc = SQLITE_DONE; goto parallel_cleanup;}
+    }
+    for (int i=0; i<nthreads; ++i) vScanMergeSlots(c, workers[i].cursor.rowids, workers[i].cursor.distance, k);
+    
+parallel_cleanup:
+    if (workers) sqlite3_free(workers);
+    if (threads) sqlite3_free(threads);
+    if (rowids) sqlite3_free(rowids);
+    if (distance) sqlite3_free(distance);
+    return rc;
+}
+
+static int vFullScanRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
+    // compute distance function
+    distance_function_t distance_fn = table_distance_function(&c->table->options);
+    distance_batch_function_t batch_fn = table_batch_distance_function(&c->table->options);
+    
+    int rc = vFullScanRunParallel(db, c, v1, distance_fn, batch_fn);
+    if (rc != SQLITE_DONE) return rc;
+    
+    sqlite3_stmt *vm = NULL;
+    vector_row_reader reader = {0};
+    bool use_reader = false;
+    rc = vFullScanPrepare(db, c, &vm, &reader, &use_reader);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
+    
+    rc = vFullScanRows(vm, (use_reader) ? &reader : NULL, c, v1, distance_fn, batch_fn);
+    
+cleanup:
+    vector_row_reader_finalize(&reader);
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
+
+static int vFullScanCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    return vCursorFilterCommon(cur, idxNum, idxStr, argc, argv, "vector_full_scan", vFullScanRun, vFullScanSortSlots, false);
+}
+
+// MARK: -
+
+// prepares the query for a quantized scan: the quantized vector (dim bytes, followed by its norm), with PQ the
+// asymmetric distance lookup table (pq_m * PQ_KSUB floats) or, with per-dimension ranges, the weights of the query
+// (see weighted_distance_finalize). n is the number of code bytes of each stored row.
+// batch_fn (optional) is the batch kernel of the codes, NULL when there is none (PQ and binary codes).
+static int vQuantPrepareQuery (sqlite3 *db, vFullScanCursor *c, const void *v1, void **query, int *n, distance_function_t *distance_fn, distance_batch_function_t *batch_fn) {
+    table_context *t_ctx = c->table;
+    int dimension = t_ctx->options.v_dim;
+    vector_qtype qtype = t_ctx->options.q_type;
+    vector_distance vd = t_ctx->options.v_distance;
+    if (batch_fn) *batch_fn = NULL;
+    
+    if (qtype == VECTOR_QUANT_PQ) {
+        float *codebook = table_context_pq_codebook(db, t_ctx);
+        if (!codebook) return SQLITE_ERROR;
+        
+        int m = t_ctx->options.pq_m;
+        float *lut = (float *)sqlite3_malloc64((sqlite3_uint64)m * PQ_KSUB * sizeof(float) + (sqlite3_uint64)dimension * sizeof(float));
+        if (!lut) return SQLITE_NOMEM;
+        
+        // query is converted in the scratch space after the lookup table
+        float *q = lut + (size_t)m * PQ_KSUB;
+        vector_to_float32(v1, q, dimension, t_ctx->options.v_type);
+        if (vd == VECTOR_DISTANCE_COSINE) vector_normalize_float32(q, dimension);
+        pq_build_lut(q, codebook, dimension, m, 1 << t_ctx->options.pq_nbits, vd, lut);
+        
+        *query = (void *)lut;
+        *n = m;
+        *distance_fn = dispatch_pq_distance_table[vd];
+        return SQLITE_OK;
+    }
+    
+    // with per-dimension ranges the query is not quantized: the scale of each dimension is folded in its weights
+    // and the offsets in a single constant, so a row is scored with one dot product over its codes
+    if (t_ctx->options.dim_ranges) {
+        distance_function_t fn = dispatch_weighted_distance_table[vd][quant_code_type(qtype)];
+        if (!fn) return SQLITE_ERROR;
+        
+        float *w = (float *)sqlite3_malloc64((sqlite3_uint64)(dimension + 2) * sizeof(float));
+        if (!w) return SQLITE_NOMEM;
+        vector_to_float32(v1, w, dimension, t_ctx->options.v_type);
+        
+        const float *scales = t_ctx->qdims;
+        const float *offsets = t_ctx->qdims + dimension;
+        double k = 0.0, norm = 0.0;
+        for (int i=0; i<dimension; ++i) {
+            k += (double)w[i] * (double)offsets[i];
+            norm += (double)w[i] * (double)w[i];
+            w[i] /= scales[i];
         }
+        w[dimension] = (float)k;
+        w[dimension + 1] = (float)sqrt(norm);
+        
+        *query = (void *)w;
+        *n = quant_code_size(&t_ctx->options);
+        *distance_fn = fn;
+        return SQLITE_OK;
     }
     
-    // retrieve arguments
-    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
-    const char *column_name = (const char *)sqlite3_value_text(argv[1]);
-    table_context *t_ctx = vector_context_lookup(vtab->ctx, table_name, column_name);
-    if (!t_ctx) {
-        return sqlite_vtab_set_error(&vtab->base, "%s: unable to retrieve context.", fname);
+    uint8_t *v = (uint8_t *)sqlite3_malloc(dimension * sizeof(int8_t) + sizeof(float));
+    if (!v) return SQLITE_NOMEM;
+    quantize_vector(v1, v, t_ctx->offset, t_ctx->scale, dimension, t_ctx->options.v_type, qtype);
+    
+    // computed once, rows with a stored norm are scored with the dot product (see vQuantUsesNorms)
+    vector_type norm_type = quant_norm_type(&t_ctx->options);
+    float norm = (norm_type) ? quant_code_norm(v, dimension, norm_type) : 0.0f;
+    memcpy(v + dimension, &norm, sizeof(float));
+    
+    *query = (void *)v;
+    if (qtype == VECTOR_QUANT_BIT) {
+        *n = quant_code_size(&t_ctx->options);
+        *distance_fn = dispatch_hamming_distance;
+        return SQLITE_OK;
     }
     
-    const void *vector = NULL;
-    int vsize = 0;
-    if (sqlite3_value_type(argv[2]) == SQLITE_TEXT) {
-        vsize = sqlite3_value_bytes(argv[2]);
-        vector = (const void *)vector_from_json(NULL, &vtab->base, t_ctx->options.v_type, (const char *)sqlite3_value_text(argv[2]), &vsize, t_ctx->options.v_dim);
-        if (!vector) return SQLITE_ERROR; // error already set inside vector_from_json
-    } else {
-        vector = (const void *)sqlite3_value_blob(argv[2]);
-        vsize = sqlite3_value_bytes(argv[2]);
-        if (!vector) return sqlite_vtab_set_error(&vtab->base, "%s: input vector cannot be NULL.", fname);
+    if (quant_is_nibble(qtype)) {
+        *n = quant_code_size(&t_ctx->options);
+        *distance_fn = (qtype == VECTOR_QUANT_U4BIT) ? dispatch_u4_distance_table[vd] : dispatch_s4_distance_table[vd];
+        return SQLITE_OK;
+    }
+    
+    VECTOR_PRINT((void*)v, quant_code_type(qtype), dimension);
+    *n = dimension;
+    *distance_fn = dispatch_distance_table[vd][quant_code_type(qtype)];
+    if (batch_fn) *batch_fn = dispatch_batch_distance_table[vd][quant_code_type(qtype)];
+    return SQLITE_OK;
+}
+
+static void vQuantScanRows (vFullScanCursor *c, const void *v, const vector_chunk *chunk, int dim, distance_function_t distance_fn, distance_batch_function_t batch_fn) {
+    double *distance = c->distance;
+    int64_t *rowids = (int64_t *)c->rowids;
+    int row_count = c->row_count;
+    double current_max = distance[0];
+    bool check_rowid = (c->rowid_constrained || c->rowset || c->delta.ids);
+    
+    bool use_norms = vQuantUsesNorms(c, chunk);
+    float query_norm = 0.0f;
+    if (use_norms) {
+        vector_type type = quant_code_type(c->table->options.q_type);
+        distance_fn = dispatch_distance_table[VECTOR_DISTANCE_DOT][type];
+        batch_fn = dispatch_batch_distance_table[VECTOR_DISTANCE_DOT][type];
+        query_norm = vQuantQueryNorm(v, dim);
+    }
+    
+    // codes are scored in blocks and a rowid is only decoded (and checked) for the rows that would be kept,
+    // with a selective rowid set (IN or rowset) rows are checked first so only the matching ones are scored
+    if (batch_fn && !c->rowid_in && !c->rowset) {
+        float block[VECTOR_SCAN_BLOCK_ROWS];
+        for (int i = 0; i < chunk->count; i += VECTOR_SCAN_BLOCK_ROWS) {
+            int count = (chunk->count - i < VECTOR_SCAN_BLOCK_ROWS) ? chunk->count - i : VECTOR_SCAN_BLOCK_ROWS;
+            batch_fn(v, (const void *)vector_chunk_code(chunk, i), chunk->code_stride, count, dim, block);
+            
+            for (int j = 0; j < count; ++j) {
+                float dist = (use_norms) ? vQuantCosine(block[j], query_norm, vector_chunk_norm(chunk, i + j)) : block[j];
+                if (nearly_zero_float32(dist)) dist = 0.0;
+                if (dist >= current_max) continue;
+                
+                int64_t rowid = vector_chunk_rowid(chunk, i + j);
+                if (check_rowid && !vCursorRowidMatch(c, rowid)) continue;
+                vTopKReplaceTop(distance, rowids, row_count, dist, rowid);
+                current_max = distance[0];
+            }
+        }
+        return;
+    }
+    
+    const uint8_t *vector_data = chunk->codes;
+    for (int i = 0; i < chunk->count; ++i, vector_data += chunk->code_stride) {
+        if (check_rowid && !vCursorRowidMatch(c, vector_chunk_rowid(chunk, i))) continue;
+
+        float dist = distance_fn(v, (const void *)vector_data, dim);
+        if (use_norms) dist = vQuantCosine(dist, query_norm, vector_chunk_norm(chunk, i));
+        if (nearly_zero_float32(dist)) dist = 0.0;
+        
+        if (dist < current_max) {
+            vTopKReplaceTop(distance, rowids, row_count, dist, vector_chunk_rowid(chunk, i));
+            current_max = distance[0];
+        }
+    }
+}
+
+static int vQuantProbeCount (vFullScanCursor *c) {
+    int nprobe = (c->options.nprobe > 0) ? c->options.nprobe : IVF_DEFAULT_NPROBE;
+    return (nprobe > c->table->options.nlist) ? c->table->options.nlist : nprobe;
+}
+
+typedef struct {
+    vFullScanCursor     cursor;             // private copy of the cursor with its own top-k slots
+    const void          *v;
+    vector_chunk        rows;               // all the preloaded rows
+    const int           *ranges;            // (first row, row count) pairs
+    int                 nranges;
+    int                 index;
+    int                 nworkers;
+    int                 n;
+    distance_function_t distance_fn;
+    distance_batch_function_t batch_fn;
+} vQuantWorker;
+
+static void vQuantWorkerRun (void *arg) {
+    vQuantWorker *w = (vQuantWorker *)arg;
+    
+    // each worker scans its own slice of every range
+    for (int i=0; i<w->nranges; ++i) {
+        int64_t first = w->ranges[i*2];
+        int64_t count = w->ranges[i*2+1];
+        int64_t start = first + (count * w->index) / w->nworkers;
+        int64_t stop = first + (count * (w->index + 1)) / w->nworkers;
+        if (stop <= start) continue;
+        
+        vector_chunk slice = vector_chunk_slice(&w->rows, (int)start, (int)(stop - start));
+        vQuantScanRows(&w->cursor, w->v, &slice, w->n, w->distance_fn, w->batch_fn);
     }
-    VECTOR_PRINT((void*)vector, t_ctx->options.v_type, t_ctx->options.v_dim);
+}
+
+static vector_chunk vQuantPreloadedRows (const table_context *t_ctx) {
+    int code_size = quant_code_size(&t_ctx->options);
+    vector_chunk rows = {t_ctx->preloaded, t_ctx->prerowids, (size_t)code_size, sizeof(int64_t), t_ctx->precounter, t_ctx->prenorms};
+    return rows;
+}
+
+static int vQuantRunRanges (vFullScanCursor *c, const void *v, int n, distance_function_t distance_fn, distance_batch_function_t batch_fn, const int *ranges, int nranges) {
+    vector_chunk rows = vQuantPreloadedRows(c->table);
     
-    if (quantized) {
-        char buffer[STATIC_SQL_SIZE];
-        char *name = generate_quant_table_name(table_name, column_name, buffer);
-        if (!name || !sqlite_table_exists(vtab->db, name)) {
-            sqlite_vtab_set_error(&vtab->base, "Quantization table not found for table '%s' and column '%s'. Ensure that vector_quantize() has been called before using vector_quantize_scan().", table_name, column_name);
-            return SQLITE_ERROR;
+    int64_t nrows = 0;
+    for (int i=0; i<nranges; ++i) nrows += ranges[i*2+1];
+    
+    int nthreads = vScanThreadCount(c, nrows);
+    if (nthreads == 1) {
+        for (int i=0; i<nranges; ++i) {
+            vector_chunk slice = vector_chunk_slice(&rows, ranges[i*2], ranges[i*2+1]);
+            vQuantScanRows(c, v, &slice, n, distance_fn, batch_fn);
         }
+        return SQLITE_OK;
     }
     
-    c->table = t_ctx;
-    if (is_streaming) {
-        return run_callback(vtab->db, c, vector, vsize);
+    int k = c->row_count;
+    vQuantWorker *workers = (vQuantWorker *)sqlite3_malloc64(sizeof(vQuantWorker) * nthreads);
+    vector_thread *threads = (vector_thread *)sqlite3_malloc64(sizeof(vector_thread) * nthreads);
+    int64_t *rowids = (int64_t *)sqlite3_malloc64(sizeof(int64_t) * k * nthreads);
+    double *distance = (double *)sqlite3_malloc64(sizeof(double) * k * nthreads);
+    int rc = (workers && threads && rowids && distance) ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc != SQLITE_OK) goto run_ranges_cleanup;
+    
+    for (int i=0; i<nthreads; ++i) {
+        vQuantWorker *w = &workers[i];
+        w->cursor = *c;
+        w->cursor.rowids = rowids + (size_t)i * k;
+        w->cursor.distance = distance + (size_t)i * k;
+        for (int j=0; j<k; ++j) {w->cursor.rowids[j] = 0; w->cursor.distance[j] = INFINITY;}
+        w->v = v;
+        w->rows = rows;
+        w->ranges = ranges;
+        w->nranges = nranges;
+        w->index = i;
+        w->nworkers = nthreads;
+        w->n = n;
+        w->distance_fn = distance_fn;
+        w->batch_fn = batch_fn;
     }
     
-    // non-streaming flow
-    int k = (is_streaming) ? 0 : sqlite3_value_int(argv[3]);
-    if (k == 0) return SQLITE_DONE;
+    // the calling thread takes care of the first slice
+    for (int i=1; i<nthreads; ++i) vector_thread_start(&threads[i], vQuantWorkerRun, &workers[i]);
+    vQuantWorkerRun(&workers[0]);
+    for (int i=1; i<nthreads; ++i) vector_thread_join(&threads[i]);
     
-    if (c->row_count != k) {
-        if (c->rowids) sqlite3_free(c->rowids);
-        c->rowids = (int64_t *)sqlite3_malloc(k * sizeof(int64_t));
-        if (c->rowids == NULL) return SQLITE_NOMEM;
-        
-        if (c->distance) sqlite3_free(c->distance);
-        c->distance = (double *)sqlite3_malloc(k * sizeof(double));
-        if (c->distance == NULL) return SQLITE_NOMEM;
+    for (int i=0; i<nthreads; ++i) vScanMergeSlots(c, workers[i].cursor.rowids, workers[i].cursor.distance, k);
+    
+run_ranges_cleanup:
+    if (workers) sqlite3_free(workers);
+    if (threads) sqlite3_free(threads);
+    if (rowids) sqlite3_free(rowids);
+    if (distance) sqlite3_free(distance);
+    return rc;
+}
+
+// index of the first row in [first, first+count) with a rowid >= value (> value when upper is true), rows must be sorted
+static int vQuantRowBound (const vector_chunk *rows, int first, int count, int64_t value, bool upper) {
+    int lo = first, hi = first + count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int64_t rowid = vector_chunk_rowid(rows, mid);
+        if ((rowid < value) || (upper && rowid == value)) lo = mid + 1; else hi = mid;
     }
+    return lo;
+}
+
+// restricts the (first, count) ranges to the rows allowed by the id constraints
+static void vQuantNarrowRanges (vFullScanCursor *c, int n, int *ranges, int nranges) {
+    if (!c->rowid_constrained || !c->table->presorted) return;
     
-    memset(c->rowids, 0, k * sizeof(int64_t));
-    for (int i=0; i<k; ++i) c->distance[i] = INFINITY;
+    vector_chunk rows = vQuantPreloadedRows(c->table);
+    for (int i=0; i<nranges; ++i) {
+        int first = vQuantRowBound(&rows, ranges[i*2], ranges[i*2+1], c->rowid_min, false);
+        int last = vQuantRowBound(&rows, ranges[i*2], ranges[i*2+1], c->rowid_max, true);
+        ranges[i*2] = first;
+        ranges[i*2+1] = (last > first) ? last - first : 0;
+    }
+}
+
+static int vQuantRunMemory(vFullScanCursor *c, const void *v, int n, distance_function_t distance_fn, distance_batch_function_t batch_fn) {
+    // no IVF partitions available, so scan all rows
+    const int *partitions = c->table->prepartitions;
+    if (!partitions || !c->table->precentroids) {
+        int range[2] = {0, c->table->precounter};
+        vQuantNarrowRanges(c, n, range, 1);
+        return vQuantRunRanges(c, v, n, distance_fn, batch_fn, range, 1);
+    }
     
-    c->size = 0;
-    c->row_index = 0;
-    c->row_count = k;
+    // IVF is only available with 8bit codes (n == dim)
+    int nprobe = vQuantProbeCount(c);
+    int *probes = ivf_probe((const uint8_t *)v, c->table->precentroids, c->table->options.nlist, n, c->table->options.q_type, nprobe);
+    if (!probes) return SQLITE_NOMEM;
     
-    int rc = run_callback(vtab->db, c, vector, vsize);
-    int count = sort_callback(c);
-    c->row_count -= count;
+    int *ranges = (int *)sqlite3_malloc64(sizeof(int) * 2 * nprobe);
+    if (!ranges) {
+        sqlite3_free(probes);
+        return SQLITE_NOMEM;
+    }
     
-    #if 0
-    for (int i=0; i<c->row_count; ++i) {
-        printf("%lld\t%f\n", (long long)c->rowids[i], c->distance[i]);
+    for (int i=0; i<nprobe; ++i) {
+        ranges[i*2] = partitions[probes[i]];
+        ranges[i*2+1] = partitions[probes[i] + 1] - partitions[probes[i]];
     }
-    #endif
+    vQuantNarrowRanges(c, n, ranges, nprobe);
     
+    int rc = vQuantRunRanges(c, v, n, distance_fn, batch_fn, ranges, nprobe);
+    sqlite3_free(ranges);
+    sqlite3_free(probes);
     return rc;
 }
 
-static int vFullScanConnect (sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr) {
-    // https://www.sqlite.org/vtab.html#table_valued_functions
-    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(tbl hidden, vector hidden, k hidden, memidx hidden, id, distance);");
+// delta rows replace the rows with the same id in the quantized chunks
+static void vQuantScanDelta (vFullScanCursor *c, const void *v, int n, distance_function_t distance_fn, distance_batch_function_t batch_fn) {
+    if (c->delta.count == 0) return;
+    
+    vector_rowset *ids = c->delta.ids;
+    vector_chunk rows = vector_chunk_rows(c->delta.rows, c->delta.count, n);
+    c->delta.ids = NULL;
+    vQuantScanRows(c, v, &rows, n, distance_fn, batch_fn);
+    c->delta.ids = ids;
+}
+
+// loads the rows written after the last quantization (auto_quantize), reloading preloaded rows made stale by a compaction
+static int vQuantLoadDelta (sqlite3 *db, vFullScanCursor *c) {
+    table_context *t_ctx = c->table;
+    vector_delta_free(&c->delta);
+    if (!t_ctx->options.auto_quantize) return SQLITE_OK;
+    
+    if (t_ctx->preload) {
+        char sql[STATIC_SQL_SIZE];
+        generate_select_quant_generation(t_ctx->t_name, t_ctx->c_name, sql);
+        if (sqlite_read_int64(db, sql) != t_ctx->preload->generation) {
+            int rc = vector_preload_table(NULL, db, t_ctx, t_ctx->preload_file);
+            if (rc != SQLITE_OK) return rc;
+        }
+    }
+    
+    return vector_delta_load(db, t_ctx, &c->delta);
+}
+
+static int vQuantRunApprox (sqlite3 *db, vFullScanCursor *c, const void *v1) {
+    // quantize target vector (or build the PQ lookup table)
+    void *v = NULL;
+    int n = 0;
+    distance_function_t distance_fn = NULL;
+    distance_batch_function_t batch_fn = NULL;
+    int rc = vQuantPrepareQuery(db, c, v1, &v, &n, &distance_fn, &batch_fn);
     if (rc != SQLITE_OK) return rc;
     
-    vFullScan *vtab = (vFullScan *)sqlite3_malloc(sizeof(vFullScan));
-    if (!vtab) return SQLITE_NOMEM;
+    if (c->table->preloaded) {
+        rc = vQuantRunMemory(c, v, n, distance_fn, batch_fn);
+        if (rc == SQLITE_OK) vQuantScanDelta(c, v, n, distance_fn, batch_fn);
+        if (v) sqlite3_free(v);
+        return rc;
+    }
     
-    memset(vtab, 0, sizeof(vFullScan));
-    vtab->db = db;
-    vtab->ctx = (vector_context *)pAux;
+    // with IVF only the chunks of the nprobe closest partitions are read
+    int *probes = NULL;
+    int nprobe = 0, probe_index = 0;
+    uint8_t *centroids = NULL;
+    int nlist = c->table->options.nlist;
     
-    *ppVtab = (sqlite3_vtab *)vtab;
-    return SQLITE_OK;
+    char sql[STATIC_SQL_SIZE];
+    sqlite3_stmt *vm = NULL;
+    rc = SQLITE_NOMEM;
+    if (nlist > 0) {
+        centroids = ivf_load_centroids(db, c->table->t_name, c->table->c_name, nlist, n);
+        if (!centroids) goto kann_run_cleanup;
+        nprobe = vQuantProbeCount(c);
+        probes = ivf_probe((const uint8_t *)v, centroids, nlist, n, c->table->options.q_type, nprobe);
+        if (!probes) goto kann_run_cleanup;
+        generate_select_quant_partition(c->table->t_name, c->table->c_name, sql);
+    } else {
+        generate_select_quant_range(c->table->t_name, c->table->c_name, sql);
+    }
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto kann_run_cleanup;
+    
+    // chunks entirely outside the id constraints are skipped without reading their data
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
+    if (nprobe > 0) {
+        rc = sqlite3_bind_int(vm, 3, probes[probe_index++]);
+        if (rc != SQLITE_OK) goto kann_run_cleanup;
+    }
+    
+    while (1) {
+        rc = sqlite3_step(vm);
+        if (rc == SQLITE_DONE) {
+            // move to the next probed partition (if any)
+            if (probe_index >= nprobe) {rc = SQLITE_OK; break;}
+            sqlite3_reset(vm);
+            rc = sqlite3_bind_int(vm, 3, probes[probe_index++]);
+            if (rc != SQLITE_OK) goto kann_run_cleanup;
+            continue;
+        }
+        else if (rc != SQLITE_ROW) goto kann_run_cleanup;
+        
+        vector_chunk chunk;
+        if (!vector_chunk_decode(&chunk, sqlite3_column_blob(vm, 1), sqlite3_column_bytes(vm, 1), sqlite3_column_int(vm, 0), n)) {rc = SQLITE_CORRUPT; goto kann_run_cleanup;}
+        vQuantScanRows(c, v, &chunk, n, distance_fn, batch_fn);
+    }
+    
+    vQuantScanDelta(c, v, n, distance_fn, batch_fn);
+    rc = SQLITE_OK;
+    
+kann_run_cleanup:
+    if (rc != SQLITE_OK) printf("Error in vector_rebuild_quantization: %s\n", sqlite3_errmsg(db));
+    if (vm) sqlite3_finalize(vm);
+    if (centroids) sqlite3_free(centroids);
+    if (probes) sqlite3_free(probes);
+    if (v) sqlite3_free(v);
+    return rc;
 }
 
-static int vFullScanDisconnect (sqlite3_vtab *pVtab) {
-    vFullScan *vtab = (vFullScan *)pVtab;
-    sqlite3_free(vtab);
-    return SQLITE_OK;
+#define BIT_DEFAULT_RERANK                          10
+#define NIBBLE_DEFAULT_RERANK                       8
+#define VECTOR_MAX_CANDIDATES                       65536
+
+// number of candidates to collect from the quantized data before reranking them with exact distances
+static int vQuantCandidateCount (vFullScanCursor *c) {
+    int rerank = c->options.rerank;
+    if (rerank == 0) {
+        vector_qtype qtype = c->table->options.q_type;
+        rerank = (qtype == VECTOR_QUANT_BIT) ? BIT_DEFAULT_RERANK : ((quant_is_nibble(qtype)) ? NIBBLE_DEFAULT_RERANK : 1);
+    }
+    int64_t count = (int64_t)c->row_count * (int64_t)rerank;
+    return (count > VECTOR_MAX_CANDIDATES) ? VECTOR_MAX_CANDIDATES : (int)count;
 }
 
-static int vFullScanBestIndex (sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
-    pIdxInfo->estimatedCost = (double)1;
-    pIdxInfo->estimatedRows = 100;
-    pIdxInfo->orderByConsumed = 1;
-    pIdxInfo->idxNum = 1;
+// recompute exact distances of the candidates on the original vectors, keeping the best row_count of them
+static int vQuantRerank (sqlite3 *db, vFullScanCursor *c, const void *query, const int64_t *rowids, const double *distances, int count) {
+    table_context *t_ctx = c->table;
+    int dimension = t_ctx->options.v_dim;
+    distance_function_t distance_fn = table_distance_function(&t_ctx->options);
     
-    const struct sqlite3_index_constraint *pConstraint = pIdxInfo->aConstraint;
-    for(int i=0; i<pIdxInfo->nConstraint; i++, pConstraint++){
-        if( pConstraint->usable == 0 ) continue;
-        if( pConstraint->op != SQLITE_INDEX_CONSTRAINT_EQ ) continue;
-        switch( pConstraint->iColumn ){
-            case VECTOR_COLUMN_IDX:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 1;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_VECTOR:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 2;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_K:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 3;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_MEMIDX:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 4;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-        }
+    vector_row_reader reader;
+    int rc = vector_row_reader_init(&reader, db, t_ctx);
+    if (rc != SQLITE_OK) goto rerank_cleanup;
+    
+    for (int i=0; i<count; ++i) {
+        if (distances[i] == INFINITY) continue;
+        
+        const void *blob = NULL;
+        rc = vector_row_reader_read(&reader, rowids[i], &blob);
+        if (rc == SQLITE_DONE) continue;
+        if (rc != SQLITE_ROW) goto rerank_cleanup;
+        
+        float distance = distance_fn(query, blob, dimension);
+        if (nearly_zero_float32(distance)) distance = 0.0;
+        if (distance < c->distance[0]) vTopKReplaceTop(c->distance, c->rowids, c->row_count, distance, rowids[i]);
     }
-    return SQLITE_OK;
+    rc = SQLITE_OK;
+    
+rerank_cleanup:
+    if (rc != SQLITE_OK) printf("Error in vQuantRerank: %s\n", sqlite3_errmsg(db));
+    vector_row_reader_finalize(&reader);
+    return rc;
 }
 
-static int vFullScanCursorOpen (sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
-    vFullScanCursor *c = (vFullScanCursor *)sqlite3_malloc(sizeof(vFullScanCursor));
-    if (!c) return SQLITE_NOMEM;
+static int vQuantRunCandidates (sqlite3 *db, vFullScanCursor *c, const void *v1) {
+    // an explicit rerank option always reports exact distances, even with rerank=1
+    int ncandidates = vQuantCandidateCount(c);
+    if (ncandidates <= c->row_count && c->options.rerank == 0) return vQuantRunApprox(db, c, v1);
     
-    memset(c, 0, sizeof(vFullScanCursor));
-    *ppCursor = (sqlite3_vtab_cursor *)c;
-    return SQLITE_OK;
+    // collect ncandidates approximate results in temporary slots
+    int64_t *rowids = c->rowids;
+    double *distance = c->distance;
+    int row_count = c->row_count;
+    
+    int64_t *candidate_rowids = (int64_t *)sqlite3_malloc64((sqlite3_uint64)ncandidates * sizeof(int64_t));
+    double *candidate_distance = (double *)sqlite3_malloc64((sqlite3_uint64)ncandidates * sizeof(double));
+    if (!candidate_rowids || !candidate_distance) {
+        if (candidate_rowids) sqlite3_free(candidate_rowids);
+        if (candidate_distance) sqlite3_free(candidate_distance);
+        return SQLITE_NOMEM;
+    }
+    memset(candidate_rowids, 0, (size_t)ncandidates * sizeof(int64_t));
+    for (int i=0; i<ncandidates; ++i) candidate_distance[i] = INFINITY;
+    
+    c->rowids = candidate_rowids;
+    c->distance = candidate_distance;
+    c->row_count = ncandidates;
+    int rc = vQuantRunApprox(db, c, v1);
+    
+    c->rowids = rowids;
+    c->distance = distance;
+    c->row_count = row_count;
+    
+    // then keep the best row_count candidates according to the exact distance
+    if (rc == SQLITE_OK) rc = vQuantRerank(db, c, v1, candidate_rowids, candidate_distance, ncandidates);
+    
+    sqlite3_free(candidate_rowids);
+    sqlite3_free(candidate_distance);
+    return rc;
 }
 
-static int vFullScanCursorClose (sqlite3_vtab_cursor *cur){
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-    if (c->rowids) sqlite3_free(c->rowids);
-    if (c->distance) sqlite3_free(c->distance);
-    if (c->stream.vector) sqlite3_free(c->stream.vector);
-    if (c->stream.vm) sqlite3_finalize(c->stream.vm);
-    sqlite3_free(c);
-    return SQLITE_OK;
+static int vQuantRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
+    int rc = vQuantLoadDelta(db, c);
+    if ((rc == SQLITE_OK) && c->filter) rc = vector_rowset_build(db, c->table, c->filter, &c->rowset);
+    if (rc == SQLITE_OK) rc = vQuantRunCandidates(db, c, v1);
+    
+    vector_delta_free(&c->delta);
+    return rc;
 }
 
-static int vFullScanCursorNext (sqlite3_vtab_cursor *cur){
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-
-    // non-streaming flow
-    if (!c->is_streaming) { c->row_index++; return SQLITE_OK; }
 
-    // streaming flow
-    sqlite3_stmt *vm = c->stream.vm;
-    void *v1 = c->stream.vector;
-    int dimension = c->stream.vdim;
-    distance_function_t distance_fn = c->stream.distance_fn;
+static int vQuantCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    return vCursorFilterCommon(cur, idxNum, idxStr, argc, argv, "vector_quantize_scan", vQuantRun, vFullScanSortSlots, true);
+}
 
-    // FULL-SCAN
-    if (!c->is_quantized) {
-        while (1) {
-            int rc = sqlite3_step(vm);
-            if (rc == SQLITE_DONE) { c->stream.is_eof = 1; return SQLITE_OK; }
-            else if (rc != SQLITE_ROW) return rc;
-            
-            // skip NULL values
-            if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
+// MARK: - Quantized Batch Scan -
 
-            const float *v2 = (const float *)sqlite3_column_blob(vm, 1);
-            if (v2 == NULL) continue;
+// vector_quantize_scan_batch scores many queries in a single pass over the quantized rows: rows are visited in tiles
+// small enough to stay in cache and every query is scored against a tile before moving to the next one, so the codes
+// are read from memory (or from disk) once instead of once per query. With IVF each query only visits the partitions
+// it probes.
+#define VECTOR_BATCH_TILE_BYTES                     (128*1024)
 
-            float distance = distance_fn((const void *)v1, (const void *)v2, dimension);
-            if (nearly_zero_float32(distance)) distance = 0.0f;
+typedef struct {
+    vFullScanCursor     *cursors;           // private copy of the cursor for each query, with its own top-k slots
+    void                **v;                // prepared query of each query
+    bool                *probed;            // nqueries x nlist matrix of the probed partitions (NULL without IVF)
+    int                 nqueries;
+    int                 nlist;
+    int                 n;
+    distance_function_t distance_fn;
+    distance_batch_function_t batch_fn;
+} vQuantBatch;
+
+static inline bool vQuantBatchProbed (const vQuantBatch *b, int q, int partition) {
+    if (!b->probed || partition < 0 || partition >= b->nlist) return true;
+    return b->probed[(size_t)q * b->nlist + partition];
+}
 
-            c->stream.distance = distance;
-            c->stream.rowid = (int64_t)sqlite3_column_int64(vm, 0);
-            return SQLITE_OK;
+static void vQuantBatchScanRows (vQuantBatch *b, const vector_chunk *rows, int partition) {
+    int tile = VECTOR_BATCH_TILE_BYTES / b->n;
+    if (tile < VECTOR_SCAN_BLOCK_ROWS) tile = VECTOR_SCAN_BLOCK_ROWS;
+    
+    for (int i=0; i<rows->count; i += tile) {
+        int count = (rows->count - i < tile) ? rows->count - i : tile;
+        vector_chunk slice = vector_chunk_slice(rows, i, count);
+        for (int q=0; q<b->nqueries; ++q) {
+            if (!vQuantBatchProbed(b, q, partition)) continue;
+            vQuantScanRows(&b->cursors[q], b->v[q], &slice, b->n, b->distance_fn, b->batch_fn);
         }
     }
+}
 
-    // QUANTIZATION sizes
-    const size_t rowid_size = sizeof(int64_t);
-    const size_t vector_size = (size_t)dimension * sizeof(uint8_t);
-    const size_t total_stride = rowid_size + vector_size;
-
-    // QUANTIZED IN-MEMORY
-    if (vm == NULL) {
-        if ((c->is_quantized == false) || (c->stream.data == NULL)) return SQLITE_MISUSE;
-
-        // EOF if we've already consumed all items
-        if (c->stream.dindex >= c->stream.dcounter) {
-            c->stream.is_eof = 1;
-            return SQLITE_OK;
-        }
-
-        const uint8_t *data = (const uint8_t *)c->stream.data;
-        size_t i = (size_t)c->stream.dindex;
-
-        const uint8_t *current_data = data + (i * total_stride);
-        const uint8_t *vector_data  = current_data + rowid_size;
-
-        
-        // no NULL vectors here by construction
-        float distance = distance_fn((const void *)v1, (const void *)vector_data, dimension);
-        if (nearly_zero_float32(distance)) distance = 0.0f;
-
-        c->stream.distance = distance;
-        c->stream.rowid    = INT64_FROM_INT8PTR(current_data);
-        c->stream.dindex++;
+static int vQuantBatchRunMemory (vFullScanCursor *c, vQuantBatch *b) {
+    vector_chunk rows = vQuantPreloadedRows(c->table);
+    const int *partitions = c->table->prepartitions;
+    
+    if (!b->probed || !partitions) {
+        int range[2] = {0, c->table->precounter};
+        vQuantNarrowRanges(c, b->n, range, 1);
+        vector_chunk slice = vector_chunk_slice(&rows, range[0], range[1]);
+        vQuantBatchScanRows(b, &slice, -1);
         return SQLITE_OK;
     }
-
-    // QUANTIZED FROM DISK (chunked)
-    if (c->stream.dcounter == 0) {
-        int rc = sqlite3_step(vm);
-        if (rc == SQLITE_DONE) { c->stream.is_eof = 1; return SQLITE_OK; }
-        else if (rc != SQLITE_ROW) return rc;
-
-        c->stream.dcounter = sqlite3_column_int(vm, 0);
-        c->stream.data     = (uint8_t *)sqlite3_column_blob(vm, 1);
-        c->stream.dindex   = 0; // reset index for the new chunk
-    }
-
-    const uint8_t *data = (const uint8_t *)c->stream.data;
-    size_t i = (size_t)c->stream.dindex;
-
-    const uint8_t *current_data = data + (i * total_stride);
-    const uint8_t *vector_data  = current_data + rowid_size;
-
-    float distance = distance_fn((const void *)v1, (const void *)vector_data, dimension);
-    if (nearly_zero_float32(distance)) distance = 0.0f;
-
-    c->stream.distance = distance;
-    c->stream.rowid    = INT64_FROM_INT8PTR(current_data);
-    c->stream.dindex++;
-
-    if (c->stream.dindex == c->stream.dcounter) {
-        // finished current chunk; force reload on next call
-        c->stream.dcounter = 0;
-        c->stream.data = NULL; // clear stale pointer to blob memory
+    
+    for (int p=0; p<b->nlist; ++p) {
+        int range[2] = {partitions[p], partitions[p+1] - partitions[p]};
+        vQuantNarrowRanges(c, b->n, range, 1);
+        if (range[1] <= 0) continue;
+        vector_chunk slice = vector_chunk_slice(&rows, range[0], range[1]);
+        vQuantBatchScanRows(b, &slice, p);
     }
-
     return SQLITE_OK;
 }
 
+static int vQuantBatchRunDisk (sqlite3 *db, vFullScanCursor *c, vQuantBatch *b) {
+    char sql[STATIC_SQL_SIZE];
+    generate_select_quant_range_partitions(c->table->t_name, c->table->c_name, sql);
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto batch_disk_cleanup;
+    
+    // chunks entirely outside the id constraints are skipped without reading their data
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
+    
+    while (1) {
+        rc = sqlite3_step(vm);
+        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;}
+        else if (rc != SQLITE_ROW) goto batch_disk_cleanup;
+        
+        // chunks of a partition that no query probes are skipped
+        int partition = sqlite3_column_int(vm, 2);
+        bool probed = false;
+        for (int q=0; q<b->nqueries && !probed; ++q) probed = vQuantBatchProbed(b, q, partition);
+        if (!probed) continue;
+        
+        vector_chunk chunk;
+        if (!vector_chunk_decode(&chunk, sqlite3_column_blob(vm, 1), sqlite3_column_bytes(vm, 1), sqlite3_column_int(vm, 0), b->n)) {rc = SQLITE_CORRUPT; goto batch_disk_cleanup;}
+        vQuantBatchScanRows(b, &chunk, partition);
+    }
+    
+batch_disk_cleanup:
+    if (vm) sqlite3_finalize(vm);
+    return rc;
+}
 
-static int vFullScanCursorEof (sqlite3_vtab_cursor *cur){
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-    return (c->is_streaming) ? c->stream.is_eof : (c->row_index == c->row_count);
+// marks the IVF partitions probed by each query
+static int vQuantBatchProbe (sqlite3 *db, vFullScanCursor *c, vQuantBatch *b) {
+    table_context *t_ctx = c->table;
+    int nlist = t_ctx->options.nlist;
+    if (nlist <= 0) return SQLITE_OK;
+    
+    // preloaded rows without partitions are scanned in full (as in vQuantRunMemory)
+    if (t_ctx->preloaded && (!t_ctx->prepartitions || !t_ctx->precentroids)) return SQLITE_OK;
+    
+    uint8_t *centroids = (t_ctx->preloaded) ? t_ctx->precentroids : ivf_load_centroids(db, t_ctx->t_name, t_ctx->c_name, nlist, b->n);
+    if (!centroids) return SQLITE_NOMEM;
+    
+    int rc = SQLITE_OK;
+    int nprobe = vQuantProbeCount(c);
+    b->probed = (bool *)sqlite3_malloc64((sqlite3_uint64)b->nqueries * nlist * sizeof(bool));
+    if (!b->probed) {rc = SQLITE_NOMEM; goto batch_probe_cleanup;}
+    memset(b->probed, 0, (size_t)b->nqueries * nlist * sizeof(bool));
+    b->nlist = nlist;
+    
+    for (int q=0; q<b->nqueries; ++q) {
+        int *probes = ivf_probe((const uint8_t *)b->v[q], centroids, nlist, b->n, t_ctx->options.q_type, nprobe);
+        if (!probes) {rc = SQLITE_NOMEM; goto batch_probe_cleanup;}
+        for (int i=0; i<nprobe; ++i) b->probed[(size_t)q * nlist + probes[i]] = true;
+        sqlite3_free(probes);
+    }
+    
+batch_probe_cleanup:
+    if (centroids != t_ctx->precentroids) sqlite3_free(centroids);
+    return rc;
 }
 
-static int vFullScanCursorColumn (sqlite3_vtab_cursor *cur, sqlite3_context *context, int iCol) {
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-    if (iCol == VECTOR_COLUMN_ROWID) {
-        sqlite3_result_int64(context, (c->is_streaming) ? (sqlite3_int64)c->stream.rowid : (sqlite3_int64)c->rowids[c->row_index]);
-    } else if (iCol == VECTOR_COLUMN_DISTANCE) {
-        sqlite3_result_double(context, (c->is_streaming) ? c->stream.distance : c->distance[c->row_index]);
+// runs nqueries queries (vsize bytes each) in one pass, the k slots of query q start at c->rowids + q*k
+// and counts[q] receives the number of results found for it
+static int vQuantBatchRun (sqlite3 *db, vFullScanCursor *c, const uint8_t *queries, int vsize, int nqueries, int k, int *counts) {
+    vQuantBatch b = {0};
+    b.nqueries = nqueries;
+    
+    // candidates are collected in separate slots when they have to be reranked with exact distances
+    int ncandidates = vQuantCandidateCount(c);
+    bool rerank = (ncandidates > k) || (c->options.rerank != 0);
+    int nslots = (rerank) ? ncandidates : k;
+    
+    int64_t *slot_rowids = c->rowids;
+    double *slot_distance = c->distance;
+    int rc = SQLITE_NOMEM;
+    b.cursors = (vFullScanCursor *)sqlite3_malloc64(sizeof(vFullScanCursor) * nqueries);
+    b.v = (void **)sqlite3_malloc64(sizeof(void *) * nqueries);
+    if (!b.cursors || !b.v) goto batch_run_cleanup;
+    memset(b.v, 0, sizeof(void *) * nqueries);
+    if (rerank) {
+        slot_rowids = (int64_t *)sqlite3_malloc64((sqlite3_uint64)nslots * nqueries * sizeof(int64_t));
+        slot_distance = (double *)sqlite3_malloc64((sqlite3_uint64)nslots * nqueries * sizeof(double));
+        if (!slot_rowids || !slot_distance) goto batch_run_cleanup;
+    }
+    
+    for (int q=0; q<nqueries; ++q) {
+        vFullScanCursor *qc = &b.cursors[q];
+        *qc = *c;
+        qc->rowids = slot_rowids + (size_t)q * nslots;
+        qc->distance = slot_distance + (size_t)q * nslots;
+        qc->row_count = nslots;
+        for (int i=0; i<nslots; ++i) {qc->rowids[i] = 0; qc->distance[i] = INFINITY;}
+        
+        rc = vQuantPrepareQuery(db, c, queries + (size_t)q * vsize, &b.v[q], &b.n, &b.distance_fn, &b.batch_fn);
+        if (rc != SQLITE_OK) goto batch_run_cleanup;
+    }
+    
+    rc = vQuantBatchProbe(db, c, &b);
+    if (rc != SQLITE_OK) goto batch_run_cleanup;
+    
+    rc = (c->table->preloaded) ? vQuantBatchRunMemory(c, &b) : vQuantBatchRunDisk(db, c, &b);
+    if (rc != SQLITE_OK) goto batch_run_cleanup;
+    for (int q=0; q<nqueries; ++q) vQuantScanDelta(&b.cursors[q], b.v[q], b.n, b.distance_fn, b.batch_fn);
+    
+    for (int q=0; q<nqueries; ++q) {
+        vFullScanCursor result = *c;
+        result.rowids = c->rowids + (size_t)q * k;
+        result.distance = c->distance + (size_t)q * k;
+        result.row_count = k;
+        if (rerank) {
+            for (int i=0; i<k; ++i) {result.rowids[i] = 0; result.distance[i] = INFINITY;}
+            rc = vQuantRerank(db, &result, queries + (size_t)q * vsize, b.cursors[q].rowids, b.cursors[q].distance, nslots);
+            if (rc != SQLITE_OK) goto batch_run_cleanup;
+        }
+        counts[q] = k - vFullScanSortSlots(&result);
+    }
+    rc = SQLITE_OK;
+    
+batch_run_cleanup:
+    if (b.v) {
+        for (int q=0; q<nqueries; ++q) if (b.v[q]) sqlite3_free(b.v[q]);
+        sqlite3_free(b.v);
+    }
+    if (b.probed) sqlite3_free(b.probed);
+    if (b.cursors) sqlite3_free(b.cursors);
+    if (rerank) {
+        if (slot_rowids) sqlite3_free(slot_rowids);
+        if (slot_distance) sqlite3_free(slot_distance);
     }
-    return SQLITE_OK;
+    return rc;
 }
 
-static int vFullScanCursorRowid (sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
-    vFullScanCursor *c = (vFullScanCursor *)cur;
-    *pRowid = (c->is_streaming) ? (sqlite3_int64)c->stream.rowid : (sqlite_int64)c->rowids[c->row_index];
+static int vQuantBatchConnect (sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr) {
+    // same layout as vFullScanConnect, the third hidden column holds all the queries and query_idx tells them apart
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(tbl hidden, col hidden, queries hidden, k hidden, options hidden, filter hidden, id, distance, query_idx);");
+    if (rc != SQLITE_OK) return rc;
+    
+    vFullScan *vtab = (vFullScan *)sqlite3_malloc(sizeof(vFullScan));
+    if (!vtab) return SQLITE_NOMEM;
+    
+    memset(vtab, 0, sizeof(vFullScan));
+    vtab->db = db;
+    vtab->ctx = (vector_context *)pAux;
+    
+    *ppVtab = (sqlite3_vtab *)vtab;
     return SQLITE_OK;
 }
 
-static inline int vFullScanFindMaxIndex (double *values, int n) {
-    int max_idx = 0;
-    if (n <= 32) {
-        // use simple version
-        for (int i = 1; i < n; ++i) {
-            if (values[i] > values[max_idx]) {max_idx = i;}
+static int vQuantBatchCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    const char *fname = "vector_quantize_scan_batch";
+    vFullScanCursor *c = (vFullScanCursor *)cur;
+    vFullScan *vtab = (vFullScan *)cur->pVtab;
+    
+    c->is_streaming = false;
+    c->is_quantized = true;
+    c->row_index = 0;
+    c->row_count = 0;
+    
+    sqlite3_value *hidden[VECTOR_COLUMN_ROWID];
+    int rc = vCursorParseArguments(c, idxNum, &argc, &argv, hidden, fname, 4, 6, true);
+    if (rc != SQLITE_OK) return rc;
+    table_context *t_ctx = c->table;
+    
+    // queries are a JSON array of vectors or a BLOB with the vectors one after the other
+    int vsize = t_ctx->options.v_dim * (int)vector_type_to_size(t_ctx->options.v_type);
+    int nqueries = 0;
+    void *json_queries = NULL;
+    const uint8_t *queries = NULL;
+    if (sqlite3_value_type(argv[2]) == SQLITE_TEXT) {
+        json_queries = vector_batch_from_json(&vtab->base, t_ctx->options.v_type, (const char *)sqlite3_value_text(argv[2]), t_ctx->options.v_dim, &nqueries);
+        if (!json_queries) return SQLITE_ERROR; // error already set inside vector_batch_from_json
+        queries = (const uint8_t *)json_queries;
+    } else {
+        int bytes = sqlite3_value_bytes(argv[2]);
+        queries = (const uint8_t *)sqlite3_value_blob(argv[2]);
+        if (!queries || bytes == 0 || (bytes % vsize) != 0) {
+            return sqlite_vtab_set_error(&vtab->base, "%s: the queries BLOB must contain one or more vectors of %d bytes (got %d bytes).", fname, vsize, bytes);
         }
-        return max_idx;
+        nqueries = bytes / vsize;
     }
     
-    // use unrolled version
-    double max_val = values[0];
-    int i = 1;
+    int k = sqlite3_value_int(argv[3]);
+    int *counts = NULL;
+    if (k <= 0) goto batch_filter_cleanup;
     
-    // unroll loop in blocks of 4
-    for (; i + 3 < n; i += 4) {
-        if (values[i] > max_val) {max_val = values[i]; max_idx = i;}
-        if (values[i + 1] > max_val) {max_val = values[i + 1]; max_idx = i + 1;}
-        if (values[i + 2] > max_val) {max_val = values[i + 2]; max_idx = i + 2;}
-        if (values[i + 3] > max_val) {max_val = values[i + 3]; max_idx = i + 3;}
-    }
+    int64_t total = (int64_t)k * nqueries;
+    rc = SQLITE_NOMEM;
+    if (c->rowids) sqlite3_free(c->rowids);
+    c->rowids = (int64_t *)sqlite3_malloc64(total * sizeof(int64_t));
+    if (c->distance) sqlite3_free(c->distance);
+    c->distance = (double *)sqlite3_malloc64(total * sizeof(double));
+    if (c->query_idx) sqlite3_free(c->query_idx);
+    c->query_idx = (int *)sqlite3_malloc64(total * sizeof(int));
+    counts = (int *)sqlite3_malloc64(nqueries * sizeof(int));
+    if (!c->rowids || !c->distance || !c->query_idx || !counts) goto batch_filter_cleanup;
+    c->row_count = k;
     
-    // process remaining elements
-    for (; i < n; ++i) {
-        if (values[i] > max_val) {max_val = values[i]; max_idx = i;}
+    // optional filter, only rows matching the WHERE fragment compete for the top-k
+    c->filter = ((argc > 5) && argv[5]) ? (const char *)sqlite3_value_text(argv[5]) : NULL;
+    if (c->filter && c->filter[0] == 0) c->filter = NULL;
+    
+    rc = vQuantLoadDelta(vtab->db, c);
+    if ((rc == SQLITE_OK) && c->filter) rc = vector_rowset_build(vtab->db, t_ctx, c->filter, &c->rowset);
+    if (rc == SQLITE_OK) rc = vQuantBatchRun(vtab->db, c, queries, vsize, nqueries, k, counts);
+    
+    // pack the results of each query (already sorted by distance) one after the other
+    int count = 0;
+    if (rc == SQLITE_OK) {
+        for (int q=0; q<nqueries; ++q) {
+            for (int i=0; i<counts[q]; ++i, ++count) {
+                c->rowids[count] = c->rowids[(size_t)q * k + i];
+                c->distance[count] = c->distance[(size_t)q * k + i];
+                c->query_idx[count] = q;
+            }
+        }
     }
-    return max_idx;
+    c->row_count = count;
+    
+batch_filter_cleanup:
+    vector_delta_free(&c->delta);
+    vector_rowset_free(c->rowset);
+    c->rowset = NULL;
+    c->filter = NULL;
+    if ((rc == SQLITE_MISUSE) && (vtab->base.zErrMsg == NULL)) sqlite_vtab_set_error(&vtab->base, "%s: filter must be a single SQL expression.", fname);
+    if (counts) sqlite3_free(counts);
+    if (json_queries) sqlite3_free(json_queries);
+    return rc;
 }
 
-static int vFullScanSortSlots (vFullScanCursor *c) {
-    int     counter = 0;
-    int     row_count = c->row_count;
-    double  *distance = c->distance;
-    int64_t *rowids = c->rowids;
-    
-    for (int i = 0; i < row_count - 1; ++i) {
-        if (distance[i] == INFINITY) ++counter;
-        for (int j = i + 1; j < row_count; ++j) {
-            if (distance[j] < distance[i]) {
-                SWAP(double, distance[i], distance[j]);
-                SWAP(int64_t, rowids[i], rowids[j]);
-            }
+// MARK: - HNSW Scan -
+
+typedef struct {
+    sqlite3_stmt        *vm_neighbors;
+    sqlite3_stmt        *vm_vector;
+    const void          *query;
+    int                 dim;
+    size_t              vsize;
+    distance_function_t distance_fn;
+    
+    int64_t             *visited;           // open addressing set of visited rowids
+    uint8_t             *used;
+    uint64_t            visited_capacity;
+    uint64_t            visited_count;
+    
+    int64_t             *links;
+    int                 links_capacity;
+} hnsw_search;
+
+static inline uint64_t hnsw_hash_rowid (int64_t rowid) {
+    uint64_t x = (uint64_t)rowid;
+    x ^= x >> 33; x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33; x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// returns 1 if rowid was inserted, 0 if it was already present, -1 on out of memory
+static int hnsw_visit (hnsw_search *s, int64_t rowid) {
+    if ((s->visited_count + 1) * 2 > s->visited_capacity) {
+        uint64_t capacity = (s->visited_capacity) ? s->visited_capacity * 2 : 1024;
+        int64_t *visited = (int64_t *)sqlite3_malloc64(capacity * sizeof(int64_t));
+        uint8_t *used = (uint8_t *)sqlite3_malloc64(capacity);
+        if (!visited || !used) {
+            if (visited) sqlite3_free(visited);
+            if (used) sqlite3_free(used);
+            return -1;
+        }
+        memset(used, 0, capacity);
+        
+        // rehash
+        for (uint64_t i=0; i<s->visited_capacity; ++i) {
+            if (!s->used[i]) continue;
+            uint64_t j = hnsw_hash_rowid(s->visited[i]) & (capacity - 1);
+            while (used[j]) j = (j + 1) & (capacity - 1);
+            used[j] = 1;
+            visited[j] = s->visited[i];
         }
+        
+        if (s->visited) sqlite3_free(s->visited);
+        if (s->used) sqlite3_free(s->used);
+        s->visited = visited;
+        s->used = used;
+        s->visited_capacity = capacity;
     }
     
-    if (distance[row_count-1] == INFINITY) ++counter;
-    return counter;
+    uint64_t mask = s->visited_capacity - 1;
+    uint64_t j = hnsw_hash_rowid(rowid) & mask;
+    while (s->used[j]) {
+        if (s->visited[j] == rowid) return 0;
+        j = (j + 1) & mask;
+    }
+    s->used[j] = 1;
+    s->visited[j] = rowid;
+    s->visited_count++;
+    return 1;
 }
 
-static int vFullScanRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
-    const char *pk_name = c->table->pk_name;
-    const char *col_name = c->table->c_name;
-    const char *table_name = c->table->t_name;
-    int dimension = c->table->options.v_dim;
+// computes distance between the query vector and the vector stored at rowid (INFINITY if the row no longer exists)
+static int hnsw_distance (hnsw_search *s, int64_t rowid, float *distance) {
+    *distance = INFINITY;
+    sqlite3_stmt *vm = s->vm_vector;
     
-    char *sql = sqlite3_mprintf("SELECT %q, %q FROM %q;", pk_name, col_name, table_name);
-    if (!sql) return SQLITE_NOMEM;
+    int rc = sqlite3_bind_int64(vm, 1, (sqlite3_int64)rowid);
+    if (rc != SQLITE_OK) return rc;
     
-    sqlite3_stmt *vm = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto cleanup;
+    rc = sqlite3_step(vm);
+    if (rc == SQLITE_ROW) {
+        const void *blob = sqlite3_column_blob(vm, 0);
+        if (blob && (size_t)sqlite3_column_bytes(vm, 0) >= s->vsize) {
+            float d = s->distance_fn(s->query, blob, s->dim);
+            *distance = (nearly_zero_float32(d)) ? 0.0f : d;
+        }
+        rc = SQLITE_DONE;
+    }
+    if (rc != SQLITE_DONE) return rc;
+    return sqlite3_reset(vm);
+}
+
+// loads into s->links the neighbors of rowid in the given layer
+static int hnsw_neighbors (hnsw_search *s, int64_t rowid, int level, int *count) {
+    *count = 0;
+    sqlite3_stmt *vm = s->vm_neighbors;
     
-    // compute distance function
-    vector_distance vd = c->table->options.v_distance;
-    vector_type vt = c->table->options.v_type;
-    distance_function_t distance_fn = dispatch_distance_table[vd][vt];
+    int rc = sqlite3_bind_int64(vm, 1, (sqlite3_int64)rowid);
+    if (rc != SQLITE_OK) return rc;
     
-    while (1) {
-        rc = sqlite3_step(vm);
-        if (rc == SQLITE_DONE) {rc = SQLITE_OK; goto cleanup;}
-        if (rc != SQLITE_ROW) goto cleanup;
-        if (sqlite3_column_type(vm, 1) == SQLITE_NULL) continue;
-        
-        float *v2 = (float *)sqlite3_column_blob(vm, 1);
-        if (v2 == NULL) continue;
-        
-        float distance = distance_fn((const void *)v1, (const void *)v2, dimension);
-        if (nearly_zero_float32(distance)) distance = 0.0;
-        VECTOR_PRINT((void*)v2, vt, dimension);
+    rc = sqlite3_step(vm);
+    if (rc == SQLITE_ROW) {
+        int node_level = sqlite3_column_int(vm, 0);
+        const uint8_t *p = (const uint8_t *)sqlite3_column_blob(vm, 1);
+        const uint8_t *end = p + sqlite3_column_bytes(vm, 1);
         
-        if (distance < c->distance[c->max_index]) {
-            c->distance[c->max_index] = distance;
-            c->rowids[c->max_index] = (int64_t)sqlite3_column_int64(vm, 0);
-            c->max_index = vFullScanFindMaxIndex(c->distance, c->row_count);
+        for (int l=0; p && l<=node_level && l<=level && p + sizeof(int32_t) <= end; ++l) {
+            int n = (int)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+            p += sizeof(int32_t);
+            if (p + (size_t)n * sizeof(int64_t) > end) break;
+            
+            if (l == level) {
+                if (n > s->links_capacity) {
+                    int64_t *links = (int64_t *)sqlite3_realloc64(s->links, (sqlite3_uint64)n * sizeof(int64_t));
+                    if (!links) {sqlite3_reset(vm); return SQLITE_NOMEM;}
+                    s->links = links;
+                    s->links_capacity = n;
+                }
+                for (int i=0; i<n; ++i) s->links[i] = INT64_FROM_INT8PTR(p + (size_t)i * sizeof(int64_t));
+                *count = n;
+            }
+            p += (size_t)n * sizeof(int64_t);
         }
+        rc = SQLITE_DONE;
     }
-    
-cleanup:
-    if (sql) sqlite3_free(sql);
-    if (vm) sqlite3_finalize(vm);
-    return rc;
-}
-
-static int vFullScanCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
-    return vCursorFilterCommon(cur, idxNum, idxStr, argc, argv, "vector_full_scan", vFullScanRun, vFullScanSortSlots, false);
+    if (rc != SQLITE_DONE) return rc;
+    return sqlite3_reset(vm);
 }
 
-// MARK: -
-
-static int vQuantRunMemory(vFullScanCursor *c, uint8_t *v, vector_qtype qtype, int dim) {
-    const int counter = c->table->precounter;
-    const uint8_t *data = c->table->preloaded;
-    const size_t rowid_size = sizeof(int64_t);
-    const size_t vector_size = dim * sizeof(uint8_t);
-    const size_t total_stride = rowid_size + vector_size;
-
-    double *distance = c->distance;
-    int64_t *rowids = (int64_t *)c->rowids;
-    int max_index = c->max_index;
-    double current_max = distance[max_index];
+static int hnsw_search_layer (hnsw_search *s, hnsw_heap *W, int ef, int level) {
+    int rc = SQLITE_OK;
+    hnsw_heap C = {.is_max = false};
     
-    // compute distance function
-    vector_distance vd = c->table->options.v_distance;
-    vector_type vt = (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8;
-    distance_function_t distance_fn = dispatch_distance_table[vd][vt];
+    for (int i=0; i<W->count; ++i) {
+        if (!hnsw_heap_push(&C, W->items[i].distance, W->items[i].id)) {rc = SQLITE_NOMEM; goto hnsw_search_layer_cleanup;}
+    }
     
-    for (int i = 0; i < counter; ++i) {
-        const uint8_t *current_data = data + (i * total_stride);
-        const uint8_t *vector_data = current_data + rowid_size;
-
-        float dist = distance_fn((const void *)v, (const void *)vector_data, dim);
-        if (nearly_zero_float32(dist)) dist = 0.0;
+    while (C.count > 0) {
+        hnsw_candidate c = hnsw_heap_pop(&C);
+        if ((W->count >= ef) && (c.distance > W->items[0].distance)) break;
         
-        if (dist < current_max) {
-            distance[max_index] = dist;
-            rowids[max_index] = INT64_FROM_INT8PTR(current_data);
-
-            // Recompute max index efficiently
-            max_index = vFullScanFindMaxIndex(distance, c->row_count);
-            current_max = distance[max_index];
+        int count = 0;
+        rc = hnsw_neighbors(s, c.id, level, &count);
+        if (rc != SQLITE_OK) goto hnsw_search_layer_cleanup;
+        
+        for (int i=0; i<count; ++i) {
+            int64_t e = s->links[i];
+            int visited = hnsw_visit(s, e);
+            if (visited < 0) {rc = SQLITE_NOMEM; goto hnsw_search_layer_cleanup;}
+            if (visited == 0) continue;
+            
+            float d;
+            rc = hnsw_distance(s, e, &d);
+            if (rc != SQLITE_OK) goto hnsw_search_layer_cleanup;
+            if (d == INFINITY) continue; // deleted row
+            
+            if ((W->count < ef) || (d < W->items[0].distance)) {
+                if (!hnsw_heap_push(&C, d, e) || !hnsw_heap_push(W, d, e)) {rc = SQLITE_NOMEM; goto hnsw_search_layer_cleanup;}
+                if (W->count > ef) hnsw_heap_pop(W);
+            }
         }
     }
-
-    c->max_index = max_index;
-    return SQLITE_OK;
+    
+hnsw_search_layer_cleanup:
+    hnsw_heap_free(&C);
+    return rc;
 }
 
-static int vQuantRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
-    // quantize target vector
-    int dimension = c->table->options.v_dim;
-    uint8_t *v = (uint8_t *)sqlite3_malloc(dimension * sizeof(int8_t));
-    if (!v) return SQLITE_NOMEM;
+static int vHnswRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
+    table_context *t_ctx = c->table;
+    if (t_ctx->hnsw_m == 0) {
+        return sqlite_vtab_set_error(c->base.pVtab, "HNSW index not found for table '%s' and column '%s'. Ensure that vector_index() has been called before using vector_hnsw_scan().", t_ctx->t_name, t_ctx->c_name);
+    }
     
-    // quantize vector
-    vector_qtype qtype = c->table->options.q_type;
-    float offset = c->table->offset;
-    float scale = c->table->scale;
-    vector_type type = c->table->options.v_type;
+    int k = c->row_count;
+    int ef = (c->options.ef_search > 0) ? c->options.ef_search : HNSW_DEFAULT_EF_SEARCH;
+    if (ef < k) ef = k;
     
-    switch (type) {
-        case VECTOR_TYPE_F32: quantize_float32((const float *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_F16: quantize_float16((const uint16_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_BF16: quantize_bfloat16((const uint16_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_U8: quantize_u8((const uint8_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_I8: quantize_i8((const int8_t *)v1, v, offset, scale, dimension, qtype); break;
+    // with a filter the graph is traversed as usual and the ef closest nodes are then filtered
+    if (c->filter) {
+        int rc = vector_rowset_build(db, t_ctx, c->filter, &c->rowset);
+        if (rc != SQLITE_OK) return rc;
     }
     
-    if (c->table->preloaded) {
-        int rc = vQuantRunMemory(c, v, qtype, dimension);
-        if (v) sqlite3_free(v);
-        return rc;
-    }
-    VECTOR_PRINT((void*)v, (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8, dimension);
+    hnsw_search s;
+    memset(&s, 0, sizeof(hnsw_search));
+    s.query = v1;
+    s.dim = t_ctx->options.v_dim;
+    s.vsize = (size_t)s.dim * vector_type_to_size(t_ctx->options.v_type);
+    s.distance_fn = table_distance_function(&t_ctx->options);
     
+    hnsw_heap W = {.is_max = true};
     char sql[STATIC_SQL_SIZE];
-    generate_select_quant_table(c->table->t_name, c->table->c_name, sql);
-    sqlite3_stmt *vm = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto kann_run_cleanup;
     
-    // precompute constants
-    const size_t rowid_size = sizeof(int64_t);
-    const size_t vector_size = dimension * sizeof(uint8_t);
-    const size_t total_stride = rowid_size + vector_size;
-    
-    // compute distance function
-    vector_distance vd = c->table->options.v_distance;
-    vector_type vt = (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8;
-    distance_function_t distance_fn = dispatch_distance_table[vd][vt];
-    
-    while (1) {
-        rc = sqlite3_step(vm);
-        if (rc == SQLITE_DONE) {rc = SQLITE_OK; break;} // return error: rebuild must be call (only if first time run)
-        else if (rc != SQLITE_ROW) goto kann_run_cleanup;
-        
-        int counter = sqlite3_column_int(vm, 0);
-        uint8_t *data = (uint8_t *)sqlite3_column_blob(vm, 1);
-        
-        // cache the maximum value to avoid repeated memory accesses
-        double current_max_distance = c->distance[c->max_index];
-        
-        for (int i=0; i<counter; ++i) {
-            const uint8_t *current_data = data + (i * total_stride);
-            const uint8_t *vector_data = current_data + rowid_size;
-            float distance = distance_fn((const void *)v, (const void *)vector_data, dimension);
-            if (nearly_zero_float32(distance)) distance = 0.0;
-            VECTOR_PRINT((void*)vector_data, vt, dimension);
+    generate_select_hnsw_table(t_ctx->t_name, t_ctx->c_name, sql);
+    int rc = sqlite3_prepare_v2(db, sql, -1, &s.vm_neighbors, NULL);
+    if (rc != SQLITE_OK) goto hnsw_run_cleanup;
+    
+    generate_select_vector_by_pk(t_ctx->t_name, t_ctx->c_name, t_ctx->pk_name, sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &s.vm_vector, NULL);
+    if (rc != SQLITE_OK) goto hnsw_run_cleanup;
+    
+    // greedy descent from the entry point down to layer 1
+    int64_t ep = t_ctx->hnsw_entry;
+    float epd;
+    rc = hnsw_distance(&s, ep, &epd);
+    if (rc != SQLITE_OK) goto hnsw_run_cleanup;
+    
+    for (int l=t_ctx->hnsw_max_level; l>0; --l) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            int count = 0;
+            rc = hnsw_neighbors(&s, ep, l, &count);
+            if (rc != SQLITE_OK) goto hnsw_run_cleanup;
             
-            if (distance < current_max_distance) {
-                c->distance[c->max_index] = distance;
-                c->rowids[c->max_index] = INT64_FROM_INT8PTR(current_data);
-                c->max_index = vFullScanFindMaxIndex(c->distance, c->row_count);
-                current_max_distance = c->distance[c->max_index]; // update cached max
+            int64_t next = ep;
+            for (int i=0; i<count; ++i) {
+                float d;
+                rc = hnsw_distance(&s, s.links[i], &d);
+                if (rc != SQLITE_OK) goto hnsw_run_cleanup;
+                if (d < epd) {epd = d; next = s.links[i]; changed = true;}
             }
+            ep = next;
         }
     }
     
-    rc = SQLITE_OK;
+    // best-first search in layer 0
+    if (hnsw_visit(&s, ep) < 0) {rc = SQLITE_NOMEM; goto hnsw_run_cleanup;}
+    if (!hnsw_heap_push(&W, epd, ep)) {rc = SQLITE_NOMEM; goto hnsw_run_cleanup;}
+    rc = hnsw_search_layer(&s, &W, ef, 0);
+    if (rc != SQLITE_OK) goto hnsw_run_cleanup;
     
-kann_run_cleanup:
-    if (rc != SQLITE_OK) printf("Error in vector_rebuild_quantization: %s\n", sqlite3_errmsg(db));
-    if (vm) sqlite3_finalize(vm);
-    if (v) sqlite3_free(v);
+    // keep the k closest candidates (among the ones matching the filter)
+    for (int i=0; i<W.count; ++i) {
+        if (!vCursorRowidMatch(c, W.items[i].id)) continue;
+        if (W.items[i].distance < c->distance[0]) vTopKReplaceTop(c->distance, c->rowids, k, W.items[i].distance, W.items[i].id);
+    }
+    
+hnsw_run_cleanup:
+    hnsw_heap_free(&W);
+    if (s.vm_neighbors) sqlite3_finalize(s.vm_neighbors);
+    if (s.vm_vector) sqlite3_finalize(s.vm_vector);
+    if (s.visited) sqlite3_free(s.visited);
+    if (s.used) sqlite3_free(s.used);
+    if (s.links) sqlite3_free(s.links);
     return rc;
 }
 
-
-static int vQuantCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
-    return vCursorFilterCommon(cur, idxNum, idxStr, argc, argv, "vector_quantize_scan", vQuantRun, vFullScanSortSlots, true);
+static int vHnswCursorFilter (sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    return vCursorFilterCommon(cur, idxNum, idxStr, argc, argv, "vector_hnsw_scan", vHnswRun, vFullScanSortSlots, false);
 }
 
 // MARK: - Streaming Modules -
@@ -2247,31 +7761,7 @@ static int vStreamScanBestIndex (sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo
     // Optionally: if ORDER BY distance is present, bump cost/rows a bit.
     pIdxInfo->estimatedCost = 1e8;
     pIdxInfo->estimatedRows = 100000;
-    
-    const struct sqlite3_index_constraint *pConstraint = pIdxInfo->aConstraint;
-    for(int i=0; i<pIdxInfo->nConstraint; i++, pConstraint++){
-        if( pConstraint->usable == 0 ) continue;
-        if( pConstraint->op != SQLITE_INDEX_CONSTRAINT_EQ ) continue;
-        switch( pConstraint->iColumn ){
-            case VECTOR_COLUMN_IDX:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 1;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_VECTOR:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 2;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_K:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 3;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-            case VECTOR_COLUMN_MEMIDX:
-                pIdxInfo->aConstraintUsage[i].argvIndex = 4;
-                pIdxInfo->aConstraintUsage[i].omit = 1;
-                break;
-        }
-    }
-    return SQLITE_OK;
+    return vScanBestIndex(pIdxInfo, 3);
 }
 
 static int vStreamScanCursorRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
@@ -2279,82 +7769,64 @@ static int vStreamScanCursorRun (sqlite3 *db, vFullScanCursor *c, const void *v1
     void *v = sqlite_memdup(v1, v1size);
     if (!v) return SQLITE_NOMEM;
     
-    const char *pk_name = c->table->pk_name;
-    const char *col_name = c->table->c_name;
-    const char *table_name = c->table->t_name;
-    int dimension = c->table->options.v_dim;
-    
     c->stream.vector = (void *)v;
     c->stream.vsize = v1size;
-    c->stream.vdim = dimension;
+    c->stream.vdim = c->table->options.v_dim;
     
-    char *sql = sqlite3_mprintf("SELECT %q, %q FROM %q;", pk_name, col_name, table_name);
-    if (!sql) return SQLITE_NOMEM;
+    if (vFullScanUseReader(c)) {
+        c->stream.reader = (vector_row_reader *)sqlite3_malloc(sizeof(vector_row_reader));
+        if (!c->stream.reader) return SQLITE_NOMEM;
+        memset(c->stream.reader, 0, sizeof(vector_row_reader));
+    }
     
+    bool use_reader = false;
     sqlite3_stmt *vm = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto cleanup;
-    
-    // compute distance function
-    vector_distance vd = c->table->options.v_distance;
-    vector_type vt = c->table->options.v_type;
-    distance_function_t distance_fn = dispatch_distance_table[vd][vt];
-    
-    c->stream.distance_fn = distance_fn;
+    int rc = vFullScanPrepare(db, c, &vm, c->stream.reader, &use_reader);
     c->stream.vm = vm;
+    if (rc != SQLITE_OK) return rc;
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
     
-    if (sql) sqlite3_free(sql);
+    // compute distance function
+    c->stream.distance_fn = table_distance_function(&c->table->options);
     return SQLITE_OK;
-    
-cleanup:
-    if (sql) sqlite3_free(sql);
-    if (vm) sqlite3_finalize(vm);
-    return rc;
 }
 
 static int vStreamQuantCursorRun (sqlite3 *db, vFullScanCursor *c, const void *v1, int v1size) {
-    // quantize input vector
-    int dimension = c->table->options.v_dim;
-    uint8_t *v = (uint8_t *)sqlite3_malloc(dimension * sizeof(int8_t));
-    if (!v) return SQLITE_NOMEM;
-    
-    // quantize vector
-    vector_qtype qtype = c->table->options.q_type;
-    float offset = c->table->offset;
-    float scale = c->table->scale;
-    vector_type type = c->table->options.v_type;
-    
-    switch (type) {
-        case VECTOR_TYPE_F32: quantize_float32((const float *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_F16: quantize_float16((const uint16_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_BF16: quantize_bfloat16((const uint16_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_U8: quantize_u8((const uint8_t *)v1, v, offset, scale, dimension, qtype); break;
-        case VECTOR_TYPE_I8: quantize_i8((const int8_t *)v1, v, offset, scale, dimension, qtype); break;
-    }
+    int rc = vQuantLoadDelta(db, c);
+    if (rc != SQLITE_OK) return rc;
     
-    c->stream.vector = (void *)v;
-    c->stream.vsize = (int)(dimension * sizeof(int8_t));
-    c->stream.vdim = dimension;
+    // quantize input vector (or build the PQ lookup table)
+    void *v = NULL;
+    int n = 0;
+    distance_function_t distance_fn = NULL;
+    rc = vQuantPrepareQuery(db, c, v1, &v, &n, &distance_fn, NULL);
+    if (rc != SQLITE_OK) return rc;
     
-    // compute distance function
-    vector_distance vd = c->table->options.v_distance;
-    vector_type vt = (qtype == VECTOR_QUANT_U8BIT) ? VECTOR_TYPE_U8 : VECTOR_TYPE_I8;
-    distance_function_t distance_fn = dispatch_distance_table[vd][vt];
+    c->stream.vector = v;
+    c->stream.vsize = (c->table->options.q_type == VECTOR_QUANT_PQ) ? (int)(n * PQ_KSUB * sizeof(float)) : (int)(n * sizeof(int8_t));
+    c->stream.vdim = n;
     c->stream.distance_fn = distance_fn;
     
     // check if quant representation was preloaded
     if (c->table->preloaded) {
-        c->stream.dindex = 0;
-        c->stream.data = c->table->preloaded;
-        c->stream.dcounter = c->table->precounter;
+        int range[2] = {0, c->table->precounter};
+        vQuantNarrowRanges(c, n, range, 1);
+        c->stream.dindex = range[0];
+        c->stream.chunk = vQuantPreloadedRows(c->table);
+        c->stream.dcounter = range[0] + range[1];
+        c->stream.preload = c->table->preload;
+        vector_preload_retain(c->stream.preload);
         return SQLITE_OK;
     }
     
     char sql[STATIC_SQL_SIZE];
-    generate_select_quant_table(c->table->t_name, c->table->c_name, sql);
+    generate_select_quant_range(c->table->t_name, c->table->c_name, sql);
     sqlite3_stmt *vm = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
     if (rc != SQLITE_OK) goto cleanup;
+    sqlite3_bind_int64(vm, 1, (sqlite3_int64)c->rowid_min);
+    sqlite3_bind_int64(vm, 2, (sqlite3_int64)c->rowid_max);
     
     c->stream.vm = vm;
     return SQLITE_OK;
@@ -2430,6 +7902,34 @@ static sqlite3_module vQuantScanModule = {
   /* xIntegrity  */ 0
 };
 
+static sqlite3_module vHnswScanModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ vFullScanConnect,
+  /* xBestIndex  */ vFullScanBestIndex,
+  /* xDisconnect */ vFullScanDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ vFullScanCursorOpen,
+  /* xClose      */ vFullScanCursorClose,
+  /* xFilter     */ vHnswCursorFilter,
+  /* xNext       */ vFullScanCursorNext,
+  /* xEof        */ vFullScanCursorEof,
+  /* xColumn     */ vFullScanCursorColumn,
+  /* xRowid      */ vFullScanCursorRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0,
+  /* xIntegrity  */ 0
+};
+
 static sqlite3_module vFullScanStreamModule = {
   /* iVersion    */ 0,
   /* xCreate     */ 0,
@@ -2486,6 +7986,34 @@ static sqlite3_module vQuantScanStreamModule = {
   /* xIntegrity  */ 0
 };
 
+static sqlite3_module vQuantScanBatchModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ vQuantBatchConnect,
+  /* xBestIndex  */ vFullScanBestIndex,
+  /* xDisconnect */ vFullScanDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ vFullScanCursorOpen,
+  /* xClose      */ vFullScanCursorClose,
+  /* xFilter     */ vQuantBatchCursorFilter,
+  /* xNext       */ vFullScanCursorNext,
+  /* xEof        */ vFullScanCursorEof,
+  /* xColumn     */ vFullScanCursorColumn,
+  /* xRowid      */ vFullScanCursorRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0,
+  /* xIntegrity  */ 0
+};
+
 // MARK: -
 
 static void vector_init (sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -2535,7 +8063,10 @@ static void vector_init (sqlite3_context *context, int argc, sqlite3_value **arg
             return;
         }
         
-        // no need to add a new entry
+        // runtime settings can be changed by calling vector_init again
+        t_ctx->options.threads = options.threads;
+        t_ctx->options.cache_size = options.cache_size;
+        if (options.cache_size == 0) vector_cache_free(&t_ctx->cache);
         return;
     }
     
@@ -2589,16 +8120,43 @@ SQLITE_VECTOR_API int sqlite3_vector_init (sqlite3 *db, char **pzErrMsg, const s
     rc = sqlite3_create_function(db, "vector_quantize", 2, SQLITE_UTF8, ctx, vector_quantize2, NULL, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
+    // table_name, column_name, options
+    rc = sqlite3_create_function(db, "vector_index", 3, SQLITE_UTF8, ctx, vector_index3, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    // table_name, column_name
+    rc = sqlite3_create_function(db, "vector_index", 2, SQLITE_UTF8, ctx, vector_index2, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
     // table_name, column_name
     rc = sqlite3_create_function(db, "vector_quantize_memory", 2, SQLITE_UTF8, ctx, vector_quantize_memory, NULL, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
     // table_name, column_name
-    rc = sqlite3_create_function(db, "vector_quantize_preload", 2, SQLITE_UTF8, ctx, vector_quantize_preload, NULL, NULL);
+    rc = sqlite3_create_function(db, "vector_quantize_stats", 2, SQLITE_UTF8, ctx, vector_quantize_stats, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    // table_name, column_name
+    rc = sqlite3_create_function(db, "vector_quantize_cache_stats", 2, SQLITE_UTF8, ctx, vector_quantize_cache_stats, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    // table_name, column_name
+    rc = sqlite3_create_function(db, "vector_quantize_preload", 2, SQLITE_UTF8 | SQLITE_DIRECTONLY, ctx, vector_quantize_preload, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_create_function(db, "vector_quantize_preload", 3, SQLITE_UTF8 | SQLITE_DIRECTONLY, ctx, vector_quantize_preload, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    // table_name, column_name
+    rc = sqlite3_create_function(db, "vector_quantize_cleanup", 2, SQLITE_UTF8 | SQLITE_DIRECTONLY, ctx, vector_quantize_cleanup, NULL, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
     // table_name, column_name
-    rc = sqlite3_create_function(db, "vector_quantize_cleanup", 2, SQLITE_UTF8, ctx, vector_quantize_cleanup, NULL, NULL);
+    rc = sqlite3_create_function(db, "vector_quantize_compact", 2, SQLITE_UTF8, ctx, vector_quantize_compact, NULL, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    // table_name, column_name, vector (used by the auto_quantize triggers, so it must be usable from the schema)
+    rc = sqlite3_create_function(db, "vector_quantize_code", 3, SQLITE_UTF8 | SQLITE_INNOCUOUS, ctx, vector_quantize_code, NULL, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
     rc = sqlite3_create_function(db, "vector_as_f32", 1, SQLITE_UTF8, ctx, vector_as_f32, NULL, NULL);
@@ -2627,12 +8185,18 @@ SQLITE_VECTOR_API int sqlite3_vector_init (sqlite3 *db, char **pzErrMsg, const s
     rc = sqlite3_create_module(db, "vector_quantize_scan", &vQuantScanModule, ctx);
     if (rc != SQLITE_OK) goto cleanup;
     
+    rc = sqlite3_create_module(db, "vector_hnsw_scan", &vHnswScanModule, ctx);
+    if (rc != SQLITE_OK) goto cleanup;
+    
     rc = sqlite3_create_module(db, "vector_full_scan_stream", &vFullScanStreamModule, ctx);
     if (rc != SQLITE_OK) goto cleanup;
     
     rc = sqlite3_create_module(db, "vector_quantize_scan_stream", &vQuantScanStreamModule, ctx);
     if (rc != SQLITE_OK) goto cleanup;
     
+    rc = sqlite3_create_module(db, "vector_quantize_scan_batch", &vQuantScanBatchModule, ctx);
+    if (rc != SQLITE_OK) goto cleanup;
+    
 cleanup:
     return rc;
 }
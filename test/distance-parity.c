@@ -0,0 +1,231 @@
+//
+//  distance-parity.c
+//  sqlitevector
+//
+//  Checks every kernel installed by the SIMD backends supported by this CPU against the CPU kernel for the same
+//  entry (batch kernels against the CPU distance of each row), on random data for every n in 1..PARITY_MAX_N.
+//
+
+#include "distance-cpu.h"
+#include "distance-sse2.h"
+#include "distance-avx2.h"
+#include "distance-avx512.h"
+#include "distance-avxvnni.h"
+#include "distance-neon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARITY_MAX_N        1536
+#define PARITY_MAX_ROWS     9
+#define PARITY_ROW_PAD      3
+#define PARITY_TOLERANCE    1e-3f
+
+extern char *distance_backend_name;
+extern distance_function_t dispatch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_function_t dispatch_pq_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_hamming_distance;
+extern distance_function_t dispatch_u4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_s4_distance_table[VECTOR_DISTANCE_MAX];
+extern distance_function_t dispatch_weighted_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+extern distance_batch_function_t dispatch_batch_distance_table[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+
+void init_cpu_functions (void);
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+bool cpu_supports_sse2 (void);
+bool cpu_supports_avx2 (void);
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+bool cpu_supports_neon (void);
+#endif
+
+typedef struct {
+    distance_function_t     distance[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+    distance_function_t     pq[VECTOR_DISTANCE_MAX];
+    distance_function_t     hamming;
+    distance_function_t     u4[VECTOR_DISTANCE_MAX];
+    distance_function_t     s4[VECTOR_DISTANCE_MAX];
+    distance_function_t     weighted[VECTOR_DISTANCE_MAX][VECTOR_TYPE_MAX];
+} parity_cpu_tables;
+
+typedef struct {
+    float       *f;         // PARITY_MAX_N floats
+    float       *lut;       // PQ_KSUB floats per code, filled once
+    uint8_t     *q;         // query, large enough for PARITY_MAX_N floats
+    uint8_t     *rows;      // PARITY_MAX_ROWS rows of PARITY_MAX_N floats (plus padding)
+    int         checked;
+    int         failed;
+} parity_context;
+
+static parity_cpu_tables cpu;
+static const char *metric_names[VECTOR_DISTANCE_MAX] = {NULL, "l2", "l2_squared", "cosine", "dot", "l1"};
+static const char *type_names[VECTOR_TYPE_MAX] = {NULL, "f32", "f16", "bf16", "u8", "i8"};
+
+// MARK: - Data -
+
+static float random_float (float range) {
+    return ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * range;
+}
+
+static void random_bytes (uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; ++i) p[i] = (uint8_t)(rand() & 0xFF);
+}
+
+static size_t type_size (vector_type type) {
+    switch (type) {
+        case VECTOR_TYPE_F32: return sizeof(float);
+        case VECTOR_TYPE_F16:
+        case VECTOR_TYPE_BF16: return sizeof(uint16_t);
+        default: return sizeof(uint8_t);
+    }
+}
+
+static void random_vector (uint8_t *p, vector_type type, int n) {
+    for (int i = 0; i < n; ++i) {
+        switch (type) {
+            case VECTOR_TYPE_F32: ((float *)p)[i] = random_float(1.0f); break;
+            case VECTOR_TYPE_F16: ((uint16_t *)p)[i] = float32_to_float16(random_float(1.0f)); break;
+            case VECTOR_TYPE_BF16: ((uint16_t *)p)[i] = float32_to_bfloat16(random_float(1.0f)); break;
+            default: p[i] = (uint8_t)(rand() & 0xFF); break;
+        }
+    }
+}
+
+// per-dimension ranges layout (see WEIGHTED_CODE_DIM): weights are kept small so that the dot product has the same
+// magnitude as the float tests, norms are large enough that the L2 distance never goes through the clamp to 0
+static void random_weighted (float *w, uint8_t *code, int dim) {
+    for (int i = 0; i < dim; ++i) w[i] = random_float(1.0f / 255.0f);
+    w[dim] = random_float(1.0f);
+    w[dim + 1] = 100.0f + random_float(50.0f);
+
+    random_bytes(code, (size_t)dim);
+    uint32_t norm = f32_to_bits(100.0f + random_float(50.0f));
+    for (int i = 0; i < 4; ++i) code[dim + i] = (uint8_t)(norm >> (8 * i));
+}
+
+// MARK: - Checks -
+
+static void parity_compare (parity_context *ctx, const char *kind, int metric, int type, int n, int row, float expected, float result) {
+    ++ctx->checked;
+
+    // accumulation order differs between backends, so the error is relative to the result and to the size of the sum
+    float tolerance = PARITY_TOLERANCE * (fabsf(expected) + sqrtf((float)n));
+    if (fabsf(expected - result) <= tolerance) return;
+    if (isnan(expected) && isnan(result)) return;
+
+    if (ctx->failed++ < 20) {
+        printf("  MISMATCH %s %s/%s n=%d row=%d: cpu=%g %s=%g\n", kind, (metric > 0) ? metric_names[metric] : "-",
+               (type > 0) ? type_names[type] : "-", n, row, expected, distance_backend_name, result);
+    }
+}
+
+static void parity_check_single (parity_context *ctx, const char *kind, distance_function_t simd, distance_function_t ref, int metric, int type, const void *v1, const void *v2, int n) {
+    if (simd == NULL || ref == NULL || simd == ref) return;
+    parity_compare(ctx, kind, metric, type, n, 0, ref(v1, v2, n), simd(v1, v2, n));
+}
+
+static void parity_check_n (parity_context *ctx, int n) {
+    // distance
+    for (int t = VECTOR_TYPE_F32; t < VECTOR_TYPE_MAX; ++t) {
+        random_vector(ctx->q, (vector_type)t, n);
+        random_vector(ctx->rows, (vector_type)t, n);
+        for (int m = VECTOR_DISTANCE_L2; m < VECTOR_DISTANCE_MAX; ++m) {
+            parity_check_single(ctx, "distance", dispatch_distance_table[m][t], cpu.distance[m][t], m, t, ctx->q, ctx->rows, n);
+        }
+    }
+
+    // 4-bit, binary and PQ (n is the number of bytes / codes)
+    random_bytes(ctx->q, (size_t)n);
+    random_bytes(ctx->rows, (size_t)n);
+    for (int m = VECTOR_DISTANCE_L2; m < VECTOR_DISTANCE_MAX; ++m) {
+        parity_check_single(ctx, "u4", dispatch_u4_distance_table[m], cpu.u4[m], m, 0, ctx->q, ctx->rows, n);
+        parity_check_single(ctx, "s4", dispatch_s4_distance_table[m], cpu.s4[m], m, 0, ctx->q, ctx->rows, n);
+    }
+    parity_check_single(ctx, "hamming", dispatch_hamming_distance, cpu.hamming, 0, 0, ctx->q, ctx->rows, n);
+
+    for (int m = VECTOR_DISTANCE_L2; m < VECTOR_DISTANCE_MAX; ++m) {
+        parity_check_single(ctx, "pq", dispatch_pq_distance_table[m], cpu.pq[m], m, 0, ctx->lut, ctx->rows, n);
+    }
+
+    // per-dimension ranges (n is the dimension, the kernels receive the size of the code)
+    random_weighted(ctx->f, ctx->rows, n);
+    for (int t = VECTOR_TYPE_F32; t < VECTOR_TYPE_MAX; ++t) {
+        for (int m = VECTOR_DISTANCE_L2; m < VECTOR_DISTANCE_MAX; ++m) {
+            parity_check_single(ctx, "weighted", dispatch_weighted_distance_table[m][t], cpu.weighted[m][t], m, t, ctx->f, ctx->rows, n + (int)sizeof(float));
+        }
+    }
+
+    // batch, rows are stride bytes apart and the stride is not a multiple of the vector size (floats stay aligned)
+    for (int t = VECTOR_TYPE_F32; t < VECTOR_TYPE_MAX; ++t) {
+        size_t size = type_size((vector_type)t);
+        size_t stride = (size_t)n * size + PARITY_ROW_PAD * size;
+        int nrows = 1 + (n % PARITY_MAX_ROWS);
+
+        random_vector(ctx->q, (vector_type)t, n);
+        for (int r = 0; r < nrows; ++r) random_vector(ctx->rows + (size_t)r * stride, (vector_type)t, n);
+
+        for (int m = VECTOR_DISTANCE_L2; m < VECTOR_DISTANCE_MAX; ++m) {
+            distance_batch_function_t batch = dispatch_batch_distance_table[m][t];
+            distance_function_t ref = cpu.distance[m][t];
+            if (batch == NULL || ref == NULL) continue;
+
+            float out[PARITY_MAX_ROWS];
+            batch(ctx->q, ctx->rows, stride, nrows, n, out);
+            for (int r = 0; r < nrows; ++r) {
+                parity_compare(ctx, "batch", m, t, n, r, ref(ctx->q, ctx->rows + (size_t)r * stride, n), out[r]);
+            }
+        }
+    }
+}
+
+static int parity_check_backend (parity_context *ctx, void (*init_backend)(void)) {
+    init_cpu_functions();
+    init_backend();
+
+    ctx->checked = 0;
+    ctx->failed = 0;
+    srand(1);
+    for (int n = 1; n <= PARITY_MAX_N; ++n) parity_check_n(ctx, n);
+
+    printf("%-8s %d checks, %d mismatches\n", distance_backend_name, ctx->checked, ctx->failed);
+    return ctx->failed;
+}
+
+// MARK: -
+
+int main (void) {
+    init_cpu_functions();
+    memcpy(cpu.distance, dispatch_distance_table, sizeof(cpu.distance));
+    memcpy(cpu.pq, dispatch_pq_distance_table, sizeof(cpu.pq));
+    cpu.hamming = dispatch_hamming_distance;
+    memcpy(cpu.u4, dispatch_u4_distance_table, sizeof(cpu.u4));
+    memcpy(cpu.s4, dispatch_s4_distance_table, sizeof(cpu.s4));
+    memcpy(cpu.weighted, dispatch_weighted_distance_table, sizeof(cpu.weighted));
+
+    parity_context ctx = {0};
+    ctx.f = (float *)malloc(sizeof(float) * (PARITY_MAX_N + 2));
+    ctx.lut = (float *)malloc(sizeof(float) * PARITY_MAX_N * PQ_KSUB);
+    ctx.q = (uint8_t *)malloc(sizeof(float) * PARITY_MAX_N);
+    ctx.rows = (uint8_t *)malloc(sizeof(float) * (PARITY_MAX_N + PARITY_ROW_PAD) * PARITY_MAX_ROWS);
+    if (!ctx.f || !ctx.lut || !ctx.q || !ctx.rows) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < PARITY_MAX_N * PQ_KSUB; ++i) ctx.lut[i] = random_float(1.0f);
+
+    int failed = 0;
+    #if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    if (cpu_supports_sse2()) failed += parity_check_backend(&ctx, init_distance_functions_sse2);
+    if (cpu_supports_avx2()) failed += parity_check_backend(&ctx, init_distance_functions_avx2);
+    if (cpu_supports_avx2() && cpu_supports_avx_vnni()) failed += parity_check_backend(&ctx, init_distance_functions_avxvnni);
+    if (cpu_supports_avx512()) failed += parity_check_backend(&ctx, init_distance_functions_avx512);
+    #elif defined(__ARM_NEON) || defined(__aarch64__)
+    if (cpu_supports_neon()) failed += parity_check_backend(&ctx, init_distance_functions_neon);
+    #endif
+
+    free(ctx.f);
+    free(ctx.lut);
+    free(ctx.q);
+    free(ctx.rows);
+    return (failed) ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+-- id = / id IN constraints on the scan modules: the values are compared without type conversion, whole REAL values
+-- match the integer id, TEXT, BLOB, NULL and fractional values never match
+CREATE TABLE t (id INTEGER PRIMARY KEY, v BLOB);
+WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 10)
+INSERT INTO t SELECT i, vector_as_f32('[' || i || ',' || (i * 2) || ']') FROM c;
+SELECT vector_init('t', 'v', 'type=FLOAT32,dimension=2') IS NULL;
+SELECT vector_quantize('t', 'v');
+
+SELECT 'full eq real', json_group_array(id) FROM (SELECT id FROM vector_full_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id = 5.0 ORDER BY id);
+SELECT 'full eq text', json_group_array(id) FROM (SELECT id FROM vector_full_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id = '7' ORDER BY id);
+SELECT 'full in mixed', json_group_array(id) FROM (SELECT id FROM vector_full_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id IN (3, NULL, '4', 5.0, 6.5) ORDER BY id);
+SELECT 'full in range', json_group_array(id) FROM (SELECT id FROM vector_full_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id IN (1e19, -1e19, x'02', 2) ORDER BY id);
+
+SELECT 'quantize eq real', json_group_array(id) FROM (SELECT id FROM vector_quantize_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id = 5.0 ORDER BY id);
+SELECT 'quantize eq text', json_group_array(id) FROM (SELECT id FROM vector_quantize_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id = '7' ORDER BY id);
+SELECT 'quantize in mixed', json_group_array(id) FROM (SELECT id FROM vector_quantize_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id IN (3, NULL, '4', 5.0, 6.5) ORDER BY id);
+SELECT 'quantize in range', json_group_array(id) FROM (SELECT id FROM vector_quantize_scan('t', 'v', vector_as_f32('[0,0]'), 10) WHERE id IN (1e19, -1e19, x'02', 2) ORDER BY id);